@@ -28,38 +28,38 @@ namespace d2dx
 	public:
 		Batch() noexcept :
 			_textureStartAddress(0),
-			_startVertexHigh_textureIndex(0),
+			_startIndexHigh_textureIndex(0),
 			_textureHash(0),
 			_textureHeight_textureWidth_alphaBlend(0),
-			_vertexCount(0),
-			_isChromaKeyEnabled_textureAtlas_paletteIndex(0),
+			_indexCount(0),
+			_isChromaKeyEnabled_textureAtlas(0),
 			_filterMode_primitiveType_combiners(0),
-			_startVertexLow(0),
+			_paletteIndex(0),
+			_startIndexLow(0),
 			_surfaceId(D2DX_SURFACE_UI)
 		{
 		}
 
 		inline int32_t GetPaletteIndex() const noexcept
 		{
-			return (int32_t)((_isChromaKeyEnabled_textureAtlas_paletteIndex & PALETTE_INDEX_MASK) >> PALETTE_INDEX_SHIFT);
+			return _paletteIndex;
 		}
 
 		inline void SetPaletteIndex(int32_t paletteIndex) noexcept
 		{
-			assert(paletteIndex >= 0 && paletteIndex < 16);
-			_isChromaKeyEnabled_textureAtlas_paletteIndex &= ~PALETTE_INDEX_MASK;
-			_isChromaKeyEnabled_textureAtlas_paletteIndex |= (paletteIndex << PALETTE_INDEX_SHIFT);
+			assert(paletteIndex >= 0 && paletteIndex < D2DX_MAX_PALETTES);
+			_paletteIndex = (uint8_t)paletteIndex;
 		}
 
 		inline bool IsChromaKeyEnabled() const noexcept
 		{
-			return (_isChromaKeyEnabled_textureAtlas_paletteIndex & CHROMAKEY_MASK) != 0;
+			return (_isChromaKeyEnabled_textureAtlas & CHROMAKEY_MASK) != 0;
 		}
 
 		inline void SetIsChromaKeyEnabled(bool enable) noexcept
 		{
-			_isChromaKeyEnabled_textureAtlas_paletteIndex &= ~CHROMAKEY_MASK;
-			_isChromaKeyEnabled_textureAtlas_paletteIndex |= (uint8_t)enable << CHROMAKEY_SHIFT;
+			_isChromaKeyEnabled_textureAtlas &= ~CHROMAKEY_MASK;
+			_isChromaKeyEnabled_textureAtlas |= (uint8_t)enable << CHROMAKEY_SHIFT;
 		}
 
 		inline RgbCombine GetRgbCombine() const noexcept
@@ -120,28 +120,29 @@ namespace d2dx
 			_textureHeight_textureWidth_alphaBlend |= (uint8_t)alphaBlend << ALPHA_BLEND_SHIFT;
 		}
 
-		inline int32_t GetStartVertex() const noexcept
+		/* For PrimitiveType::Sprites, the start and count are in sprite instances. */
+		inline int32_t GetStartIndex() const noexcept
 		{
-			return _startVertexLow | ((_startVertexHigh_textureIndex & HIGH_VERTEX_MASK) >> HIGH_VERTEX_SHIFT << 16);
+			return _startIndexLow | ((_startIndexHigh_textureIndex & HIGH_INDEX_MASK) >> HIGH_INDEX_SHIFT << 16);
 		}
 
-		inline void SetStartVertex(int32_t startVertex) noexcept
+		inline void SetStartIndex(int32_t startIndex) noexcept
 		{
-			assert(startVertex <= 0xFFFFF);
-			_startVertexLow = startVertex & 0xFFFF;
-			_startVertexHigh_textureIndex &= ~HIGH_VERTEX_MASK;
-			_startVertexHigh_textureIndex |= (startVertex >> 16) << HIGH_VERTEX_SHIFT;
+			assert(startIndex <= 0xFFFFF);
+			_startIndexLow = startIndex & 0xFFFF;
+			_startIndexHigh_textureIndex &= ~HIGH_INDEX_MASK;
+			_startIndexHigh_textureIndex |= (startIndex >> 16) << HIGH_INDEX_SHIFT;
 		}
 
-		inline uint32_t GetVertexCount() const noexcept
+		inline uint32_t GetIndexCount() const noexcept
 		{
-			return _vertexCount;
+			return _indexCount;
 		}
 
-		inline void SetVertexCount(uint32_t vertexCount) noexcept
+		inline void SetIndexCount(uint32_t indexCount) noexcept
 		{
-			assert(vertexCount >= 0 && vertexCount <= 0xFFFF);
-			_vertexCount = vertexCount;
+			assert(indexCount >= 0 && indexCount <= 0xFFFF);
+			_indexCount = indexCount;
 		}
 
 		inline uint32_t SelectColorAndAlpha(uint32_t iteratedColor, uint32_t constantColor) const noexcept
@@ -170,26 +171,26 @@ namespace d2dx
 
 		inline uint32_t GetTextureAtlas() const noexcept
 		{
-			return (uint32_t)((_isChromaKeyEnabled_textureAtlas_paletteIndex >> 4) & 0b111);
+			return (uint32_t)((_isChromaKeyEnabled_textureAtlas >> 4) & 0b111);
 		}
 
 		inline void SetTextureAtlas(uint32_t textureAtlas) noexcept
 		{
 			assert(textureAtlas < 8);
-			_isChromaKeyEnabled_textureAtlas_paletteIndex &= ~TEXTURE_ATLAS_MASK;
-			_isChromaKeyEnabled_textureAtlas_paletteIndex |= (uint8_t)textureAtlas << TEXTURE_ATLAS_SHIFT;
+			_isChromaKeyEnabled_textureAtlas &= ~TEXTURE_ATLAS_MASK;
+			_isChromaKeyEnabled_textureAtlas |= (uint8_t)textureAtlas << TEXTURE_ATLAS_SHIFT;
 		}
 
 		inline uint32_t GetTextureIndex() const noexcept
 		{
-			return (uint32_t)(_startVertexHigh_textureIndex & TEXTURE_INDEX_MASK) >> TEXTURE_INDEX_SHIFT;
+			return (uint32_t)(_startIndexHigh_textureIndex & TEXTURE_INDEX_MASK) >> TEXTURE_INDEX_SHIFT;
 		}
 
 		inline void SetTextureIndex(uint32_t textureIndex) noexcept
 		{
 			assert(textureIndex < 4096);
-			_startVertexHigh_textureIndex &= ~TEXTURE_INDEX_MASK;
-			_startVertexHigh_textureIndex |= (uint16_t)textureIndex << TEXTURE_INDEX_SHIFT;
+			_startIndexHigh_textureIndex &= ~TEXTURE_INDEX_MASK;
+			_startIndexHigh_textureIndex |= (uint16_t)textureIndex << TEXTURE_INDEX_SHIFT;
 		}
 
 		inline int32_t GetTextureStartAddress() const noexcept
@@ -223,6 +224,18 @@ namespace d2dx
 			return (GrTextureFilterMode_t)((_filterMode_primitiveType_combiners & FILTER_MODE_MASK) >> FILTER_MODE_SHIFT);
 		}
 
+		inline PrimitiveType GetPrimitiveType() const noexcept
+		{
+			return (PrimitiveType)((_filterMode_primitiveType_combiners & PRIMITIVE_TYPE_MASK) >> PRIMITIVE_TYPE_SHIFT);
+		}
+
+		inline void SetPrimitiveType(PrimitiveType primitiveType) noexcept
+		{
+			assert(primitiveType < PrimitiveType::Count);
+			_filterMode_primitiveType_combiners &= ~PRIMITIVE_TYPE_MASK;
+			_filterMode_primitiveType_combiners |= (uint8_t)primitiveType << PRIMITIVE_TYPE_SHIFT;
+		}
+
 		void SetSurfaceId(int16_t id) noexcept
 		{
 			_surfaceId = id;
@@ -241,35 +254,34 @@ namespace d2dx
 	private:
 		uint64_t _textureHash;
 		uint16_t _surfaceId;
-		uint16_t _startVertexLow;
-		uint16_t _vertexCount;
+		uint16_t _startIndexLow;
+		uint16_t _indexCount;
 		uint16_t _textureStartAddress;							// byte address / D2DX_TMU_ADDRESS_ALIGNMENT
-		uint16_t _startVertexHigh_textureIndex;					// VVVVAAAA AAAAAAAA
+		uint16_t _startIndexHigh_textureIndex;					// IIIIAAAA AAAAAAAA
 		uint8_t _textureHeight_textureWidth_alphaBlend;			// HHHWWWBB
-		uint8_t _isChromaKeyEnabled_textureAtlas_paletteIndex;	// CAAAPPPP
+		uint8_t _isChromaKeyEnabled_textureAtlas;				// CAAA....
 		uint8_t _filterMode_primitiveType_combiners;			// ...MPPCC
+		uint8_t _paletteIndex;
 
 		static const int TEXTURE_INDEX_SHIFT = 0;
-		static const int HIGH_VERTEX_SHIFT = 12;
+		static const int HIGH_INDEX_SHIFT = 12;
 		static const int TEXTURE_HEIGHT_SHIFT = 5;
 		static const int TEXTURE_WIDTH_SHIFT = 2;
 		static const int ALPHA_BLEND_SHIFT = 0;
 		static const int CHROMAKEY_SHIFT = 7;
 		static const int TEXTURE_ATLAS_SHIFT = 4;
-		static const int PALETTE_INDEX_SHIFT = 0;
 		static const int FILTER_MODE_SHIFT = 4;
 		static const int PRIMITIVE_TYPE_SHIFT = 2;
 		static const int ALPHA_COMBINE_SHIFT = 1;
 		static const int RGB_COMBINE_SHIFT = 0;
 
 		static const uint16_t TEXTURE_INDEX_MASK = 0b00001111'11111111;
-		static const uint16_t HIGH_VERTEX_MASK   = 0b11110000'00000000;
+		static const uint16_t HIGH_INDEX_MASK   = 0b11110000'00000000;
 		static const uint8_t TEXTURE_HEIGHT_MASK = 0b11100000;
 		static const uint8_t TEXTURE_WIDTH_MASK  = 0b00011100;
 		static const uint8_t ALPHA_BLEND_MASK    = 0b00000011;
 		static const uint8_t CHROMAKEY_MASK      = 0b10000000;
 		static const uint8_t TEXTURE_ATLAS_MASK  = 0b01110000;
-		static const uint8_t PALETTE_INDEX_MASK  = 0b00001111;
 		static const uint8_t FILTER_MODE_MASK    = 0b00010000;
 		static const uint8_t PRIMITIVE_TYPE_MASK = 0b00001100;
 		static const uint8_t ALPHA_COMBINE_MASK  = 0b00000010;
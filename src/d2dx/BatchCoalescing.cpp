@@ -0,0 +1,52 @@
+/*
+	This file is part of D2DX.
+
+	Copyright (C) 2021  Bolrog
+
+	D2DX is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	D2DX is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with D2DX.  If not, see <https://www.gnu.org/licenses/>.
+*/
+#include "pch.h"
+#include "BatchCoalescing.h"
+
+using namespace d2dx;
+
+_Use_decl_annotations_
+bool d2dx::TryCoalesceBatch(
+	Batch& lastBatch,
+	BatchBounds& lastBounds,
+	uint32_t lastDrawStateKey,
+	const Batch& batch,
+	const BatchBounds& bounds,
+	uint32_t drawStateKey)
+{
+	if (drawStateKey != lastDrawStateKey ||
+		drawStateKey == BatchReorderer::SkipKey ||
+		!batch.IsValid() ||
+		!lastBatch.IsValid())
+	{
+		return false;
+	}
+
+	const uint32_t indexCount = lastBatch.GetIndexCount() + batch.GetIndexCount();
+
+	if ((uint32_t)batch.GetStartIndex() != (uint32_t)lastBatch.GetStartIndex() + lastBatch.GetIndexCount() ||
+		indexCount > 0xFFFF)
+	{
+		return false;
+	}
+
+	lastBatch.SetIndexCount(indexCount);
+	lastBounds.Add(bounds);
+	return true;
+}
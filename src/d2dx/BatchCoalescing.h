@@ -0,0 +1,38 @@
+/*
+	This file is part of D2DX.
+
+	Copyright (C) 2021  Bolrog
+
+	D2DX is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	D2DX is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with D2DX.  If not, see <https://www.gnu.org/licenses/>.
+*/
+#pragma once
+
+#include "Batch.h"
+#include "BatchReorderer.h"
+
+namespace d2dx
+{
+	/* Extends the last recorded batch with the one being recorded, if they have the same
+	   draw state key and the new batch's indices (or sprites) directly follow the last one's.
+	   Such batches would always end up in the same draw call, so this saves the batch arrays
+	   and the passes over them from growing with every point, line and particle. Returns
+	   false if the batch has to be recorded on its own. */
+	bool TryCoalesceBatch(
+		_Inout_ Batch& lastBatch,
+		_Inout_ BatchBounds& lastBounds,
+		_In_ uint32_t lastDrawStateKey,
+		_In_ const Batch& batch,
+		_In_ const BatchBounds& bounds,
+		_In_ uint32_t drawStateKey);
+}
@@ -0,0 +1,118 @@
+/*
+	This file is part of D2DX.
+
+	Copyright (C) 2021  Bolrog
+
+	D2DX is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	D2DX is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with D2DX.  If not, see <https://www.gnu.org/licenses/>.
+*/
+#include "pch.h"
+#include "BatchReorderer.h"
+
+using namespace d2dx;
+
+_Use_decl_annotations_
+BatchReorderer::BatchReorderer(
+	uint32_t capacity) :
+	_runs{ capacity },
+	_nextBatches{ capacity },
+	_order{ capacity }
+{
+}
+
+_Use_decl_annotations_
+bool BatchReorderer::Reorder(
+	const uint32_t* drawStateKeys,
+	const BatchBounds* bounds,
+	uint32_t batchCount)
+{
+	assert(batchCount <= _order.capacity);
+	batchCount = min(batchCount, _order.capacity);
+
+	uint32_t runCount = 0;
+	uint32_t lastDrawStateKey = SkipKey;
+	bool isReordered = false;
+
+	_runCountBefore = 0;
+
+	for (uint32_t i = 0; i < batchCount; ++i)
+	{
+		const uint32_t drawStateKey = drawStateKeys[i];
+
+		if (drawStateKey == SkipKey)
+		{
+			isReordered = true;
+			continue;
+		}
+
+		if (drawStateKey != lastDrawStateKey)
+		{
+			++_runCountBefore;
+			lastDrawStateKey = drawStateKey;
+		}
+
+		_nextBatches.items[i] = UINT32_MAX;
+
+		/* Look back for a run to join. Any run in between that overlaps this batch must
+		   stay drawn before it, so the search ends there. */
+		const uint32_t lookbackEnd = runCount > MaxLookbackRuns ? runCount - MaxLookbackRuns : 0;
+		int32_t joinedRun = -1;
+
+		for (int32_t r = (int32_t)runCount - 1; r >= (int32_t)lookbackEnd; --r)
+		{
+			Run& run = _runs.items[r];
+
+			if (run.drawStateKey == drawStateKey)
+			{
+				joinedRun = r;
+				break;
+			}
+
+			if (run.bounds.Overlaps(bounds[i]))
+			{
+				break;
+			}
+		}
+
+		if (joinedRun >= 0)
+		{
+			Run& run = _runs.items[joinedRun];
+			_nextBatches.items[run.lastBatch] = i;
+			run.lastBatch = i;
+			run.bounds.Add(bounds[i]);
+			isReordered |= joinedRun != (int32_t)runCount - 1;
+		}
+		else
+		{
+			Run& run = _runs.items[runCount++];
+			run.bounds = bounds[i];
+			run.drawStateKey = drawStateKey;
+			run.firstBatch = i;
+			run.lastBatch = i;
+		}
+	}
+
+	_orderCount = 0;
+
+	for (uint32_t r = 0; r < runCount; ++r)
+	{
+		for (uint32_t i = _runs.items[r].firstBatch; i != UINT32_MAX; i = _nextBatches.items[i])
+		{
+			_order.items[_orderCount++] = i;
+		}
+	}
+
+	_runCountAfter = runCount;
+
+	return isReordered;
+}
@@ -0,0 +1,112 @@
+/*
+	This file is part of D2DX.
+
+	Copyright (C) 2021  Bolrog
+
+	D2DX is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	D2DX is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with D2DX.  If not, see <https://www.gnu.org/licenses/>.
+*/
+#pragma once
+
+#include "Buffer.h"
+
+namespace d2dx
+{
+	/* The pixels a batch can touch, as an inclusive rectangle. A rectangle with left > right
+	   is empty and overlaps nothing. */
+	struct BatchBounds final
+	{
+		int16_t left;
+		int16_t top;
+		int16_t right;
+		int16_t bottom;
+
+		static BatchBounds Empty() noexcept
+		{
+			return { INT16_MAX, INT16_MAX, INT16_MIN, INT16_MIN };
+		}
+
+		inline bool Overlaps(
+			_In_ const BatchBounds& other) const noexcept
+		{
+			return left <= other.right && other.left <= right &&
+				top <= other.bottom && other.top <= bottom;
+		}
+
+		inline void Add(
+			_In_ const BatchBounds& other) noexcept
+		{
+			left = min(left, other.left);
+			top = min(top, other.top);
+			right = max(right, other.right);
+			bottom = max(bottom, other.bottom);
+		}
+	};
+
+	static_assert(sizeof(BatchBounds) == 8, "sizeof(BatchBounds)");
+
+	/* Finds an order to draw a frame's batches in that puts batches with the same draw state
+	   next to each other, so that they can be merged into one draw call.
+
+	   Batches are grouped into runs of equal draw state. A batch joins the latest run with
+	   its state if none of the runs after that one overlap it on screen, and otherwise
+	   starts a new run. It only ever moves earlier past batches it doesn't overlap, so every
+	   pixel is drawn by the same batches in the same order as before. How far back a batch
+	   may look is limited, to keep the pass linear. */
+	class BatchReorderer final
+	{
+	public:
+		/* Draw state key of batches that aren't drawn. They are left out of the order. */
+		static const uint32_t SkipKey = 0xFFFFFFFF;
+
+		BatchReorderer(
+			_In_ uint32_t capacity);
+
+		~BatchReorderer() noexcept {}
+
+		/* Returns true if the order differs from the order the batches were given in. */
+		bool Reorder(
+			_In_reads_(batchCount) const uint32_t* drawStateKeys,
+			_In_reads_(batchCount) const BatchBounds* bounds,
+			_In_ uint32_t batchCount);
+
+		/* The indices of the drawn batches, in drawing order. */
+		const uint32_t* GetOrder() const noexcept { return _order.items; }
+
+		uint32_t GetOrderCount() const noexcept { return _orderCount; }
+
+		/* The number of runs of equal draw state in the original order and in the new one,
+		   i.e. draw calls before and after reordering. */
+		uint32_t GetRunCountBefore() const noexcept { return _runCountBefore; }
+
+		uint32_t GetRunCountAfter() const noexcept { return _runCountAfter; }
+
+	private:
+		static const uint32_t MaxLookbackRuns = 32;
+
+		struct Run final
+		{
+			BatchBounds bounds;
+			uint32_t drawStateKey;
+			uint32_t firstBatch;
+			uint32_t lastBatch;
+		};
+
+		Buffer<Run> _runs;
+		Buffer<uint32_t> _nextBatches;
+		Buffer<uint32_t> _order;
+		uint32_t _orderCount = 0;
+		uint32_t _runCountBefore = 0;
+		uint32_t _runCountAfter = 0;
+	};
+}
@@ -0,0 +1,234 @@
+/*
+	This file is part of D2DX.
+
+	Copyright (C) 2021  Bolrog
+
+	D2DX is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	D2DX is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with D2DX.  If not, see <https://www.gnu.org/licenses/>.
+*/
+#include "pch.h"
+#include "BatchStream.h"
+#include "BatchReorderer.h"
+
+using namespace d2dx;
+
+static const uint32_t MaxDrawCallIndexCount = 0xFFFF;
+
+_Use_decl_annotations_
+BatchStream::BatchStream(
+	uint32_t initialCapacity,
+	uint32_t maxCapacity) noexcept :
+	drawStateKeys{ initialCapacity, maxCapacity },
+	startIndices{ initialCapacity, maxCapacity },
+	indexCounts{ initialCapacity, maxCapacity }
+{
+}
+
+_Use_decl_annotations_
+bool BatchStream::Reserve(
+	uint32_t usedCount,
+	uint32_t count) noexcept
+{
+	return drawStateKeys.Reserve(usedCount, count) &&
+		startIndices.Reserve(usedCount, count) &&
+		indexCounts.Reserve(usedCount, count);
+}
+
+_Use_decl_annotations_
+void BatchStream::OnReuse(
+	uint32_t usedCount) noexcept
+{
+	drawStateKeys.OnReuse(usedCount);
+	startIndices.OnReuse(usedCount);
+	indexCounts.OnReuse(usedCount);
+}
+
+uint32_t BatchStream::GetAllocatedSize() const noexcept
+{
+	return drawStateKeys.GetAllocatedSize() + startIndices.GetAllocatedSize() + indexCounts.GetAllocatedSize();
+}
+
+typedef uint32_t(*MergeBatchesFn)(
+	const uint32_t* __restrict drawStateKeys,
+	const uint32_t* __restrict startIndices,
+	const uint32_t* __restrict indexCounts,
+	uint32_t batchCount,
+	DrawCallRange* __restrict drawCalls);
+
+/* Adds batch i to the last draw call, or starts a new one. */
+static inline void MergeBatch(
+	const uint32_t* __restrict drawStateKeys,
+	const uint32_t* __restrict startIndices,
+	const uint32_t* __restrict indexCounts,
+	uint32_t i,
+	DrawCallRange* __restrict drawCalls,
+	uint32_t& drawCallCount,
+	bool& isDrawCallOpen)
+{
+	const uint32_t drawStateKey = drawStateKeys[i];
+
+	if (drawStateKey == BatchReorderer::SkipKey)
+	{
+		isDrawCallOpen = false;
+		return;
+	}
+
+	if (isDrawCallOpen)
+	{
+		DrawCallRange& drawCall = drawCalls[drawCallCount - 1];
+
+		if (drawStateKey == drawStateKeys[i - 1] &&
+			startIndices[i] == drawCall.startIndex + drawCall.indexCount &&
+			drawCall.indexCount + indexCounts[i] <= MaxDrawCallIndexCount)
+		{
+			drawCall.indexCount += indexCounts[i];
+			return;
+		}
+	}
+
+	drawCalls[drawCallCount++] = { i, startIndices[i], indexCounts[i] };
+	isDrawCallOpen = true;
+}
+
+static uint32_t MergeBatchesScalar(
+	const uint32_t* __restrict drawStateKeys,
+	const uint32_t* __restrict startIndices,
+	const uint32_t* __restrict indexCounts,
+	uint32_t batchCount,
+	DrawCallRange* __restrict drawCalls)
+{
+	uint32_t drawCallCount = 0;
+	bool isDrawCallOpen = false;
+
+	for (uint32_t i = 0; i < batchCount; ++i)
+	{
+		MergeBatch(drawStateKeys, startIndices, indexCounts, i, drawCalls, drawCallCount, isDrawCallOpen);
+	}
+
+	return drawCallCount;
+}
+
+#ifdef D2DX_SIMD_X86
+
+/* Compares four batches at a time with the ones before them. When all four continue the
+   open draw call, which is the common case after reordering, they are added in one go. The
+   rest goes through the scalar path. */
+static uint32_t MergeBatchesSse2(
+	const uint32_t* __restrict drawStateKeys,
+	const uint32_t* __restrict startIndices,
+	const uint32_t* __restrict indexCounts,
+	uint32_t batchCount,
+	DrawCallRange* __restrict drawCalls)
+{
+	uint32_t drawCallCount = 0;
+	bool isDrawCallOpen = false;
+	uint32_t i = 0;
+
+	if (batchCount > 0)
+	{
+		MergeBatch(drawStateKeys, startIndices, indexCounts, 0, drawCalls, drawCallCount, isDrawCallOpen);
+		i = 1;
+	}
+
+	const __m128i skipKeys = _mm_set1_epi32((int32_t)BatchReorderer::SkipKey);
+
+	for (; i + 4 <= batchCount; i += 4)
+	{
+		const __m128i keys = _mm_loadu_si128((const __m128i*)&drawStateKeys[i]);
+		const __m128i previousKeys = _mm_loadu_si128((const __m128i*)&drawStateKeys[i - 1]);
+		const __m128i starts = _mm_loadu_si128((const __m128i*)&startIndices[i]);
+		const __m128i counts = _mm_loadu_si128((const __m128i*)&indexCounts[i]);
+		const __m128i previousEnds = _mm_add_epi32(
+			_mm_loadu_si128((const __m128i*)&startIndices[i - 1]),
+			_mm_loadu_si128((const __m128i*)&indexCounts[i - 1]));
+
+		const __m128i continues = _mm_andnot_si128(
+			_mm_cmpeq_epi32(keys, skipKeys),
+			_mm_and_si128(_mm_cmpeq_epi32(keys, previousKeys), _mm_cmpeq_epi32(starts, previousEnds)));
+
+		if (isDrawCallOpen && _mm_movemask_ps(_mm_castsi128_ps(continues)) == 0xF)
+		{
+			/* The counts are at most 65535 each, so the sum can't overflow. */
+			__m128i sum = _mm_add_epi32(counts, _mm_shuffle_epi32(counts, _MM_SHUFFLE(1, 0, 3, 2)));
+			sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, _MM_SHUFFLE(2, 3, 0, 1)));
+
+			DrawCallRange& drawCall = drawCalls[drawCallCount - 1];
+			const uint32_t indexCount = drawCall.indexCount + (uint32_t)_mm_cvtsi128_si32(sum);
+
+			if (indexCount <= MaxDrawCallIndexCount)
+			{
+				drawCall.indexCount = indexCount;
+				continue;
+			}
+		}
+
+		for (uint32_t j = i; j < i + 4; ++j)
+		{
+			MergeBatch(drawStateKeys, startIndices, indexCounts, j, drawCalls, drawCallCount, isDrawCallOpen);
+		}
+	}
+
+	for (; i < batchCount; ++i)
+	{
+		MergeBatch(drawStateKeys, startIndices, indexCounts, i, drawCalls, drawCallCount, isDrawCallOpen);
+	}
+
+	return drawCallCount;
+}
+
+/* Merging is bound by memory, not arithmetic, so the SSE2 kernel serves all SIMD slots. */
+static const MergeBatchesFn mergeBatchesKernels[] =
+{
+	MergeBatchesScalar,
+	MergeBatchesSse2,
+	MergeBatchesSse2,
+	MergeBatchesSse2,
+};
+
+#else
+
+static const MergeBatchesFn mergeBatchesKernels[] =
+{
+	MergeBatchesScalar,
+	MergeBatchesScalar,
+	MergeBatchesScalar,
+	MergeBatchesScalar,
+};
+
+#endif
+
+static_assert(sizeof(mergeBatchesKernels) / sizeof(mergeBatchesKernels[0]) == (size_t)SimdKernel::Count, "one MergeBatches kernel per SimdKernel");
+
+_Use_decl_annotations_
+uint32_t d2dx::MergeBatches(
+	const uint32_t* __restrict drawStateKeys,
+	const uint32_t* __restrict startIndices,
+	const uint32_t* __restrict indexCounts,
+	uint32_t batchCount,
+	DrawCallRange* __restrict drawCalls)
+{
+	return MergeBatches(GetBestSimdKernel(), drawStateKeys, startIndices, indexCounts, batchCount, drawCalls);
+}
+
+_Use_decl_annotations_
+uint32_t d2dx::MergeBatches(
+	SimdKernel kernel,
+	const uint32_t* __restrict drawStateKeys,
+	const uint32_t* __restrict startIndices,
+	const uint32_t* __restrict indexCounts,
+	uint32_t batchCount,
+	DrawCallRange* __restrict drawCalls)
+{
+	assert(IsSimdKernelSupported(kernel));
+	return mergeBatchesKernels[(int32_t)kernel](drawStateKeys, startIndices, indexCounts, batchCount, drawCalls);
+}
@@ -0,0 +1,77 @@
+/*
+	This file is part of D2DX.
+
+	Copyright (C) 2021  Bolrog
+
+	D2DX is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	D2DX is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with D2DX.  If not, see <https://www.gnu.org/licenses/>.
+*/
+#pragma once
+
+#include "FrameArena.h"
+#include "Simd.h"
+
+namespace d2dx
+{
+	/* What decides how a sequence of batches is merged into draw calls, kept as separate
+	   arrays so that merging doesn't have to go through the batches themselves. */
+	struct BatchStream final
+	{
+		BatchStream(
+			_In_ uint32_t initialCapacity,
+			_In_ uint32_t maxCapacity) noexcept;
+
+		/* Makes room for count more batches after the first usedCount. */
+		bool Reserve(
+			_In_ uint32_t usedCount,
+			_In_ uint32_t count) noexcept;
+
+		void OnReuse(
+			_In_ uint32_t usedCount) noexcept;
+
+		uint32_t GetAllocatedSize() const noexcept;
+
+		/* BatchReorderer::SkipKey for batches that aren't drawn. */
+		FrameArena<uint32_t> drawStateKeys;
+
+		/* For sprite batches, the start and count are in sprite instances. */
+		FrameArena<uint32_t> startIndices;
+		FrameArena<uint32_t> indexCounts;
+	};
+
+	struct DrawCallRange final
+	{
+		uint32_t firstBatch;
+		uint32_t startIndex;
+		uint32_t indexCount;
+	};
+
+	/* Merges batches into draw calls. A batch joins the draw call of the batch before it if
+	   they have the same draw state key, its indices follow on from the previous batch's, and
+	   the draw call stays within 65535 indices. Batches with BatchReorderer::SkipKey are left
+	   out. drawCalls must have room for batchCount entries. Returns the number of draw calls. */
+	uint32_t MergeBatches(
+		_In_reads_(batchCount) const uint32_t* __restrict drawStateKeys,
+		_In_reads_(batchCount) const uint32_t* __restrict startIndices,
+		_In_reads_(batchCount) const uint32_t* __restrict indexCounts,
+		_In_ uint32_t batchCount,
+		_Out_writes_(batchCount) DrawCallRange* __restrict drawCalls);
+
+	uint32_t MergeBatches(
+		_In_ SimdKernel kernel,
+		_In_reads_(batchCount) const uint32_t* __restrict drawStateKeys,
+		_In_reads_(batchCount) const uint32_t* __restrict startIndices,
+		_In_reads_(batchCount) const uint32_t* __restrict indexCounts,
+		_In_ uint32_t batchCount,
+		_Out_writes_(batchCount) DrawCallRange* __restrict drawCalls);
+}
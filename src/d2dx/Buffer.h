@@ -86,6 +86,22 @@ namespace d2dx
 			_aligned_free(items);
 		}
 
+		/* Changes the capacity, keeping the items that fit and filling the new ones with fillValue. */
+		void Resize(
+			_In_ uint32_t newCapacity,
+			_In_ T fillValue)
+		{
+			Buffer resized(newCapacity, true, fillValue);
+
+			if (items)
+			{
+				::memcpy(resized.items, items, sizeof(T) * min(capacity, newCapacity));
+			}
+
+			std::swap(items, resized.items);
+			std::swap(capacity, resized.capacity);
+		}
+
 		T* __restrict items;
 		uint32_t capacity;
 	};
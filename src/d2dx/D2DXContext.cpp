@@ -20,12 +20,16 @@
 #include "D2DXContext.h"
 #include "D2DXContextFactory.h"
 #include "Detours.h"
+#include "BatchCoalescing.h"
+#include "BatchStream.h"
 #include "BuiltinMods.h"
 #include "RenderContext.h"
 #include "GameHelper.h"
 #include "Metrics.h"
+#include "PrimitiveIndices.h"
 #include "Utils.h"
 #include "Vertex.h"
+#include "VertexRing.h"
 #include "dx256_bmp.h"
 #include "Profiler.h"
 #include "CompatModeCheck.h"
@@ -52,11 +56,20 @@ static Options GetCommandLineOptions()
 D2DXContext::D2DXContext() :
 	_frame(0),
 	_majorGameState(MajorGameState::Unknown),
-	_paletteKeys(D2DX_MAX_PALETTES, true),
+	_paletteCache(D2DX_MAX_GAME_PALETTES),
 	_batchCount(0),
-	_batches(D2DX_MAX_BATCHES_PER_FRAME),
+	_batches(1024, D2DX_MAX_BATCHES_PER_FRAME),
 	_vertexCount(0),
-	_vertices(D2DX_MAX_VERTICES_PER_FRAME),
+	_indexCount(0),
+	_indices(16 * 1024, D2DX_MAX_INDICES_PER_FRAME),
+	_spriteCount(0),
+	_sprites(1024, D2DX_MAX_SPRITES_PER_FRAME),
+	_batchBounds(1024, D2DX_MAX_BATCHES_PER_FRAME),
+	_batchStream(1024, D2DX_MAX_BATCHES_PER_FRAME),
+	_reorderedBatches(0, D2DX_MAX_BATCHES_PER_FRAME),
+	_reorderedBatchStream(0, D2DX_MAX_BATCHES_PER_FRAME),
+	_drawCalls(1024, D2DX_MAX_BATCHES_PER_FRAME),
+	_batchReorderer(D2DX_MAX_BATCHES_PER_FRAME),
 	_customGameSize{ 0,0 },
 	_suggestedGameSize{ 0, 0 },
 	_options{ GetCommandLineOptions() },
@@ -105,6 +118,11 @@ D2DXContext::D2DXContext() :
 	_options.SetFlag(OptionsFlag::NoFpsMod, true);
 #endif
 
+	if (_options.GetFlag(OptionsFlag::BackgroundTextureHashing))
+	{
+		_textureHasher.StartWorker(_glideState.tmuMemory.items, _glideState.tmuMemory.capacity);
+	}
+
 	AttachDetours(_gameHelper, *this);
 }
 
@@ -219,8 +237,13 @@ void D2DXContext::OnSstWinOpen(
 		_renderContext->SetSizes(gameSize, windowSize * _options.GetWindowScale(), _renderContext->GetScreenMode());
 	}
 
+	_vertexRing = _renderContext->GetVertexRing();
+	_vertexRing->EndFrame();
+
 	_batchCount = 0;
 	_vertexCount = 0;
+	_indexCount = 0;
+	_spriteCount = 0;
 	_scratchBatch = Batch();
 }
 
@@ -257,14 +280,24 @@ void D2DXContext::OnTexDownload(
 		return;
 	}
 
-	_textureHasher.Invalidate(startAddress);
-
 	uint32_t memRequired = (uint32_t)(width * height);
 
+	/* The hash is taken from the game's texels, which are in cache for the copy right after,
+	   and if TMU memory already holds the same texels the copy isn't needed at all. */
+	if (!_textureHasher.OnDownload(startAddress, sourceAddress, memRequired))
+	{
+		AddTexDownloadCopySkipped();
+		return;
+	}
+
+	_textureLocationMemo.Invalidate(startAddress, memRequired);
+
 	auto pStart = _glideState.tmuMemory.items + startAddress;
 	auto pEnd = _glideState.tmuMemory.items + startAddress + memRequired;
 	assert(pEnd <= (_glideState.tmuMemory.items + _glideState.tmuMemory.capacity));
 	memcpy_s(pStart, _glideState.tmuMemory.capacity - startAddress, sourceAddress, memRequired);
+
+	_textureHasher.OnDownloadCopied(startAddress, memRequired);
 }
 
 _Use_decl_annotations_
@@ -285,14 +318,48 @@ void D2DXContext::OnTexSource(
 
 	_readVertexState.isDirty = true;
 
-	uint8_t* pixels = _glideState.tmuMemory.items + startAddress;
-	const uint32_t pixelsSize = width * height;
-
 	int32_t stShift = 0;
 	_BitScanReverse((DWORD*)&stShift, max(width, height));
 	_glideState.stShift = 8 - stShift;
 
-	uint64_t hash = _textureHasher.GetHash(startAddress, pixels, pixelsSize, largeLog2, ratioLog2);
+	/* Many textures are only bound for draws that turn out to be off screen, so the hash is
+	   left until a draw needs it. */
+	if (_textureSourceState.isHashPending)
+	{
+		AddTexHashAvoided();
+	}
+
+	_scratchBatch.SetTextureStartAddress(startAddress);
+	_scratchBatch.SetTextureHash(0);
+	_scratchBatch.SetTextureSize(width, height);
+
+	_textureSourceState.largeLog2 = largeLog2;
+	_textureSourceState.ratioLog2 = ratioLog2;
+	_textureSourceState.isHashPending = true;
+
+	/* Every texture that is bound gets dumped. */
+	if (_options.GetFlag(OptionsFlag::DbgDumpTextures))
+	{
+		EnsureTextureHashed();
+	}
+}
+
+void D2DXContext::EnsureTextureHashed()
+{
+	if (!_textureSourceState.isHashPending)
+	{
+		return;
+	}
+
+	_textureSourceState.isHashPending = false;
+
+	const int32_t width = _scratchBatch.GetTextureWidth();
+	const int32_t height = _scratchBatch.GetTextureHeight();
+	uint8_t* pixels = _glideState.tmuMemory.items + _scratchBatch.GetTextureStartAddress();
+	const uint32_t pixelsSize = width * height;
+
+	uint64_t hash = _textureHasher.GetHash(_scratchBatch.GetTextureStartAddress(), pixels, pixelsSize,
+		_textureSourceState.largeLog2, _textureSourceState.ratioLog2);
 
 	/* Patch the '5' to not look like '6'. */
 	if (hash == 0xbeed610acac387d3)
@@ -302,9 +369,7 @@ void D2DXContext::OnTexSource(
 		pixels[1 + 11 * 16] = 29;
 	}
 
-	_scratchBatch.SetTextureStartAddress(startAddress);
 	_scratchBatch.SetTextureHash(hash);
-	_scratchBatch.SetTextureSize(width, height);
 
 	if (_options.GetFlag(OptionsFlag::DbgDumpTextures))
 	{
@@ -324,101 +389,233 @@ void D2DXContext::OnTexFilterMode(
 
 void D2DXContext::CheckMajorGameState()
 {
-	const int32_t batchCount = (int32_t)_batchCount;
-
-	if ((_majorGameState == MajorGameState::Unknown || _majorGameState == MajorGameState::FmvIntro) && batchCount == 0)
+	if ((_majorGameState == MajorGameState::Unknown || _majorGameState == MajorGameState::FmvIntro) && _frameRecordedBatchCount == 0)
 	{
 		_majorGameState = MajorGameState::FmvIntro;
 		return;
 	}
 
-	_majorGameState = MajorGameState::Other;
+	_majorGameState = _isTitleScreenBatchRecorded ? MajorGameState::TitleScreen : MajorGameState::Other;
+}
 
-	for (int32_t i = 0; i < batchCount; ++i)
+_Use_decl_annotations_
+void D2DXContext::CheckTitleScreenBatch(
+	const Batch& batch,
+	float y0)
+{
+	if (_isTitleScreenBatchRecorded || batch.GetHash() != 0x84ab94c374c42d9a)
 	{
-		const Batch& batch = _batches.items[i];
-		const float y0 = _vertices.items[batch.GetStartVertex()].GetY();
+		return;
+	}
 
-		if (batch.GetHash() == 0x84ab94c374c42d9a && y0 >= 550.0f)
-		{
-			_majorGameState = MajorGameState::TitleScreen;
-			break;
-		}
+	_isTitleScreenBatchRecorded = y0 >= 550.0f;
+}
+
+_Use_decl_annotations_
+uint32_t D2DXContext::GetBatchDrawStateKey(
+	const Batch& batch)
+{
+	/* The state that DrawBatches can't merge across. */
+	return !batch.IsValid() ? BatchReorderer::SkipKey :
+		((batch.GetPrimitiveType() == PrimitiveType::Sprites ? 1U : 0U) << 12) |
+		(RenderContextResources::GetTextureCacheIndex(batch.GetTextureWidth(), batch.GetTextureHeight()) << 8) |
+		(batch.GetTextureAtlas() << 4) |
+		((uint32_t)batch.GetAlphaBlend() << 1) |
+		(uint32_t)batch.GetFilterMode();
+}
+
+uint32_t D2DXContext::ReorderBatches()
+{
+	if (_options.GetFlag(OptionsFlag::NoBatchReorder))
+	{
+		return 0;
 	}
+
+	_reorderedBatches.Reserve(0, _batchCount);
+	_reorderedBatchStream.Reserve(0, _batchCount);
+
+	if (!_batchReorderer.Reorder(_batchStream.drawStateKeys.GetItems(), _batchBounds.GetItems(), _batchCount))
+	{
+		return 0;
+	}
+
+	const uint32_t* order = _batchReorderer.GetOrder();
+	const uint32_t orderCount = _batchReorderer.GetOrderCount();
+
+	for (uint32_t i = 0; i < orderCount; ++i)
+	{
+		_reorderedBatches.GetItems()[i] = _batches.GetItems()[order[i]];
+		_reorderedBatchStream.drawStateKeys.GetItems()[i] = _batchStream.drawStateKeys.GetItems()[order[i]];
+		_reorderedBatchStream.indexCounts.GetItems()[i] = _batchStream.indexCounts.GetItems()[order[i]];
+	}
+
+	_reorderedBatchStream.OnReuse(orderCount);
+	return orderCount;
 }
 
 _Use_decl_annotations_
 void D2DXContext::DrawBatches(
-	uint32_t startVertexLocation)
+	const Batch* batches,
+	const BatchStream& batchStream,
+	uint32_t batchCount,
+	uint32_t startVertexLocation,
+	uint32_t startIndexLocation,
+	uint32_t startSpriteLocation)
 {
-	const int32_t batchCount = (int32_t)_batchCount;
+	_drawCalls.Reserve(0, batchCount);
 
-	Batch mergedBatch;
-	int32_t drawCalls = 0;
+	const uint32_t drawCalls = MergeBatches(
+		batchStream.drawStateKeys.GetItems(),
+		batchStream.startIndices.GetItems(),
+		batchStream.indexCounts.GetItems(),
+		batchCount,
+		_drawCalls.GetItems());
 
-	for (int32_t i = 0; i < batchCount; ++i)
+	for (uint32_t i = 0; i < drawCalls; ++i)
 	{
-		const Batch& batch = _batches.items[i];
+		const DrawCallRange& drawCall = _drawCalls.GetItems()[i];
+		Batch mergedBatch = batches[drawCall.firstBatch];
+		mergedBatch.SetStartIndex(drawCall.startIndex);
+		mergedBatch.SetIndexCount(drawCall.indexCount);
+		_renderContext->Draw(mergedBatch, startVertexLocation, startIndexLocation, startSpriteLocation);
+	}
 
-		if (!batch.IsValid())
-		{
-			D2DX_DEBUG_LOG("Skipping batch %i, it is invalid.", i);
-			continue;
-		}
+	_drawCalls.OnReuse(drawCalls);
+
+	const uint32_t drawCallsBeforeReordering = _options.GetFlag(OptionsFlag::NoBatchReorder) ?
+		drawCalls : _batchReorderer.GetRunCountBefore();
+
+	AddDrawCalls(drawCalls, drawCallsBeforeReordering);
 
-		if (!mergedBatch.IsValid())
+	if (!(_frame & 255))
+	{
+		D2DX_DEBUG_LOG("Nr draw calls: %u (%u before reordering), %u vertices, %u indices, %u sprites", drawCalls, drawCallsBeforeReordering, _vertexCount, _indexCount, _spriteCount);
+	}
+}
+
+void D2DXContext::FlushBatches()
+{
+	/* Send the textures that were first used in this frame to the device before any batch
+	   refers to them. */
+	_renderContext->FlushTextureUploads();
+
+	{
+		Timer _timer(ProfCategory::DrawBatches);
+
+		const uint32_t reorderedBatchCount = ReorderBatches();
+		_vertexCount = _vertexRing->GetFrameVertexCount();
+		const uint32_t startVertexLocation = _vertexRing->EndFrame();
+
+		if (reorderedBatchCount > 0)
 		{
-			mergedBatch = batch;
+			const uint32_t startIndexLocation = _renderContext->BulkWriteBatchIndices(
+				_indices.GetItems(), _reorderedBatches.GetItems(), reorderedBatchCount, _indexCount);
+			const uint32_t startSpriteLocation = _renderContext->BulkWriteBatchSprites(
+				_sprites.GetItems(), _reorderedBatches.GetItems(), reorderedBatchCount, _spriteCount);
+
+			/* The indices and sprites are now in drawing order. */
+			uint32_t startIndex = 0;
+			uint32_t startSprite = 0;
+
+			for (uint32_t i = 0; i < reorderedBatchCount; ++i)
+			{
+				const Batch& batch = _reorderedBatches.GetItems()[i];
+				uint32_t& start = batch.GetPrimitiveType() == PrimitiveType::Sprites ? startSprite : startIndex;
+				_reorderedBatchStream.startIndices.GetItems()[i] = start;
+				start += batch.GetIndexCount();
+			}
+
+			DrawBatches(_reorderedBatches.GetItems(), _reorderedBatchStream, reorderedBatchCount, startVertexLocation, startIndexLocation, startSpriteLocation);
 		}
 		else
 		{
-			if (_renderContext->GetTextureCache(batch) != _renderContext->GetTextureCache(mergedBatch) ||
-				batch.GetTextureAtlas() != mergedBatch.GetTextureAtlas() ||
-				batch.GetAlphaBlend() != mergedBatch.GetAlphaBlend() ||
-				batch.GetFilterMode() != mergedBatch.GetFilterMode() ||
-				((mergedBatch.GetVertexCount() + batch.GetVertexCount()) > 65535))
-			{
-				_renderContext->Draw(mergedBatch, startVertexLocation);
-				++drawCalls;
-				mergedBatch = batch;
-			}
-			else
-			{
-				mergedBatch.SetVertexCount(mergedBatch.GetVertexCount() + batch.GetVertexCount());
-			}
+			const uint32_t startIndexLocation = _renderContext->BulkWriteIndices(_indices.GetItems(), _indexCount);
+			const uint32_t startSpriteLocation = _renderContext->BulkWriteSprites(_sprites.GetItems(), _spriteCount);
+			DrawBatches(_batches.GetItems(), _batchStream, _batchCount, startVertexLocation, startIndexLocation, startSpriteLocation);
 		}
 	}
 
-	if (mergedBatch.IsValid())
-	{
-		_renderContext->Draw(mergedBatch, startVertexLocation);
-		++drawCalls;
-	}
+	_batches.OnReuse(_batchCount);
+	_batchBounds.OnReuse(_batchCount);
+	_batchStream.OnReuse(_batchCount);
+	_indices.OnReuse(_indexCount);
+	_sprites.OnReuse(_spriteCount);
+	_vertexHighWaterCount = max(_vertexHighWaterCount, _vertexCount);
 
-	if (!(_frame & 255))
+	_batchCount = 0;
+	_vertexCount = 0;
+	_indexCount = 0;
+	_spriteCount = 0;
+}
+
+_Use_decl_annotations_
+void D2DXContext::EnsureFrameCapacity(
+	uint32_t vertexCount,
+	uint32_t indexCount,
+	uint32_t spriteCount)
+{
+	if (!_batches.CanReserve(_batchCount, 1) ||
+		!_indices.CanReserve(_indexCount, indexCount) ||
+		!_sprites.CanReserve(_spriteCount, spriteCount) ||
+		_vertexRing->GetFrameVertexCount() + vertexCount > _vertexRing->GetFrameVertexLimit())
 	{
-		D2DX_DEBUG_LOG("Nr draw calls: %i", drawCalls);
+		/* Draw what has been recorded so far, and go on with the rest of the frame. */
+		FlushBatches();
+		++_partialFlushCount;
 	}
-}
 
+	_batches.Reserve(_batchCount, 1);
+	_batchBounds.Reserve(_batchCount, 1);
+	_batchStream.Reserve(_batchCount, 1);
+	_indices.Reserve(_indexCount, indexCount);
+	_sprites.Reserve(_spriteCount, spriteCount);
+}
 
 void D2DXContext::OnBufferSwap()
 {
 	CheckMajorGameState();
 	InsertLogoOnTitleScreen();
+	FlushBatches();
+
+	_renderContext->Present();
+	_renderContext->RebalanceTextureCaches();
+	_textureLocationMemo.InvalidateAll();
 
+	/* Batches recorded next frame keep using the current palette until the game sets another. */
+	_paletteCache.OnNewFrame();
+	_paletteCache.Touch(_scratchBatch.GetPaletteIndex());
+
+	AddBatches(_frameRecordedBatchCount, _frameBatchCount);
+
+	if (!(_frame & 255))
 	{
-		Timer _timer(ProfCategory::DrawBatches);
-		auto startVertexLocation = _renderContext->BulkWriteVertices(_vertices.items, _vertexCount);
-		DrawBatches(startVertexLocation);
+		D2DX_DEBUG_LOG("Batches: %u recorded, %u after coalescing", _frameRecordedBatchCount, _frameBatchCount);
+
+		D2DX_DEBUG_LOG("Palettes: %u used, %u evictions, %u resets",
+			_paletteCache.GetUsedCount(),
+			_paletteCache.GetEvictionCount(),
+			_paletteCache.GetResetCount());
+
+		D2DX_DEBUG_LOG("Frame arena high water: %u batches, %u vertices, %u indices, %u sprites, %u partial flushes",
+			_batches.GetHighWaterCount(),
+			_vertexHighWaterCount,
+			_indices.GetHighWaterCount(),
+			_sprites.GetHighWaterCount(),
+			_partialFlushCount);
+
+		D2DX_DEBUG_LOG("Frame arena memory: %u kB batches, %u kB indices, %u kB sprites, %u kB staged vertices",
+			(_batches.GetAllocatedSize() + _batchBounds.GetAllocatedSize() + _batchStream.GetAllocatedSize() +
+			_reorderedBatches.GetAllocatedSize() + _reorderedBatchStream.GetAllocatedSize() + _drawCalls.GetAllocatedSize()) / 1024,
+			_indices.GetAllocatedSize() / 1024,
+			_sprites.GetAllocatedSize() / 1024,
+			_vertexRing->GetStaging().GetAllocatedSize() / 1024);
 	}
 
-	_renderContext->Present();
-
 	++_frame;
 
-	_batchCount = 0;
-	_vertexCount = 0;
+	_frameRecordedBatchCount = 0;
+	_frameBatchCount = 0;
+	_isTitleScreenBatchRecorded = false;
 	_nextSurface = D2DX_SURFACE_FIRST;
 
 	_renderContext->GetCurrentMetrics(&_gameSize, nullptr);
@@ -521,22 +718,17 @@ void D2DXContext::OnDrawPoint(
 	uint32_t gameContext)
 {
 	Timer _timer(ProfCategory::Draw);
+	EnsureTextureHashed();
 	Batch batch = _scratchBatch;
-	batch.SetStartVertex(_vertexCount);
 
 	EnsureReadVertexStateUpdated(batch);
-
-	auto vertex0 = _readVertexState.templateVertex;
-
-	const uint32_t iteratedColorMask = _readVertexState.iteratedColorMask;
-	const uint32_t maskedConstantColor = _readVertexState.maskedConstantColor;
-	const int32_t stShift = _glideState.stShift;
+	EnsureFrameCapacity(3, 3, 0);
 
 	const D2::Vertex* d2Vertex = (const D2::Vertex*)pt;
 
-	vertex0.SetPosition(d2Vertex->x, d2Vertex->y);
-	vertex0.SetTexcoord((int32_t)d2Vertex->s >> stShift, (int32_t)d2Vertex->t >> stShift);
-	vertex0.SetColor(maskedConstantColor | (d2Vertex->color & iteratedColorMask));
+	Vertex vertex0;
+	BatchBounds bounds;
+	ConvertVertices(&d2Vertex, 1, GetVertexConversionParams(batch, { 0, 0 }), &vertex0, bounds);
 
 	Vertex vertex1 = vertex0;
 	Vertex vertex2 = vertex0;
@@ -544,16 +736,14 @@ void D2DXContext::OnDrawPoint(
 	vertex1.AddOffset(1, 0);
 	vertex2.AddOffset(1, 1);
 
-	assert((_vertexCount + 3) < _vertices.capacity);
-	_vertices.items[_vertexCount++] = vertex0;
-	_vertices.items[_vertexCount++] = vertex1;
-	_vertices.items[_vertexCount++] = vertex2;
+	const Vertex vertices[3] = { vertex0, vertex1, vertex2 };
+	const uint32_t startVertex = AppendVertices(vertices, 3);
 
-	batch.SetVertexCount(3);
-	FillVertexSurfaceId(batch);
+	batch.SetStartIndex(_indexCount);
+	batch.SetIndexCount(WriteTriangleStripIndices(&_indices.GetItems()[_indexCount], startVertex, 3));
+	_indexCount += batch.GetIndexCount();
 
-	assert(_batchCount < _batches.capacity);
-	_batches.items[_batchCount++] = batch;
+	AppendBatch(batch, GetVertexBounds(vertices, 3), vertex0.GetY());
 }
 
 _Use_decl_annotations_
@@ -563,22 +753,21 @@ void D2DXContext::OnDrawLine(
 	uint32_t gameContext)
 {
 	Timer _timer(ProfCategory::Draw);
+	EnsureTextureHashed();
 	Batch batch = _scratchBatch;
-	batch.SetStartVertex(_vertexCount);
 	batch.SetPaletteIndex(D2DX_WHITE_PALETTE_INDEX);
 
 	EnsureReadVertexStateUpdated(batch);
-
-	auto vertex0 = _readVertexState.templateVertex;
-
-	const uint32_t iteratedColorMask = _readVertexState.iteratedColorMask;
-	const uint32_t maskedConstantColor = _readVertexState.maskedConstantColor;
+	EnsureFrameCapacity(4, 6, 0);
 
 	const D2::Vertex* d2Vertex0 = (const D2::Vertex*)v1;
 	const D2::Vertex* d2Vertex1 = (const D2::Vertex*)v2;
 
-	vertex0.SetTexcoord((int32_t)d2Vertex1->s >> _glideState.stShift, (int32_t)d2Vertex1->t >> _glideState.stShift);
-	vertex0.SetColor(maskedConstantColor | (d2Vertex1->color & iteratedColorMask));
+	/* The texcoords and color come from the second end point. The positions are replaced
+	   by the widened corners below. */
+	Vertex vertex0;
+	BatchBounds bounds;
+	ConvertVertices(&d2Vertex1, 1, GetVertexConversionParams(batch, { 0, 0 }), &vertex0, bounds);
 
 	OffsetF widening = { d2Vertex1->y - d2Vertex0->y, d2Vertex1->x - d2Vertex0->x };
 	widening.NormalizeTo(0.5f);
@@ -592,52 +781,125 @@ void D2DXContext::OnDrawLine(
 	vertex2.SetPosition(d2Vertex1->x - widening.x, d2Vertex1->y + widening.y);
 	vertex3.SetPosition(d2Vertex0->x - widening.x, d2Vertex0->y + widening.y);
 
-	assert((_vertexCount + 6) < _vertices.capacity);
-	_vertices.items[_vertexCount++] = vertex0;
-	_vertices.items[_vertexCount++] = vertex1;
-	_vertices.items[_vertexCount++] = vertex2;
-	_vertices.items[_vertexCount++] = vertex1;
-	_vertices.items[_vertexCount++] = vertex3;
-	_vertices.items[_vertexCount++] = vertex2;
+	const Vertex vertices[4] = { vertex0, vertex1, vertex2, vertex3 };
+	const uint32_t startVertex = AppendVertices(vertices, 4);
 
-	batch.SetVertexCount(6);
-	FillVertexSurfaceId(batch);
+	batch.SetStartIndex(_indexCount);
+	batch.SetIndexCount(WriteTriangleStripIndices(&_indices.GetItems()[_indexCount], startVertex, 4));
+	_indexCount += batch.GetIndexCount();
 
-	assert(_batchCount < _batches.capacity);
-	_batches.items[_batchCount++] = batch;
+	AppendBatch(batch, GetVertexBounds(vertices, 4), vertex0.GetY());
 }
 
 _Use_decl_annotations_
 const Batch D2DXContext::PrepareBatchForSubmit(
 	Batch batch,
 	PrimitiveType primitiveType,
-	uint32_t vertexCount,
-	uint32_t gameContext) const
+	uint32_t indexCount,
+	uint32_t gameContext,
+	Offset& texcoordOffset)
 {
-	auto tcl = _renderContext->UpdateTexture(batch, _glideState.tmuMemory.items, _glideState.tmuMemory.capacity);
+	texcoordOffset = { 0, 0 };
 
-	if (tcl._textureAtlas < 0)
+	if (!batch.IsValid())
 	{
 		return batch;
 	}
 
+	TextureCacheLocation tcl;
+
+	if (!_textureLocationMemo.Find(batch.GetTextureStartAddress(), batch.GetHash(), tcl))
+	{
+		tcl = _renderContext->UpdateTexture(batch, _glideState.tmuMemory.items, _glideState.tmuMemory.capacity);
+
+		/* If the cache had to evict textures already used in this frame, any location
+		   remembered so far may now hold a different texture. */
+		const uint32_t textureCacheResetCount = _renderContext->GetTextureCacheResetCount();
+
+		if (textureCacheResetCount != _textureCacheResetCount)
+		{
+			_textureLocationMemo.InvalidateAll();
+			_textureCacheResetCount = textureCacheResetCount;
+		}
+
+		if (tcl._textureAtlas < 0)
+		{
+			return batch;
+		}
+
+		_textureLocationMemo.Insert(batch.GetTextureStartAddress(), batch.GetHash(), tcl);
+	}
+
 	batch.SetTextureAtlas(tcl._textureAtlas);
 	batch.SetTextureIndex(tcl._textureIndex);
 
-	batch.SetStartVertex(_vertexCount);
-	batch.SetVertexCount(vertexCount);
+	/* Non-zero if the texture was packed into a slice together with others. The size of the
+	   texture goes along in the high bits. */
+	texcoordOffset = {
+		tcl._offsetS + Vertex::GetTexcoordSizeBits(batch.GetTextureWidth()),
+		tcl._offsetT + Vertex::GetTexcoordSizeBits(batch.GetTextureHeight()) };
+
+	batch.SetStartIndex(_indexCount);
+	batch.SetIndexCount(indexCount);
 	return batch;
 }
 
 _Use_decl_annotations_
-void D2DXContext::FillVertexSurfaceId(
-	const Batch& batch)
+VertexConversionParams D2DXContext::GetVertexConversionParams(
+	const Batch& batch,
+	Offset texcoordOffset) const
 {
-	uint16_t id = batch.GetSurfaceId();
-	for (auto i = &_vertices.items[batch.GetStartVertex()], end = i + batch.GetVertexCount(); i < end; ++i)
+	VertexConversionParams conversion = _readVertexState.conversion;
+	conversion.templateVertex.SetAtlasIndex(batch.GetTextureIndex());
+	conversion.templateVertex.SetSurfaceId(batch.GetSurfaceId());
+	conversion.texcoordOffset = texcoordOffset;
+	return conversion;
+}
+
+_Use_decl_annotations_
+uint32_t D2DXContext::AppendVertices(
+	const Vertex* vertices,
+	uint32_t count)
+{
+	/* The frame also holds any vertices written directly to the ring. */
+	const uint32_t startVertex = _vertexRing->GetFrameVertexCount();
+	assert((startVertex + count) <= D2DX_MAX_VERTICES_PER_FRAME);
+	memcpy(_vertexRing->Append(count), vertices, sizeof(Vertex) * count);
+	_vertexCount = startVertex + count;
+	return startVertex;
+}
+
+_Use_decl_annotations_
+void D2DXContext::AppendBatch(
+	const Batch& batch,
+	const BatchBounds& bounds,
+	float y0)
+{
+	CheckTitleScreenBatch(batch, y0);
+	++_frameRecordedBatchCount;
+
+	const uint32_t drawStateKey = GetBatchDrawStateKey(batch);
+
+	if (_batchCount > 0 && TryCoalesceBatch(
+		_batches.GetItems()[_batchCount - 1],
+		_batchBounds.GetItems()[_batchCount - 1],
+		_batchStream.drawStateKeys.GetItems()[_batchCount - 1],
+		batch,
+		bounds,
+		drawStateKey))
 	{
-		i->SetSurfaceId(id);
+		_batchStream.indexCounts.GetItems()[_batchCount - 1] = _batches.GetItems()[_batchCount - 1].GetIndexCount();
+		return;
 	}
+
+	assert(_batchCount < _batches.GetCapacity() && _batchCount < _batchBounds.GetCapacity() && _batchCount < _batchStream.drawStateKeys.GetCapacity());
+
+	_batchStream.drawStateKeys.GetItems()[_batchCount] = drawStateKey;
+	_batchStream.startIndices.GetItems()[_batchCount] = batch.GetStartIndex();
+	_batchStream.indexCounts.GetItems()[_batchCount] = batch.GetIndexCount();
+	_batchBounds.GetItems()[_batchCount] = bounds;
+	_batches.GetItems()[_batchCount++] = batch;
+	++_frameBatchCount;
 }
 
 _Use_decl_annotations_
@@ -649,7 +911,9 @@ void D2DXContext::EnsureReadVertexStateUpdated(
 		return;
 	}
 
-	_readVertexState.templateVertex = Vertex(
+	VertexConversionParams& conversion = _readVertexState.conversion;
+
+	conversion.templateVertex = Vertex(
 		0, 0,
 		0, 0,
 		0,
@@ -661,8 +925,10 @@ void D2DXContext::EnsureReadVertexStateUpdated(
 	const bool isIteratedColor = batch.GetRgbCombine() == RgbCombine::ColorMultipliedByTexture;
 	const uint32_t constantColorMask = isIteratedColor ? 0xFF000000 : 0xFFFFFFFF;
 	_readVertexState.constantColorMask = constantColorMask;
-	_readVertexState.iteratedColorMask = isIteratedColor ? 0x00FFFFFF : 0x00000000;
-	_readVertexState.maskedConstantColor = constantColorMask & (_glideState.constantColor | (batch.GetAlphaBlend() != AlphaBlend::SrcAlphaInvSrcAlpha ? 0xFF000000 : 0));
+	conversion.iteratedColorMask = isIteratedColor ? 0x00FFFFFF : 0x00000000;
+	conversion.maskedConstantColor = constantColorMask & (_glideState.constantColor | (batch.GetAlphaBlend() != AlphaBlend::SrcAlphaInvSrcAlpha ? 0xFF000000 : 0));
+	conversion.stShift = _glideState.stShift;
+	conversion.screenSize = _gameSize;
 	_readVertexState.isDirty = false;
 }
 
@@ -683,77 +949,47 @@ void D2DXContext::OnDrawVertexArray(
 
 	EnsureReadVertexStateUpdated(_scratchBatch);
 
-	Vertex v = _readVertexState.templateVertex;
-
-	const uint32_t iteratedColorMask = _readVertexState.iteratedColorMask;
-	const uint32_t maskedConstantColor = _readVertexState.maskedConstantColor;
+	const D2::Vertex* const* d2Vertices = (const D2::Vertex* const*)pointers;
 
-	Vertex* pVertices = &_vertices.items[_vertexCount];
-
-	bool onScreen = false;
-	for (int32_t i = 0; i < 3; ++i)
-	{
-		const D2::Vertex* d2Vertex = (const D2::Vertex*)pointers[i];
-		v.SetPosition(d2Vertex->x, d2Vertex->y);
-		v.SetTexcoord((int32_t)d2Vertex->s >> _glideState.stShift, (int32_t)d2Vertex->t >> _glideState.stShift);
-		v.SetColor(maskedConstantColor | (d2Vertex->color & iteratedColorMask));
-		*pVertices++ = v;
-		onScreen |= 0 <= d2Vertex->x && d2Vertex->x < _gameSize.width &&
-			0 <= d2Vertex->y && d2Vertex->y < _gameSize.height;
-	}
-
-	if (mode == GR_TRIANGLE_FAN)
+	if (IsAnyVertexOnScreen(d2Vertices, count, _gameSize))
 	{
-		auto vertex0 = pVertices[-3];
+		const uint32_t indexCount = GetTriangleListIndexCount(count);
+		EnsureFrameCapacity(count, indexCount, 0);
 
-		for (uint32_t i = 0; i < (count - 3); ++i)
-		{
-			*pVertices++ = vertex0;
-			*pVertices++ = pVertices[-2];
-			const D2::Vertex* d2Vertex = (const D2::Vertex*)pointers[i + 3];
-			v.SetPosition(d2Vertex->x, d2Vertex->y);
-			v.SetTexcoord((int32_t)d2Vertex->s >> _glideState.stShift, (int32_t)d2Vertex->t >> _glideState.stShift);
-			v.SetColor(maskedConstantColor | (d2Vertex->color & iteratedColorMask));
-			*pVertices++ = v;
-			onScreen |= 0 <= d2Vertex->x && d2Vertex->x < _gameSize.width &&
-				0 <= d2Vertex->y && d2Vertex->y < _gameSize.height;
-		}
-	}
-	else
-	{
-		for (uint32_t i = 0; i < (count - 3); ++i)
-		{
-			*pVertices++ = pVertices[-2];
-			*pVertices++ = pVertices[-2];
-			const D2::Vertex* d2Vertex = (const D2::Vertex*)pointers[i + 3];
-			v.SetPosition(d2Vertex->x, d2Vertex->y);
-			v.SetTexcoord((int32_t)d2Vertex->s >> _glideState.stShift, (int32_t)d2Vertex->t >> _glideState.stShift);
-			v.SetColor(maskedConstantColor | (d2Vertex->color & iteratedColorMask));
-			*pVertices++ = v;
-			onScreen |= 0 <= d2Vertex->x && d2Vertex->x < _gameSize.width &&
-				0 <= d2Vertex->y && d2Vertex->y < _gameSize.height;
-		}
-	}
-
-	if (onScreen)
-	{
-		Batch batch = PrepareBatchForSubmit(_scratchBatch, PrimitiveType::Triangles, 3 * (count - 2), gameContext);
+		Offset texcoordOffset{ 0, 0 };
+		EnsureTextureHashed();
+		Batch batch = PrepareBatchForSubmit(_scratchBatch, PrimitiveType::Triangles, indexCount, gameContext, texcoordOffset);
 		if (!batch.IsValid())
 		{
 			return;
 		}
 
-		pVertices = &_vertices.items[_vertexCount];
-		for (uint32_t i = 0; i < 3 * (count - 2); ++i)
+		const uint32_t startVertex = _vertexRing->GetFrameVertexCount();
+		assert((startVertex + count) <= D2DX_MAX_VERTICES_PER_FRAME);
+
+		/* The recorded vertices may be write-combined, so the first position is taken from
+		   the game's vertex rather than read back. */
+		Vertex vertex0;
+		vertex0.SetPosition(d2Vertices[0]->x, d2Vertices[0]->y);
+
+		BatchBounds bounds;
+		ConvertVertices(d2Vertices, count, GetVertexConversionParams(batch, texcoordOffset), _vertexRing->Append(count), bounds);
+
+		assert((_indexCount + indexCount) <= _indices.GetCapacity());
+
+		if (mode == GR_TRIANGLE_FAN)
 		{
-			pVertices[i].SetAtlasIndex(batch.GetTextureIndex());
+			WriteTriangleFanIndices(&_indices.GetItems()[_indexCount], startVertex, count);
+		}
+		else
+		{
+			WriteTriangleStripIndices(&_indices.GetItems()[_indexCount], startVertex, count);
 		}
 
-		_vertexCount += 3 * (count - 2);
-		FillVertexSurfaceId(batch);
+		_vertexCount = startVertex + count;
+		_indexCount += indexCount;
 
-		assert(_batchCount < _batches.capacity);
-		_batches.items[_batchCount++] = batch;
+		AppendBatch(batch, bounds, vertex0.GetY());
 	}
 	else
 	{
@@ -781,47 +1017,47 @@ void D2DXContext::OnDrawVertexArrayContiguous(
 
 	EnsureReadVertexStateUpdated(_scratchBatch);
 
-	const uint32_t iteratedColorMask = _readVertexState.iteratedColorMask;
-	const uint32_t maskedConstantColor = _readVertexState.maskedConstantColor;
-
 	const D2::Vertex* d2Vertices = (const D2::Vertex*)vertex;
+	const D2::Vertex* d2VertexPointers[4] = { &d2Vertices[0], &d2Vertices[1], &d2Vertices[2], &d2Vertices[3] };
 
-	Vertex v = _readVertexState.templateVertex;
-
-	Vertex* pVertices = &_vertices.items[_vertexCount];
-
-	bool onScreen = false;
-	for (int32_t i = 0; i < 4; ++i)
+	if (IsAnyVertexOnScreen(d2VertexPointers, 4, _gameSize))
 	{
-		v.SetPosition(d2Vertices[i].x, d2Vertices[i].y);
-		v.SetTexcoord((int32_t)d2Vertices[i].s >> _glideState.stShift, (int32_t)d2Vertices[i].t >> _glideState.stShift);
-		v.SetColor(maskedConstantColor | (d2Vertices[i].color & iteratedColorMask));
-		pVertices[i] = v;
-		onScreen |= 0 <= d2Vertices[i].x && d2Vertices[i].x < _gameSize.width &&
-			0 <= d2Vertices[i].y && d2Vertices[i].y < _gameSize.height;
-	}
+		EnsureFrameCapacity(4, 6, 1);
 
-	pVertices[4] = pVertices[0];
-	pVertices[5] = pVertices[2];
-
-	if (onScreen)
-	{
-		Batch batch = PrepareBatchForSubmit(_scratchBatch, PrimitiveType::Triangles, 3 * (count - 2), gameContext);
+		Offset texcoordOffset{ 0, 0 };
+		EnsureTextureHashed();
+		Batch batch = PrepareBatchForSubmit(_scratchBatch, PrimitiveType::Triangles, 6, gameContext, texcoordOffset);
 		if (!batch.IsValid())
 		{
 			return;
 		}
 
-		for (int i = 0; i < 6; ++i)
+		Vertex vertices[4];
+		BatchBounds bounds;
+		ConvertVertices(d2VertexPointers, 4, GetVertexConversionParams(batch, texcoordOffset), vertices, bounds);
+
+		SpriteInstance sprite;
+		float y0 = vertices[0].GetY();
+
+		if (!_options.GetFlag(OptionsFlag::NoSprites) && TryMakeSpriteInstance(vertices, sprite))
 		{
-			pVertices[i].SetAtlasIndex(batch.GetTextureIndex());
+			assert(_spriteCount < _sprites.GetCapacity());
+			batch.SetPrimitiveType(PrimitiveType::Sprites);
+			batch.SetStartIndex(_spriteCount);
+			batch.SetIndexCount(1);
+			_sprites.GetItems()[_spriteCount++] = sprite;
+			y0 = sprite.GetY0();
 		}
+		else
+		{
+			const uint32_t startVertex = AppendVertices(vertices, 4);
 
-		_vertexCount += 6;
-		FillVertexSurfaceId(batch);
+			assert((_indexCount + 6) <= _indices.GetCapacity());
+			WriteTriangleFanIndices(&_indices.GetItems()[_indexCount], startVertex, 4);
+			_indexCount += 6;
+		}
 
-		assert(_batchCount < _batches.capacity);
-		_batches.items[_batchCount++] = batch;
+		AppendBatch(batch, bounds, y0);
 	}
 	else
 	{
@@ -846,46 +1082,31 @@ void D2DXContext::OnTexDownloadTable(
 	uint64_t hash = XXH3_64bits(data, 1024);
 	assert(hash != 0);
 
-	for (uint32_t i = 0; i < D2DX_MAX_GAME_PALETTES; ++i)
-	{
-		if (_paletteKeys.items[i] == 0)
-		{
-			break;
-		}
-
-		if (_paletteKeys.items[i] == hash)
-		{
-			_scratchBatch.SetPaletteIndex(i);
-			return;
-		}
-	}
+	int32_t paletteIndex = _paletteCache.Find(hash);
 
-	for (uint32_t i = 0; i < D2DX_MAX_GAME_PALETTES; ++i)
+	if (paletteIndex >= 0)
 	{
-		if (_paletteKeys.items[i] == 0)
-		{
-			_paletteKeys.items[i] = hash;
-			_scratchBatch.SetPaletteIndex(i);
+		_scratchBatch.SetPaletteIndex(paletteIndex);
+		return;
+	}
 
-			uint32_t* palette = (uint32_t*)data;
+	bool evicted = false;
+	paletteIndex = _paletteCache.Insert(hash, evicted);
+	_scratchBatch.SetPaletteIndex(paletteIndex);
 
-			for (int32_t j = 0; j < 256; ++j)
-			{
-				palette[j] |= 0xFF000000;
-			}
+	uint32_t* palette = (uint32_t*)data;
 
-			if (_options.GetFlag(OptionsFlag::DbgDumpTextures))
-			{
-				memcpy(_glideState.palettes.items + 256 * i, palette, 1024);
-			}
+	for (int32_t j = 0; j < 256; ++j)
+	{
+		palette[j] |= 0xFF000000;
+	}
 
-			_renderContext->SetPalette(i, palette);
-			return;
-		}
+	if (_options.GetFlag(OptionsFlag::DbgDumpTextures))
+	{
+		memcpy(_glideState.palettes.items + 256 * paletteIndex, palette, 1024);
 	}
 
-	assert(false && "Too many palettes.");
-	D2DX_LOG("Too many palettes.");
+	_renderContext->SetPalette(paletteIndex, palette);
 }
 
 _Use_decl_annotations_
@@ -977,7 +1198,6 @@ void D2DXContext::PrepareLogoTextureBatch()
 	_logoTextureBatch.SetRgbCombine(RgbCombine::ColorMultipliedByTexture);
 	_logoTextureBatch.SetAlphaCombine(AlphaCombine::One);
 	_logoTextureBatch.SetPaletteIndex(D2DX_LOGO_PALETTE_INDEX);
-	_logoTextureBatch.SetVertexCount(6);
 	_logoTextureBatch.SetSurfaceId(D2DX_SURFACE_UI);
 
 	memset(data, 0, _logoTextureBatch.GetTextureWidth() * _logoTextureBatch.GetTextureHeight());
@@ -997,13 +1217,13 @@ void D2DXContext::InsertLogoOnTitleScreen()
 	if (_options.GetFlag(OptionsFlag::NoLogo) || _majorGameState != MajorGameState::TitleScreen || _batchCount <= 0)
 		return;
 
+	EnsureFrameCapacity(4, 6, 0);
 	PrepareLogoTextureBatch();
 
 	auto tcl = _renderContext->UpdateTexture(_logoTextureBatch, _glideState.sideTmuMemory.items, _glideState.sideTmuMemory.capacity);
 
 	_logoTextureBatch.SetTextureAtlas(tcl._textureAtlas);
 	_logoTextureBatch.SetTextureIndex(tcl._textureIndex);
-	_logoTextureBatch.SetStartVertex(_vertexCount);
 
 	Size gameSize;
 	_renderContext->GetCurrentMetrics(&gameSize, nullptr);
@@ -1014,20 +1234,22 @@ void D2DXContext::InsertLogoOnTitleScreen()
 	const float y2 = static_cast<float>(gameSize.height - 9 - 16);
 	const uint32_t color = 0xFFFFa090;
 
-	Vertex vertex0(x1, y1, 0, 0, color, true, _logoTextureBatch.GetTextureIndex(), D2DX_LOGO_PALETTE_INDEX, D2DX_SURFACE_UI);
-	Vertex vertex1(x2, y1, 80, 0, color, true, _logoTextureBatch.GetTextureIndex(), D2DX_LOGO_PALETTE_INDEX, D2DX_SURFACE_UI);
-	Vertex vertex2(x2, y2, 80, 41, color, true, _logoTextureBatch.GetTextureIndex(), D2DX_LOGO_PALETTE_INDEX, D2DX_SURFACE_UI);
-	Vertex vertex3(x1, y2, 0, 41, color, true, _logoTextureBatch.GetTextureIndex(), D2DX_LOGO_PALETTE_INDEX, D2DX_SURFACE_UI);
+	const int32_t s = tcl._offsetS + Vertex::GetTexcoordSizeBits(_logoTextureBatch.GetTextureWidth());
+	const int32_t t = tcl._offsetT + Vertex::GetTexcoordSizeBits(_logoTextureBatch.GetTextureHeight());
+
+	Vertex vertex0(x1, y1, s, t, color, true, _logoTextureBatch.GetTextureIndex(), D2DX_LOGO_PALETTE_INDEX, D2DX_SURFACE_UI);
+	Vertex vertex1(x2, y1, s + 80, t, color, true, _logoTextureBatch.GetTextureIndex(), D2DX_LOGO_PALETTE_INDEX, D2DX_SURFACE_UI);
+	Vertex vertex2(x2, y2, s + 80, t + 41, color, true, _logoTextureBatch.GetTextureIndex(), D2DX_LOGO_PALETTE_INDEX, D2DX_SURFACE_UI);
+	Vertex vertex3(x1, y2, s, t + 41, color, true, _logoTextureBatch.GetTextureIndex(), D2DX_LOGO_PALETTE_INDEX, D2DX_SURFACE_UI);
+
+	const Vertex vertices[4] = { vertex0, vertex1, vertex2, vertex3 };
+	const uint32_t startVertex = AppendVertices(vertices, 4);
 
-	assert((_vertexCount + 6) < _vertices.capacity);
-	_vertices.items[_vertexCount++] = vertex0;
-	_vertices.items[_vertexCount++] = vertex1;
-	_vertices.items[_vertexCount++] = vertex2;
-	_vertices.items[_vertexCount++] = vertex0;
-	_vertices.items[_vertexCount++] = vertex2;
-	_vertices.items[_vertexCount++] = vertex3;
+	_logoTextureBatch.SetStartIndex(_indexCount);
+	_logoTextureBatch.SetIndexCount(WriteTriangleFanIndices(&_indices.GetItems()[_indexCount], startVertex, 4));
+	_indexCount += _logoTextureBatch.GetIndexCount();
 
-	_batches.items[_batchCount++] = _logoTextureBatch;
+	AppendBatch(_logoTextureBatch, GetVertexBounds(vertices, 4), vertex0.GetY());
 }
 
 _Use_decl_annotations_
@@ -19,15 +19,22 @@
 #pragma once
 
 #include "Batch.h"
+#include "BatchReorderer.h"
+#include "BatchStream.h"
 #include "Buffer.h"
 #include "BuiltinMods.h"
+#include "FrameArena.h"
 #include "GameHelper.h"
 #include "ID2DXContext.h"
 #include "IGlide3x.h"
 #include "IRenderContext.h"
 #include "IWin32InterceptionHandler.h"
+#include "PaletteCache.h"
+#include "SpriteInstance.h"
 #include "TextureHasher.h"
+#include "TextureLocationMemo.h"
 #include "Vertex.h"
+#include "VertexConversion.h"
 
 namespace d2dx
 {
@@ -207,24 +214,80 @@ namespace d2dx
 	private:		
 		void CheckMajorGameState();
 
+		/* Notes if the batch shows that this is the title screen. Must be called before the
+		   batch can be coalesced into another one. y0 is the y of its first vertex, or of the
+		   top of its sprite. */
+		void CheckTitleScreenBatch(
+			_In_ const Batch& batch,
+			_In_ float y0);
+
+		/* The state that DrawBatches can't merge across, or BatchReorderer::SkipKey. */
+		static uint32_t GetBatchDrawStateKey(
+			_In_ const Batch& batch);
+
 		void PrepareLogoTextureBatch();
 
 		void InsertLogoOnTitleScreen();
 
+		/* Finds a drawing order with fewer draw calls, and if it differs from the order the
+		   batches were recorded in, fills _reorderedBatches and the keys and counts of
+		   _reorderedBatchStream, and returns their count. */
+		uint32_t ReorderBatches();
+
+		/* Merges the batches into as few draw calls as the stream allows, and draws them. */
 		void DrawBatches(
-			_In_ uint32_t startVertexLocation);
+			_In_reads_(batchCount) const Batch* batches,
+			_In_ const BatchStream& batchStream,
+			_In_ uint32_t batchCount,
+			_In_ uint32_t startVertexLocation,
+			_In_ uint32_t startIndexLocation,
+			_In_ uint32_t startSpriteLocation);
+
+		/* Draws the batches recorded so far and starts over with empty arrays. */
+		void FlushBatches();
+
+		/* Makes room for one more batch with the given number of vertices, indices and
+		   sprites. If the frame is at a hard limit, what it has so far is drawn first, so this
+		   must be called before anything of the batch is recorded. */
+		void EnsureFrameCapacity(
+			_In_ uint32_t vertexCount,
+			_In_ uint32_t indexCount,
+			_In_ uint32_t spriteCount);
 
+		/* Finds the texture of the batch in the texture cache, uploading it if needed.
+		   texcoordOffset receives the offset of the texture within its atlas slice. */
 		const Batch PrepareBatchForSubmit(
 			_In_ Batch batch,
 			_In_ PrimitiveType primitiveType,
-			_In_ uint32_t vertexCount,
-			_In_ uint32_t gameContext) const;
+			_In_ uint32_t indexCount,
+			_In_ uint32_t gameContext,
+			_Out_ Offset& texcoordOffset);
 		
+		/* Hashes the texture last passed to OnTexSource, if that hasn't been done yet. Must
+		   be called before _scratchBatch is used for a batch that is recorded. */
+		void EnsureTextureHashed();
+
 		void EnsureReadVertexStateUpdated(
 			_In_ const Batch& batch);
 
-		void FillVertexSurfaceId(
-			_In_ const Batch& batch);
+		/* The conversion for vertices of the batch, whose texture location is known. */
+		VertexConversionParams GetVertexConversionParams(
+			_In_ const Batch& batch,
+			_In_ Offset texcoordOffset) const;
+
+		/* Adds vertices to the frame and returns the index of the first one. */
+		uint32_t AppendVertices(
+			_In_reads_(count) const Vertex* vertices,
+			_In_ uint32_t count);
+
+		/* Adds a batch whose vertices and indices have just been written, along with the
+		   bounds of its vertices and the y of the first one, which is kept here since the
+		   written vertices are not read back. It is coalesced into the previous batch if
+		   possible. */
+		void AppendBatch(
+			_In_ const Batch& batch,
+			_In_ const BatchBounds& bounds,
+			_In_ float y0);
 
 		Offset GameToWinCursorPos(
 			_In_ Offset pos);
@@ -241,15 +304,21 @@ namespace d2dx
 
 		struct ReadVertexState
 		{
-			Vertex templateVertex;
+			VertexConversionParams conversion;
 			uint32_t constantColorMask{ 0 };
-			uint32_t iteratedColorMask{ 0 };
-			uint32_t maskedConstantColor{ 0 };
 			bool isDirty{ false };
 		};
 
+		struct TextureSourceState
+		{
+			uint32_t largeLog2{ 0 };
+			uint32_t ratioLog2{ 0 };
+			bool isHashPending{ false };
+		};
+
 		GlideState _glideState;
 		ReadVertexState _readVertexState;
+		TextureSourceState _textureSourceState;
 
 		Batch _scratchBatch;
 		uint16_t _nextSurface = D2DX_SURFACE_FIRST;
@@ -259,17 +328,38 @@ namespace d2dx
 		GameHelper _gameHelper;
 		BuiltinMods _builtinMods;
 		TextureHasher _textureHasher;
+		TextureLocationMemo _textureLocationMemo;
+		uint32_t _textureCacheResetCount = 0;
 
 		MajorGameState _majorGameState;
 		ScreenMode _initialScreenMode;
 
-		Buffer<uint64_t> _paletteKeys;
+		PaletteCache _paletteCache;
 
 		uint32_t _batchCount;
-		Buffer<Batch> _batches;
+		FrameArena<Batch> _batches;
 
 		uint32_t _vertexCount;
-		Buffer<Vertex> _vertices;
+		uint32_t _vertexHighWaterCount = 0;
+		VertexRing* _vertexRing = nullptr;
+
+		uint32_t _indexCount;
+		FrameArena<uint32_t> _indices;
+
+		uint32_t _spriteCount;
+		FrameArena<SpriteInstance> _sprites;
+
+		FrameArena<BatchBounds> _batchBounds;
+		BatchStream _batchStream;
+		FrameArena<Batch> _reorderedBatches;
+		BatchStream _reorderedBatchStream;
+		FrameArena<DrawCallRange> _drawCalls;
+		uint32_t _partialFlushCount = 0;
+
+		uint32_t _frameRecordedBatchCount = 0;
+		uint32_t _frameBatchCount = 0;
+		bool _isTitleScreenBatchRecorded = false;
+		BatchReorderer _batchReorderer;
 
 		Options _options;
 		Batch _logoTextureBatch;
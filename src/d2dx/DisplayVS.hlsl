@@ -25,25 +25,26 @@ void main(
 	out DisplayVSOutput vs_out,
 	out noperspective float4 vs_out_pos : SV_POSITION)	
 {
-	float2 fpos = float2(vs_in.pos) * c_invScreenSize - 0.5;
-	vs_out_pos = fpos.xyxx * float4(2, -2, 0, 0) + float4(0,0,0,1);
-	
 	float2 stf = vs_in.st;
 	vs_out.textureSize_invTextureSize = float4(stf, 1/stf);
 
 	const float srcWidth = vs_in.misc.y & 16383;
-	const float srcHeight = vs_in.misc.x & 4095;
+	const float srcHeight = vs_in.misc.x;
 
+	/* A triangle covering the viewport, twice its size in each direction. */
 	switch (vs_in_vertexId)
 	{
 	default:
 	case 0:
+		vs_out_pos = float4(-1, 1, 0, 1);
 		vs_out.tc = float2(0, 0);
 		break;
 	case 1:
+		vs_out_pos = float4(3, 1, 0, 1);
 		vs_out.tc = float2(srcWidth * 2 * vs_out.textureSize_invTextureSize.z, 0);
 		break;
 	case 2:
+		vs_out_pos = float4(-1, -3, 0, 1);
 		vs_out.tc = float2(0, srcHeight * 2 * vs_out.textureSize_invTextureSize.w);
 		break;
 	}
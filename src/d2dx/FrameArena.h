@@ -0,0 +1,131 @@
+/*
+	This file is part of D2DX.
+
+	Copyright (C) 2021  Bolrog
+
+	D2DX is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	D2DX is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with D2DX.  If not, see <https://www.gnu.org/licenses/>.
+*/
+#pragma once
+
+#include "Buffer.h"
+
+namespace d2dx
+{
+	/* Per-frame storage that starts small and grows on demand, up to a hard limit. The items
+	   are kept in one block, so that they can be passed on as an array, and growing moves
+	   them. When the hard limit is reached, the caller is expected to flush what it has
+	   recorded so far and start over. */
+	template<typename T>
+	class FrameArena final
+	{
+	public:
+		FrameArena(
+			_In_ uint32_t initialCapacity,
+			_In_ uint32_t maxCapacity) noexcept :
+			_maxCapacity{ maxCapacity }
+		{
+			if (initialCapacity > 0)
+			{
+				_buffer = Buffer<T>(min(initialCapacity, maxCapacity));
+			}
+		}
+
+		FrameArena(const FrameArena&) = delete;
+
+		FrameArena& operator=(const FrameArena&) = delete;
+
+		/* Makes room for count more items after the first usedCount, which are kept. Returns
+		   false, leaving the arena as it was, if that would go past the hard limit. */
+		inline bool Reserve(
+			_In_ uint32_t usedCount,
+			_In_ uint32_t count) noexcept
+		{
+			if (usedCount + count <= _buffer.capacity)
+			{
+				return true;
+			}
+
+			return Grow(usedCount, count);
+		}
+
+		/* Returns true if count more items after the first usedCount fit under the hard limit. */
+		inline bool CanReserve(
+			_In_ uint32_t usedCount,
+			_In_ uint32_t count) const noexcept
+		{
+			return usedCount + count <= _maxCapacity;
+		}
+
+		/* Records how many items were used before the arena is reused. */
+		inline void OnReuse(
+			_In_ uint32_t usedCount) noexcept
+		{
+			_highWaterCount = max(_highWaterCount, usedCount);
+		}
+
+		inline T* GetItems() const noexcept
+		{
+			return _buffer.items;
+		}
+
+		inline uint32_t GetCapacity() const noexcept
+		{
+			return _buffer.capacity;
+		}
+
+		inline uint32_t GetMaxCapacity() const noexcept
+		{
+			return _maxCapacity;
+		}
+
+		/* The most items used at once. */
+		inline uint32_t GetHighWaterCount() const noexcept
+		{
+			return _highWaterCount;
+		}
+
+		/* The memory currently held, in bytes. */
+		inline uint32_t GetAllocatedSize() const noexcept
+		{
+			return _buffer.capacity * sizeof(T);
+		}
+
+	private:
+		bool Grow(
+			_In_ uint32_t usedCount,
+			_In_ uint32_t count) noexcept
+		{
+			if (!CanReserve(usedCount, count))
+			{
+				return false;
+			}
+
+			/* Doubling keeps the number of moves per frame logarithmic. */
+			const uint32_t capacity = min(_maxCapacity, max(usedCount + count, max(_buffer.capacity * 2, 256U)));
+			Buffer<T> buffer(capacity);
+
+			if (usedCount > 0)
+			{
+				memcpy(buffer.items, _buffer.items, sizeof(T) * usedCount);
+			}
+
+			_buffer = std::move(buffer);
+			return true;
+		}
+
+		Buffer<T> _buffer;
+		uint32_t _maxCapacity;
+		uint32_t _highWaterCount = 0;
+	};
+}
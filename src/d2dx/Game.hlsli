@@ -17,14 +17,25 @@
 	along with D2DX.  If not, see <https://www.gnu.org/licenses/>.
 */
 
+/* Vertex positions are 13.3 fixed point, see Vertex.h. */
+static const float c_vertexPositionScale = 1.0 / 8;
+
 struct GameVSInput
 {
-	float2 pos : POSITION;
+	int2 pos : POSITION;
 	int2 texCoord : TEXCOORD0;
 	float4 color : COLOR0;
 	uint2 misc : TEXCOORD1;
 };
 
+struct SpriteVSInput
+{
+	int4 rect : POSITION;
+	int4 texCoordRect : TEXCOORD0;
+	float4 color : COLOR0;
+	uint2 misc : TEXCOORD1;
+};
+
 struct GameVSOutput
 {
 	noperspective float4 pos : SV_POSITION;
@@ -35,6 +46,15 @@ struct GameVSOutput
 
 typedef GameVSOutput GamePSInput;
 
+/* Texcoords carry log2 of their texture's size above bit 11, see Vertex.h. Returns the
+   texcoords without it. */
+int2 DecodeTexCoord(int2 texCoord, out uint2 log2TextureSize)
+{
+	const int2 sizeBits = (texCoord + 1024) >> 11;
+	log2TextureSize = uint2(sizeBits);
+	return texCoord - (sizeBits << 11);
+}
+
 struct GamePSOutput
 {
 	float4 color : SV_TARGET0;
@@ -35,8 +35,23 @@ void main(
 		discard;
 
 	const float2 tc = ps_in.tc - 0.5;
-	const int2 ulTc = int2(tc);
-	const int2 lrTc = ulTc + 1;
+	const int2 tapTc = int2(floor(tc));
+	int2 ulTc = tapTc;
+	int2 lrTc = tapTc + 1;
+
+	/* Keep the taps inside the texture, which may share its atlas slice with others. Every
+	   texture is aligned to its size, in units of at least 8 texels. */
+	const uint2 log2TextureSize = (ps_in.atlasIndex_paletteIndex_surfaceId_flags.ww >> uint2(1, 5)) & 15;
+
+	if (all(log2TextureSize))
+	{
+		const int2 textureSize = int2(1u << log2TextureSize);
+		const int2 cellSize = max(textureSize, 8);
+		const int2 origin = (int2(ps_in.tc) / cellSize) * cellSize;
+		ulTc = clamp(ulTc, origin, origin + textureSize - 1);
+		lrTc = clamp(lrTc, origin, origin + textureSize - 1);
+	}
+
 	const uint i1 = tex.Load(int4(ulTc, atlasIndex, 0));
 	const uint i2 = tex.Load(int4(lrTc.x, ulTc.y, atlasIndex, 0));
 	const uint i3 = tex.Load(int4(ulTc.x, lrTc.y, atlasIndex, 0));
@@ -46,7 +61,7 @@ void main(
 	const float4 c3 = palette.Load(int3(i3, paletteIndex, 0));
 	const float4 c4 = palette.Load(int3(i4, paletteIndex, 0));
 
-	const float2 blend = saturate((tc - float2(ulTc)) * c_sharpness - ((c_sharpness - 1.0) * 0.5));
+	const float2 blend = saturate((tc - float2(tapTc)) * c_sharpness - ((c_sharpness - 1.0) * 0.5));
 
 	const float4 c12 = chromaKeyEnabled && (i1 == 0 || i2 == 0)
 		? (i1 == 0 ? c2 : c1)
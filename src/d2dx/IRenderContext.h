@@ -25,7 +25,9 @@
 namespace d2dx
 {
 	class Vertex;
+	class VertexRing;
 	class Batch;
+	class SpriteInstance;
 
 	struct IRenderContext abstract
 	{
@@ -37,18 +39,50 @@ namespace d2dx
 			_In_reads_(valueCount) const uint32_t* values,
 			_In_ uint32_t valueCount) = 0;
 
-		virtual uint32_t BulkWriteVertices(
-			_In_reads_(vertexCount) const Vertex* vertices,
-			_In_ uint32_t vertexCount) = 0;
+		/* The game vertices of each frame are recorded here, directly into the vertex buffer. */
+		virtual VertexRing* GetVertexRing() = 0;
+
+		virtual uint32_t BulkWriteIndices(
+			_In_reads_(indexCount) const uint32_t* indices,
+			_In_ uint32_t indexCount) = 0;
+
+		/* Writes the indices of the batches one after the other, in the order the batches
+		   are given, and returns where the first one was written. Sprite batches are skipped. */
+		virtual uint32_t BulkWriteBatchIndices(
+			_In_ const uint32_t* indices,
+			_In_reads_(batchCount) const Batch* batches,
+			_In_ uint32_t batchCount,
+			_In_ uint32_t indexCount) = 0;
+
+		virtual uint32_t BulkWriteSprites(
+			_In_reads_(spriteCount) const SpriteInstance* sprites,
+			_In_ uint32_t spriteCount) = 0;
+
+		/* Like BulkWriteBatchIndices, for the sprites of the PrimitiveType::Sprites batches. */
+		virtual uint32_t BulkWriteBatchSprites(
+			_In_ const SpriteInstance* sprites,
+			_In_reads_(batchCount) const Batch* batches,
+			_In_ uint32_t batchCount,
+			_In_ uint32_t spriteCount) = 0;
 
 		virtual TextureCacheLocation UpdateTexture(
 			_In_ const Batch& batch,
 			_In_reads_(tmuDataSize) const uint8_t* tmuData,
 			_In_ uint32_t tmuDataSize) = 0;
 
+		virtual uint32_t GetTextureCacheResetCount() const = 0;
+
+		virtual void FlushTextureUploads() = 0;
+
+		/* Lets the texture caches trade slots. Only call this once per game frame, after all
+		   of its batches have been drawn. */
+		virtual void RebalanceTextureCaches() = 0;
+
 		virtual void Draw(
 			_In_ const Batch& batch,
-			_In_ uint32_t startVertexLocation) = 0;
+			_In_ uint32_t startVertexLocation,
+			_In_ uint32_t startIndexLocation,
+			_In_ uint32_t startSpriteLocation) = 0;
 
 		virtual void Present() = 0;
 
@@ -28,9 +28,11 @@ namespace d2dx
 	{
 		int16_t _textureAtlas;
 		int16_t _textureIndex;
+		uint8_t _offsetS;
+		uint8_t _offsetT;
 	};
 
-	static_assert(sizeof(TextureCacheLocation) == 4, "sizeof(TextureCacheLocation) == 4");
+	static_assert(sizeof(TextureCacheLocation) == 6, "sizeof(TextureCacheLocation) == 6");
 
 	struct ITextureCache abstract
 	{
@@ -54,5 +56,26 @@ namespace d2dx
 		virtual uint32_t GetMemoryFootprint() const = 0;
 
 		virtual uint32_t GetUsedCount() const = 0;
+
+		virtual uint32_t GetResetCount() const = 0;
+
+		virtual uint32_t GetEvictionCount() const = 0;
+
+		virtual uint32_t GetCapacity() const = 0;
+
+		/* Changes the number of slots, forgetting only the textures in the slots given away.
+		   Must only be called between frames, with no uploads pending. */
+		virtual void SetCapacity(
+			_In_ uint32_t capacity) = 0;
+
+		/* The texels of the cached textures, and of the slots or shelves reserved for them.
+		   The ratio is the packing efficiency. */
+		virtual uint64_t GetTexelCount() const = 0;
+
+		virtual uint64_t GetReservedTexelCount() const = 0;
+
+		/* The number of textures that were stored in overflow slots, because every regular
+		   slot had been used in the frame. */
+		virtual uint32_t GetOverflowCount() const = 0;
 	};
 }
@@ -0,0 +1,63 @@
+/*
+	This file is part of D2DX.
+
+	Copyright (C) 2021  Bolrog
+
+	D2DX is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	D2DX is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with D2DX.  If not, see <https://www.gnu.org/licenses/>.
+*/
+#pragma once
+
+namespace d2dx
+{
+	enum class TextureCachePolicyType
+	{
+		BitPmru = 0,
+		Clock = 1,
+		TwoQueue = 2,
+		Frequency = 3,
+		Count = 4
+	};
+
+	/* Decides which slot of a texture cache holds which texture. Textures are uploaded to
+	   their slot immediately but drawn at the end of the frame, so a policy must not hand out
+	   a slot that was used in the current frame. When every slot has been used, it may start
+	   over, and must count that in GetResetCount(). */
+	struct ITextureCachePolicy abstract
+	{
+		virtual ~ITextureCachePolicy() noexcept {}
+
+		virtual int32_t Find(
+			_In_ uint64_t contentKey,
+			_In_ int32_t lastIndex) = 0;
+
+		virtual int32_t Insert(
+			_In_ uint64_t contentKey,
+			_Out_ bool& evicted) = 0;
+
+		virtual void OnNewFrame() = 0;
+
+		/* Changes the number of slots, keeping the textures in the slots below the new
+		   capacity. */
+		virtual void SetCapacity(
+			_In_ uint32_t capacity) = 0;
+
+		virtual uint32_t GetUsedCount() const = 0;
+
+		/* The number of slots used in the current frame. When it reaches the capacity, the
+		   next Insert has to start over. */
+		virtual uint32_t GetUsedInFrameCount() const = 0;
+
+		virtual uint32_t GetResetCount() const = 0;
+	};
+}
@@ -0,0 +1,38 @@
+/*
+	This file is part of D2DX.
+
+	Copyright (C) 2021  Bolrog
+
+	D2DX is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	D2DX is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with D2DX.  If not, see <https://www.gnu.org/licenses/>.
+*/
+#pragma once
+
+namespace d2dx
+{
+	class Vertex;
+
+	/* The vertex buffer behind a VertexRing. */
+	struct IVertexRingStorage abstract
+	{
+		virtual ~IVertexRingStorage() noexcept {}
+
+		/* Maps the whole buffer for writing. With discard, submitted draws keep reading the
+		   previous contents, and the returned memory starts out undefined. Without it, the
+		   contents are kept, and nothing a submitted draw may still read can be overwritten. */
+		virtual Vertex* MapVertices(
+			_In_ bool discard) = 0;
+
+		virtual void UnmapVertices() = 0;
+	};
+}
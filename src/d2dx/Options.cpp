@@ -80,6 +80,10 @@ void Options::ApplyCfg(
 		READ_OPTOUTS_FLAG(OptionsFlag::NoCompatModeFix, "nocompatmodefix");
 		READ_OPTOUTS_FLAG(OptionsFlag::NoTitleChange, "notitlechange");
 		READ_OPTOUTS_FLAG(OptionsFlag::NoKeepAspectRatio, "nokeepaspectratio");
+		READ_OPTOUTS_FLAG(OptionsFlag::NoTextureCacheRebalance, "notexturecacherebalance");
+		READ_OPTOUTS_FLAG(OptionsFlag::NoBatchReorder, "nobatchreorder");
+		READ_OPTOUTS_FLAG(OptionsFlag::NoSprites, "nosprites");
+		READ_OPTOUTS_FLAG(OptionsFlag::NoVertexRing, "novertexring");
 
 #undef READ_OPTOUTS_FLAG
 	}
@@ -142,6 +146,42 @@ void Options::ApplyCfg(
 		}
 	}
 
+	auto textureCache = toml_table_in(root, "texturecache");
+
+	if (textureCache)
+	{
+		auto capacities = toml_array_in(textureCache, "capacities");
+		if (capacities)
+		{
+			for (uint32_t i = 0; i < D2DX_TEXTURE_CACHE_COUNT; ++i)
+			{
+				auto capacity = toml_int_at(capacities, i);
+				if (capacity.ok)
+				{
+					SetTextureCacheCapacity(i, (uint32_t)max(0, capacity.u.i));
+				}
+			}
+		}
+
+		auto budget = toml_int_in(textureCache, "budget");
+		if (budget.ok)
+		{
+			SetTextureCacheBudget((uint32_t)max(0, budget.u.i));
+		}
+
+		auto uploadBudget = toml_int_in(textureCache, "uploadbudget");
+		if (uploadBudget.ok)
+		{
+			SetTextureUploadBudget((uint32_t)max(0, uploadBudget.u.i));
+		}
+
+		auto backgroundHashing = toml_bool_in(textureCache, "backgroundhashing");
+		if (backgroundHashing.ok)
+		{
+			SetFlag(OptionsFlag::BackgroundTextureHashing, backgroundHashing.u.b);
+		}
+	}
+
 	auto debug = toml_table_in(root, "debug");
 
 	if (debug)
@@ -151,6 +191,12 @@ void Options::ApplyCfg(
 		{
 			SetFlag(OptionsFlag::DbgDumpTextures, dumpTextures.u.b);
 		}
+
+		auto recordTextureCacheTrace = toml_bool_in(debug, "recordtexturecachetrace");
+		if (recordTextureCacheTrace.ok)
+		{
+			SetFlag(OptionsFlag::DbgRecordTextureCacheTrace, recordTextureCacheTrace.u.b);
+		}
 	}
 
 	toml_free(root);
@@ -170,8 +216,13 @@ void Options::ApplyCommandLine(
 	if (strstr(cmdLine, "-dxnocompatmodefix")) SetFlag(OptionsFlag::NoCompatModeFix, true);
 	if (strstr(cmdLine, "-dxnotitlechange")) SetFlag(OptionsFlag::NoTitleChange, true);
 	if (strstr(cmdLine, "-dxnokeepaspectratio")) SetFlag(OptionsFlag::NoKeepAspectRatio, true);
+	if (strstr(cmdLine, "-dxnotexturecacherebalance")) SetFlag(OptionsFlag::NoTextureCacheRebalance, true);
+	if (strstr(cmdLine, "-dxnobatchreorder")) SetFlag(OptionsFlag::NoBatchReorder, true);
+	if (strstr(cmdLine, "-dxnosprites")) SetFlag(OptionsFlag::NoSprites, true);
+	if (strstr(cmdLine, "-dxnovertexring")) SetFlag(OptionsFlag::NoVertexRing, true);
 	if (strstr(cmdLine, "-dxvsync")) SetFlag(OptionsFlag::NoVSync, false);
 	if (strstr(cmdLine, "-dxframetearing")) SetFlag(OptionsFlag::NoFrameTearing, false);
+	if (strstr(cmdLine, "-dxbackgroundhashing")) SetFlag(OptionsFlag::BackgroundTextureHashing, true);
 
 	char const* upscale = strstr(cmdLine, "-dxupscale=");
 	if (upscale)
@@ -197,6 +248,7 @@ void Options::ApplyCommandLine(
 	}
 
 	if (strstr(cmdLine, "-dxdbg_dump_textures")) SetFlag(OptionsFlag::DbgDumpTextures, true);
+	if (strstr(cmdLine, "-dxdbg_record_texture_cache_trace")) SetFlag(OptionsFlag::DbgRecordTextureCacheTrace, true);
 }
 
 _Use_decl_annotations_
@@ -275,4 +327,48 @@ void Options::SetBilinearSharpness(
 	_In_ float sharpness) noexcept
 {
 	_bilinearSharpness = max(sharpness, 1.0f);
-}
\ No newline at end of file
+}
+
+_Use_decl_annotations_
+uint32_t Options::GetTextureCacheCapacity(
+	uint32_t cacheIndex) const
+{
+	assert(cacheIndex < D2DX_TEXTURE_CACHE_COUNT);
+	return _textureCacheCapacities[cacheIndex];
+}
+
+_Use_decl_annotations_
+void Options::SetTextureCacheCapacity(
+	uint32_t cacheIndex,
+	uint32_t capacity)
+{
+	if (cacheIndex < D2DX_TEXTURE_CACHE_COUNT)
+	{
+		/* The cache policies work in blocks of 64 slots. */
+		_textureCacheCapacities[cacheIndex] = max(64, (min(capacity, 8192) + 63) & ~63);
+	}
+}
+
+uint32_t Options::GetTextureCacheBudget() const
+{
+	return _textureCacheBudget;
+}
+
+_Use_decl_annotations_
+void Options::SetTextureCacheBudget(
+	uint32_t budget)
+{
+	_textureCacheBudget = min(budget, 4096);
+}
+
+uint32_t Options::GetTextureUploadBudget() const
+{
+	return _textureUploadBudget;
+}
+
+_Use_decl_annotations_
+void Options::SetTextureUploadBudget(
+	uint32_t budget)
+{
+	_textureUploadBudget = min(budget, 65536);
+}
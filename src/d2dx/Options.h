@@ -35,11 +35,18 @@ namespace d2dx
 		NoVSync,
 		NoKeepAspectRatio,
 		NoFrameTearing,
+		NoTextureCacheRebalance,
+		NoBatchReorder,
+		NoSprites,
+		NoVertexRing,
 
 		DbgDumpTextures,
+		DbgRecordTextureCacheTrace,
 
 		Frameless,
 
+		BackgroundTextureHashing,
+
 		Count
 	};
 
@@ -97,6 +104,27 @@ namespace d2dx
 		void SetBilinearSharpness(
 			_In_ float sharpness) noexcept;
 
+		uint32_t GetTextureCacheCapacity(
+			_In_ uint32_t cacheIndex) const;
+
+		void SetTextureCacheCapacity(
+			_In_ uint32_t cacheIndex,
+			_In_ uint32_t capacity);
+
+		/* The most video memory the texture caches may use in total, in megabytes. Zero means
+		   the size of the starting capacities. */
+		uint32_t GetTextureCacheBudget() const;
+
+		void SetTextureCacheBudget(
+			_In_ uint32_t budget);
+
+		/* How much new texture data is staged per frame and uploaded in one pass before
+		   drawing, in kilobytes. Zero means textures are uploaded as they are first used. */
+		uint32_t GetTextureUploadBudget() const;
+
+		void SetTextureUploadBudget(
+			_In_ uint32_t budget);
+
 	private:
 		uint32_t _flags = (1 << (uint32_t)OptionsFlag::NoVSync) | (1 << (uint32_t)OptionsFlag::NoFrameTearing);
 		float _windowScale = 1;
@@ -104,5 +132,8 @@ namespace d2dx
 		Size _userSpecifiedGameSize{ -1, -1 };
 		UpscaleMethod _upscaleMethod{ UpscaleMethod::HighQuality };
 		float _bilinearSharpness = 2.0;
+		uint32_t _textureCacheCapacities[D2DX_TEXTURE_CACHE_COUNT] = { 512, 1024, 2048, 2048, 1024, 512, 512 };
+		uint32_t _textureCacheBudget = 0;
+		uint32_t _textureUploadBudget = 4096;
 	};
 }
\ No newline at end of file
@@ -0,0 +1,117 @@
+/*
+	This file is part of D2DX.
+
+	Copyright (C) 2021  Bolrog
+
+	D2DX is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	D2DX is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with D2DX.  If not, see <https://www.gnu.org/licenses/>.
+*/
+#include "pch.h"
+#include "Utils.h"
+#include "PaletteCache.h"
+
+using namespace d2dx;
+
+_Use_decl_annotations_
+PaletteCache::PaletteCache(
+	uint32_t capacity) :
+	_capacity{ capacity },
+	_keys{ capacity },
+	_lastUsedFrames{ capacity, true },
+	_lastUsedTimes{ capacity, true }
+{
+	assert(capacity > 0);
+}
+
+_Use_decl_annotations_
+void PaletteCache::Touch(
+	int32_t index)
+{
+	assert(index >= 0 && index < (int32_t)_capacity);
+	_lastUsedFrames.items[index] = _frame;
+	_lastUsedTimes.items[index] = ++_time;
+}
+
+_Use_decl_annotations_
+int32_t PaletteCache::Find(
+	uint64_t contentKey)
+{
+	assert(contentKey != 0);
+
+	const int32_t findIndex = _keys.Find(contentKey);
+
+	if (findIndex >= 0)
+	{
+		Touch(findIndex);
+	}
+
+	return findIndex;
+}
+
+_Use_decl_annotations_
+int32_t PaletteCache::Insert(
+	uint64_t contentKey,
+	bool& evicted)
+{
+	assert(contentKey != 0);
+
+	int32_t replacementIndex = -1;
+
+	if (_usedCount < _capacity)
+	{
+		replacementIndex = (int32_t)_usedCount++;
+	}
+	else
+	{
+		/* Palettes only miss a few times per frame, so a scan for the least recently used
+		   slot is cheap. Slots used in this frame were used most recently, so the least
+		   recently used slot is only one of them if all of them are. */
+		uint32_t oldestAge = 0;
+		int32_t oldestIndex = 0;
+
+		for (uint32_t i = 0; i < _capacity; ++i)
+		{
+			const uint32_t age = _time - _lastUsedTimes.items[i];
+
+			if (age > oldestAge)
+			{
+				oldestAge = age;
+				oldestIndex = (int32_t)i;
+			}
+		}
+
+		if (_lastUsedFrames.items[oldestIndex] == _frame)
+		{
+			D2DX_LOG("All palettes used in a single frame, replacing the least recently used one!");
+			++_resetCount;
+		}
+
+		replacementIndex = oldestIndex;
+	}
+
+	Touch(replacementIndex);
+
+	evicted = _keys.Replace(replacementIndex, contentKey) != 0;
+
+	if (evicted)
+	{
+		++_evictionCount;
+	}
+
+	return replacementIndex;
+}
+
+void PaletteCache::OnNewFrame()
+{
+	++_frame;
+}
@@ -0,0 +1,71 @@
+/*
+	This file is part of D2DX.
+
+	Copyright (C) 2021  Bolrog
+
+	D2DX is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	D2DX is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with D2DX.  If not, see <https://www.gnu.org/licenses/>.
+*/
+#pragma once
+
+#include "Buffer.h"
+#include "TextureCacheKeyIndex.h"
+
+namespace d2dx
+{
+	/* Decides which slot of the palette texture holds which game palette. Palettes are
+	   uploaded to their slot immediately but drawn at the end of the frame, so a slot that was
+	   used in the current frame is never replaced, unless every slot has been. Otherwise the
+	   least recently used palette is replaced. */
+	class PaletteCache final
+	{
+	public:
+		PaletteCache(
+			_In_ uint32_t capacity);
+		~PaletteCache() noexcept {}
+
+		/* Returns the slot holding the palette, or -1 if it isn't cached. */
+		int32_t Find(
+			_In_ uint64_t contentKey);
+
+		/* Picks the slot to upload the palette to. */
+		int32_t Insert(
+			_In_ uint64_t contentKey,
+			_Out_ bool& evicted);
+
+		/* Marks the slot as used in the current frame. */
+		void Touch(
+			_In_ int32_t index);
+
+		void OnNewFrame();
+
+		uint32_t GetUsedCount() const { return _usedCount; }
+
+		uint32_t GetEvictionCount() const { return _evictionCount; }
+
+		/* The number of times every slot was used in a single frame, so that a palette that
+		   was drawn with had to be replaced. */
+		uint32_t GetResetCount() const { return _resetCount; }
+
+	private:
+		uint32_t _capacity = 0;
+		TextureCacheKeyIndex _keys;
+		Buffer<uint32_t> _lastUsedFrames;
+		Buffer<uint32_t> _lastUsedTimes;
+		uint32_t _frame = 1;
+		uint32_t _time = 0;
+		uint32_t _usedCount = 0;
+		uint32_t _evictionCount = 0;
+		uint32_t _resetCount = 0;
+	};
+}
@@ -0,0 +1,59 @@
+/*
+	This file is part of D2DX.
+
+	Copyright (C) 2021  Bolrog
+
+	D2DX is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	D2DX is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with D2DX.  If not, see <https://www.gnu.org/licenses/>.
+*/
+#include "pch.h"
+#include "PrimitiveIndices.h"
+
+using namespace d2dx;
+
+_Use_decl_annotations_
+uint32_t d2dx::WriteTriangleStripIndices(
+	uint32_t* __restrict indices,
+	uint32_t firstVertex,
+	uint32_t vertexCount) noexcept
+{
+	const uint32_t indexCount = GetTriangleListIndexCount(vertexCount);
+
+	for (uint32_t i = 0; i < indexCount; i += 3)
+	{
+		indices[i + 0] = firstVertex;
+		indices[i + 1] = firstVertex + 1;
+		indices[i + 2] = firstVertex + 2;
+		++firstVertex;
+	}
+
+	return indexCount;
+}
+
+_Use_decl_annotations_
+uint32_t d2dx::WriteTriangleFanIndices(
+	uint32_t* __restrict indices,
+	uint32_t firstVertex,
+	uint32_t vertexCount) noexcept
+{
+	const uint32_t indexCount = GetTriangleListIndexCount(vertexCount);
+
+	for (uint32_t i = 0, vertex = firstVertex + 1; i < indexCount; i += 3, ++vertex)
+	{
+		indices[i + 0] = firstVertex;
+		indices[i + 1] = vertex;
+		indices[i + 2] = vertex + 1;
+	}
+
+	return indexCount;
+}
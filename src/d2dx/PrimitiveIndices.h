@@ -0,0 +1,44 @@
+/*
+	This file is part of D2DX.
+
+	Copyright (C) 2021  Bolrog
+
+	D2DX is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	D2DX is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with D2DX.  If not, see <https://www.gnu.org/licenses/>.
+*/
+#pragma once
+
+namespace d2dx
+{
+	/* The number of triangle list indices for a strip or fan with vertexCount vertices. */
+	inline uint32_t GetTriangleListIndexCount(
+		_In_ uint32_t vertexCount) noexcept
+	{
+		return vertexCount >= 3 ? 3 * (vertexCount - 2) : 0;
+	}
+
+	/* Writes triangle list indices for a triangle strip whose vertices are numbered from
+	   firstVertex, and returns the number of indices written. Triangle i is (i, i+1, i+2);
+	   the winding isn't alternated, as nothing is culled. */
+	uint32_t WriteTriangleStripIndices(
+		_Out_writes_(GetTriangleListIndexCount(vertexCount)) uint32_t* __restrict indices,
+		_In_ uint32_t firstVertex,
+		_In_ uint32_t vertexCount) noexcept;
+
+	/* Writes triangle list indices for a triangle fan whose vertices are numbered from
+	   firstVertex, and returns the number of indices written. Triangle i is (0, i+1, i+2). */
+	uint32_t WriteTriangleFanIndices(
+		_Out_writes_(GetTriangleListIndexCount(vertexCount)) uint32_t* __restrict indices,
+		_In_ uint32_t firstVertex,
+		_In_ uint32_t vertexCount) noexcept;
+}
@@ -77,12 +77,14 @@ public:
 				"Frame profile:\n"
 				"Time: %.4fms\n"
 				"Profiled time: %.4fms (%u events)\n"
-				"TextureDownload: %.4fms (%u events)\n"
+				"TextureDownload: %.4fms (%u events) (%u copies skipped)\n"
 				"TextureSource: %.4fms (%u events)\n"
-				"TextureHash Miss Rate: %u/%u (%.2f%s)\n"
+				"TextureHash Miss Rate: %u/%u (%.2f%s) (%u stale avoided) (%u lookups avoided) (%u in background, %u waits)\n"
+				"TextureLocationMemo Hit Rate: %u/%u\n"
 				"MotionPrediction: %.4fms (%u events)\n"
 				"Draw: %.4fms (%u events) (%u dropped)\n"
-				"DrawBatches: %.4fms\n"
+				"DrawBatches: %.4fms (%u batches, %u after coalescing) (%u draw calls, %u before reordering)\n"
+				"TextureUpload: %.4fms (%u uploads, %.2fkiB) (%u over budget)\n"
 				"Sleep: %.4fms (%u events)\n"
 				"Sleep (other): %.4fms (%u events)\n"
 				"Present: %.4fms\n",
@@ -91,15 +93,22 @@ public:
 				_events[static_cast<std::size_t>(ProfCategory::Count)],
 				TimeToMs(_times[static_cast<std::size_t>(ProfCategory::TextureDownload)]),
 				_events[static_cast<std::size_t>(ProfCategory::TextureDownload)],
+				tex_download_copies_skipped,
 				TimeToMs(_times[static_cast<std::size_t>(ProfCategory::TextureSource)]),
 				_events[static_cast<std::size_t>(ProfCategory::TextureSource)],
-				tex_misses, tex_lookups, hashSize, hashUnit,
+				tex_misses, tex_lookups, hashSize, hashUnit, tex_stale_hashes_avoided, tex_hashes_avoided,
+				tex_hashes_in_background, tex_hash_waits,
+				tex_memo_hits, tex_memo_lookups,
 				TimeToMs(_times[static_cast<std::size_t>(ProfCategory::MotionPrediction)]),
 				_events[static_cast<std::size_t>(ProfCategory::MotionPrediction)],
 				TimeToMs(_times[static_cast<std::size_t>(ProfCategory::Draw)]),
 				_events[static_cast<std::size_t>(ProfCategory::Draw)],
 				dropped_draws,
 				TimeToMs(_times[static_cast<std::size_t>(ProfCategory::DrawBatches)]),
+				batches, batches_after_coalescing,
+				draw_calls, draw_calls_before_reordering,
+				TimeToMs(_times[static_cast<std::size_t>(ProfCategory::TextureUpload)]),
+				tex_uploads, tex_upload_size / 1024.0, tex_upload_overflows,
 				TimeToMs(_times[static_cast<std::size_t>(ProfCategory::Sleep)]),
 				_events[static_cast<std::size_t>(ProfCategory::Sleep)],
 				TimeToMs(atomicTime),
@@ -114,7 +123,21 @@ public:
 		tex_lookups = 0;
 		tex_misses = 0;
 		tex_miss_size = 0;
+		tex_stale_hashes_avoided = 0;
+		tex_hashes_avoided = 0;
+		tex_hashes_in_background = 0;
+		tex_hash_waits = 0;
+		tex_download_copies_skipped = 0;
+		tex_memo_lookups = 0;
+		tex_memo_hits = 0;
 		dropped_draws = 0;
+		batches = 0;
+		batches_after_coalescing = 0;
+		draw_calls = 0;
+		draw_calls_before_reordering = 0;
+		tex_uploads = 0;
+		tex_upload_size = 0;
+		tex_upload_overflows = 0;
 		lastProfileTime = TimeStamp();
 	}
 
@@ -127,8 +150,23 @@ public:
 	size_t tex_lookups = 0;
 	size_t tex_misses = 0;
 	size_t tex_miss_size = 0;
+	size_t tex_stale_hashes_avoided = 0;
+	size_t tex_hashes_avoided = 0;
+	size_t tex_hashes_in_background = 0;
+	size_t tex_hash_waits = 0;
+	size_t tex_download_copies_skipped = 0;
+	size_t tex_memo_lookups = 0;
+	size_t tex_memo_hits = 0;
 
 	size_t dropped_draws = 0;
+	size_t batches = 0;
+	size_t batches_after_coalescing = 0;
+	size_t draw_calls = 0;
+	size_t draw_calls_before_reordering = 0;
+
+	size_t tex_uploads = 0;
+	size_t tex_upload_size = 0;
+	size_t tex_upload_overflows = 0;
 };
 
 static Profiler profiler;
@@ -202,9 +240,97 @@ void d2dx::AddTexHashMiss(
 #endif
 }
 
+void d2dx::AddTexHashStaleAvoided() noexcept
+{
+#ifdef D2DX_PROFILE
+	profiler.tex_stale_hashes_avoided += 1;
+#endif
+}
+
+void d2dx::AddTexHashAvoided() noexcept
+{
+#ifdef D2DX_PROFILE
+	profiler.tex_hashes_avoided += 1;
+#endif
+}
+
+void d2dx::AddTexHashInBackground() noexcept
+{
+#ifdef D2DX_PROFILE
+	profiler.tex_hashes_in_background += 1;
+#endif
+}
+
+void d2dx::AddTexHashWait() noexcept
+{
+#ifdef D2DX_PROFILE
+	profiler.tex_hash_waits += 1;
+#endif
+}
+
+void d2dx::AddTexDownloadCopySkipped() noexcept
+{
+#ifdef D2DX_PROFILE
+	profiler.tex_download_copies_skipped += 1;
+#endif
+}
+
+void d2dx::AddTexLocationMemoLookup() noexcept
+{
+#ifdef D2DX_PROFILE
+	profiler.tex_memo_lookups += 1;
+#endif
+}
+
+void d2dx::AddTexLocationMemoHit() noexcept
+{
+#ifdef D2DX_PROFILE
+	profiler.tex_memo_hits += 1;
+#endif
+}
+
 void d2dx::AddDroppedDraw() noexcept
 {
 #ifdef D2DX_PROFILE
 	profiler.dropped_draws += 1;
 #endif
 }
+
+_Use_decl_annotations_
+void d2dx::AddBatches(
+	size_t batches,
+	size_t batchesAfterCoalescing) noexcept
+{
+#ifdef D2DX_PROFILE
+	profiler.batches += batches;
+	profiler.batches_after_coalescing += batchesAfterCoalescing;
+#endif
+}
+
+_Use_decl_annotations_
+void d2dx::AddDrawCalls(
+	size_t drawCalls,
+	size_t drawCallsBeforeReordering) noexcept
+{
+#ifdef D2DX_PROFILE
+	profiler.draw_calls += drawCalls;
+	profiler.draw_calls_before_reordering += drawCallsBeforeReordering;
+#endif
+}
+
+_Use_decl_annotations_
+void d2dx::AddTexUpload(
+	size_t size) noexcept
+{
+#ifdef D2DX_PROFILE
+	profiler.tex_uploads += 1;
+	profiler.tex_upload_size += size;
+#endif
+}
+
+void d2dx::AddTexUploadOverflow() noexcept
+{
+#ifdef D2DX_PROFILE
+	profiler.tex_upload_overflows += 1;
+#endif
+}
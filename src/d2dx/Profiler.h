@@ -6,6 +6,7 @@ namespace d2dx {
 		MotionPrediction,
 		Draw,
 		DrawBatches,
+		TextureUpload,
 		TextureDownload,
 		Sleep,
 		Present,
@@ -37,6 +38,31 @@ namespace d2dx {
 	void AddTexHashLookup() noexcept;
 	void AddTexHashMiss(
 		_In_ size_t size) noexcept;
+	void AddTexHashStaleAvoided() noexcept;
+
+	/* A texture was bound, but no draw needed its hash before the next one was. */
+	void AddTexHashAvoided() noexcept;
+
+	void AddTexHashInBackground() noexcept;
+
+	/* The game thread waited for the texture hashing worker thread. */
+	void AddTexHashWait() noexcept;
+	void AddTexDownloadCopySkipped() noexcept;
+
+	void AddTexLocationMemoLookup() noexcept;
+	void AddTexLocationMemoHit() noexcept;
 
 	void AddDroppedDraw() noexcept;
+
+	void AddBatches(
+		_In_ size_t batches,
+		_In_ size_t batchesAfterCoalescing) noexcept;
+
+	void AddDrawCalls(
+		_In_ size_t drawCalls,
+		_In_ size_t drawCallsBeforeReordering) noexcept;
+
+	void AddTexUpload(
+		_In_ size_t size) noexcept;
+	void AddTexUploadOverflow() noexcept;
 }
@@ -21,6 +21,7 @@
 #include "D2DXContextFactory.h"
 #include "RenderContext.h"
 #include "Metrics.h"
+#include "SpriteInstance.h"
 #include "TextureCache.h"
 #include "Vertex.h"
 #include "Utils.h"
@@ -47,6 +48,13 @@ extern BOOL(WINAPI* SetWindowPos_Real)(
 static LRESULT CALLBACK d2dxSubclassWndProc(HWND hWnd, UINT uMsg, WPARAM wParam,
 	LPARAM lParam, UINT_PTR uIdSubclass, DWORD_PTR dwRefData);
 
+static double GetPackingEfficiency(
+	_In_ const ITextureCache* textureCache)
+{
+	const uint64_t reservedTexelCount = textureCache->GetReservedTexelCount();
+	return reservedTexelCount ? 100.0 * textureCache->GetTexelCount() / reservedTexelCount : 100.0;
+}
+
 _Use_decl_annotations_
 RenderContext::RenderContext(
 	HWND hWnd,
@@ -66,6 +74,11 @@ RenderContext::RenderContext(
 
 	_constants.sharpness = _d2dxContext->GetOptions().GetBilinearSharpness();
 
+	if (_d2dxContext->GetOptions().GetFlag(OptionsFlag::DbgRecordTextureCacheTrace))
+	{
+		_textureCacheTraceRecorder = std::make_unique<TextureCacheTraceRecorder>("d2dx_texture_cache_trace.bin");
+	}
+
 	
 	Offset startPos = _d2dxContext->GetOptions().GetWindowPosition();
 	RECT windowRect;
@@ -268,6 +281,8 @@ RenderContext::RenderContext(
 	_deviceContext->ClearRenderTargetView(_backbufferRtv.Get(), color);
 
 	_vbCapacity = 1024 * 1024;
+	_ibCapacity = 1024 * 1024;
+	_sbCapacity = 64 * 1024;
 
 	_gameSize = { 0, 0 };
 	SetSizes(_gameSize, _windowSize, _screenMode);
@@ -277,12 +292,23 @@ RenderContext::RenderContext(
 		: gameSize;
 	_resources = std::make_unique<RenderContextResources>(
 			_vbCapacity * sizeof(Vertex),
+			_ibCapacity * sizeof(uint32_t),
+			_sbCapacity * sizeof(SpriteInstance),
 			16 * sizeof(Constants),
 		framebufferSize,
+		_d2dxContext->GetOptions(),
 			_device.Get());
 
+	/* Leave room for the full-screen triangles drawn after each frame. */
+	_vertexRing = std::make_unique<VertexRing>(
+		this,
+		_vbCapacity,
+		_vbCapacity / 4,
+		D2DX_MAX_VERTICES_PER_FRAME,
+		_d2dxContext->GetOptions().GetFlag(OptionsFlag::NoVertexRing));
+
 	SetRasterizerState(_resources->GetRasterizerState(true));
-	_deviceContext->IASetInputLayout(_resources->GetInputLayout());
+	SetInputLayout(_resources->GetInputLayout());
 
 	ID3D11Buffer* cb = _resources->GetConstantBuffer();
 	_deviceContext->VSSetConstantBuffers(0, 1, &cb);
@@ -300,10 +326,11 @@ RenderContext::RenderContext(
 		_resources->GetFramebufferRtv(RenderContextFramebuffer::Game),
 		_resources->GetFramebufferRtv(RenderContextFramebuffer::SurfaceId));
 
-	uint32_t stride = sizeof(Vertex);
-	uint32_t offset = 0;
-	ID3D11Buffer* vbs[1] = { _resources->GetVertexBuffer() };
-	_deviceContext->IASetVertexBuffers(0, 1, vbs, &stride, &offset);
+	uint32_t strides[2] = { sizeof(Vertex), sizeof(SpriteInstance) };
+	uint32_t offsets[2] = { 0, 0 };
+	ID3D11Buffer* vbs[2] = { _resources->GetVertexBuffer(), _resources->GetSpriteBuffer() };
+	_deviceContext->IASetVertexBuffers(0, 2, vbs, strides, offsets);
+	_deviceContext->IASetIndexBuffer(_resources->GetIndexBuffer(), DXGI_FORMAT_R32_UINT, 0);
 }
 
 HWND RenderContext::GetHWnd() const
@@ -314,10 +341,14 @@ HWND RenderContext::GetHWnd() const
 _Use_decl_annotations_
 void RenderContext::Draw(
 	const Batch& batch,
-	uint32_t startVertexLocation)
+	uint32_t startVertexLocation,
+	uint32_t startIndexLocation,
+	uint32_t startSpriteLocation)
 {
 	SetBlendState(batch.GetAlphaBlend());
 
+	const bool isSprites = batch.GetPrimitiveType() == PrimitiveType::Sprites;
+
 	ITextureCache* atlas = GetTextureCache(batch);
 
 	RenderContextPixelShader shader = batch.GetFilterMode() == GR_TEXTUREFILTER_BILINEAR
@@ -325,12 +356,19 @@ void RenderContext::Draw(
 		: RenderContextPixelShader::Game;
 
 	SetShaderState(
-		_resources->GetVertexShader(RenderContextVertexShader::Game),
+		_resources->GetVertexShader(isSprites ? RenderContextVertexShader::Sprite : RenderContextVertexShader::Game),
 		_resources->GetPixelShader(shader),
 		atlas ? atlas->GetSrv(batch.GetTextureAtlas()) : nullptr,
 		_resources->GetTexture1DSrv(RenderContextTexture1D::Palette));
 
-	_deviceContext->Draw(batch.GetVertexCount(), startVertexLocation + batch.GetStartVertex());
+	if (isSprites)
+	{
+		_deviceContext->DrawInstanced(6, batch.GetIndexCount(), 0, startSpriteLocation + batch.GetStartIndex());
+	}
+	else
+	{
+		_deviceContext->DrawIndexed(batch.GetIndexCount(), startIndexLocation + batch.GetStartIndex(), startVertexLocation);
+	}
 }
 
 bool RenderContext::IsIntegerScale() const
@@ -367,12 +405,10 @@ void RenderContext::Present()
 			_resources->GetPixelShader(RenderContextPixelShader::Gamma),
 			source,
 			additionalSource);
-		auto startVertexLocation = _vbWriteIndex;
-		uint32_t vertexCount = UpdateVerticesWithFullScreenTriangle(
+		const uint32_t startVertexLocation = UpdateVerticesWithFullScreenTriangle(
 			_gameSize,
-			_resources->GetFramebufferSize(),
-			{ 0,0,_gameSize.width, _gameSize.height });
-		_deviceContext->Draw(vertexCount, startVertexLocation);
+			_resources->GetFramebufferSize());
+		_deviceContext->Draw(3, startVertexLocation);
 		source = _resources->GetFramebufferSrv(RenderContextFramebuffer::GammaCorrected);
 	}
 
@@ -395,13 +431,11 @@ void RenderContext::Present()
 			source,
 			_resources->GetFramebufferSrv(RenderContextFramebuffer::SurfaceId));
 
-		auto startVertexLocation = _vbWriteIndex;
-		auto vertexCount = UpdateVerticesWithFullScreenTriangle(
+		const uint32_t startVertexLocation = UpdateVerticesWithFullScreenTriangle(
 			_gameSize,
-			_resources->GetFramebufferSize(),
-			{ 0,0,_gameSize.width, _gameSize.height });
+			_resources->GetFramebufferSize());
 
-		_deviceContext->Draw(vertexCount, startVertexLocation);
+		_deviceContext->Draw(3, startVertexLocation);
 		source = _resources->GetFramebufferSrv(RenderContextFramebuffer::Game);
 	}
 
@@ -444,13 +478,11 @@ void RenderContext::Present()
 		source,
 		additionalSource);
 
-	auto startVertexLocation = _vbWriteIndex;
-	auto vertexCount = UpdateVerticesWithFullScreenTriangle(
+	const uint32_t startVertexLocation = UpdateVerticesWithFullScreenTriangle(
 		_gameSize,
-		_resources->GetFramebufferSize(),
-		_renderRect);
+		_resources->GetFramebufferSize());
 
-	_deviceContext->Draw(vertexCount, startVertexLocation);
+	_deviceContext->Draw(3, startVertexLocation);
 
 	SetShaderState(
 		nullptr,
@@ -460,14 +492,42 @@ void RenderContext::Present()
 
 	if (!(_frameCount & 255))
 	{
-		D2DX_DEBUG_LOG("Texture cache use: %u, %u, %u, %u, %u, %u, %u",
+		D2DX_DEBUG_LOG("Texture cache use: %u/%u, %u/%u, %u/%u, %u/%u, %u/%u, %u/%u, %u/%u",
 			this->_resources->GetTextureCache(8, 8)->GetUsedCount(),
+			this->_resources->GetTextureCache(8, 8)->GetCapacity(),
 			this->_resources->GetTextureCache(16, 16)->GetUsedCount(),
+			this->_resources->GetTextureCache(16, 16)->GetCapacity(),
 			this->_resources->GetTextureCache(32, 32)->GetUsedCount(),
+			this->_resources->GetTextureCache(32, 32)->GetCapacity(),
 			this->_resources->GetTextureCache(64, 64)->GetUsedCount(),
+			this->_resources->GetTextureCache(64, 64)->GetCapacity(),
 			this->_resources->GetTextureCache(128, 128)->GetUsedCount(),
+			this->_resources->GetTextureCache(128, 128)->GetCapacity(),
 			this->_resources->GetTextureCache(256, 256)->GetUsedCount(),
-			this->_resources->GetTextureCache(256, 128)->GetUsedCount());
+			this->_resources->GetTextureCache(256, 256)->GetCapacity(),
+			this->_resources->GetTextureCache(256, 128)->GetUsedCount(),
+			this->_resources->GetTextureCache(256, 128)->GetCapacity());
+
+		D2DX_DEBUG_LOG("Texture cache packing efficiency: %.0f%%, %.0f%%, %.0f%%, %.0f%%, %.0f%%, %.0f%%, %.0f%%",
+			GetPackingEfficiency(this->_resources->GetTextureCache(8, 8)),
+			GetPackingEfficiency(this->_resources->GetTextureCache(16, 16)),
+			GetPackingEfficiency(this->_resources->GetTextureCache(32, 32)),
+			GetPackingEfficiency(this->_resources->GetTextureCache(64, 64)),
+			GetPackingEfficiency(this->_resources->GetTextureCache(128, 128)),
+			GetPackingEfficiency(this->_resources->GetTextureCache(256, 256)),
+			GetPackingEfficiency(this->_resources->GetTextureCache(256, 128)));
+
+		D2DX_DEBUG_LOG("Texture cache overflows: %u, %u, %u, %u, %u, %u, %u",
+			this->_resources->GetTextureCache(8, 8)->GetOverflowCount(),
+			this->_resources->GetTextureCache(16, 16)->GetOverflowCount(),
+			this->_resources->GetTextureCache(32, 32)->GetOverflowCount(),
+			this->_resources->GetTextureCache(64, 64)->GetOverflowCount(),
+			this->_resources->GetTextureCache(128, 128)->GetOverflowCount(),
+			this->_resources->GetTextureCache(256, 256)->GetOverflowCount(),
+			this->_resources->GetTextureCache(256, 128)->GetOverflowCount());
+
+		D2DX_DEBUG_LOG("Vertex ring discards: %u",
+			_vertexRing->GetDiscardCount());
 	}
 
 	{
@@ -503,6 +563,9 @@ void RenderContext::Present()
 		_deviceContext1->DiscardView(_backbufferRtv.Get());
 	}
 
+	/* When presenting outside of a game frame (e.g. on resize), textures may still be
+	   waiting for upload; they must reach their atlases before the caches move on. */
+	FlushTextureUploads();
 	_resources->OnNewFrame();
 
 	SetRenderTargets(
@@ -574,8 +637,7 @@ void RenderContext::WriteToScreen(
 {
 	D3D11_MAPPED_SUBRESOURCE ms;
 	SetBlendState(AlphaBlend::Opaque);
-	uint32_t startVertexLocation = _vbWriteIndex;
-	uint32_t vertexCount = 0;
+	uint32_t startVertexLocation = 0;
 
 	ID3D11PixelShader* shader = nullptr;
 	if (is16Bit)
@@ -598,7 +660,7 @@ void RenderContext::WriteToScreen(
 			shader,
 			_resources->GetCinematicSrv(),
 			nullptr);
-		vertexCount = UpdateVerticesWithFullScreenTriangle(_gameSize, _resources->GetCinematicTextureSize(), { 0,0,_gameSize.width, _gameSize.height });
+		startVertexLocation = UpdateVerticesWithFullScreenTriangle(_gameSize, _resources->GetCinematicTextureSize());
 	}
 	else
 	{
@@ -611,10 +673,10 @@ void RenderContext::WriteToScreen(
 			shader,
 			_resources->GetVideoSrv(),
 			nullptr);
-		vertexCount = UpdateVerticesWithFullScreenTriangle(_gameSize, _resources->GetVideoTextureSize(), { 0,0,_gameSize.width, _gameSize.height });
+		startVertexLocation = UpdateVerticesWithFullScreenTriangle(_gameSize, _resources->GetVideoTextureSize());
 	}
 
-	_deviceContext->Draw(vertexCount, startVertexLocation);
+	_deviceContext->Draw(3, startVertexLocation);
 
 	Present();
 }
@@ -627,64 +689,148 @@ void RenderContext::SetBlendState(
 }
 
 _Use_decl_annotations_
-uint32_t RenderContext::BulkWriteVertices(
-	const Vertex* vertices,
-	uint32_t vertexCount)
+VertexRing* RenderContext::GetVertexRing()
+{
+	return _vertexRing.get();
+}
+
+_Use_decl_annotations_
+Vertex* RenderContext::MapVertices(
+	bool discard)
+{
+	D3D11_MAPPED_SUBRESOURCE mappedSubResource = { 0 };
+	D2DX_CHECK_HR(_deviceContext->Map(_resources->GetVertexBuffer(), 0,
+		discard ? D3D11_MAP_WRITE_DISCARD : D3D11_MAP_WRITE_NO_OVERWRITE, 0, &mappedSubResource));
+	return (Vertex*)mappedSubResource.pData;
+}
+
+void RenderContext::UnmapVertices()
+{
+	_deviceContext->Unmap(_resources->GetVertexBuffer(), 0);
+}
+
+template<typename TWrite>
+_Use_decl_annotations_
+uint32_t RenderContext::BulkWrite(
+	ID3D11Buffer* buffer,
+	uint32_t elementSize,
+	uint32_t capacity,
+	uint32_t& writeIndex,
+	uint32_t count,
+	const TWrite& write)
 {
 	auto mapType = D3D11_MAP_WRITE_NO_OVERWRITE;
-	if ((_vbWriteIndex + vertexCount) > _vbCapacity)
+	if ((writeIndex + count) > capacity)
 	{
 		mapType = D3D11_MAP_WRITE_DISCARD;
-		_vbWriteIndex = 0;
-		assert(vertexCount <= _vbCapacity);
-		vertexCount = min(vertexCount, _vbCapacity);
+		writeIndex = 0;
+		assert(count <= capacity);
+		count = min(count, capacity);
 	}
 
-	const uint32_t startVertexLocation = _vbWriteIndex;
+	const uint32_t startLocation = writeIndex;
 
-	if (vertexCount > 0)
+	if (count > 0)
 	{
 		D3D11_MAPPED_SUBRESOURCE mappedSubResource = { 0 };
-		D2DX_CHECK_HR(_deviceContext->Map(_resources->GetVertexBuffer(), 0, mapType, 0, &mappedSubResource));
-		Vertex* pMappedVertices = (Vertex*)mappedSubResource.pData + _vbWriteIndex;
-		memcpy(pMappedVertices, vertices, sizeof(Vertex) * vertexCount);
-		_deviceContext->Unmap(_resources->GetVertexBuffer(), 0);
+		D2DX_CHECK_HR(_deviceContext->Map(buffer, 0, mapType, 0, &mappedSubResource));
+		write((uint8_t*)mappedSubResource.pData + (size_t)writeIndex * elementSize, count);
+		_deviceContext->Unmap(buffer, 0);
 	}
 
-	_vbWriteIndex += vertexCount;
+	writeIndex += count;
 
-	return startVertexLocation;
+	return startLocation;
 }
 
 _Use_decl_annotations_
-uint32_t RenderContext::UpdateVerticesWithFullScreenTriangle(
-	Size srcSize,
-	Size srcTextureSize,
-	Rect dstRect)
+uint32_t RenderContext::BulkWriteIndices(
+	const uint32_t* indices,
+	uint32_t indexCount)
 {
-	Vertex vertices[3] = {
-		Vertex{ 0, 0, srcTextureSize.width, srcTextureSize.height, 0xFFFFFFFF, false, srcSize.height, 0, srcSize.width },
-		Vertex{ static_cast<float>(dstRect.size.width * 2), 0, srcTextureSize.width, srcTextureSize.height, 0xFFFFFFFF, false, srcSize.height, 0, srcSize.width },
-		Vertex{ 0, static_cast<float>(dstRect.size.height * 2), srcTextureSize.width, srcTextureSize.height, 0xFFFFFFFF, false, srcSize.height, 0, srcSize.width },
-	};
+	return BulkWrite(_resources->GetIndexBuffer(), sizeof(uint32_t), _ibCapacity, _ibWriteIndex, indexCount,
+		[indices](uint8_t* mappedIndices, uint32_t count)
+		{
+			memcpy(mappedIndices, indices, sizeof(uint32_t) * count);
+		});
+}
 
-	auto mapType = D3D11_MAP_WRITE_NO_OVERWRITE;
+_Use_decl_annotations_
+uint32_t RenderContext::BulkWriteBatchIndices(
+	const uint32_t* indices,
+	const Batch* batches,
+	uint32_t batchCount,
+	uint32_t indexCount)
+{
+	return BulkWrite(_resources->GetIndexBuffer(), sizeof(uint32_t), _ibCapacity, _ibWriteIndex, indexCount,
+		[indices, batches, batchCount](uint8_t* mappedIndices, uint32_t count)
+		{
+			uint32_t writtenCount = 0;
 
-	if ((_vbWriteIndex + ARRAYSIZE(vertices)) > _vbCapacity)
-	{
-		mapType = D3D11_MAP_WRITE_DISCARD;
-		_vbWriteIndex = 0;
-	}
+			for (uint32_t i = 0; i < batchCount; ++i)
+			{
+				if (batches[i].GetPrimitiveType() == PrimitiveType::Sprites)
+				{
+					continue;
+				}
+
+				const uint32_t batchIndexCount = min(batches[i].GetIndexCount(), count - writtenCount);
+				memcpy((uint32_t*)mappedIndices + writtenCount, indices + batches[i].GetStartIndex(), sizeof(uint32_t) * batchIndexCount);
+				writtenCount += batchIndexCount;
+			}
+		});
+}
 
-	D3D11_MAPPED_SUBRESOURCE mappedSubResource = { 0 };
-	D2DX_CHECK_HR(_deviceContext->Map(_resources->GetVertexBuffer(), 0, mapType, 0, &mappedSubResource));
-	Vertex* pMappedVertices = (Vertex*)mappedSubResource.pData + _vbWriteIndex;
-	memcpy(pMappedVertices, vertices, sizeof(Vertex) * ARRAYSIZE(vertices));
-	_deviceContext->Unmap(_resources->GetVertexBuffer(), 0);
+_Use_decl_annotations_
+uint32_t RenderContext::BulkWriteSprites(
+	const SpriteInstance* sprites,
+	uint32_t spriteCount)
+{
+	return BulkWrite(_resources->GetSpriteBuffer(), sizeof(SpriteInstance), _sbCapacity, _sbWriteIndex, spriteCount,
+		[sprites](uint8_t* mappedSprites, uint32_t count)
+		{
+			memcpy(mappedSprites, sprites, sizeof(SpriteInstance) * count);
+		});
+}
 
-	_vbWriteIndex += ARRAYSIZE(vertices);
+_Use_decl_annotations_
+uint32_t RenderContext::BulkWriteBatchSprites(
+	const SpriteInstance* sprites,
+	const Batch* batches,
+	uint32_t batchCount,
+	uint32_t spriteCount)
+{
+	return BulkWrite(_resources->GetSpriteBuffer(), sizeof(SpriteInstance), _sbCapacity, _sbWriteIndex, spriteCount,
+		[sprites, batches, batchCount](uint8_t* mappedSprites, uint32_t count)
+		{
+			uint32_t writtenCount = 0;
 
-	return ARRAYSIZE(vertices);
+			for (uint32_t i = 0; i < batchCount; ++i)
+			{
+				if (batches[i].GetPrimitiveType() != PrimitiveType::Sprites)
+				{
+					continue;
+				}
+
+				const uint32_t batchSpriteCount = min(batches[i].GetIndexCount(), count - writtenCount);
+				memcpy((SpriteInstance*)mappedSprites + writtenCount, sprites + batches[i].GetStartIndex(), sizeof(SpriteInstance) * batchSpriteCount);
+				writtenCount += batchSpriteCount;
+			}
+		});
+}
+
+_Use_decl_annotations_
+uint32_t RenderContext::UpdateVerticesWithFullScreenTriangle(
+	Size srcSize,
+	Size srcTextureSize)
+{
+	/* DisplayVS places the triangle over the viewport by SV_VertexID, so only the sizes are
+	   passed in the vertices. The height takes up both the atlas and low palette bits. */
+	const Vertex vertex{ 0, 0, srcTextureSize.width, srcTextureSize.height, 0xFFFFFFFF, false,
+		srcSize.height & 2047, srcSize.height >> 11, srcSize.width };
+	const Vertex vertices[3] = { vertex, vertex, vertex };
+
+	return _vertexRing->Write(vertices, ARRAYSIZE(vertices));
 }
 
 _Use_decl_annotations_
@@ -700,18 +846,52 @@ TextureCacheLocation RenderContext::UpdateTexture(
 
 	const uint64_t contentKey = batch.GetHash();
 
+	if (_textureCacheTraceRecorder)
+	{
+		_textureCacheTraceRecorder->Record(
+			_frameCount,
+			RenderContextResources::GetTextureCacheIndex(batch.GetTextureWidth(), batch.GetTextureHeight()),
+			batch.GetTextureWidth(),
+			batch.GetTextureHeight(),
+			contentKey);
+	}
+
 	ITextureCache* atlas = GetTextureCache(batch);
 
 	auto tcl = atlas->FindTexture(contentKey, -1);
 
 	if (tcl._textureAtlas < 0)
 	{
+		const uint32_t resetCount = atlas->GetResetCount();
+
 		tcl = atlas->InsertTexture(contentKey, batch, tmuData, tmuDataSize);
+
+		if (atlas->GetResetCount() != resetCount)
+		{
+			++_textureCacheResetCount;
+		}
 	}
 
 	return tcl;
 }
 
+uint32_t RenderContext::GetTextureCacheResetCount() const
+{
+	return _textureCacheResetCount;
+}
+
+void RenderContext::FlushTextureUploads()
+{
+	Timer _timer(ProfCategory::TextureUpload);
+	_resources->FlushTextureUploads(_deviceContext.Get());
+}
+
+void RenderContext::RebalanceTextureCaches()
+{
+	FlushTextureUploads();
+	_resources->RebalanceTextureCaches();
+}
+
 _Use_decl_annotations_
 void RenderContext::UpdateViewport(
 	Rect rect)
@@ -958,6 +1138,17 @@ void RenderContext::SetBlendState(
 	}
 }
 
+_Use_decl_annotations_
+void RenderContext::SetInputLayout(
+	ID3D11InputLayout* inputLayout)
+{
+	if (inputLayout != _shadowState.il)
+	{
+		_deviceContext->IASetInputLayout(inputLayout);
+		_shadowState.il = inputLayout;
+	}
+}
+
 _Use_decl_annotations_
 void RenderContext::SetShaderState(
 	ID3D11VertexShader* vs,
@@ -969,6 +1160,12 @@ void RenderContext::SetShaderState(
 	{
 		_deviceContext->VSSetShader(vs, NULL, 0);
 		_shadowState.vs = vs;
+
+		if (vs)
+		{
+			SetInputLayout(vs == _resources->GetVertexShader(RenderContextVertexShader::Sprite) ?
+				_resources->GetSpriteInputLayout() : _resources->GetInputLayout());
+		}
 	}
 
 	if (ps != _shadowState.ps)
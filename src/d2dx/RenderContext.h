@@ -21,12 +21,15 @@
 #include "IRenderContext.h"
 #include "ITextureCache.h"
 #include "RenderContextResources.h"
+#include "TextureCacheTrace.h"
 #include "Types.h"
+#include "VertexRing.h"
 
 namespace d2dx
 {
 	class Vertex;
 	class Batch;
+	class SpriteInstance;
 
 	enum class RenderContextSyncStrategy
 	{
@@ -42,7 +45,7 @@ namespace d2dx
 		Discard = 1,
 	};
 
-	class RenderContext final : public IRenderContext
+	class RenderContext final : public IRenderContext, public IVertexRingStorage
 	{
 	public:
 		RenderContext(
@@ -60,18 +63,44 @@ namespace d2dx
 			_In_reads_(valueCount) const uint32_t* values,
 			_In_ uint32_t valueCount) override;
 
-		virtual uint32_t BulkWriteVertices(
-			_In_reads_(vertexCount) const Vertex* vertices,
-			_In_ uint32_t vertexCount) override;
+		virtual VertexRing* GetVertexRing() override;
+
+		virtual uint32_t BulkWriteIndices(
+			_In_reads_(indexCount) const uint32_t* indices,
+			_In_ uint32_t indexCount) override;
+
+		virtual uint32_t BulkWriteBatchIndices(
+			_In_ const uint32_t* indices,
+			_In_reads_(batchCount) const Batch* batches,
+			_In_ uint32_t batchCount,
+			_In_ uint32_t indexCount) override;
+
+		virtual uint32_t BulkWriteSprites(
+			_In_reads_(spriteCount) const SpriteInstance* sprites,
+			_In_ uint32_t spriteCount) override;
+
+		virtual uint32_t BulkWriteBatchSprites(
+			_In_ const SpriteInstance* sprites,
+			_In_reads_(batchCount) const Batch* batches,
+			_In_ uint32_t batchCount,
+			_In_ uint32_t spriteCount) override;
 
 		virtual TextureCacheLocation UpdateTexture(
 			_In_ const Batch& batch,
 			_In_reads_(tmuDataSize) const uint8_t* tmuData,
 			_In_ uint32_t tmuDataSize) override;
 
+		virtual uint32_t GetTextureCacheResetCount() const override;
+
+		virtual void FlushTextureUploads() override;
+
+		virtual void RebalanceTextureCaches() override;
+
 		virtual void Draw(
 			_In_ const Batch& batch,
-			_In_ uint32_t startVertexLocation) override;
+			_In_ uint32_t startVertexLocation,
+			_In_ uint32_t startIndexLocation,
+			_In_ uint32_t startSpriteLocation) override;
 
 		virtual void Present() override;
 
@@ -108,6 +137,11 @@ namespace d2dx
 
 		virtual ScreenMode GetScreenMode() const override;
 
+		virtual Vertex* MapVertices(
+			_In_ bool discard) override;
+
+		virtual void UnmapVertices() override;
+
 		void SetActiveWindow(bool active) {
 			if (!active)
 			{
@@ -139,10 +173,22 @@ namespace d2dx
 		void AdjustWindowPlacement(
 			_In_ HWND hWnd);
 
+		/* Appends count elements of elementSize bytes to a ring buffer, starting over at the
+		   beginning (discarding the old contents) when they don't fit. The elements are written
+		   by calling write(mappedElements, count). Returns where the first one went. */
+		template<typename TWrite>
+		uint32_t BulkWrite(
+			_In_ ID3D11Buffer* buffer,
+			_In_ uint32_t elementSize,
+			_In_ uint32_t capacity,
+			_Inout_ uint32_t& writeIndex,
+			_In_ uint32_t count,
+			_In_ const TWrite& write);
+
+		/* Writes the three vertices of DisplayVS, and returns where the first one went. */
 		uint32_t UpdateVerticesWithFullScreenTriangle(
 			_In_ Size srcSize,
-			_In_ Size srcTextureSize,
-			_In_ Rect dstRect);
+			_In_ Size srcTextureSize);
 
 		bool IsFrameLatencyWaitableObjectSupported() const;
 
@@ -150,6 +196,9 @@ namespace d2dx
 
 		void ResizeBackbuffer();
 
+		void SetInputLayout(
+			_In_ ID3D11InputLayout* inputLayout);
+
 		void SetShaderState(
 			_In_opt_ ID3D11VertexShader* vs,
 			_In_opt_ ID3D11PixelShader* ps,
@@ -189,6 +238,7 @@ namespace d2dx
 		{
 			Constants constants;
 			ID3D11RasterizerState* rs = nullptr;
+			ID3D11InputLayout* il = nullptr;
 			ID3D11VertexShader* vs = nullptr;
 			ID3D11PixelShader* ps = nullptr;
 			ID3D11BlendState* bs = nullptr;
@@ -207,16 +257,22 @@ namespace d2dx
 		ComPtr<IDXGISwapChain2> _swapChain2;
 		ComPtr<ID3D11RenderTargetView> _backbufferRtv;
 		std::unique_ptr<RenderContextResources> _resources;
+		std::unique_ptr<TextureCacheTraceRecorder> _textureCacheTraceRecorder;
+		std::unique_ptr<VertexRing> _vertexRing;
 
 		uint32_t _frameCount = 0;
+		uint32_t _textureCacheResetCount = 0;
 		Size _gameSize = { 0, 0 };
 		Rect _renderRect = { 0,0,0,0 };
 		Size _windowSize = { 0,0 };
 		Offset _windowPos = { -1, -1 };
 		bool _useSavedWindowPos = false;
 		int32_t _desktopClientMaxHeight = 0;
-		uint32_t _vbWriteIndex = 0;
 		uint32_t _vbCapacity = 0;
+		uint32_t _ibWriteIndex = 0;
+		uint32_t _ibCapacity = 0;
+		uint32_t _sbWriteIndex = 0;
+		uint32_t _sbCapacity = 0;
 		Constants _constants;
 		RenderContextSyncStrategy _syncStrategy = RenderContextSyncStrategy::AllowTearing;
 		RenderContextSwapStrategy _swapStrategy = RenderContextSwapStrategy::FlipDiscard;
@@ -30,6 +30,7 @@
 #include "GamePS_cso.h"
 #include "GameBilinearPS_cso.h"
 #include "GameVS_cso.h"
+#include "SpriteVS_cso.h"
 #include "VideoPS_cso.h"
 #include "VideoGammaPS_cso.h"
 #include "GammaPS_cso.h"
@@ -41,12 +42,15 @@ using namespace d2dx;
 _Use_decl_annotations_
 RenderContextResources::RenderContextResources(
 	uint32_t vbSizeBytes,
+	uint32_t ibSizeBytes,
+	uint32_t sbSizeBytes,
 	uint32_t cbSizeBytes,
 	Size framebufferSize,
+	const Options& options,
 	ID3D11Device* device)
 {
 	CreateTexture1Ds(device);
-	CreateTextureCaches(device);
+	CreateTextureCaches(options, device);
 	CreateVideoTextures(device);
 	CreateShadersAndInputLayout(device);
 	CreateRasterizerState(device);
@@ -54,6 +58,8 @@ RenderContextResources::RenderContextResources(
 	CreateBlendStates(device);
 	CreateFramebuffers(framebufferSize, device);
 	CreateVertexBuffer(vbSizeBytes, device);
+	CreateIndexBuffer(ibSizeBytes, device);
+	CreateSpriteBuffer(sbSizeBytes, device);
 	CreateConstantBuffer(cbSizeBytes, device);
 }
 
@@ -65,13 +71,88 @@ void RenderContextResources::OnNewFrame()
 	}
 }
 
+_Use_decl_annotations_
+void RenderContextResources::FlushTextureUploads(
+	ID3D11DeviceContext* deviceContext)
+{
+	if (_textureUploadQueue)
+	{
+		_textureUploadQueue->Flush(deviceContext);
+	}
+}
+
+void RenderContextResources::RebalanceTextureCaches()
+{
+	if (!_textureCacheBalancer)
+	{
+		return;
+	}
+
+	uint32_t evictionCounts[D2DX_TEXTURE_CACHE_COUNT];
+	uint32_t usedCounts[D2DX_TEXTURE_CACHE_COUNT];
+
+	for (int32_t i = 0; i < ARRAYSIZE(_textureCaches); ++i)
+	{
+		evictionCounts[i] = _textureCaches[i]->GetEvictionCount();
+		usedCounts[i] = _textureCaches[i]->GetUsedCount();
+	}
+
+	if (!_textureCacheBalancer->OnNewFrame(evictionCounts, usedCounts))
+	{
+		return;
+	}
+
+	/* Called between game frames: the batches of the last one have been drawn, and the
+	   uploads flushed, so nothing refers to the slots that are given away. */
+	for (int32_t i = 0; i < ARRAYSIZE(_textureCaches); ++i)
+	{
+		_textureCaches[i]->SetCapacity(_textureCacheBalancer->GetCapacity(i));
+	}
+
+	LogTextureCacheSplit();
+}
+
+void RenderContextResources::LogTextureCacheSplit() const
+{
+	uint32_t allocatedSize = 0;
+	uint64_t capacitySize = 0;
+
+	for (int32_t i = 0; i < ARRAYSIZE(_textureCaches); ++i)
+	{
+		allocatedSize += _textureCaches[i]->GetMemoryFootprint();
+		const Size slotSize = GetTextureCacheSlotSize(i);
+		capacitySize += (uint64_t)_textureCaches[i]->GetCapacity() * slotSize.width * slotSize.height;
+	}
+
+	D2DX_LOG("Texture cache split: 8x8 %u, 16x16 %u, 32x32 %u, 64x64 %u, 128x128 %u, 256x256 %u, packed %u (%u kB of %u kB budget, %u kB allocated).",
+		_textureCaches[0]->GetCapacity(),
+		_textureCaches[1]->GetCapacity(),
+		_textureCaches[2]->GetCapacity(),
+		_textureCaches[3]->GetCapacity(),
+		_textureCaches[4]->GetCapacity(),
+		_textureCaches[5]->GetCapacity(),
+		_textureCaches[6]->GetCapacity(),
+		(uint32_t)(capacitySize / 1024),
+		(uint32_t)((_textureCacheBalancer ? _textureCacheBalancer->GetBudget() : capacitySize) / 1024),
+		allocatedSize / 1024);
+}
+
 ITextureCache* RenderContextResources::GetTextureCache(
 	int32_t textureWidth,
 	int32_t textureHeight) const
 {
-	if (textureWidth == 256 && textureHeight == 128)
+	return _textureCaches[GetTextureCacheIndex(textureWidth, textureHeight)].get();
+}
+
+uint32_t RenderContextResources::GetTextureCacheIndex(
+	int32_t textureWidth,
+	int32_t textureHeight)
+{
+	/* Non-square textures waste much of a square slot, so from 64 texels and up they are
+	   packed together in the last cache instead. */
+	if (textureWidth != textureHeight && max(textureWidth, textureHeight) >= 64)
 	{
-		return _textureCaches[6].get();
+		return 6;
 	}
 
 	const int32_t longest = max(textureWidth, textureHeight);
@@ -80,7 +161,16 @@ ITextureCache* RenderContextResources::GetTextureCache(
 	BitScanForward((DWORD*)&log2Longest, (DWORD)longest);
 	log2Longest -= 3;
 	assert(log2Longest <= 5);
-	return _textureCaches[log2Longest].get();
+	return log2Longest;
+}
+
+_Use_decl_annotations_
+Size RenderContextResources::GetTextureCacheSlotSize(
+	uint32_t cacheIndex)
+{
+	/* The last cache packs textures into 256x256 slices. */
+	const int32_t size = cacheIndex == 6 ? 256 : 8 << cacheIndex;
+	return { size, size };
 }
 
 void RenderContextResources::SetFramebufferSize(
@@ -106,6 +196,9 @@ void RenderContextResources::CreateShadersAndInputLayout(
 	D2DX_CHECK_HR(
 		device->CreateVertexShader(GameVS_cso, ARRAYSIZE(GameVS_cso), NULL, &_vertexShaders[(int32_t)RenderContextVertexShader::Game]));
 
+	D2DX_CHECK_HR(
+		device->CreateVertexShader(SpriteVS_cso, ARRAYSIZE(SpriteVS_cso), NULL, &_vertexShaders[(int32_t)RenderContextVertexShader::Sprite]));
+
 	D2DX_CHECK_HR(
 		device->CreatePixelShader(GamePS_cso, ARRAYSIZE(GamePS_cso), NULL, &_pixelShaders[(int32_t)RenderContextPixelShader::Game]));
 
@@ -144,14 +237,26 @@ void RenderContextResources::CreateShadersAndInputLayout(
 
 	D3D11_INPUT_ELEMENT_DESC inputElementDescs[4] =
 	{
-		{ "POSITION", 0, DXGI_FORMAT_R32G32_FLOAT, 0, 0, D3D11_INPUT_PER_VERTEX_DATA, 0 },
-		{ "TEXCOORD", 0, DXGI_FORMAT_R16G16_SINT, 0, 8, D3D11_INPUT_PER_VERTEX_DATA, 0 },
-		{ "COLOR", 0, DXGI_FORMAT_B8G8R8A8_UNORM, 0, 12, D3D11_INPUT_PER_VERTEX_DATA, 0 },
-		{ "TEXCOORD", 1, DXGI_FORMAT_R16G16_UINT, 0, 16, D3D11_INPUT_PER_VERTEX_DATA, 0 }
+		{ "POSITION", 0, DXGI_FORMAT_R16G16_SINT, 0, 0, D3D11_INPUT_PER_VERTEX_DATA, 0 },
+		{ "TEXCOORD", 0, DXGI_FORMAT_R16G16_SINT, 0, 4, D3D11_INPUT_PER_VERTEX_DATA, 0 },
+		{ "COLOR", 0, DXGI_FORMAT_B8G8R8A8_UNORM, 0, 8, D3D11_INPUT_PER_VERTEX_DATA, 0 },
+		{ "TEXCOORD", 1, DXGI_FORMAT_R16G16_UINT, 0, 12, D3D11_INPUT_PER_VERTEX_DATA, 0 }
 	};
 
 	D2DX_CHECK_HR(
 		device->CreateInputLayout(inputElementDescs, ARRAYSIZE(inputElementDescs), GameVS_cso, ARRAYSIZE(GameVS_cso), &_inputLayout));
+
+	/* Sprite instances are read from input slot 1, one per instance. */
+	D3D11_INPUT_ELEMENT_DESC spriteInputElementDescs[4] =
+	{
+		{ "POSITION", 0, DXGI_FORMAT_R16G16B16A16_SINT, 1, 0, D3D11_INPUT_PER_INSTANCE_DATA, 1 },
+		{ "TEXCOORD", 0, DXGI_FORMAT_R16G16B16A16_SINT, 1, 8, D3D11_INPUT_PER_INSTANCE_DATA, 1 },
+		{ "COLOR", 0, DXGI_FORMAT_B8G8R8A8_UNORM, 1, 16, D3D11_INPUT_PER_INSTANCE_DATA, 1 },
+		{ "TEXCOORD", 1, DXGI_FORMAT_R16G16_UINT, 1, 20, D3D11_INPUT_PER_INSTANCE_DATA, 1 }
+	};
+
+	D2DX_CHECK_HR(
+		device->CreateInputLayout(spriteInputElementDescs, ARRAYSIZE(spriteInputElementDescs), SpriteVS_cso, ARRAYSIZE(SpriteVS_cso), &_spriteInputLayout));
 }
 
 _Use_decl_annotations_
@@ -206,33 +311,54 @@ void RenderContextResources::CreateTexture1Ds(
 
 _Use_decl_annotations_
 void RenderContextResources::CreateTextureCaches(
+	const Options& options,
 	ID3D11Device* device)
 {
-	static const uint32_t capacities[7] = { 512, 1024, 2048, 2048, 1024, 512, 1024 };
-
 	const uint32_t texturesPerAtlas = DetermineMaxTextureArraySize(device);
 	D2DX_LOG("The device supports %u textures per atlas.", texturesPerAtlas);
 
-	uint32_t totalSize = 0;
+	/* A cache can span at most four atlases. */
+	const uint32_t maxCapacity = texturesPerAtlas * 4;
+
+	uint32_t capacities[D2DX_TEXTURE_CACHE_COUNT];
+	uint32_t textureSizes[D2DX_TEXTURE_CACHE_COUNT];
+
+	const uint32_t uploadBudget = options.GetTextureUploadBudget() * 1024;
+
+	if (uploadBudget)
+	{
+		_textureUploadQueue = std::make_unique<TextureUploadQueue>(uploadBudget);
+		D2DX_DEBUG_LOG("Staging up to %u kB of texture uploads per frame.", uploadBudget / 1024);
+	}
+
 	for (int32_t i = 0; i < ARRAYSIZE(_textureCaches); ++i)
 	{
-		int32_t width = 1U << (i + 3);
-		int32_t height = 1U << (i + 3);
+		const Size slotSize = GetTextureCacheSlotSize(i);
+		const int32_t width = slotSize.width;
+		const int32_t height = slotSize.height;
 
-		if (i == 6)
-		{
-			width = 256;
-			height = 128;
-		}
+		capacities[i] = min(options.GetTextureCacheCapacity(i), maxCapacity);
+		textureSizes[i] = width * height;
+
+		_textureCaches[i] = std::make_unique<TextureCache>(width, height, capacities[i], texturesPerAtlas, i == 6, _textureUploadQueue.get(), device);
+
+		D2DX_DEBUG_LOG("Creating texture cache for %i x %i with capacity %u (up to %u kB).", width, height, capacities[i], capacities[i] * textureSizes[i] / 1024);
+	}
 
-		_textureCaches[i] = std::make_unique<TextureCache>(width, height, capacities[i], texturesPerAtlas, device);
+	if (!options.GetFlag(OptionsFlag::NoTextureCacheRebalance))
+	{
+		const uint64_t budget = (uint64_t)options.GetTextureCacheBudget() * 1024 * 1024;
 
-		D2DX_DEBUG_LOG("Creating texture cache for %i x %i with capacity %u (%u kB).", width, height, capacities[i], _textureCaches[i]->GetMemoryFootprint() / 1024);
+		_textureCacheBalancer = std::make_unique<TextureCacheBalancer>(capacities, textureSizes, maxCapacity, budget);
 
-		totalSize += _textureCaches[i]->GetMemoryFootprint();
+		if (budget && _textureCacheBalancer->GetBudget() > budget)
+		{
+			D2DX_LOG("The texture cache budget is smaller than the starting capacities, using %u kB instead.",
+				(uint32_t)(_textureCacheBalancer->GetBudget() / 1024));
+		}
 	}
 
-	D2DX_LOG("Total size of texture caches is %u kB.", totalSize / 1024);
+	LogTextureCacheSplit();
 }
 
 _Use_decl_annotations_
@@ -558,6 +684,40 @@ void RenderContextResources::CreateVertexBuffer(
 		device->CreateBuffer(&vbDesc, NULL, &_vb));
 }
 
+_Use_decl_annotations_
+void RenderContextResources::CreateIndexBuffer(
+	uint32_t ibSizeBytes,
+	ID3D11Device* device)
+{
+	const CD3D11_BUFFER_DESC ibDesc
+	{
+		ibSizeBytes,
+		D3D11_BIND_INDEX_BUFFER,
+		D3D11_USAGE_DYNAMIC,
+		D3D11_CPU_ACCESS_WRITE
+	};
+
+	D2DX_CHECK_HR(
+		device->CreateBuffer(&ibDesc, NULL, &_ib));
+}
+
+_Use_decl_annotations_
+void RenderContextResources::CreateSpriteBuffer(
+	uint32_t sbSizeBytes,
+	ID3D11Device* device)
+{
+	const CD3D11_BUFFER_DESC sbDesc
+	{
+		sbSizeBytes,
+		D3D11_BIND_VERTEX_BUFFER,
+		D3D11_USAGE_DYNAMIC,
+		D3D11_CPU_ACCESS_WRITE
+	};
+
+	D2DX_CHECK_HR(
+		device->CreateBuffer(&sbDesc, NULL, &_sb));
+}
+
 _Use_decl_annotations_
 void RenderContextResources::CreateConstantBuffer(
 	uint32_t cbSizeBytes,
@@ -19,6 +19,9 @@
 #pragma once
 
 #include "ITextureCache.h"
+#include "Options.h"
+#include "TextureCacheBalancer.h"
+#include "TextureUploadQueue.h"
 #include "Types.h"
 
 namespace d2dx
@@ -34,7 +37,8 @@ namespace d2dx
 	{
 		Game = 0,
 		Display = 1,
-		Count = 2
+		Sprite = 2,
+		Count = 3
 	};
 
 	enum class RenderContextPixelShader
@@ -73,18 +77,31 @@ namespace d2dx
 	public:
 		RenderContextResources(
 			_In_ uint32_t vbSizeBytes,
+			_In_ uint32_t ibSizeBytes,
+			_In_ uint32_t sbSizeBytes,
 			_In_ uint32_t cbSizeBytes,
 			_In_ Size framebufferSize,
+			_In_ const Options& options,
 			_In_ ID3D11Device* device);
 		
 		virtual ~RenderContextResources() noexcept {}
 
 		void OnNewFrame();
 
+		/* Uploads the textures that were added to the caches in this frame. */
+		void FlushTextureUploads(
+			_In_ ID3D11DeviceContext* deviceContext);
+
+		/* Moves slots between the texture caches according to their recent pressure. Must
+		   only be called between game frames, with no uploads pending. */
+		void RebalanceTextureCaches();
+
 		void SetFramebufferSize(Size framebufferSize, ID3D11Device* device);
 
 		ID3D11InputLayout* GetInputLayout() const { return _inputLayout.Get(); }
 
+		ID3D11InputLayout* GetSpriteInputLayout() const { return _spriteInputLayout.Get(); }
+
 		ID3D11VertexShader* GetVertexShader(RenderContextVertexShader vertexShader) const
 		{
 			return _vertexShaders[(int32_t)vertexShader].Get();
@@ -99,6 +116,10 @@ namespace d2dx
 			int32_t textureWidth, 
 			int32_t textureHeight) const;
 
+		static uint32_t GetTextureCacheIndex(
+			int32_t textureWidth,
+			int32_t textureHeight);
+
 		ID3D11Texture1D* GetTexture1D(RenderContextTexture1D texture1d) const
 		{ 
 			return _texture1Ds[(int32_t)texture1d].texture.Get();
@@ -179,6 +200,16 @@ namespace d2dx
 			return _vb.Get();
 		}
 
+		ID3D11Buffer* GetIndexBuffer() const
+		{
+			return _ib.Get();
+		}
+
+		ID3D11Buffer* GetSpriteBuffer() const
+		{
+			return _sb.Get();
+		}
+
 		ID3D11Buffer* GetConstantBuffer() const
 		{
 			return _cb.Get();
@@ -198,7 +229,13 @@ namespace d2dx
 			_In_ ID3D11Device* device);
 
 		void CreateTextureCaches(
+			_In_ const Options& options,
 			_In_ ID3D11Device* device);
+
+		static Size GetTextureCacheSlotSize(
+			_In_ uint32_t cacheIndex);
+
+		void LogTextureCacheSplit() const;
 	
 		void CreateVideoTextures(
 			_In_ ID3D11Device* device);
@@ -217,11 +254,20 @@ namespace d2dx
 			_In_ uint32_t vbSizeBytes,
 			_In_ ID3D11Device* device);
 
+		void CreateIndexBuffer(
+			_In_ uint32_t ibSizeBytes,
+			_In_ ID3D11Device* device);
+
+		void CreateSpriteBuffer(
+			_In_ uint32_t sbSizeBytes,
+			_In_ ID3D11Device* device);
+
 		void CreateConstantBuffer(
 			_In_ uint32_t cbSizeBytes,
 			_In_ ID3D11Device* device);
 
 		ComPtr<ID3D11InputLayout> _inputLayout;
+		ComPtr<ID3D11InputLayout> _spriteInputLayout;
 		ComPtr<ID3D11VertexShader> _vertexShaders[(int32_t)RenderContextVertexShader::Count];
 		ComPtr<ID3D11PixelShader> _pixelShaders[(int32_t)RenderContextPixelShader::Count];
 		ComPtr<ID3D11PixelShader> _gammaPS;
@@ -242,7 +288,9 @@ namespace d2dx
 		ComPtr<ID3D11Texture2D> _cinematicTexture;
 		ComPtr<ID3D11ShaderResourceView> _cinematicTextureSrv;
 
-		std::unique_ptr<ITextureCache> _textureCaches[7];
+		std::unique_ptr<ITextureCache> _textureCaches[D2DX_TEXTURE_CACHE_COUNT];
+		std::unique_ptr<TextureCacheBalancer> _textureCacheBalancer;
+		std::unique_ptr<TextureUploadQueue> _textureUploadQueue;
 
 		ComPtr<ID3D11RasterizerState> _rasterizerStateNoScissor;
 		ComPtr<ID3D11RasterizerState> _rasterizerState;
@@ -261,6 +309,8 @@ namespace d2dx
 		Size _framebufferSize;
 
 		ComPtr<ID3D11Buffer> _vb;
+		ComPtr<ID3D11Buffer> _ib;
+		ComPtr<ID3D11Buffer> _sb;
 		ComPtr<ID3D11Buffer> _cb;
 	};
 }
@@ -0,0 +1,164 @@
+/*
+	This file is part of D2DX.
+
+	Copyright (C) 2021  Bolrog
+
+	D2DX is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	D2DX is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with D2DX.  If not, see <https://www.gnu.org/licenses/>.
+*/
+#include "pch.h"
+#include "Simd.h"
+
+#if defined(D2DX_SIMD_X86) && !defined(_MSC_VER)
+#include <cpuid.h>
+#endif
+
+using namespace d2dx;
+
+#ifdef D2DX_SIMD_X86
+
+static void CpuId(
+	uint32_t regs[4],
+	uint32_t leaf,
+	uint32_t subleaf)
+{
+#if defined(_MSC_VER)
+	__cpuidex((int*)regs, (int)leaf, (int)subleaf);
+#else
+	__cpuid_count(leaf, subleaf, regs[0], regs[1], regs[2], regs[3]);
+#endif
+}
+
+static uint64_t ReadXcr0()
+{
+#if defined(_MSC_VER)
+	return _xgetbv(0);
+#else
+	uint32_t eax = 0, edx = 0;
+	__asm__ volatile("xgetbv" : "=a"(eax), "=d"(edx) : "c"(0));
+	return ((uint64_t)edx << 32) | eax;
+#endif
+}
+
+static uint32_t DetectSupportedSimdKernels()
+{
+	uint32_t supported = 1 << (int)SimdKernel::Scalar;
+	uint32_t regs[4] = { 0 };
+
+	CpuId(regs, 0, 0);
+	const uint32_t maxLeaf = regs[0];
+
+	if (maxLeaf < 1)
+	{
+		return supported;
+	}
+
+	CpuId(regs, 1, 0);
+	const bool hasSse41 = (regs[2] & (1 << 19)) != 0;
+	const bool hasOsXsave = (regs[2] & (1 << 27)) != 0;
+	const bool hasAvx = (regs[2] & (1 << 28)) != 0;
+
+	if (hasSse41)
+	{
+		supported |= 1 << (int)SimdKernel::Sse41;
+	}
+
+	if (!hasOsXsave || !hasAvx || maxLeaf < 7)
+	{
+		return supported;
+	}
+
+	/* The OS must save the YMM (and for AVX-512, the opmask and ZMM) registers. */
+	const uint64_t xcr0 = ReadXcr0();
+	const bool osSavesYmm = (xcr0 & 0x06) == 0x06;
+	const bool osSavesZmm = (xcr0 & 0xE6) == 0xE6;
+
+	CpuId(regs, 7, 0);
+	const bool hasAvx2 = (regs[1] & (1 << 5)) != 0;
+	const bool hasAvx512f = (regs[1] & (1 << 16)) != 0;
+
+	if (hasAvx2 && osSavesYmm)
+	{
+		supported |= 1 << (int)SimdKernel::Avx2;
+	}
+
+	if (hasAvx512f && osSavesZmm)
+	{
+		supported |= 1 << (int)SimdKernel::Avx512;
+	}
+
+	return supported;
+}
+
+#else
+
+static uint32_t DetectSupportedSimdKernels()
+{
+	return 1 << (int)SimdKernel::Scalar;
+}
+
+#endif
+
+static SimdKernel SelectBestSimdKernel(
+	uint32_t supported)
+{
+	for (int32_t kernel = (int32_t)SimdKernel::Count - 1; kernel > 0; --kernel)
+	{
+		if (supported & (1 << kernel))
+		{
+			return (SimdKernel)kernel;
+		}
+	}
+
+	return SimdKernel::Scalar;
+}
+
+/* Detected on first use rather than while the DLL is being loaded. */
+static uint32_t GetSupportedSimdKernels()
+{
+	static const uint32_t supportedSimdKernels = DetectSupportedSimdKernels();
+	return supportedSimdKernels;
+}
+
+_Use_decl_annotations_
+const char* d2dx::GetSimdKernelName(
+	SimdKernel kernel)
+{
+	switch (kernel)
+	{
+	case SimdKernel::Scalar:
+		return "Scalar";
+	case SimdKernel::Sse41:
+		return "SSE4.1";
+	case SimdKernel::Avx2:
+		return "AVX2";
+	case SimdKernel::Avx512:
+		return "AVX-512";
+	default:
+		return "Unknown";
+	}
+}
+
+_Use_decl_annotations_
+bool d2dx::IsSimdKernelSupported(
+	SimdKernel kernel)
+{
+	return (uint32_t)kernel < (uint32_t)SimdKernel::Count &&
+		(GetSupportedSimdKernels() & (1 << (int32_t)kernel)) != 0;
+}
+
+SimdKernel d2dx::GetBestSimdKernel()
+{
+	static const SimdKernel bestSimdKernel = SelectBestSimdKernel(GetSupportedSimdKernels());
+	return bestSimdKernel;
+}
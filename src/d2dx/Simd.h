@@ -0,0 +1,52 @@
+/*
+	This file is part of D2DX.
+
+	Copyright (C) 2021  Bolrog
+
+	D2DX is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	D2DX is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with D2DX.  If not, see <https://www.gnu.org/licenses/>.
+*/
+#pragma once
+
+#if defined(_M_IX86) || defined(_M_X64) || defined(__i386__) || defined(__x86_64__)
+#define D2DX_SIMD_X86 1
+#include <immintrin.h>
+#endif
+
+/* MSVC allows any intrinsic in any function, GCC/Clang need the ISA enabled per function. */
+#if defined(_MSC_VER)
+#define D2DX_SIMD_TARGET(isa)
+#else
+#define D2DX_SIMD_TARGET(isa) __attribute__((target(isa)))
+#endif
+
+namespace d2dx
+{
+	enum class SimdKernel
+	{
+		Scalar = 0,
+		Sse41 = 1,
+		Avx2 = 2,
+		Avx512 = 3,
+		Count = 4
+	};
+
+	const char* GetSimdKernelName(
+		_In_ SimdKernel kernel);
+
+	bool IsSimdKernelSupported(
+		_In_ SimdKernel kernel);
+
+	/* The fastest kernel supported by the CPU and OS, detected on first use. */
+	SimdKernel GetBestSimdKernel();
+}
@@ -0,0 +1,76 @@
+/*
+	This file is part of D2DX.
+
+	Copyright (C) 2021  Bolrog
+
+	D2DX is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	D2DX is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with D2DX.  If not, see <https://www.gnu.org/licenses/>.
+*/
+#include "pch.h"
+#include "SpriteInstance.h"
+
+using namespace d2dx;
+
+static bool HasSameAttributes(
+	_In_ const Vertex& a,
+	_In_ const Vertex& b)
+{
+	return
+		a.GetColor() == b.GetColor() &&
+		a.GetAtlasIndex() == b.GetAtlasIndex() &&
+		a.GetPaletteIndex() == b.GetPaletteIndex() &&
+		a.GetSurfaceId() == b.GetSurfaceId() &&
+		a.IsChromaKeyEnabled() == b.IsChromaKeyEnabled();
+}
+
+static bool IsCorner(
+	_In_ const Vertex& vertex,
+	_In_ const Vertex& xSource,
+	_In_ const Vertex& ySource)
+{
+	return
+		vertex.GetFixedPointX() == xSource.GetFixedPointX() && vertex.GetS() == xSource.GetS() &&
+		vertex.GetFixedPointY() == ySource.GetFixedPointY() && vertex.GetT() == ySource.GetT();
+}
+
+_Use_decl_annotations_
+bool d2dx::TryMakeSpriteInstance(
+	const Vertex* vertices,
+	SpriteInstance& sprite)
+{
+	const Vertex& v0 = vertices[0];
+	const Vertex& v1 = vertices[1];
+	const Vertex& v2 = vertices[2];
+	const Vertex& v3 = vertices[3];
+
+	if (v0.GetFixedPointX() == v2.GetFixedPointX() || v0.GetFixedPointY() == v2.GetFixedPointY())
+	{
+		return false;
+	}
+
+	if (!HasSameAttributes(v0, v1) || !HasSameAttributes(v0, v2) || !HasSameAttributes(v0, v3))
+	{
+		return false;
+	}
+
+	/* The fan splits the quad along v0-v2, as SpriteVS does, so v1 and v3 may be either
+	   of the two remaining corners. */
+	if (!(IsCorner(v1, v2, v0) && IsCorner(v3, v0, v2)) &&
+		!(IsCorner(v1, v0, v2) && IsCorner(v3, v2, v0)))
+	{
+		return false;
+	}
+
+	sprite = SpriteInstance(v0, v2);
+	return true;
+}
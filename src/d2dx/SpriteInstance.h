@@ -0,0 +1,128 @@
+/*
+	This file is part of D2DX.
+
+	Copyright (C) 2021  Bolrog
+
+	D2DX is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	D2DX is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with D2DX.  If not, see <https://www.gnu.org/licenses/>.
+*/
+#pragma once
+
+#include "Types.h"
+#include "Vertex.h"
+
+namespace d2dx
+{
+	/* A screen-aligned textured quad, drawn by SpriteVS as the triangles (0, 1, 2) and (0, 2, 3)
+	   of its corners. Corner 0 is (x0, y0) and corner 2 is (x1, y1), which need not be the
+	   top-left and bottom-right. Texcoords are affine across the quad: s follows x and t
+	   follows y. Positions are 13.3 fixed point, like those of Vertex. */
+	class SpriteInstance final
+	{
+	public:
+		SpriteInstance() noexcept :
+			_x0{ 0 },
+			_y0{ 0 },
+			_x1{ 0 },
+			_y1{ 0 },
+			_s0{ 0 },
+			_t0{ 0 },
+			_s1{ 0 },
+			_t1{ 0 },
+			_color{ 0 },
+			_paletteIndexLow_atlasIndex{ 0 },
+			_paletteIndexHigh_isChromaKeyEnabled_surfaceId{ 0 }
+		{
+		}
+
+		SpriteInstance(
+			const Vertex& corner0,
+			const Vertex& corner2) noexcept :
+			_x0((int16_t)corner0.GetFixedPointX()),
+			_y0((int16_t)corner0.GetFixedPointY()),
+			_x1((int16_t)corner2.GetFixedPointX()),
+			_y1((int16_t)corner2.GetFixedPointY()),
+			_s0(corner0.GetS()),
+			_t0(corner0.GetT()),
+			_s1(corner2.GetS()),
+			_t1(corner2.GetT()),
+			_color(corner0.GetColor()),
+			_paletteIndexLow_atlasIndex(((corner0.GetPaletteIndex() & 31) << 11) | corner0.GetAtlasIndex()),
+			_paletteIndexHigh_isChromaKeyEnabled_surfaceId(((corner0.GetPaletteIndex() & 32) << 10) |
+				(corner0.IsChromaKeyEnabled() ? 0x4000 : 0) | corner0.GetSurfaceId())
+		{
+		}
+
+		inline float GetY0() const noexcept
+		{
+			return _y0 * (1.0f / (1 << Vertex::POSITION_FRACTION_BITS));
+		}
+
+		inline void SetSurfaceId(int32_t surfaceId) noexcept
+		{
+			assert(surfaceId >= 0 && surfaceId <= 16383);
+			_paletteIndexHigh_isChromaKeyEnabled_surfaceId &= ~16383;
+			_paletteIndexHigh_isChromaKeyEnabled_surfaceId |= surfaceId & 16383;
+		}
+
+		inline void SetAtlasIndex(int32_t atlasIndex) noexcept
+		{
+			assert(atlasIndex >= 0 && atlasIndex <= 2047);
+			_paletteIndexLow_atlasIndex = (_paletteIndexLow_atlasIndex & ~2047) | (atlasIndex & 2047);
+		}
+
+		/* The vertex SpriteVS generates for the corner (0-3). */
+		Vertex GetCorner(
+			_In_ int32_t corner) const noexcept
+		{
+			const bool isRight = corner == 1 || corner == 2;
+			const bool isBottom = corner >= 2;
+
+			Vertex vertex(
+				0,
+				0,
+				isRight ? _s1 : _s0,
+				isBottom ? _t1 : _t0,
+				_color,
+				(_paletteIndexHigh_isChromaKeyEnabled_surfaceId & 0x4000) != 0,
+				_paletteIndexLow_atlasIndex & 2047,
+				(_paletteIndexLow_atlasIndex >> 11) | ((_paletteIndexHigh_isChromaKeyEnabled_surfaceId >> 10) & 32),
+				_paletteIndexHigh_isChromaKeyEnabled_surfaceId & 16383);
+
+			vertex.SetFixedPointPosition(isRight ? _x1 : _x0, isBottom ? _y1 : _y0);
+			return vertex;
+		}
+
+	private:
+		int16_t _x0;
+		int16_t _y0;
+		int16_t _x1;
+		int16_t _y1;
+		int16_t _s0;
+		int16_t _t0;
+		int16_t _s1;
+		int16_t _t1;
+		uint32_t _color;
+		uint16_t _paletteIndexLow_atlasIndex;
+		uint16_t _paletteIndexHigh_isChromaKeyEnabled_surfaceId;
+	};
+
+	static_assert(sizeof(SpriteInstance) == 24, "sizeof(SpriteInstance)");
+
+	/* Packs a quad, given as the 4 vertices of a triangle fan, into a sprite instance. Fails
+	   unless the sprite draws exactly the same two triangles, in which case the quad must be
+	   drawn as triangles. */
+	bool TryMakeSpriteInstance(
+		_In_reads_(4) const Vertex* vertices,
+		_Out_ SpriteInstance& sprite);
+}
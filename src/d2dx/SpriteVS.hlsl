@@ -0,0 +1,46 @@
+/*
+	This file is part of D2DX.
+
+	Copyright (C) 2021  Bolrog
+
+	D2DX is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	D2DX is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with D2DX.  If not, see <https://www.gnu.org/licenses/>.
+*/
+#include "Constants.hlsli"
+#include "Game.hlsli"
+
+/* Two triangles split along corner 0-2, like the triangle fan the sprite replaces. */
+static const uint c_corners[6] = { 0, 1, 2, 0, 2, 3 };
+
+void main(
+	in SpriteVSInput vs_in,
+	in uint vertexId : SV_VertexID,
+	out GameVSOutput vs_out)
+{
+	uint corner = c_corners[vertexId];
+	bool isRight = corner == 1 || corner == 2;
+	bool isBottom = corner >= 2;
+
+	int2 pos = int2(isRight ? vs_in.rect.z : vs_in.rect.x, isBottom ? vs_in.rect.w : vs_in.rect.y);
+	int2 texCoord = int2(isRight ? vs_in.texCoordRect.z : vs_in.texCoordRect.x, isBottom ? vs_in.texCoordRect.w : vs_in.texCoordRect.y);
+
+	float2 unitPos = float2(pos) * c_vertexPositionScale * c_invScreenSize - 0.5;
+	vs_out.pos = unitPos.xyxx * float4(2, -2, 0, 0) + float4(0, 0, 0, 1);
+	uint2 log2TextureSize;
+	vs_out.tc = DecodeTexCoord(texCoord, log2TextureSize);
+	vs_out.color = vs_in.color;
+	vs_out.atlasIndex_paletteIndex_surfaceId_flags.x = vs_in.misc.x & 2047;
+	vs_out.atlasIndex_paletteIndex_surfaceId_flags.y = (vs_in.misc.x >> 11) | ((vs_in.misc.y & 0x8000) ? 0x20 : 0);
+	vs_out.atlasIndex_paletteIndex_surfaceId_flags.z = vs_in.misc.y & 16383;
+	vs_out.atlasIndex_paletteIndex_surfaceId_flags.w = ((vs_in.misc.y & 0x4000) ? 1 : 0) | (log2TextureSize.x << 1) | (log2TextureSize.y << 5);
+}
@@ -0,0 +1,552 @@
+/*
+	This file is part of D2DX.
+
+	Copyright (C) 2021  Bolrog
+
+	D2DX is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	D2DX is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with D2DX.  If not, see <https://www.gnu.org/licenses/>.
+*/
+#include "pch.h"
+#include "TextureAtlasPacker.h"
+
+using namespace d2dx;
+
+static const uint32_t TexelsPerUnit = 8;
+static const uint32_t NoItem = 0xFFFFFFFF;
+
+static uint32_t TexelsToUnits(
+	_In_ uint32_t texels)
+{
+	const uint32_t units = (texels + TexelsPerUnit - 1) / TexelsPerUnit;
+	uint32_t powerOfTwoUnits = 1;
+
+	while (powerOfTwoUnits < units)
+	{
+		powerOfTwoUnits <<= 1;
+	}
+
+	return powerOfTwoUnits;
+}
+
+_Use_decl_annotations_
+TextureAtlasPacker::TextureAtlasPacker(
+	uint32_t sliceSize,
+	uint32_t sliceCount) :
+	_sliceCount{ sliceCount },
+	_sliceUnits{ sliceSize / TexelsPerUnit },
+	_fullMask{ 0xFFFFFFFF }
+{
+	assert(sliceSize >= TexelsPerUnit && sliceSize <= 32 * TexelsPerUnit && !(sliceSize & (sliceSize - 1)));
+	assert(sliceCount > 0 && sliceCount <= 65536);
+
+	/* Rows and columns beyond the edge of a slice are marked as always used. */
+	_emptyMask = ~MakeMask(_sliceUnits, 0);
+
+	/* Shelves are at least one row high, and textures are assumed to cover at least eight
+	   units (e.g. 64x8) on average. If the items still run out, shelves are evicted. */
+	const uint32_t maxShelfCount = sliceCount * _sliceUnits;
+	const uint32_t maxItemCount = max(sliceCount, maxShelfCount * _sliceUnits / 8);
+
+	_sliceRowMasks = Buffer<uint32_t>(sliceCount);
+	_rowShelves = Buffer<uint32_t>(maxShelfCount);
+	_shelves = Buffer<Shelf>(maxShelfCount, true);
+	_freeShelves = Buffer<uint32_t>(maxShelfCount);
+
+	for (int32_t i = 0; i < ARRAYSIZE(_openShelves); ++i)
+	{
+		_openShelves[i] = Buffer<uint32_t>(maxShelfCount);
+	}
+
+	_items = Buffer<Item>(maxItemCount, true);
+	_freeItems = Buffer<uint32_t>(maxItemCount);
+
+	Reset();
+}
+
+_Use_decl_annotations_
+bool TextureAtlasPacker::Find(
+	uint64_t contentKey,
+	TextureAtlasRect& rect)
+{
+	const int32_t itemIndex = _keys.Find(contentKey);
+
+	if (itemIndex < 0)
+	{
+		rect = { 0, 0, 0, 0, 0 };
+		return false;
+	}
+
+	const Item& item = _items.items[itemIndex];
+	_shelves.items[item.shelf].lastUsedFrame = _frame;
+	rect = item.rect;
+	return true;
+}
+
+_Use_decl_annotations_
+bool TextureAtlasPacker::TryInsert(
+	uint64_t contentKey,
+	uint32_t width,
+	uint32_t height,
+	TextureAtlasRect& rect,
+	uint32_t& evictedCount)
+{
+	assert(contentKey && _keys.Find(contentKey) < 0);
+
+	const uint32_t widthUnits = TexelsToUnits(width);
+	const uint32_t heightUnits = TexelsToUnits(height);
+	assert(widthUnits <= _sliceUnits && heightUnits <= _sliceUnits);
+
+	rect = { 0, 0, 0, 0, 0 };
+	evictedCount = 0;
+
+	if (!_freeItemCount && !EvictLeastRecentlyUsedShelf(evictedCount))
+	{
+		return false;
+	}
+
+	uint32_t shelfIndex = 0;
+	uint32_t x = 0;
+
+	if (!TryAllocate(widthUnits, heightUnits, shelfIndex, x))
+	{
+		if (!EvictLeastRecentlyUsedBlock(heightUnits, evictedCount))
+		{
+			return false;
+		}
+
+		const bool isAllocated = TryAllocate(widthUnits, heightUnits, shelfIndex, x);
+		assert(isAllocated);
+	}
+
+	Shelf& shelf = _shelves.items[shelfIndex];
+	shelf.lastUsedFrame = _frame;
+
+	assert(_freeItemCount > 0);
+	const uint32_t itemIndex = _freeItems.items[--_freeItemCount];
+
+	Item& item = _items.items[itemIndex];
+	item.rect = { shelf.slice, (uint16_t)(x * TexelsPerUnit), (uint16_t)(shelf.y * TexelsPerUnit), (uint16_t)width, (uint16_t)height };
+	item.shelf = shelfIndex;
+	item.nextInShelf = shelf.firstItem;
+	shelf.firstItem = itemIndex;
+
+	_keys.Replace((int32_t)itemIndex, contentKey);
+
+	++_textureCount;
+	_texelCount += width * height;
+
+	rect = item.rect;
+	return true;
+}
+
+_Use_decl_annotations_
+TextureAtlasRect TextureAtlasPacker::Insert(
+	uint64_t contentKey,
+	uint32_t width,
+	uint32_t height,
+	uint32_t& evictedCount)
+{
+	TextureAtlasRect rect;
+
+	if (TryInsert(contentKey, width, height, rect, evictedCount))
+	{
+		return rect;
+	}
+
+	/* Everything was used in this frame. */
+	evictedCount += _textureCount;
+	Reset();
+	++_resetCount;
+
+	uint32_t resetEvictedCount = 0;
+	const bool isInserted = TryInsert(contentKey, width, height, rect, resetEvictedCount);
+	assert(isInserted && !resetEvictedCount);
+	return rect;
+}
+
+void TextureAtlasPacker::OnNewFrame()
+{
+	++_frame;
+}
+
+_Use_decl_annotations_
+void TextureAtlasPacker::SetSliceCount(
+	uint32_t sliceCount)
+{
+	assert(sliceCount > 0 && sliceCount <= 65536);
+
+	for (uint32_t i = sliceCount * _sliceUnits; i < _sliceCount * _sliceUnits; ++i)
+	{
+		if (_rowShelves.items[i])
+		{
+			EvictShelf(_rowShelves.items[i] - 1);
+		}
+	}
+
+	/* The kept shelves and items may have any index, so the pools only ever grow. */
+	const uint32_t maxShelfCount = sliceCount * _sliceUnits;
+	const uint32_t maxItemCount = max(sliceCount, maxShelfCount * _sliceUnits / 8);
+
+	if (maxShelfCount > _shelves.capacity)
+	{
+		const uint32_t oldShelfCount = _shelves.capacity;
+
+		_shelves.Resize(maxShelfCount, Shelf{});
+		_freeShelves.Resize(maxShelfCount, 0);
+
+		for (int32_t i = 0; i < ARRAYSIZE(_openShelves); ++i)
+		{
+			_openShelves[i].Resize(maxShelfCount, 0);
+		}
+
+		for (uint32_t i = oldShelfCount; i < maxShelfCount; ++i)
+		{
+			_freeShelves.items[_freeShelfCount++] = i;
+		}
+	}
+
+	if (maxItemCount > _items.capacity)
+	{
+		const uint32_t oldItemCount = _items.capacity;
+
+		_items.Resize(maxItemCount, Item{});
+		_freeItems.Resize(maxItemCount, 0);
+		_keys.Resize(maxItemCount);
+
+		for (uint32_t i = oldItemCount; i < maxItemCount; ++i)
+		{
+			_freeItems.items[_freeItemCount++] = i;
+		}
+	}
+
+	_sliceRowMasks.Resize(sliceCount, _emptyMask);
+	_rowShelves.Resize(maxShelfCount, 0);
+	_sliceCount = sliceCount;
+}
+
+_Use_decl_annotations_
+bool TextureAtlasPacker::TryAllocate(
+	uint32_t widthUnits,
+	uint32_t heightUnits,
+	uint32_t& shelfIndex,
+	uint32_t& x)
+{
+	/* Fill the shelves of the right height first. */
+	const uint32_t heightLog2 = GetLog2(heightUnits);
+	const Buffer<uint32_t>& openShelves = _openShelves[heightLog2];
+
+	for (uint32_t i = 0; i < _openShelfCounts[heightLog2]; ++i)
+	{
+		/* A shelf that fills up leaves the list, so take its index first. */
+		const uint32_t openShelfIndex = openShelves.items[i];
+
+		if (TryAllocateInShelf(openShelfIndex, widthUnits, x))
+		{
+			shelfIndex = openShelfIndex;
+			return true;
+		}
+	}
+
+	/* Then open a new shelf in the first slice with room for it, keeping the used slices
+	   (and so the allocated atlas memory) at the start. */
+	const uint32_t shelfMask = MakeMask(heightUnits, 0);
+
+	for (uint32_t slice = 0; slice < _sliceCount; ++slice)
+	{
+		const uint32_t rowMask = _sliceRowMasks.items[slice];
+
+		if (rowMask == _fullMask)
+		{
+			continue;
+		}
+
+		for (uint32_t y = 0; y < _sliceUnits; y += heightUnits)
+		{
+			if (!(rowMask & (shelfMask << y)))
+			{
+				shelfIndex = OpenShelf(slice, y, heightUnits);
+
+				const bool isAllocated = TryAllocateInShelf(shelfIndex, widthUnits, x);
+				assert(isAllocated);
+				return isAllocated;
+			}
+		}
+	}
+
+	return false;
+}
+
+_Use_decl_annotations_
+bool TextureAtlasPacker::TryAllocateInShelf(
+	uint32_t shelfIndex,
+	uint32_t widthUnits,
+	uint32_t& x)
+{
+	Shelf& shelf = _shelves.items[shelfIndex];
+	const uint32_t textureMask = MakeMask(widthUnits, 0);
+
+	for (uint32_t position = 0; position < _sliceUnits; position += widthUnits)
+	{
+		if (!(shelf.columnMask & (textureMask << position)))
+		{
+			shelf.columnMask |= textureMask << position;
+
+			if (shelf.columnMask == _fullMask)
+			{
+				RemoveFromOpenList(shelfIndex);
+			}
+
+			x = position;
+			return true;
+		}
+	}
+
+	return false;
+}
+
+_Use_decl_annotations_
+uint32_t TextureAtlasPacker::OpenShelf(
+	uint32_t slice,
+	uint32_t y,
+	uint32_t heightUnits)
+{
+	assert(_freeShelfCount > 0);
+	const uint32_t shelfIndex = _freeShelves.items[--_freeShelfCount];
+
+	Shelf& shelf = _shelves.items[shelfIndex];
+	shelf.columnMask = _emptyMask;
+	shelf.lastUsedFrame = _frame;
+	shelf.firstItem = NoItem;
+	shelf.openListPosition = -1;
+	shelf.slice = (uint16_t)slice;
+	shelf.y = (uint8_t)y;
+	shelf.height = (uint8_t)heightUnits;
+
+	if (_sliceRowMasks.items[slice] == _emptyMask)
+	{
+		++_usedSliceCount;
+	}
+
+	_sliceRowMasks.items[slice] |= MakeMask(heightUnits, y);
+
+	for (uint32_t row = y; row < y + heightUnits; ++row)
+	{
+		_rowShelves.items[slice * _sliceUnits + row] = shelfIndex + 1;
+	}
+
+	_shelfTexelCount += _sliceUnits * heightUnits * TexelsPerUnit * TexelsPerUnit;
+
+	AddToOpenList(shelfIndex);
+	return shelfIndex;
+}
+
+_Use_decl_annotations_
+uint32_t TextureAtlasPacker::EvictShelf(
+	uint32_t shelfIndex)
+{
+	Shelf& shelf = _shelves.items[shelfIndex];
+	uint32_t evictedCount = 0;
+
+	for (uint32_t itemIndex = shelf.firstItem; itemIndex != NoItem; itemIndex = _items.items[itemIndex].nextInShelf)
+	{
+		const Item& item = _items.items[itemIndex];
+		_keys.Replace((int32_t)itemIndex, 0);
+		_texelCount -= item.rect.width * item.rect.height;
+		_freeItems.items[_freeItemCount++] = itemIndex;
+		--_textureCount;
+		++evictedCount;
+	}
+
+	if (shelf.openListPosition >= 0)
+	{
+		RemoveFromOpenList(shelfIndex);
+	}
+
+	_sliceRowMasks.items[shelf.slice] &= ~MakeMask(shelf.height, shelf.y);
+
+	if (_sliceRowMasks.items[shelf.slice] == _emptyMask)
+	{
+		--_usedSliceCount;
+	}
+
+	for (uint32_t row = shelf.y; row < (uint32_t)shelf.y + shelf.height; ++row)
+	{
+		_rowShelves.items[shelf.slice * _sliceUnits + row] = 0;
+	}
+
+	_shelfTexelCount -= _sliceUnits * shelf.height * TexelsPerUnit * TexelsPerUnit;
+	_freeShelves.items[_freeShelfCount++] = shelfIndex;
+
+	return evictedCount;
+}
+
+_Use_decl_annotations_
+bool TextureAtlasPacker::EvictLeastRecentlyUsedBlock(
+	uint32_t heightUnits,
+	uint32_t& evictedCount)
+{
+	/* Find the aligned block of rows, heightUnits high, whose most recently used shelf is
+	   the oldest. Shelves are aligned to their height, so a shelf either lies inside a
+	   block or covers it completely. */
+	uint32_t bestSlice = 0;
+	uint32_t bestY = 0;
+	uint32_t bestLastUsedFrame = 0xFFFFFFFF;
+
+	for (uint32_t slice = 0; slice < _sliceCount && bestLastUsedFrame > 0; ++slice)
+	{
+		const uint32_t* rowShelves = &_rowShelves.items[slice * _sliceUnits];
+
+		for (uint32_t y = 0; y < _sliceUnits; y += heightUnits)
+		{
+			uint32_t lastUsedFrame = 0;
+
+			for (uint32_t row = y; row < y + heightUnits; ++row)
+			{
+				if (rowShelves[row])
+				{
+					lastUsedFrame = max(lastUsedFrame, _shelves.items[rowShelves[row] - 1].lastUsedFrame);
+				}
+			}
+
+			if (lastUsedFrame < bestLastUsedFrame)
+			{
+				bestSlice = slice;
+				bestY = y;
+				bestLastUsedFrame = lastUsedFrame;
+			}
+		}
+	}
+
+	if (bestLastUsedFrame >= _frame)
+	{
+		return false;
+	}
+
+	for (uint32_t row = bestY; row < bestY + heightUnits; ++row)
+	{
+		const uint32_t shelf = _rowShelves.items[bestSlice * _sliceUnits + row];
+
+		if (shelf)
+		{
+			evictedCount += EvictShelf(shelf - 1);
+		}
+	}
+
+	return true;
+}
+
+_Use_decl_annotations_
+bool TextureAtlasPacker::EvictLeastRecentlyUsedShelf(
+	uint32_t& evictedCount)
+{
+	uint32_t bestShelf = NoItem;
+
+	for (uint32_t i = 0; i < _sliceCount * _sliceUnits; ++i)
+	{
+		const uint32_t shelf = _rowShelves.items[i];
+
+		if (shelf && _shelves.items[shelf - 1].firstItem != NoItem &&
+			(bestShelf == NoItem || _shelves.items[shelf - 1].lastUsedFrame < _shelves.items[bestShelf].lastUsedFrame))
+		{
+			bestShelf = shelf - 1;
+		}
+	}
+
+	if (bestShelf == NoItem || _shelves.items[bestShelf].lastUsedFrame >= _frame)
+	{
+		return false;
+	}
+
+	evictedCount += EvictShelf(bestShelf);
+	return true;
+}
+
+_Use_decl_annotations_
+void TextureAtlasPacker::AddToOpenList(
+	uint32_t shelfIndex)
+{
+	Shelf& shelf = _shelves.items[shelfIndex];
+	const uint32_t heightLog2 = GetLog2(shelf.height);
+
+	assert(shelf.openListPosition < 0);
+	shelf.openListPosition = (int32_t)_openShelfCounts[heightLog2];
+	_openShelves[heightLog2].items[_openShelfCounts[heightLog2]++] = shelfIndex;
+}
+
+_Use_decl_annotations_
+void TextureAtlasPacker::RemoveFromOpenList(
+	uint32_t shelfIndex)
+{
+	Shelf& shelf = _shelves.items[shelfIndex];
+	const uint32_t heightLog2 = GetLog2(shelf.height);
+	Buffer<uint32_t>& openShelves = _openShelves[heightLog2];
+
+	assert(shelf.openListPosition >= 0);
+	const uint32_t lastShelfIndex = openShelves.items[--_openShelfCounts[heightLog2]];
+	openShelves.items[shelf.openListPosition] = lastShelfIndex;
+	_shelves.items[lastShelfIndex].openListPosition = shelf.openListPosition;
+	shelf.openListPosition = -1;
+}
+
+void TextureAtlasPacker::Reset()
+{
+	for (uint32_t slice = 0; slice < _sliceCount; ++slice)
+	{
+		_sliceRowMasks.items[slice] = _emptyMask;
+	}
+
+	memset(_rowShelves.items, 0, sizeof(uint32_t) * _rowShelves.capacity);
+
+	_freeShelfCount = _freeShelves.capacity;
+
+	for (uint32_t i = 0; i < _freeShelfCount; ++i)
+	{
+		_freeShelves.items[i] = _freeShelfCount - 1 - i;
+	}
+
+	for (int32_t i = 0; i < ARRAYSIZE(_openShelfCounts); ++i)
+	{
+		_openShelfCounts[i] = 0;
+	}
+
+	_freeItemCount = _freeItems.capacity;
+
+	for (uint32_t i = 0; i < _freeItemCount; ++i)
+	{
+		_freeItems.items[i] = _freeItemCount - 1 - i;
+	}
+
+	_keys = TextureCacheKeyIndex(_items.capacity);
+
+	_textureCount = 0;
+	_usedSliceCount = 0;
+	_texelCount = 0;
+	_shelfTexelCount = 0;
+}
+
+_Use_decl_annotations_
+uint32_t TextureAtlasPacker::GetLog2(
+	uint32_t units)
+{
+	DWORD log2 = 0;
+	BitScanReverse(&log2, units);
+	return log2;
+}
+
+_Use_decl_annotations_
+uint32_t TextureAtlasPacker::MakeMask(
+	uint32_t units,
+	uint32_t position)
+{
+	return (units >= 32 ? 0xFFFFFFFF : ((1U << units) - 1)) << position;
+}
@@ -0,0 +1,184 @@
+/*
+	This file is part of D2DX.
+
+	Copyright (C) 2021  Bolrog
+
+	D2DX is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	D2DX is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with D2DX.  If not, see <https://www.gnu.org/licenses/>.
+*/
+#pragma once
+
+#include "Buffer.h"
+#include "TextureCacheKeyIndex.h"
+
+namespace d2dx
+{
+	struct TextureAtlasRect final
+	{
+		uint16_t slice;
+		uint16_t x;
+		uint16_t y;
+		uint16_t width;
+		uint16_t height;
+	};
+
+	/* Packs textures of different shapes into the square slices of a texture atlas, so that
+	   e.g. sixteen 16x256 sprites share one 256x256 slice instead of taking one each.
+
+	   Each slice is divided into shelves: horizontal strips as tall as the textures they
+	   hold. Sizes are rounded up to powers of two in units of 8 texels, and both shelves
+	   (within a slice) and textures (within a shelf) are aligned to their size, which keeps
+	   fragmentation low and makes every free/used test a bit mask operation. A slice is at
+	   most 256 texels, so the rows of a slice and the columns of a shelf fit in 32 bits.
+
+	   When there is no room, whole shelves are evicted: the aligned block of rows whose
+	   shelves were least recently used. Like the cache policies, it never evicts a texture
+	   used in the current frame. If only such textures could make room, TryInsert fails so
+	   that the caller can put the texture elsewhere, and Insert starts over and counts a
+	   reset. */
+	class TextureAtlasPacker final
+	{
+	public:
+		TextureAtlasPacker(
+			_In_ uint32_t sliceSize,
+			_In_ uint32_t sliceCount);
+
+		~TextureAtlasPacker() noexcept {}
+
+		/* Looks up a texture and marks it as used in this frame. */
+		bool Find(
+			_In_ uint64_t contentKey,
+			_Out_ TextureAtlasRect& rect);
+
+		/* Places a texture that isn't in the atlas, evicting others not used in this frame if
+		   needed. Returns false if that doesn't make room. */
+		bool TryInsert(
+			_In_ uint64_t contentKey,
+			_In_ uint32_t width,
+			_In_ uint32_t height,
+			_Out_ TextureAtlasRect& rect,
+			_Out_ uint32_t& evictedCount);
+
+		/* Places a texture that isn't in the atlas, evicting others if needed. */
+		TextureAtlasRect Insert(
+			_In_ uint64_t contentKey,
+			_In_ uint32_t width,
+			_In_ uint32_t height,
+			_Out_ uint32_t& evictedCount);
+
+		void OnNewFrame();
+
+		/* Changes the number of slices, keeping the textures in the slices below the new
+		   count. */
+		void SetSliceCount(
+			_In_ uint32_t sliceCount);
+
+		uint32_t GetTextureCount() const { return _textureCount; }
+
+		uint32_t GetUsedSliceCount() const { return _usedSliceCount; }
+
+		uint32_t GetResetCount() const { return _resetCount; }
+
+		/* The texels of the packed textures, and of the shelves that hold them. The ratio is
+		   the packing efficiency. */
+		uint64_t GetTexelCount() const { return _texelCount; }
+
+		uint64_t GetShelfTexelCount() const { return _shelfTexelCount; }
+
+	private:
+		struct Shelf final
+		{
+			uint32_t columnMask;
+			uint32_t lastUsedFrame;
+			uint32_t firstItem;
+			int32_t openListPosition;
+			uint16_t slice;
+			uint8_t y;
+			uint8_t height;
+		};
+
+		struct Item final
+		{
+			TextureAtlasRect rect;
+			uint32_t shelf;
+			uint32_t nextInShelf;
+		};
+
+		bool TryAllocate(
+			_In_ uint32_t widthUnits,
+			_In_ uint32_t heightUnits,
+			_Out_ uint32_t& shelfIndex,
+			_Out_ uint32_t& x);
+
+		bool TryAllocateInShelf(
+			_In_ uint32_t shelfIndex,
+			_In_ uint32_t widthUnits,
+			_Out_ uint32_t& x);
+
+		uint32_t OpenShelf(
+			_In_ uint32_t slice,
+			_In_ uint32_t y,
+			_In_ uint32_t heightUnits);
+
+		uint32_t EvictShelf(
+			_In_ uint32_t shelfIndex);
+
+		/* These return false, evicting nothing, if everything was used in this frame. */
+		bool EvictLeastRecentlyUsedBlock(
+			_In_ uint32_t heightUnits,
+			_Inout_ uint32_t& evictedCount);
+
+		bool EvictLeastRecentlyUsedShelf(
+			_Inout_ uint32_t& evictedCount);
+
+		void AddToOpenList(
+			_In_ uint32_t shelfIndex);
+
+		void RemoveFromOpenList(
+			_In_ uint32_t shelfIndex);
+
+		void Reset();
+
+		static uint32_t GetLog2(
+			_In_ uint32_t units);
+
+		static uint32_t MakeMask(
+			_In_ uint32_t units,
+			_In_ uint32_t position);
+
+		uint32_t _sliceCount = 0;
+		uint32_t _sliceUnits = 0;
+		uint32_t _fullMask = 0;
+		uint32_t _emptyMask = 0;
+		uint32_t _frame = 1;
+
+		Buffer<uint32_t> _sliceRowMasks;
+		Buffer<uint32_t> _rowShelves;
+		Buffer<Shelf> _shelves;
+		Buffer<uint32_t> _freeShelves;
+		uint32_t _freeShelfCount = 0;
+		Buffer<uint32_t> _openShelves[6];
+		uint32_t _openShelfCounts[6] = { 0 };
+
+		Buffer<Item> _items;
+		Buffer<uint32_t> _freeItems;
+		uint32_t _freeItemCount = 0;
+		TextureCacheKeyIndex _keys;
+
+		uint32_t _textureCount = 0;
+		uint32_t _usedSliceCount = 0;
+		uint32_t _resetCount = 0;
+		uint64_t _texelCount = 0;
+		uint64_t _shelfTexelCount = 0;
+	};
+}
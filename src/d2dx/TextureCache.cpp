@@ -18,6 +18,7 @@
 */
 #include "pch.h"
 #include "D2DXContext.h"
+#include "Profiler.h"
 #include "Utils.h"
 #include "TextureCache.h"
 #include "TextureCachePolicyBitPmru.h"
@@ -31,46 +32,112 @@ TextureCache::TextureCache(
 	int32_t height,
 	uint32_t capacity,
 	uint32_t texturesPerAtlas,
+	bool isPacked,
+	TextureUploadQueue* uploadQueue,
 	ID3D11Device* device)
 {
-	assert(_atlasCount <= 4);
+	assert(capacity <= texturesPerAtlas * 4);
+	assert(!isPacked || width == height);
 
 	_width = width;
 	_height = height;
 	_capacity = capacity;
 	_texturesPerAtlas = texturesPerAtlas;
-	_atlasCount = (int32_t)max(1, capacity / texturesPerAtlas);
-	_policy = TextureCachePolicyBitPmru(capacity);
+	_isPacked = isPacked;
+	_uploadQueue = uploadQueue;
+
+	if (isPacked)
+	{
+		_packer = std::make_unique<TextureAtlasPacker>(_width, _capacity);
+		_overflowPacker = std::make_unique<TextureAtlasPacker>(_width, PackedOverflowCapacity);
+	}
+	else
+	{
+		_policy = std::make_unique<TextureCachePolicyBitPmru>(_capacity);
+		_slotTexelCounts = Buffer<uint32_t>(_capacity, true);
+		_overflowKeys = TextureCacheKeyIndex(OverflowCapacity);
+	}
 
 #ifndef D2DX_UNITTEST
+	/* The atlases are created when the policy first hands out a slot in them. */
+	_device = device;
+	device->GetImmediateContext(&_deviceContext);
+	assert(_deviceContext);
+#endif
+}
+
+uint32_t TextureCache::GetMemoryFootprint() const
+{
+	uint32_t sliceCount = 0;
+
+	for (int32_t atlasIndex = 0; atlasIndex < ARRAYSIZE(_atlasSliceCounts); ++atlasIndex)
+	{
+		sliceCount += _atlasSliceCounts[atlasIndex];
+	}
+
+	return _width * _height * sliceCount;
+}
+
+_Use_decl_annotations_
+uint32_t TextureCache::GetRequiredSliceCount(
+	uint32_t atlasIndex) const
+{
+	if (atlasIndex == OverflowAtlasIndex)
+	{
+		return _packer ? PackedOverflowCapacity : OverflowCapacity;
+	}
+
+	const uint32_t firstIndex = atlasIndex * _texturesPerAtlas;
+	return firstIndex < _capacity ? min(_texturesPerAtlas, _capacity - firstIndex) : 0;
+}
+
+_Use_decl_annotations_
+void TextureCache::CreateAtlas(
+	uint32_t atlasIndex)
+{
+	assert(atlasIndex < ARRAYSIZE(_atlasSliceCounts));
+
+	const uint32_t sliceCount = GetRequiredSliceCount(atlasIndex);
+	assert(sliceCount > 0 && sliceCount != _atlasSliceCounts[atlasIndex]);
 
+#ifndef D2DX_UNITTEST
 	CD3D11_TEXTURE2D_DESC desc
 	{
 		DXGI_FORMAT_R8_UINT,
-		(UINT)width,
-		(UINT)height,
-		_texturesPerAtlas,
+		(UINT)_width,
+		(UINT)_height,
+		sliceCount,
 		1U,
 		D3D11_BIND_SHADER_RESOURCE,
 		D3D11_USAGE_DEFAULT
 	};
 
-	uint32_t capacityPerPartition = _capacity;
+	ComPtr<ID3D11Texture2D> texture;
+	D2DX_CHECK_HR(_device->CreateTexture2D(&desc, nullptr, &texture));
+
+	const uint32_t copiedSliceCount = min(sliceCount, _atlasSliceCounts[atlasIndex]);
 
-	for (int32_t partition = 0; partition < 4; ++partition)
+	for (uint32_t slice = 0; slice < copiedSliceCount; ++slice)
 	{
-		D2DX_CHECK_HR(device->CreateTexture2D(&desc, nullptr, &_textures[partition]));
-		D2DX_CHECK_HR(device->CreateShaderResourceView(_textures[partition].Get(), NULL, _srvs[partition].GetAddressOf()));
+		const UINT subresource = D3D11CalcSubresource(0, slice, 1);
+		_deviceContext->CopySubresourceRegion(texture.Get(), subresource, 0, 0, 0, _textures[atlasIndex].Get(), subresource, nullptr);
 	}
 
-	device->GetImmediateContext(&_deviceContext);
-	assert(_deviceContext);
+	_textures[atlasIndex] = texture;
+	_srvs[atlasIndex] = nullptr;
+	D2DX_CHECK_HR(_device->CreateShaderResourceView(_textures[atlasIndex].Get(), NULL, _srvs[atlasIndex].GetAddressOf()));
 #endif
-}
 
-uint32_t TextureCache::GetMemoryFootprint() const
-{
-	return _width * _height * _texturesPerAtlas * _atlasCount;
+	if (_atlasSliceCounts[atlasIndex])
+	{
+		D2DX_DEBUG_LOG("Resized %ix%i texture atlas %u from %u to %u slices.", _width, _height, atlasIndex, _atlasSliceCounts[atlasIndex], sliceCount);
+	}
+	else
+	{
+		D2DX_DEBUG_LOG("Created %ix%i texture atlas %u with %u slices.", _width, _height, atlasIndex, sliceCount);
+	}
+
+	_atlasSliceCounts[atlasIndex] = sliceCount;
 }
 
 _Use_decl_annotations_
@@ -78,16 +145,85 @@ TextureCacheLocation TextureCache::FindTexture(
 	uint64_t contentKey,
 	int32_t lastIndex)
 {
-	const int32_t index = _policy.Find(contentKey, lastIndex);
+	if (_packer)
+	{
+		TextureAtlasRect rect;
+
+		if (!_packer->Find(contentKey, rect))
+		{
+			if (_atlasSliceCounts[OverflowAtlasIndex] && _overflowPacker->Find(contentKey, rect))
+			{
+				return { (int16_t)OverflowAtlasIndex, (int16_t)rect.slice, (uint8_t)rect.x, (uint8_t)rect.y };
+			}
+
+			return { -1, -1 };
+		}
+
+		return { (int16_t)(rect.slice / _texturesPerAtlas), (int16_t)(rect.slice & (_texturesPerAtlas - 1)), (uint8_t)rect.x, (uint8_t)rect.y };
+	}
+
+	const int32_t index = _policy->Find(contentKey, lastIndex);
 
 	if (index < 0)
 	{
-		return { -1, -1 };
+		return FindOverflowTexture(contentKey);
 	}
 
 	return { (int16_t)(index / _texturesPerAtlas), (int16_t)(index & (_texturesPerAtlas - 1)) };
 }
 
+_Use_decl_annotations_
+TextureCacheLocation TextureCache::FindOverflowTexture(
+	uint64_t contentKey)
+{
+	if (!_atlasSliceCounts[OverflowAtlasIndex])
+	{
+		return { -1, -1 };
+	}
+
+	const int32_t index = _overflowKeys.Find(contentKey);
+
+	if (index < 0)
+	{
+		return { -1, -1 };
+	}
+
+	_overflowUsedInFrameBits |= 1ull << index;
+	return { (int16_t)OverflowAtlasIndex, (int16_t)index };
+}
+
+_Use_decl_annotations_
+bool TextureCache::InsertOverflowTexture(
+	uint64_t contentKey,
+	uint32_t& index)
+{
+	static_assert(OverflowCapacity == 64, "The overflow slots are tracked in a 64-bit mask.");
+
+	if (_overflowUsedInFrameBits == ~0ull)
+	{
+		index = 0;
+		return false;
+	}
+
+	/* Take the overflow slots in turn, skipping those used in this frame. */
+	while (_overflowUsedInFrameBits & (1ull << _nextOverflowIndex))
+	{
+		_nextOverflowIndex = (_nextOverflowIndex + 1) & (OverflowCapacity - 1);
+	}
+
+	index = _nextOverflowIndex;
+	_nextOverflowIndex = (_nextOverflowIndex + 1) & (OverflowCapacity - 1);
+	_overflowUsedInFrameBits |= 1ull << index;
+
+	if (_overflowKeys.Replace((int32_t)index, contentKey))
+	{
+		++_evictionCount;
+	}
+
+	++_overflowCount;
+	return true;
+}
+
 _Use_decl_annotations_
 TextureCacheLocation TextureCache::InsertTexture(
 	uint64_t contentKey,
@@ -97,42 +233,130 @@ TextureCacheLocation TextureCache::InsertTexture(
 {
 	assert(batch.IsValid() && batch.GetTextureWidth() > 0 && batch.GetTextureHeight() > 0);
 
-	bool evicted = false;
-	int32_t replacementIndex = _policy.Insert(contentKey, evicted);
+	const uint32_t textureWidth = batch.GetTextureWidth();
+	const uint32_t textureHeight = batch.GetTextureHeight();
+
+	uint32_t atlasIndex = 0;
+	uint32_t subresource = 0;
+	TextureAtlasRect rect = { 0, 0, 0, (uint16_t)textureWidth, (uint16_t)textureHeight };
 
-	if (evicted)
+	if (_packer)
 	{
-		D2DX_DEBUG_LOG("Evicted %ix%i texture %i from cache.", batch.GetTextureWidth(), batch.GetTextureHeight(), replacementIndex);
+		uint32_t evictedCount = 0;
+
+		if (_packer->TryInsert(contentKey, textureWidth, textureHeight, rect, evictedCount))
+		{
+			atlasIndex = rect.slice / _texturesPerAtlas;
+			subresource = rect.slice & (_texturesPerAtlas - 1);
+		}
+		else
+		{
+			/* Room could only be made by evicting textures used in this frame. */
+			uint32_t overflowEvictedCount = 0;
+
+			if (_overflowPacker->TryInsert(contentKey, textureWidth, textureHeight, rect, overflowEvictedCount))
+			{
+				atlasIndex = OverflowAtlasIndex;
+				subresource = rect.slice;
+				++_overflowCount;
+				D2DX_DEBUG_LOG("No room for %ix%i texture in packed cache in this frame, storing it in overflow slice %u.", textureWidth, textureHeight, subresource);
+			}
+			else
+			{
+				uint32_t resetEvictedCount = 0;
+				rect = _packer->Insert(contentKey, textureWidth, textureHeight, resetEvictedCount);
+				atlasIndex = rect.slice / _texturesPerAtlas;
+				subresource = rect.slice & (_texturesPerAtlas - 1);
+				evictedCount += resetEvictedCount;
+			}
+
+			evictedCount += overflowEvictedCount;
+		}
+
+		if (evictedCount)
+		{
+			_evictionCount += evictedCount;
+			D2DX_DEBUG_LOG("Evicted %u textures from packed cache to make room for %ix%i texture.", evictedCount, textureWidth, textureHeight);
+		}
 	}
+	else if (_policy->GetUsedInFrameCount() >= _capacity && InsertOverflowTexture(contentKey, subresource))
+	{
+		atlasIndex = OverflowAtlasIndex;
+		D2DX_DEBUG_LOG("All %ix%i texture cache slots used in this frame, storing texture in overflow slot %u.", _width, _height, subresource);
+	}
+	else
+	{
+		bool evicted = false;
+		const int32_t replacementIndex = _policy->Insert(contentKey, evicted);
 
-#ifndef D2DX_UNITTEST
-	CD3D11_BOX box;
-	box.left = 0;
-	box.top = 0;
-	box.right = batch.GetTextureWidth();
-	box.bottom = batch.GetTextureHeight();
-	box.front = 0;
-	box.back = 1;
+		if (evicted)
+		{
+			++_evictionCount;
+			D2DX_DEBUG_LOG("Evicted %ix%i texture %i from cache.", textureWidth, textureHeight, replacementIndex);
+		}
+
+		_texelCount -= _slotTexelCounts.items[replacementIndex];
+		_slotTexelCounts.items[replacementIndex] = textureWidth * textureHeight;
+		_texelCount += _slotTexelCounts.items[replacementIndex];
+
+		atlasIndex = replacementIndex / _texturesPerAtlas;
+		subresource = replacementIndex & (_texturesPerAtlas - 1);
+	}
+
+	if (!_atlasSliceCounts[atlasIndex])
+	{
+		CreateAtlas(atlasIndex);
+	}
 
 	const uint8_t* pData = tmuData + batch.GetTextureStartAddress();
 
-	_deviceContext->UpdateSubresource(_textures[replacementIndex / _texturesPerAtlas].Get(), replacementIndex & (_texturesPerAtlas - 1), &box, pData, batch.GetTextureWidth(), 0);
+	/* Without a queue, or when this frame's upload budget is used up, upload immediately. */
+	if (!_uploadQueue || !_uploadQueue->Enqueue(_textures[atlasIndex].Get(), subresource, rect.x, rect.y, textureWidth, textureHeight, pData))
+	{
+		/* A queued upload may be for the texture that was evicted from this slot, so it must
+		   not land after this one. */
+		if (_uploadQueue)
+		{
+			_uploadQueue->Flush(_deviceContext.Get());
+		}
+
+#ifndef D2DX_UNITTEST
+		CD3D11_BOX box;
+		box.left = rect.x;
+		box.top = rect.y;
+		box.right = rect.x + textureWidth;
+		box.bottom = rect.y + textureHeight;
+		box.front = 0;
+		box.back = 1;
+
+		_deviceContext->UpdateSubresource(_textures[atlasIndex].Get(), subresource, &box, pData, textureWidth, 0);
 #endif
+		AddTexUpload(textureWidth * textureHeight);
+	}
 
-	return { (int16_t)(replacementIndex / _texturesPerAtlas), (int16_t)(replacementIndex & (_texturesPerAtlas - 1)) };
+	return { (int16_t)atlasIndex, (int16_t)subresource, (uint8_t)rect.x, (uint8_t)rect.y };
 }
 
 _Use_decl_annotations_
 ID3D11ShaderResourceView* TextureCache::GetSrv(
 	uint32_t textureAtlas) const
 {
-	assert(textureAtlas >= 0 && textureAtlas < (uint32_t)_atlasCount);
+	assert(textureAtlas < ARRAYSIZE(_atlasSliceCounts) && _atlasSliceCounts[textureAtlas] > 0);
 	return _srvs[textureAtlas].Get();
 }
 
 void TextureCache::OnNewFrame()
 {
-	_policy.OnNewFrame();
+	if (_packer)
+	{
+		_packer->OnNewFrame();
+		_overflowPacker->OnNewFrame();
+	}
+	else
+	{
+		_policy->OnNewFrame();
+		_overflowUsedInFrameBits = 0;
+	}
 }
 
 _Use_decl_annotations_
@@ -163,5 +387,88 @@ void TextureCache::CopyPixels(
 
 uint32_t TextureCache::GetUsedCount() const
 {
-	return _policy.GetUsedCount();
+	return _packer ? _packer->GetUsedSliceCount() : _policy->GetUsedCount();
+}
+
+uint32_t TextureCache::GetResetCount() const
+{
+	return _packer ? _packer->GetResetCount() : _policy->GetResetCount();
+}
+
+uint32_t TextureCache::GetEvictionCount() const
+{
+	return _evictionCount;
+}
+
+uint32_t TextureCache::GetCapacity() const
+{
+	return _capacity;
+}
+
+_Use_decl_annotations_
+void TextureCache::SetCapacity(
+	uint32_t capacity)
+{
+	assert(capacity <= _texturesPerAtlas * 4);
+
+	if (capacity == _capacity)
+	{
+		return;
+	}
+
+	/* Only the textures in the slots that are given away are lost; locations that callers
+	   have remembered for the others stay valid. */
+	if (_packer)
+	{
+		_packer->SetSliceCount(capacity);
+	}
+	else
+	{
+		_policy->SetCapacity(capacity);
+
+		for (uint32_t i = capacity; i < _capacity; ++i)
+		{
+			_texelCount -= _slotTexelCounts.items[i];
+		}
+
+		_slotTexelCounts.Resize(capacity, 0);
+	}
+
+	_capacity = capacity;
+
+	/* Resize the atlases that exist but no longer have the right number of slices. The
+	   others are created when the policy first hands out a slot in them. */
+	for (uint32_t atlasIndex = 0; atlasIndex < OverflowAtlasIndex; ++atlasIndex)
+	{
+		if (!_atlasSliceCounts[atlasIndex] || _atlasSliceCounts[atlasIndex] == GetRequiredSliceCount(atlasIndex))
+		{
+			continue;
+		}
+
+		if (GetRequiredSliceCount(atlasIndex))
+		{
+			CreateAtlas(atlasIndex);
+		}
+		else
+		{
+			_srvs[atlasIndex] = nullptr;
+			_textures[atlasIndex] = nullptr;
+			_atlasSliceCounts[atlasIndex] = 0;
+		}
+	}
+}
+
+uint64_t TextureCache::GetTexelCount() const
+{
+	return _packer ? _packer->GetTexelCount() : _texelCount;
+}
+
+uint32_t TextureCache::GetOverflowCount() const
+{
+	return _overflowCount;
+}
+
+uint64_t TextureCache::GetReservedTexelCount() const
+{
+	return _packer ? _packer->GetShelfTexelCount() : (uint64_t)_policy->GetUsedCount() * _width * _height;
 }
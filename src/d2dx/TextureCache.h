@@ -18,11 +18,28 @@
 */
 #pragma once
 
+#include "Buffer.h"
 #include "ITextureCache.h"
-#include "TextureCachePolicyBitPmru.h"
+#include "ITextureCachePolicy.h"
+#include "TextureAtlasPacker.h"
+#include "TextureCacheKeyIndex.h"
+#include "TextureUploadQueue.h"
 
 namespace d2dx
 {
+	/* Holds textures of one size class in up to four atlases (texture arrays). Normally
+	   every texture gets a slice of its own, chosen by the cache policy. A packed cache
+	   instead lets a TextureAtlasPacker place textures of any shape up to width x height
+	   side by side in the slices; its capacity counts slices.
+
+	   When every slot has been used in the current frame, new textures spill into a small
+	   overflow atlas instead of evicting textures that the frame's batches still refer to.
+	   A packed cache does the same when its packer can't make room without evicting such
+	   textures, packing them into the overflow atlas with a packer of its own. Only when
+	   that is full as well does the cache start over.
+
+	   Given an upload queue, new textures are staged there and uploaded when the queue is
+	   flushed, which must happen before the frame is drawn. */
 	class TextureCache final : public ITextureCache
 	{
 	public:
@@ -31,6 +48,8 @@ namespace d2dx
 			_In_ int32_t height,
 			_In_ uint32_t capacity,
 			_In_ uint32_t texturesPerAtlas,
+			_In_ bool isPacked,
+			_In_opt_ TextureUploadQueue* uploadQueue,
 			_In_ ID3D11Device* device);
 
 		virtual ~TextureCache() noexcept {}
@@ -54,7 +73,41 @@ namespace d2dx
 
 		virtual uint32_t GetUsedCount() const override;
 
+		virtual uint32_t GetResetCount() const override;
+
+		virtual uint32_t GetEvictionCount() const override;
+
+		virtual uint32_t GetCapacity() const override;
+
+		virtual void SetCapacity(
+			_In_ uint32_t capacity) override;
+
+		virtual uint64_t GetTexelCount() const override;
+
+		virtual uint64_t GetReservedTexelCount() const override;
+
+		virtual uint32_t GetOverflowCount() const override;
+
 	private:
+		static constexpr uint32_t OverflowAtlasIndex = 4;
+		static constexpr uint32_t OverflowCapacity = 64;
+		static constexpr uint32_t PackedOverflowCapacity = 16;
+
+		TextureCacheLocation FindOverflowTexture(
+			_In_ uint64_t contentKey);
+
+		bool InsertOverflowTexture(
+			_In_ uint64_t contentKey,
+			_Out_ uint32_t& index);
+
+		uint32_t GetRequiredSliceCount(
+			_In_ uint32_t atlasIndex) const;
+
+		/* Creates the atlas with the slice count it needs for the current capacity. If it
+		   already exists with another slice count, the slices they share are copied over. */
+		void CreateAtlas(
+			_In_ uint32_t atlasIndex);
+
 		void CopyPixels(
 			_In_ int32_t srcWidth,
 			_In_ int32_t srcHeight,
@@ -67,10 +120,22 @@ namespace d2dx
 		int32_t _height = 0;
 		uint32_t _capacity = 0;
 		uint32_t _texturesPerAtlas = 0;
-		int32_t _atlasCount = 0;
+		uint32_t _atlasSliceCounts[5] = { 0 };
+		uint32_t _evictionCount = 0;
+		bool _isPacked = false;
+		Buffer<uint32_t> _slotTexelCounts;
+		uint64_t _texelCount = 0;
+		TextureCacheKeyIndex _overflowKeys;
+		uint64_t _overflowUsedInFrameBits = 0;
+		uint32_t _nextOverflowIndex = 0;
+		uint32_t _overflowCount = 0;
+		TextureUploadQueue* _uploadQueue = nullptr;
+		ComPtr<ID3D11Device> _device;
 		ComPtr<ID3D11DeviceContext> _deviceContext;
-		ComPtr<ID3D11Texture2D> _textures[4];
-		ComPtr<ID3D11ShaderResourceView> _srvs[4];
-		TextureCachePolicyBitPmru _policy;
+		ComPtr<ID3D11Texture2D> _textures[5];
+		ComPtr<ID3D11ShaderResourceView> _srvs[5];
+		std::unique_ptr<ITextureCachePolicy> _policy;
+		std::unique_ptr<TextureAtlasPacker> _packer;
+		std::unique_ptr<TextureAtlasPacker> _overflowPacker;
 	};
 }
@@ -0,0 +1,190 @@
+/*
+	This file is part of D2DX.
+
+	Copyright (C) 2021  Bolrog
+
+	D2DX is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	D2DX is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with D2DX.  If not, see <https://www.gnu.org/licenses/>.
+*/
+#include "pch.h"
+#include "TextureCacheBalancer.h"
+
+using namespace d2dx;
+
+static uint32_t RoundUpToGranularity(
+	_In_ uint32_t slotCount)
+{
+	const uint32_t granularity = TextureCacheBalancer::CapacityGranularity;
+	return (slotCount + granularity - 1) / granularity * granularity;
+}
+
+_Use_decl_annotations_
+TextureCacheBalancer::TextureCacheBalancer(
+	const uint32_t* capacities,
+	const uint32_t* textureSizes,
+	uint32_t maxCapacity,
+	uint64_t budget) :
+	_maxCapacity{ maxCapacity / CapacityGranularity * CapacityGranularity }
+{
+	assert(_maxCapacity >= CapacityGranularity);
+
+	for (uint32_t i = 0; i < D2DX_TEXTURE_CACHE_COUNT; ++i)
+	{
+		_capacities[i] = min(_maxCapacity, max(CapacityGranularity, RoundUpToGranularity(capacities[i])));
+		_textureSizes[i] = textureSizes[i];
+	}
+
+	/* The starting capacities are always honored, so the budget is at least their size. */
+	_budget = max(budget, GetTotalSize());
+}
+
+_Use_decl_annotations_
+bool TextureCacheBalancer::OnNewFrame(
+	const uint32_t* evictionCounts,
+	const uint32_t* usedCounts)
+{
+	if (++_frame < RebalancePeriod)
+	{
+		return false;
+	}
+
+	_frame = 0;
+
+	for (uint32_t i = 0; i < D2DX_TEXTURE_CACHE_COUNT; ++i)
+	{
+		_pressures[i] = evictionCounts[i] - _periodStartEvictionCounts[i];
+		_periodStartEvictionCounts[i] = evictionCounts[i];
+	}
+
+	return Rebalance(usedCounts);
+}
+
+_Use_decl_annotations_
+bool TextureCacheBalancer::Rebalance(
+	const uint32_t* usedCounts)
+{
+	/* Grow the cache with the most evictions, unless it evicts less than a slot every four
+	   frames: that much churn is normal and not worth flushing a cache for. */
+	int32_t recipient = -1;
+
+	for (int32_t i = 0; i < D2DX_TEXTURE_CACHE_COUNT; ++i)
+	{
+		if (_capacities[i] < _maxCapacity &&
+			_pressures[i] >= RebalancePeriod / 4 &&
+			(recipient < 0 || _pressures[i] > _pressures[recipient]))
+		{
+			recipient = i;
+		}
+	}
+
+	if (recipient < 0)
+	{
+		return false;
+	}
+
+	const uint32_t recipientTextureSize = _textureSizes[recipient];
+	uint32_t growth = max(CapacityGranularity, _capacities[recipient] / 4 / CapacityGranularity * CapacityGranularity);
+	growth = min(growth, _maxCapacity - _capacities[recipient]);
+
+	const uint64_t totalSize = GetTotalSize();
+	uint64_t freeBudget = _budget > totalSize ? _budget - totalSize : 0;
+
+	int32_t donor = -1;
+	uint32_t shrinkage = 0;
+
+	if ((uint64_t)growth * recipientTextureSize > freeBudget)
+	{
+		/* Only take slots that the donor isn't using, from a cache that evicts at most a
+		   quarter as much as the recipient. Prefer the donor that frees the most memory. */
+		const uint64_t neededSize = (uint64_t)growth * recipientTextureSize - freeBudget;
+		uint64_t donatedSize = 0;
+
+		for (int32_t i = 0; i < D2DX_TEXTURE_CACHE_COUNT; ++i)
+		{
+			if (i == recipient || (uint64_t)_pressures[i] * 4 > _pressures[recipient])
+			{
+				continue;
+			}
+
+			const uint32_t usedCapacity = max(CapacityGranularity, RoundUpToGranularity(usedCounts[i]));
+
+			if (usedCapacity >= _capacities[i])
+			{
+				continue;
+			}
+
+			const uint32_t neededSlots = RoundUpToGranularity((uint32_t)((neededSize + _textureSizes[i] - 1) / _textureSizes[i]));
+			const uint32_t slots = min(_capacities[i] - usedCapacity, neededSlots);
+			const uint64_t size = (uint64_t)slots * _textureSizes[i];
+
+			if (size > donatedSize ||
+				(size == donatedSize && donor >= 0 && _pressures[i] < _pressures[donor]))
+			{
+				donor = i;
+				shrinkage = slots;
+				donatedSize = size;
+			}
+		}
+
+		freeBudget += donatedSize;
+		growth = min(growth, (uint32_t)(freeBudget / recipientTextureSize) / CapacityGranularity * CapacityGranularity);
+
+		if (!growth)
+		{
+			return false;
+		}
+	}
+
+	_capacities[recipient] += growth;
+
+	if (donor >= 0)
+	{
+		_capacities[donor] -= shrinkage;
+	}
+
+	assert(GetTotalSize() <= _budget);
+	return true;
+}
+
+_Use_decl_annotations_
+uint32_t TextureCacheBalancer::GetCapacity(
+	uint32_t cacheIndex) const
+{
+	assert(cacheIndex < D2DX_TEXTURE_CACHE_COUNT);
+	return _capacities[cacheIndex];
+}
+
+_Use_decl_annotations_
+uint32_t TextureCacheBalancer::GetPressure(
+	uint32_t cacheIndex) const
+{
+	assert(cacheIndex < D2DX_TEXTURE_CACHE_COUNT);
+	return _pressures[cacheIndex];
+}
+
+uint64_t TextureCacheBalancer::GetTotalSize() const
+{
+	uint64_t totalSize = 0;
+
+	for (uint32_t i = 0; i < D2DX_TEXTURE_CACHE_COUNT; ++i)
+	{
+		totalSize += (uint64_t)_capacities[i] * _textureSizes[i];
+	}
+
+	return totalSize;
+}
+
+uint64_t TextureCacheBalancer::GetBudget() const
+{
+	return _budget;
+}
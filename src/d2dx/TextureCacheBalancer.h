@@ -0,0 +1,74 @@
+/*
+	This file is part of D2DX.
+
+	Copyright (C) 2021  Bolrog
+
+	D2DX is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	D2DX is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with D2DX.  If not, see <https://www.gnu.org/licenses/>.
+*/
+#pragma once
+
+#include "Types.h"
+
+namespace d2dx
+{
+	/* Moves texture cache slots between size classes at runtime. Each size class has its own
+	   cache, and which one runs out of room first depends on the game and mods: some overflow
+	   the 32x32 cache while the 256x256 one sits mostly empty. Every RebalancePeriod frames,
+	   the cache with the most evictions grows, paid for by free budget or by the unused slots
+	   of a cache with much less eviction pressure. The total size never exceeds the budget. */
+	class TextureCacheBalancer final
+	{
+	public:
+		static const uint32_t RebalancePeriod = 256;
+		static const uint32_t CapacityGranularity = 64;
+
+		TextureCacheBalancer(
+			_In_reads_(D2DX_TEXTURE_CACHE_COUNT) const uint32_t* capacities,
+			_In_reads_(D2DX_TEXTURE_CACHE_COUNT) const uint32_t* textureSizes,
+			_In_ uint32_t maxCapacity,
+			_In_ uint64_t budget);
+
+		~TextureCacheBalancer() noexcept {}
+
+		/* Takes the total eviction count and the used slot count of each cache. Returns true if
+		   any capacity changed, in which case the caches must be resized before the next
+		   texture is inserted. */
+		bool OnNewFrame(
+			_In_reads_(D2DX_TEXTURE_CACHE_COUNT) const uint32_t* evictionCounts,
+			_In_reads_(D2DX_TEXTURE_CACHE_COUNT) const uint32_t* usedCounts);
+
+		uint32_t GetCapacity(
+			_In_ uint32_t cacheIndex) const;
+
+		/* The number of evictions per cache in the last completed period. */
+		uint32_t GetPressure(
+			_In_ uint32_t cacheIndex) const;
+
+		uint64_t GetTotalSize() const;
+
+		uint64_t GetBudget() const;
+
+	private:
+		bool Rebalance(
+			_In_reads_(D2DX_TEXTURE_CACHE_COUNT) const uint32_t* usedCounts);
+
+		uint32_t _capacities[D2DX_TEXTURE_CACHE_COUNT] = { 0 };
+		uint32_t _textureSizes[D2DX_TEXTURE_CACHE_COUNT] = { 0 };
+		uint32_t _periodStartEvictionCounts[D2DX_TEXTURE_CACHE_COUNT] = { 0 };
+		uint32_t _pressures[D2DX_TEXTURE_CACHE_COUNT] = { 0 };
+		uint32_t _maxCapacity = 0;
+		uint64_t _budget = 0;
+		uint32_t _frame = 0;
+	};
+}
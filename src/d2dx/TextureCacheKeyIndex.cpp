@@ -0,0 +1,186 @@
+/*
+	This file is part of D2DX.
+
+	Copyright (C) 2021  Bolrog
+
+	D2DX is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	D2DX is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with D2DX.  If not, see <https://www.gnu.org/licenses/>.
+*/
+#include "pch.h"
+#include "TextureCacheKeyIndex.h"
+
+using namespace d2dx;
+
+_Use_decl_annotations_
+TextureCacheKeyIndex::TextureCacheKeyIndex(
+	uint32_t capacity) :
+	_contentKeys{ capacity, true }
+{
+	uint32_t hashTableSize = 64;
+	while (hashTableSize < capacity * 2)
+	{
+		hashTableSize <<= 1;
+	}
+
+	DWORD hashTableLog2 = 0;
+	BitScanReverse(&hashTableLog2, hashTableSize);
+
+	_hashTable = Buffer<uint32_t>(hashTableSize, true);
+	_hashMask = hashTableSize - 1;
+	_hashShift = 64 - hashTableLog2;
+}
+
+_Use_decl_annotations_
+int32_t TextureCacheKeyIndex::Find(
+	uint64_t contentKey) const
+{
+	if (!_hashTable.items)
+	{
+		return -1;
+	}
+
+	uint32_t position = HashIndexOf(contentKey);
+
+	while (true)
+	{
+		const uint32_t entry = _hashTable.items[position];
+
+		if (!entry)
+		{
+			return -1;
+		}
+
+		if (_contentKeys.items[entry - 1] == contentKey)
+		{
+			return (int32_t)(entry - 1);
+		}
+
+		position = (position + 1) & _hashMask;
+	}
+}
+
+_Use_decl_annotations_
+uint64_t TextureCacheKeyIndex::Replace(
+	int32_t index,
+	uint64_t contentKey)
+{
+	assert(index >= 0 && index < (int32_t)_contentKeys.capacity);
+
+	const uint64_t replacedContentKey = _contentKeys.items[index];
+
+	if (replacedContentKey)
+	{
+		HashRemove(replacedContentKey, index);
+	}
+
+	_contentKeys.items[index] = contentKey;
+
+	if (contentKey)
+	{
+		HashInsert(contentKey, index);
+	}
+
+	return replacedContentKey;
+}
+
+_Use_decl_annotations_
+uint32_t TextureCacheKeyIndex::Resize(
+	uint32_t capacity)
+{
+	TextureCacheKeyIndex resized{ capacity };
+	uint32_t keptCount = 0;
+
+	const uint32_t keptCapacity = min(capacity, _contentKeys.capacity);
+
+	for (uint32_t i = 0; i < keptCapacity; ++i)
+	{
+		if (_contentKeys.items[i])
+		{
+			resized.Replace((int32_t)i, _contentKeys.items[i]);
+			++keptCount;
+		}
+	}
+
+	*this = std::move(resized);
+	return keptCount;
+}
+
+_Use_decl_annotations_
+uint32_t TextureCacheKeyIndex::HashIndexOf(
+	uint64_t contentKey) const
+{
+	/* Fibonacci hashing: the top bits of the product are well mixed even for keys that
+	   only differ in a few bits. */
+	return (uint32_t)((contentKey * 0x9E3779B97F4A7C15ull) >> _hashShift);
+}
+
+_Use_decl_annotations_
+void TextureCacheKeyIndex::HashInsert(
+	uint64_t contentKey,
+	int32_t index)
+{
+	uint32_t position = HashIndexOf(contentKey);
+
+	while (_hashTable.items[position])
+	{
+		assert(_contentKeys.items[_hashTable.items[position] - 1] != contentKey || _hashTable.items[position] - 1 == (uint32_t)index);
+		position = (position + 1) & _hashMask;
+	}
+
+	_hashTable.items[position] = (uint32_t)index + 1;
+}
+
+_Use_decl_annotations_
+void TextureCacheKeyIndex::HashRemove(
+	uint64_t contentKey,
+	int32_t index)
+{
+	uint32_t position = HashIndexOf(contentKey);
+
+	while (_hashTable.items[position] != (uint32_t)index + 1)
+	{
+		assert(_hashTable.items[position] != 0);
+		position = (position + 1) & _hashMask;
+	}
+
+	/* Backward-shift deletion: pull later entries of the probe chain into the hole, so that
+	   no tombstones are needed and lookups stay short. */
+	uint32_t hole = position;
+	uint32_t next = position;
+
+	while (true)
+	{
+		next = (next + 1) & _hashMask;
+
+		const uint32_t entry = _hashTable.items[next];
+
+		if (!entry)
+		{
+			break;
+		}
+
+		const uint32_t home = HashIndexOf(_contentKeys.items[entry - 1]);
+
+		const bool homeIsBetweenHoleAndNext = hole <= next ?
+			(hole < home && home <= next) :
+			(hole < home || home <= next);
+
+		if (!homeIsBetweenHoleAndNext)
+		{
+			_hashTable.items[hole] = entry;
+			hole = next;
+		}
+	}
+
+	_hashTable.items[hole] = 0;
+}
@@ -0,0 +1,81 @@
+/*
+	This file is part of D2DX.
+
+	Copyright (C) 2021  Bolrog
+
+	D2DX is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	D2DX is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with D2DX.  If not, see <https://www.gnu.org/licenses/>.
+*/
+#pragma once
+
+#include "Buffer.h"
+
+namespace d2dx
+{
+	/* Maps content keys to slots for the texture cache policies. Holds the content key of
+	   every slot (zero meaning empty) and an open-addressed (linear probing) hash table from
+	   content key to slot + 1, sized to twice the capacity to keep probe chains short. */
+	class TextureCacheKeyIndex final
+	{
+	public:
+		TextureCacheKeyIndex() = default;
+		TextureCacheKeyIndex& operator=(TextureCacheKeyIndex&& rhs) = default;
+
+		TextureCacheKeyIndex(
+			_In_ uint32_t capacity);
+		~TextureCacheKeyIndex() noexcept {}
+
+		int32_t Find(
+			_In_ uint64_t contentKey) const;
+
+		uint64_t GetContentKey(
+			_In_ int32_t index) const
+		{
+			assert(index >= 0 && index < (int32_t)_contentKeys.capacity);
+			return _contentKeys.items[index];
+		}
+
+		/* Stores contentKey in the slot at index and returns the content key it replaced,
+		   or zero if the slot was empty. */
+		uint64_t Replace(
+			_In_ int32_t index,
+			_In_ uint64_t contentKey);
+
+		/* Changes the capacity, keeping the content keys of the slots below it. Returns the
+		   number of content keys kept. */
+		uint32_t Resize(
+			_In_ uint32_t capacity);
+
+		uint32_t GetCapacity() const
+		{
+			return _contentKeys.capacity;
+		}
+
+	private:
+		uint32_t HashIndexOf(
+			_In_ uint64_t contentKey) const;
+
+		void HashInsert(
+			_In_ uint64_t contentKey,
+			_In_ int32_t index);
+
+		void HashRemove(
+			_In_ uint64_t contentKey,
+			_In_ int32_t index);
+
+		Buffer<uint64_t> _contentKeys;
+		Buffer<uint32_t> _hashTable;
+		uint32_t _hashMask = 0;
+		uint32_t _hashShift = 0;
+	};
+}
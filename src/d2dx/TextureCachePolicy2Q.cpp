@@ -0,0 +1,284 @@
+/*
+	This file is part of D2DX.
+
+	Copyright (C) 2021  Bolrog
+
+	D2DX is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	D2DX is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with D2DX.  If not, see <https://www.gnu.org/licenses/>.
+*/
+#include "pch.h"
+#include "Utils.h"
+#include "TextureCachePolicy2Q.h"
+
+using namespace d2dx;
+
+/* Sizes recommended by the 2Q paper: A1in holds a quarter of the cache, A1out remembers
+   half as many keys as the cache holds. */
+
+_Use_decl_annotations_
+TextureCachePolicy2Q::TextureCachePolicy2Q(
+	uint32_t capacity) :
+	_capacity{ capacity },
+	_a1inCapacity{ capacity / 4 },
+	_keys{ capacity },
+	_usedInFrameBits{ capacity >> 5, true },
+	_prev{ capacity, true, -1 },
+	_next{ capacity, true, -1 },
+	_queue{ capacity, true },
+	_ghostKeys{ max(capacity / 2, 1U) }
+{
+	assert(!(capacity & 63));
+}
+
+_Use_decl_annotations_
+void TextureCachePolicy2Q::Touch(
+	int32_t index)
+{
+	if (!IsUsedInFrame(index))
+	{
+		_usedInFrameBits.items[index >> 5] |= 1 << (index & 31);
+		++_usedInFrameCount;
+	}
+}
+
+_Use_decl_annotations_
+void TextureCachePolicy2Q::Link(
+	int32_t index,
+	Queue queue)
+{
+	assert(_queue.items[index] == QueueNone);
+
+	_queue.items[index] = queue;
+	_prev.items[index] = -1;
+	_next.items[index] = _head[queue];
+
+	if (_head[queue] >= 0)
+	{
+		_prev.items[_head[queue]] = index;
+	}
+	else
+	{
+		_tail[queue] = index;
+	}
+
+	_head[queue] = index;
+	++_queueSize[queue];
+}
+
+_Use_decl_annotations_
+void TextureCachePolicy2Q::Unlink(
+	int32_t index)
+{
+	const Queue queue = (Queue)_queue.items[index];
+	assert(queue != QueueNone);
+
+	const int32_t prev = _prev.items[index];
+	const int32_t next = _next.items[index];
+
+	if (prev >= 0)
+	{
+		_next.items[prev] = next;
+	}
+	else
+	{
+		_head[queue] = next;
+	}
+
+	if (next >= 0)
+	{
+		_prev.items[next] = prev;
+	}
+	else
+	{
+		_tail[queue] = prev;
+	}
+
+	_queue.items[index] = QueueNone;
+	--_queueSize[queue];
+}
+
+_Use_decl_annotations_
+int32_t TextureCachePolicy2Q::FindVictim(
+	Queue queue) const
+{
+	for (int32_t index = _tail[queue]; index >= 0; index = _prev.items[index])
+	{
+		if (!IsUsedInFrame(index))
+		{
+			return index;
+		}
+	}
+
+	return -1;
+}
+
+_Use_decl_annotations_
+int32_t TextureCachePolicy2Q::Find(
+	uint64_t contentKey,
+	int32_t lastIndex)
+{
+	assert(contentKey != 0);
+
+	if (_capacity == 0)
+	{
+		return -1;
+	}
+
+	int32_t findIndex = lastIndex;
+
+	if (lastIndex < 0 || lastIndex >= (int32_t)_capacity ||
+		contentKey != _keys.GetContentKey(lastIndex))
+	{
+		findIndex = _keys.Find(contentKey);
+
+		if (findIndex < 0)
+		{
+			return -1;
+		}
+	}
+
+	Touch(findIndex);
+
+	/* Hits in A1in are deliberately not promoted: a texture has to survive being evicted
+	   from A1in before it counts as part of the working set. */
+	if (_queue.items[findIndex] == QueueAm && _head[QueueAm] != findIndex)
+	{
+		Unlink(findIndex);
+		Link(findIndex, QueueAm);
+	}
+
+	return findIndex;
+}
+
+_Use_decl_annotations_
+int32_t TextureCachePolicy2Q::Insert(
+	uint64_t contentKey,
+	bool& evicted)
+{
+	if (_capacity == 0)
+	{
+		evicted = false;
+		return -1;
+	}
+
+	int32_t replacementIndex = -1;
+
+	if (_usedCount < _capacity)
+	{
+		replacementIndex = (int32_t)_usedCount;
+	}
+	else
+	{
+		const Queue preferred = _queueSize[QueueA1in] > _a1inCapacity ? QueueA1in : QueueAm;
+		const Queue other = preferred == QueueA1in ? QueueAm : QueueA1in;
+
+		replacementIndex = FindVictim(preferred);
+
+		if (replacementIndex < 0)
+		{
+			replacementIndex = FindVictim(other);
+		}
+
+		if (replacementIndex < 0)
+		{
+			D2DX_LOG("All texture atlas entries used in a single frame, starting over!");
+			++_resetCount;
+			memset(_usedInFrameBits.items, 0, sizeof(uint32_t) * _usedInFrameBits.capacity);
+			_usedInFrameCount = 0;
+
+			replacementIndex = _tail[preferred] >= 0 ? _tail[preferred] : _tail[other];
+		}
+
+		if (_queue.items[replacementIndex] == QueueA1in)
+		{
+			_ghostKeys.Replace((int32_t)_ghostNext, _keys.GetContentKey(replacementIndex));
+			_ghostNext = (_ghostNext + 1) % _ghostKeys.GetCapacity();
+		}
+
+		Unlink(replacementIndex);
+	}
+
+	const int32_t ghostIndex = _ghostKeys.Find(contentKey);
+
+	if (ghostIndex >= 0)
+	{
+		_ghostKeys.Replace(ghostIndex, 0);
+		Link(replacementIndex, QueueAm);
+	}
+	else
+	{
+		Link(replacementIndex, QueueA1in);
+	}
+
+	Touch(replacementIndex);
+
+	evicted = _keys.Replace(replacementIndex, contentKey) != 0;
+
+	if (!evicted)
+	{
+		++_usedCount;
+	}
+
+	return replacementIndex;
+}
+
+void TextureCachePolicy2Q::OnNewFrame()
+{
+	memset(_usedInFrameBits.items, 0, sizeof(uint32_t) * _usedInFrameBits.capacity);
+	_usedInFrameCount = 0;
+}
+
+_Use_decl_annotations_
+void TextureCachePolicy2Q::SetCapacity(
+	uint32_t capacity)
+{
+	assert(!(capacity & 63));
+
+	/* The used slots are always the first ones, so shrinking drops the tail of the range. */
+	for (uint32_t index = capacity; index < _usedCount; ++index)
+	{
+		Unlink((int32_t)index);
+	}
+
+	_capacity = capacity;
+	_a1inCapacity = capacity / 4;
+	_usedCount = _keys.Resize(capacity);
+	_usedInFrameBits.Resize(capacity >> 5, 0);
+	_prev.Resize(capacity, -1);
+	_next.Resize(capacity, -1);
+	_queue.Resize(capacity, QueueNone);
+	_ghostKeys.Resize(max(capacity / 2, 1U));
+	_ghostNext %= _ghostKeys.GetCapacity();
+
+	_usedInFrameCount = 0;
+
+	for (uint32_t word = 0; word < _usedInFrameBits.capacity; ++word)
+	{
+		_usedInFrameCount += std::popcount(_usedInFrameBits.items[word]);
+	}
+}
+
+uint32_t TextureCachePolicy2Q::GetUsedCount() const
+{
+	return _usedCount;
+}
+
+uint32_t TextureCachePolicy2Q::GetUsedInFrameCount() const
+{
+	return _usedInFrameCount;
+}
+
+uint32_t TextureCachePolicy2Q::GetResetCount() const
+{
+	return _resetCount;
+}
@@ -0,0 +1,100 @@
+/*
+	This file is part of D2DX.
+
+	Copyright (C) 2021  Bolrog
+
+	D2DX is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	D2DX is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with D2DX.  If not, see <https://www.gnu.org/licenses/>.
+*/
+#pragma once
+
+#include "Buffer.h"
+#include "ITextureCachePolicy.h"
+#include "TextureCacheKeyIndex.h"
+
+namespace d2dx
+{
+	/* 2Q: textures seen for the first time enter a small FIFO (A1in). Textures evicted from it
+	   are remembered (A1out, keys only), and if requested again they go to the main LRU (Am).
+	   This keeps one-off textures, e.g. from effects, from flushing the working set. */
+	class TextureCachePolicy2Q final : public ITextureCachePolicy
+	{
+	public:
+		TextureCachePolicy2Q(
+			_In_ uint32_t capacity);
+		virtual ~TextureCachePolicy2Q() noexcept {}
+
+		virtual int32_t Find(
+			_In_ uint64_t contentKey,
+			_In_ int32_t lastIndex) override;
+
+		virtual int32_t Insert(
+			_In_ uint64_t contentKey,
+			_Out_ bool& evicted) override;
+
+		virtual void OnNewFrame() override;
+
+		virtual void SetCapacity(
+			_In_ uint32_t capacity) override;
+
+		virtual uint32_t GetUsedCount() const override;
+
+		virtual uint32_t GetUsedInFrameCount() const override;
+
+		virtual uint32_t GetResetCount() const override;
+
+	private:
+		enum Queue : uint8_t
+		{
+			QueueNone = 0,
+			QueueA1in = 1,
+			QueueAm = 2,
+			QueueCount = 3
+		};
+
+		void Touch(
+			_In_ int32_t index);
+
+		void Link(
+			_In_ int32_t index,
+			_In_ Queue queue);
+
+		void Unlink(
+			_In_ int32_t index);
+
+		int32_t FindVictim(
+			_In_ Queue queue) const;
+
+		bool IsUsedInFrame(
+			_In_ int32_t index) const
+		{
+			return (_usedInFrameBits.items[index >> 5] & (1 << (index & 31))) != 0;
+		}
+
+		uint32_t _capacity = 0;
+		uint32_t _a1inCapacity = 0;
+		TextureCacheKeyIndex _keys;
+		Buffer<uint32_t> _usedInFrameBits;
+		Buffer<int32_t> _prev;
+		Buffer<int32_t> _next;
+		Buffer<uint8_t> _queue;
+		int32_t _head[QueueCount] = { -1, -1, -1 };
+		int32_t _tail[QueueCount] = { -1, -1, -1 };
+		uint32_t _queueSize[QueueCount] = { 0, 0, 0 };
+		TextureCacheKeyIndex _ghostKeys;
+		uint32_t _ghostNext = 0;
+		uint32_t _usedCount = 0;
+		uint32_t _usedInFrameCount = 0;
+		uint32_t _resetCount = 0;
+	};
+}
@@ -26,11 +26,88 @@ _Use_decl_annotations_
 TextureCachePolicyBitPmru::TextureCachePolicyBitPmru(
 	uint32_t capacity) :
 	_capacity{ capacity },
-	_contentKeys{ capacity, true },
+	_keys{ capacity },
 	_usedInFrameBits{ capacity >> 5, true },
-	_mruBits{ capacity >> 5, true }
+	_usedInFrameEpochs{ capacity >> 5, true },
+	_unmarkedBits{ capacity >> 5 },
+	_unmarkedSummaryBits{ ((capacity >> 5) + 31) >> 5 }
 {
 	assert(!(capacity & 63));
+
+	MarkUsedInFrame();
+}
+
+_Use_decl_annotations_
+void TextureCachePolicyBitPmru::Touch(
+	int32_t index)
+{
+	const uint32_t word = (uint32_t)index >> 5;
+	const uint32_t mask = 1 << (index & 31);
+
+	/* A word stamped with an older epoch has no slots used in this frame. */
+	if (_usedInFrameEpochs.items[word] != _epoch)
+	{
+		_usedInFrameEpochs.items[word] = _epoch;
+		_usedInFrameBits.items[word] = 0;
+	}
+
+	if (!(_usedInFrameBits.items[word] & mask))
+	{
+		_usedInFrameBits.items[word] |= mask;
+		++_usedInFrameCount;
+	}
+
+	/* The summary bit is left set even if this was the last unmarked slot in the word;
+	   FindUnmarked clears it when it gets there, which keeps hits cheap. */
+	_unmarkedBits.items[word] &= ~mask;
+}
+
+int32_t TextureCachePolicyBitPmru::FindUnmarked()
+{
+	for (uint32_t i = 0; i < _unmarkedSummaryBits.capacity; ++i)
+	{
+		DWORD word;
+		while (BitScanForward(&word, (DWORD)_unmarkedSummaryBits.items[i]))
+		{
+			DWORD bit;
+			if (BitScanForward(&bit, (DWORD)_unmarkedBits.items[i * 32 + word]))
+			{
+				return (int32_t)((i * 32 + word) * 32 + bit);
+			}
+
+			_unmarkedSummaryBits.items[i] &= ~(1 << word);
+		}
+	}
+
+	return -1;
+}
+
+void TextureCachePolicyBitPmru::MarkUsedInFrame()
+{
+	memset(_unmarkedSummaryBits.items, 0, sizeof(uint32_t) * _unmarkedSummaryBits.capacity);
+
+	for (uint32_t word = 0; word < _unmarkedBits.capacity; ++word)
+	{
+		const uint32_t usedInFrameBits = _usedInFrameEpochs.items[word] == _epoch ? _usedInFrameBits.items[word] : 0;
+		_unmarkedBits.items[word] = ~usedInFrameBits;
+
+		if (~usedInFrameBits)
+		{
+			_unmarkedSummaryBits.items[word >> 5] |= 1 << (word & 31);
+		}
+	}
+}
+
+void TextureCachePolicyBitPmru::StartNewEpoch()
+{
+	if (++_epoch == 0)
+	{
+		/* The epoch wrapped around: make sure no word looks used in the new one. */
+		memset(_usedInFrameEpochs.items, 0, sizeof(uint32_t) * _usedInFrameEpochs.capacity);
+		_epoch = 1;
+	}
+
+	_usedInFrameCount = 0;
 }
 
 _Use_decl_annotations_
@@ -46,19 +123,17 @@ int32_t TextureCachePolicyBitPmru::Find(
 	}
 
 	if (lastIndex >= 0 && lastIndex < (int32_t)_capacity &&
-		contentKey == _contentKeys.items[lastIndex])
+		contentKey == _keys.GetContentKey(lastIndex))
 	{
-		_usedInFrameBits.items[lastIndex >> 5] |= 1 << (lastIndex & 31);
-		_mruBits.items[lastIndex >> 5] |= 1 << (lastIndex & 31);
+		Touch(lastIndex);
 		return lastIndex;
 	}
 
-	int32_t findIndex = IndexOfUInt64(_contentKeys.items, _capacity, contentKey);
+	int32_t findIndex = _keys.Find(contentKey);
 
 	if (findIndex >= 0)
 	{
-		_usedInFrameBits.items[findIndex >> 5] |= 1 << (findIndex & 31);
-		_mruBits.items[findIndex >> 5] |= 1 << (findIndex & 31);
+		Touch(findIndex);
 		return findIndex;
 	}
 
@@ -76,71 +151,92 @@ int32_t TextureCachePolicyBitPmru::Insert(
 		return -1;
 	}
 
-	int32_t replacementIndex = -1;
-
-	for (uint32_t i = 0; i < _mruBits.capacity; ++i)
-	{
-		DWORD ri;
-		if (BitScanForward(&ri, (DWORD)~_mruBits.items[i]))
-		{
-			replacementIndex = (int32_t)(i * 32 + ri);
-			break;
-		}
-	}
+	int32_t replacementIndex = FindUnmarked();
 
 	if (replacementIndex < 0)
 	{
-		memcpy(_mruBits.items, _usedInFrameBits.items, sizeof(uint32_t) * _mruBits.capacity);
-
-		for (uint32_t i = 0; i < _mruBits.capacity; ++i)
-		{
-			DWORD ri;
-			if (BitScanForward(&ri, (DWORD)~_mruBits.items[i]))
-			{
-				replacementIndex = (int32_t)(i * 32 + ri);
-				break;
-			}
-		}
+		MarkUsedInFrame();
+		replacementIndex = FindUnmarked();
 	}
 
 	if (replacementIndex < 0)
 	{
 		D2DX_LOG("All texture atlas entries used in a single frame, starting over!");
-		memset(_mruBits.items, 0, sizeof(uint32_t) * _mruBits.capacity);
-		memset(_usedInFrameBits.items, 0, sizeof(uint32_t) * _usedInFrameBits.capacity);
-
-		for (uint32_t i = 0; i < _mruBits.capacity; ++i)
-		{
-			DWORD ri;
-			if (BitScanForward(&ri, (DWORD)~_mruBits.items[i]))
-			{
-				replacementIndex = (int32_t)(i * 32 + ri);
-				break;
-			}
-		}
+		++_resetCount;
+		StartNewEpoch();
+		MarkUsedInFrame();
+		replacementIndex = FindUnmarked();
 	}
 
-	_mruBits.items[replacementIndex >> 5] |= 1 << (replacementIndex & 31);
-	_usedInFrameBits.items[replacementIndex >> 5] |= 1 << (replacementIndex & 31);
+	Touch(replacementIndex);
 
-	evicted = _contentKeys.items[replacementIndex] != 0;
+	evicted = _keys.Replace(replacementIndex, contentKey) != 0;
 
 	if (!evicted)
 	{
 		++_usedCount;
 	}
 
-	_contentKeys.items[replacementIndex] = contentKey;
-
 	return replacementIndex;
 }
 
 void TextureCachePolicyBitPmru::OnNewFrame()
 {
-	memset(_usedInFrameBits.items, 0, sizeof(uint32_t) * _usedInFrameBits.capacity);
+	StartNewEpoch();
+}
+
+_Use_decl_annotations_
+void TextureCachePolicyBitPmru::SetCapacity(
+	uint32_t capacity)
+{
+	assert(!(capacity & 63));
+
+	const uint32_t keptWordCount = min(capacity, _capacity) >> 5;
+
+	_capacity = capacity;
+	_usedCount = _keys.Resize(capacity);
+	_usedInFrameBits.Resize(capacity >> 5, 0);
+	_usedInFrameEpochs.Resize(capacity >> 5, 0);
+	_unmarkedBits.Resize(capacity >> 5, 0);
+	_unmarkedSummaryBits = Buffer<uint32_t>(((capacity >> 5) + 31) >> 5, true);
+
+	_usedInFrameCount = 0;
+
+	for (uint32_t word = 0; word < keptWordCount; ++word)
+	{
+		if (_usedInFrameEpochs.items[word] == _epoch)
+		{
+			_usedInFrameCount += std::popcount(_usedInFrameBits.items[word]);
+		}
+	}
+
+	/* The kept slots stay as marked as they were. The added slots are empty, so they are
+	   unmarked and filled before anything is evicted. */
+	for (uint32_t word = 0; word < _unmarkedBits.capacity; ++word)
+	{
+		if (word >= keptWordCount)
+		{
+			_unmarkedBits.items[word] = ~0U;
+		}
+
+		if (_unmarkedBits.items[word])
+		{
+			_unmarkedSummaryBits.items[word >> 5] |= 1 << (word & 31);
+		}
+	}
 }
 
 uint32_t TextureCachePolicyBitPmru::GetUsedCount() const
 {
 	return _usedCount;
 }
+
+uint32_t TextureCachePolicyBitPmru::GetUsedInFrameCount() const
+{
+	return _usedInFrameCount;
+}
+
+uint32_t TextureCachePolicyBitPmru::GetResetCount() const
+{
+	return _resetCount;
+}
@@ -19,36 +19,65 @@
 #pragma once
 
 #include "Buffer.h"
+#include "ITextureCachePolicy.h"
+#include "TextureCacheKeyIndex.h"
 
 namespace d2dx
 {
-	class TextureCachePolicyBitPmru final
+	/* Bit pseudo-MRU: every used slot is marked as recently used, and a slot that isn't is
+	   replaced. When all slots are marked, only the ones used in the current frame stay
+	   marked.
+
+	   The unmarked slots are kept in a two-level bitmap (a summary bit per 32-slot leaf
+	   word that may have any), so a replacement is found by scanning at most a few summary
+	   words. The slots used in the current frame are stamped with the frame's epoch, per
+	   leaf word, so that starting a new frame doesn't have to clear anything. */
+	class TextureCachePolicyBitPmru final : public ITextureCachePolicy
 	{
 	public:
-		TextureCachePolicyBitPmru() = default;
-		TextureCachePolicyBitPmru& operator=(TextureCachePolicyBitPmru&& rhs) = default;
-
 		TextureCachePolicyBitPmru(
 			_In_ uint32_t capacity);
-		~TextureCachePolicyBitPmru() noexcept {}
+		virtual ~TextureCachePolicyBitPmru() noexcept {}
 
-		int32_t Find(
+		virtual int32_t Find(
 			_In_ uint64_t contentKey,
-			_In_ int32_t lastIndex);
+			_In_ int32_t lastIndex) override;
 		
-		int32_t Insert(
+		virtual int32_t Insert(
 			_In_ uint64_t contentKey,
-			_Out_ bool& evicted);
+			_Out_ bool& evicted) override;
 		
-		void OnNewFrame();
+		virtual void OnNewFrame() override;
+
+		virtual void SetCapacity(
+			_In_ uint32_t capacity) override;
+
+		virtual uint32_t GetUsedCount() const override;
+
+		virtual uint32_t GetUsedInFrameCount() const override;
 
-		uint32_t GetUsedCount() const;
+		virtual uint32_t GetResetCount() const override;
 
 	private:
+		void Touch(
+			_In_ int32_t index);
+
+		int32_t FindUnmarked();
+
+		/* Marks exactly the slots used in the current frame. */
+		void MarkUsedInFrame();
+
+		void StartNewEpoch();
+
 		uint32_t _capacity = 0;
-		Buffer<uint64_t> _contentKeys;
+		TextureCacheKeyIndex _keys;
 		Buffer<uint32_t> _usedInFrameBits;
-		Buffer<uint32_t> _mruBits;
+		Buffer<uint32_t> _usedInFrameEpochs;
+		Buffer<uint32_t> _unmarkedBits;
+		Buffer<uint32_t> _unmarkedSummaryBits;
+		uint32_t _epoch = 1;
 		uint32_t _usedCount = 0;
+		uint32_t _usedInFrameCount = 0;
+		uint32_t _resetCount = 0;
 	};
 }
@@ -0,0 +1,180 @@
+/*
+	This file is part of D2DX.
+
+	Copyright (C) 2021  Bolrog
+
+	D2DX is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	D2DX is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with D2DX.  If not, see <https://www.gnu.org/licenses/>.
+*/
+#include "pch.h"
+#include "Utils.h"
+#include "TextureCachePolicyClock.h"
+
+using namespace d2dx;
+
+_Use_decl_annotations_
+TextureCachePolicyClock::TextureCachePolicyClock(
+	uint32_t capacity) :
+	_capacity{ capacity },
+	_keys{ capacity },
+	_usedInFrameBits{ capacity >> 5, true },
+	_referencedBits{ capacity >> 5, true }
+{
+	assert(!(capacity & 63));
+}
+
+_Use_decl_annotations_
+void TextureCachePolicyClock::Touch(
+	int32_t index)
+{
+	if (!(_usedInFrameBits.items[index >> 5] & (1 << (index & 31))))
+	{
+		_usedInFrameBits.items[index >> 5] |= 1 << (index & 31);
+		++_usedInFrameCount;
+	}
+
+	_referencedBits.items[index >> 5] |= 1 << (index & 31);
+}
+
+_Use_decl_annotations_
+int32_t TextureCachePolicyClock::Find(
+	uint64_t contentKey,
+	int32_t lastIndex)
+{
+	assert(contentKey != 0);
+
+	if (_capacity == 0)
+	{
+		return -1;
+	}
+
+	if (lastIndex >= 0 && lastIndex < (int32_t)_capacity &&
+		contentKey == _keys.GetContentKey(lastIndex))
+	{
+		Touch(lastIndex);
+		return lastIndex;
+	}
+
+	const int32_t findIndex = _keys.Find(contentKey);
+
+	if (findIndex >= 0)
+	{
+		Touch(findIndex);
+	}
+
+	return findIndex;
+}
+
+_Use_decl_annotations_
+int32_t TextureCachePolicyClock::Insert(
+	uint64_t contentKey,
+	bool& evicted)
+{
+	if (_capacity == 0)
+	{
+		evicted = false;
+		return -1;
+	}
+
+	int32_t replacementIndex = -1;
+
+	/* Two revolutions are enough: the first clears every reference bit that is not
+	   protected by use in this frame. */
+	for (uint32_t step = 0; step < 2 * _capacity; ++step)
+	{
+		const uint32_t index = _hand;
+		const uint32_t mask = 1 << (index & 31);
+		_hand = (_hand + 1) == _capacity ? 0 : _hand + 1;
+
+		if (_usedInFrameBits.items[index >> 5] & mask)
+		{
+			continue;
+		}
+
+		if (_referencedBits.items[index >> 5] & mask)
+		{
+			_referencedBits.items[index >> 5] &= ~mask;
+			continue;
+		}
+
+		replacementIndex = (int32_t)index;
+		break;
+	}
+
+	if (replacementIndex < 0)
+	{
+		D2DX_LOG("All texture atlas entries used in a single frame, starting over!");
+		++_resetCount;
+		memset(_usedInFrameBits.items, 0, sizeof(uint32_t) * _usedInFrameBits.capacity);
+		_usedInFrameCount = 0;
+		memset(_referencedBits.items, 0, sizeof(uint32_t) * _referencedBits.capacity);
+
+		replacementIndex = (int32_t)_hand;
+		_hand = (_hand + 1) == _capacity ? 0 : _hand + 1;
+	}
+
+	Touch(replacementIndex);
+
+	evicted = _keys.Replace(replacementIndex, contentKey) != 0;
+
+	if (!evicted)
+	{
+		++_usedCount;
+	}
+
+	return replacementIndex;
+}
+
+void TextureCachePolicyClock::OnNewFrame()
+{
+	memset(_usedInFrameBits.items, 0, sizeof(uint32_t) * _usedInFrameBits.capacity);
+	_usedInFrameCount = 0;
+}
+
+_Use_decl_annotations_
+void TextureCachePolicyClock::SetCapacity(
+	uint32_t capacity)
+{
+	assert(!(capacity & 63));
+
+	const uint32_t keptWordCount = min(capacity, _capacity) >> 5;
+
+	/* After growing, start the hand at the added (empty) slots. */
+	_hand = capacity > _capacity ? _capacity : (_hand < capacity ? _hand : 0);
+	_capacity = capacity;
+	_usedCount = _keys.Resize(capacity);
+	_usedInFrameBits.Resize(capacity >> 5, 0);
+	_referencedBits.Resize(capacity >> 5, 0);
+
+	_usedInFrameCount = 0;
+
+	for (uint32_t word = 0; word < keptWordCount; ++word)
+	{
+		_usedInFrameCount += std::popcount(_usedInFrameBits.items[word]);
+	}
+}
+
+uint32_t TextureCachePolicyClock::GetUsedCount() const
+{
+	return _usedCount;
+}
+
+uint32_t TextureCachePolicyClock::GetUsedInFrameCount() const
+{
+	return _usedInFrameCount;
+}
+
+uint32_t TextureCachePolicyClock::GetResetCount() const
+{
+	return _resetCount;
+}
@@ -0,0 +1,68 @@
+/*
+	This file is part of D2DX.
+
+	Copyright (C) 2021  Bolrog
+
+	D2DX is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	D2DX is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with D2DX.  If not, see <https://www.gnu.org/licenses/>.
+*/
+#pragma once
+
+#include "Buffer.h"
+#include "ITextureCachePolicy.h"
+#include "TextureCacheKeyIndex.h"
+
+namespace d2dx
+{
+	/* CLOCK (second chance): a hand sweeps the slots, clearing reference bits, and replaces
+	   the first slot that has not been referenced since the hand last passed it. */
+	class TextureCachePolicyClock final : public ITextureCachePolicy
+	{
+	public:
+		TextureCachePolicyClock(
+			_In_ uint32_t capacity);
+		virtual ~TextureCachePolicyClock() noexcept {}
+
+		virtual int32_t Find(
+			_In_ uint64_t contentKey,
+			_In_ int32_t lastIndex) override;
+
+		virtual int32_t Insert(
+			_In_ uint64_t contentKey,
+			_Out_ bool& evicted) override;
+
+		virtual void OnNewFrame() override;
+
+		virtual void SetCapacity(
+			_In_ uint32_t capacity) override;
+
+		virtual uint32_t GetUsedCount() const override;
+
+		virtual uint32_t GetUsedInFrameCount() const override;
+
+		virtual uint32_t GetResetCount() const override;
+
+	private:
+		void Touch(
+			_In_ int32_t index);
+
+		uint32_t _capacity = 0;
+		TextureCacheKeyIndex _keys;
+		Buffer<uint32_t> _usedInFrameBits;
+		Buffer<uint32_t> _referencedBits;
+		uint32_t _hand = 0;
+		uint32_t _usedCount = 0;
+		uint32_t _usedInFrameCount = 0;
+		uint32_t _resetCount = 0;
+	};
+}
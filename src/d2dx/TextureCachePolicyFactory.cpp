@@ -0,0 +1,64 @@
+/*
+	This file is part of D2DX.
+
+	Copyright (C) 2021  Bolrog
+
+	D2DX is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	D2DX is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with D2DX.  If not, see <https://www.gnu.org/licenses/>.
+*/
+#include "pch.h"
+#include "TextureCachePolicyFactory.h"
+#include "TextureCachePolicy2Q.h"
+#include "TextureCachePolicyBitPmru.h"
+#include "TextureCachePolicyClock.h"
+#include "TextureCachePolicyFrequency.h"
+
+using namespace d2dx;
+
+_Use_decl_annotations_
+std::unique_ptr<ITextureCachePolicy> TextureCachePolicyFactory::Create(
+	TextureCachePolicyType type,
+	uint32_t capacity)
+{
+	switch (type)
+	{
+	default:
+	case TextureCachePolicyType::BitPmru:
+		return std::make_unique<TextureCachePolicyBitPmru>(capacity);
+	case TextureCachePolicyType::Clock:
+		return std::make_unique<TextureCachePolicyClock>(capacity);
+	case TextureCachePolicyType::TwoQueue:
+		return std::make_unique<TextureCachePolicy2Q>(capacity);
+	case TextureCachePolicyType::Frequency:
+		return std::make_unique<TextureCachePolicyFrequency>(capacity);
+	}
+}
+
+_Use_decl_annotations_
+const char* TextureCachePolicyFactory::GetName(
+	TextureCachePolicyType type)
+{
+	switch (type)
+	{
+	case TextureCachePolicyType::BitPmru:
+		return "BitPmru";
+	case TextureCachePolicyType::Clock:
+		return "Clock";
+	case TextureCachePolicyType::TwoQueue:
+		return "2Q";
+	case TextureCachePolicyType::Frequency:
+		return "Frequency";
+	default:
+		return "Unknown";
+	}
+}
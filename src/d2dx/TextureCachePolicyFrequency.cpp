@@ -0,0 +1,213 @@
+/*
+	This file is part of D2DX.
+
+	Copyright (C) 2021  Bolrog
+
+	D2DX is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	D2DX is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with D2DX.  If not, see <https://www.gnu.org/licenses/>.
+*/
+#include "pch.h"
+#include "Utils.h"
+#include "TextureCachePolicyFrequency.h"
+
+using namespace d2dx;
+
+/* Halve all frequencies this often (in frames). About one second at 60 fps. */
+#define D2DX_TEXTURE_FREQUENCY_AGING_PERIOD 64
+
+_Use_decl_annotations_
+TextureCachePolicyFrequency::TextureCachePolicyFrequency(
+	uint32_t capacity) :
+	_capacity{ capacity },
+	_keys{ capacity },
+	_usedInFrameBits{ capacity >> 5, true },
+	_frequencies{ capacity, true },
+	_lastUsedFrames{ capacity, true }
+{
+	assert(!(capacity & 63));
+}
+
+_Use_decl_annotations_
+void TextureCachePolicyFrequency::Touch(
+	int32_t index)
+{
+	const uint32_t mask = 1 << (index & 31);
+
+	/* Count each texture at most once per frame, so that sprites drawn many times in a
+	   single frame don't appear more popular than they are over time. */
+	if (!(_usedInFrameBits.items[index >> 5] & mask))
+	{
+		_usedInFrameBits.items[index >> 5] |= mask;
+		++_usedInFrameCount;
+
+		if (_frequencies.items[index] < 0xFFFF)
+		{
+			++_frequencies.items[index];
+		}
+	}
+
+	_lastUsedFrames.items[index] = _frame;
+}
+
+int32_t TextureCachePolicyFrequency::FindVictim() const
+{
+	int32_t victimIndex = -1;
+	uint32_t victimFrequency = 0xFFFFFFFF;
+	uint32_t victimLastUsedFrame = 0xFFFFFFFF;
+
+	for (uint32_t i = 0; i < _capacity; ++i)
+	{
+		if (_usedInFrameBits.items[i >> 5] & (1 << (i & 31)))
+		{
+			continue;
+		}
+
+		const uint32_t frequency = _frequencies.items[i];
+		const uint32_t lastUsedFrame = _lastUsedFrames.items[i];
+
+		if (frequency < victimFrequency ||
+			(frequency == victimFrequency && lastUsedFrame < victimLastUsedFrame))
+		{
+			victimIndex = (int32_t)i;
+			victimFrequency = frequency;
+			victimLastUsedFrame = lastUsedFrame;
+		}
+	}
+
+	return victimIndex;
+}
+
+_Use_decl_annotations_
+int32_t TextureCachePolicyFrequency::Find(
+	uint64_t contentKey,
+	int32_t lastIndex)
+{
+	assert(contentKey != 0);
+
+	if (_capacity == 0)
+	{
+		return -1;
+	}
+
+	if (lastIndex >= 0 && lastIndex < (int32_t)_capacity &&
+		contentKey == _keys.GetContentKey(lastIndex))
+	{
+		Touch(lastIndex);
+		return lastIndex;
+	}
+
+	const int32_t findIndex = _keys.Find(contentKey);
+
+	if (findIndex >= 0)
+	{
+		Touch(findIndex);
+	}
+
+	return findIndex;
+}
+
+_Use_decl_annotations_
+int32_t TextureCachePolicyFrequency::Insert(
+	uint64_t contentKey,
+	bool& evicted)
+{
+	if (_capacity == 0)
+	{
+		evicted = false;
+		return -1;
+	}
+
+	int32_t replacementIndex = -1;
+
+	if (_usedCount < _capacity)
+	{
+		replacementIndex = (int32_t)_usedCount;
+	}
+	else
+	{
+		replacementIndex = FindVictim();
+
+		if (replacementIndex < 0)
+		{
+			D2DX_LOG("All texture atlas entries used in a single frame, starting over!");
+			++_resetCount;
+			memset(_usedInFrameBits.items, 0, sizeof(uint32_t) * _usedInFrameBits.capacity);
+			_usedInFrameCount = 0;
+
+			replacementIndex = FindVictim();
+		}
+	}
+
+	_frequencies.items[replacementIndex] = 0;
+	Touch(replacementIndex);
+
+	evicted = _keys.Replace(replacementIndex, contentKey) != 0;
+
+	if (!evicted)
+	{
+		++_usedCount;
+	}
+
+	return replacementIndex;
+}
+
+void TextureCachePolicyFrequency::OnNewFrame()
+{
+	memset(_usedInFrameBits.items, 0, sizeof(uint32_t) * _usedInFrameBits.capacity);
+	_usedInFrameCount = 0;
+
+	++_frame;
+
+	if (!(_frame % D2DX_TEXTURE_FREQUENCY_AGING_PERIOD))
+	{
+		for (uint32_t i = 0; i < _capacity; ++i)
+		{
+			_frequencies.items[i] >>= 1;
+		}
+	}
+}
+
+_Use_decl_annotations_
+void TextureCachePolicyFrequency::SetCapacity(
+	uint32_t capacity)
+{
+	assert(!(capacity & 63));
+
+	_capacity = capacity;
+	_usedCount = _keys.Resize(capacity);
+	_usedInFrameBits.Resize(capacity >> 5, 0);
+	_frequencies.Resize(capacity, 0);
+	_lastUsedFrames.Resize(capacity, 0);
+
+	_usedInFrameCount = 0;
+
+	for (uint32_t word = 0; word < _usedInFrameBits.capacity; ++word)
+	{
+		_usedInFrameCount += std::popcount(_usedInFrameBits.items[word]);
+	}
+}
+
+uint32_t TextureCachePolicyFrequency::GetUsedCount() const
+{
+	return _usedCount;
+}
+
+uint32_t TextureCachePolicyFrequency::GetUsedInFrameCount() const
+{
+	return _usedInFrameCount;
+}
+
+uint32_t TextureCachePolicyFrequency::GetResetCount() const
+{
+	return _resetCount;
+}
@@ -0,0 +1,72 @@
+/*
+	This file is part of D2DX.
+
+	Copyright (C) 2021  Bolrog
+
+	D2DX is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	D2DX is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with D2DX.  If not, see <https://www.gnu.org/licenses/>.
+*/
+#pragma once
+
+#include "Buffer.h"
+#include "ITextureCachePolicy.h"
+#include "TextureCacheKeyIndex.h"
+
+namespace d2dx
+{
+	/* Frequency-aware (LFU with aging): counts the frames in which each texture was used,
+	   halving all counts periodically so that old popularity fades, and replaces the least
+	   frequently used texture, breaking ties by least recent use. */
+	class TextureCachePolicyFrequency final : public ITextureCachePolicy
+	{
+	public:
+		TextureCachePolicyFrequency(
+			_In_ uint32_t capacity);
+		virtual ~TextureCachePolicyFrequency() noexcept {}
+
+		virtual int32_t Find(
+			_In_ uint64_t contentKey,
+			_In_ int32_t lastIndex) override;
+
+		virtual int32_t Insert(
+			_In_ uint64_t contentKey,
+			_Out_ bool& evicted) override;
+
+		virtual void OnNewFrame() override;
+
+		virtual void SetCapacity(
+			_In_ uint32_t capacity) override;
+
+		virtual uint32_t GetUsedCount() const override;
+
+		virtual uint32_t GetUsedInFrameCount() const override;
+
+		virtual uint32_t GetResetCount() const override;
+
+	private:
+		void Touch(
+			_In_ int32_t index);
+
+		int32_t FindVictim() const;
+
+		uint32_t _capacity = 0;
+		TextureCacheKeyIndex _keys;
+		Buffer<uint32_t> _usedInFrameBits;
+		Buffer<uint16_t> _frequencies;
+		Buffer<uint32_t> _lastUsedFrames;
+		uint32_t _frame = 0;
+		uint32_t _usedCount = 0;
+		uint32_t _usedInFrameCount = 0;
+		uint32_t _resetCount = 0;
+	};
+}
@@ -0,0 +1,103 @@
+/*
+	This file is part of D2DX.
+
+	Copyright (C) 2021  Bolrog
+
+	D2DX is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	D2DX is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with D2DX.  If not, see <https://www.gnu.org/licenses/>.
+*/
+#include "pch.h"
+#include "TextureCacheSimulator.h"
+#include "TextureCachePolicyFactory.h"
+
+using namespace d2dx;
+
+_Use_decl_annotations_
+TextureCacheSimulator::TextureCacheSimulator(
+	TextureCachePolicyType policyType,
+	const uint32_t* capacities,
+	uint32_t sizeClassCount)
+{
+	for (uint32_t i = 0; i < sizeClassCount; ++i)
+	{
+		_policies.push_back(TextureCachePolicyFactory::Create(policyType, capacities[i]));
+	}
+}
+
+_Use_decl_annotations_
+void TextureCacheSimulator::Replay(
+	const TextureCacheTraceRecord* records,
+	uint32_t recordCount)
+{
+	for (uint32_t i = 0; i < recordCount; ++i)
+	{
+		const TextureCacheTraceRecord& record = records[i];
+
+		if (_frameStats.empty() || _frameStats.back().frame != record.frame)
+		{
+			if (!_frameStats.empty())
+			{
+				for (auto& policy : _policies)
+				{
+					policy->OnNewFrame();
+				}
+			}
+
+			TextureCacheSimulatorStats frameStats;
+			frameStats.frame = record.frame;
+			_frameStats.push_back(frameStats);
+		}
+
+		if (record.sizeClass >= _policies.size() || !record.contentKey)
+		{
+			continue;
+		}
+
+		ITextureCachePolicy* policy = _policies[record.sizeClass].get();
+		TextureCacheSimulatorStats& frameStats = _frameStats.back();
+
+		++frameStats.lookups;
+
+		if (policy->Find(record.contentKey, -1) >= 0)
+		{
+			++frameStats.hits;
+			continue;
+		}
+
+		const uint32_t resetCount = policy->GetResetCount();
+
+		bool evicted = false;
+		policy->Insert(record.contentKey, evicted);
+
+		frameStats.uploadBytes += 1ull << (record.widthLog2 + record.heightLog2);
+		frameStats.evictions += evicted ? 1 : 0;
+		frameStats.resets += policy->GetResetCount() - resetCount;
+	}
+}
+
+TextureCacheSimulatorStats TextureCacheSimulator::GetTotals() const
+{
+	TextureCacheSimulatorStats totals;
+
+	for (const auto& frameStats : _frameStats)
+	{
+		++totals.frame;
+		totals.lookups += frameStats.lookups;
+		totals.hits += frameStats.hits;
+		totals.evictions += frameStats.evictions;
+		totals.resets += frameStats.resets;
+		totals.uploadBytes += frameStats.uploadBytes;
+	}
+
+	return totals;
+}
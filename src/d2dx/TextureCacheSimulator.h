@@ -0,0 +1,63 @@
+/*
+	This file is part of D2DX.
+
+	Copyright (C) 2021  Bolrog
+
+	D2DX is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	D2DX is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with D2DX.  If not, see <https://www.gnu.org/licenses/>.
+*/
+#pragma once
+
+#include "ITextureCachePolicy.h"
+#include "TextureCacheTrace.h"
+
+namespace d2dx
+{
+	struct TextureCacheSimulatorStats final
+	{
+		uint32_t frame = 0;
+		uint32_t lookups = 0;
+		uint32_t hits = 0;
+		uint32_t evictions = 0;
+		uint32_t resets = 0;
+		uint64_t uploadBytes = 0;
+	};
+
+	/* Replays a texture cache trace through one policy per size class, without a device,
+	   and collects hit rate, upload bytes and evictions per frame. */
+	class TextureCacheSimulator final
+	{
+	public:
+		TextureCacheSimulator(
+			_In_ TextureCachePolicyType policyType,
+			_In_reads_(sizeClassCount) const uint32_t* capacities,
+			_In_ uint32_t sizeClassCount);
+		~TextureCacheSimulator() noexcept {}
+
+		void Replay(
+			_In_reads_(recordCount) const TextureCacheTraceRecord* records,
+			_In_ uint32_t recordCount);
+
+		const std::vector<TextureCacheSimulatorStats>& GetFrameStats() const
+		{
+			return _frameStats;
+		}
+
+		/* Sums the stats of all frames. The frame member holds the number of frames. */
+		TextureCacheSimulatorStats GetTotals() const;
+
+	private:
+		std::vector<std::unique_ptr<ITextureCachePolicy>> _policies;
+		std::vector<TextureCacheSimulatorStats> _frameStats;
+	};
+}
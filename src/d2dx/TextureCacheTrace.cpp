@@ -0,0 +1,152 @@
+/*
+	This file is part of D2DX.
+
+	Copyright (C) 2021  Bolrog
+
+	D2DX is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	D2DX is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with D2DX.  If not, see <https://www.gnu.org/licenses/>.
+*/
+#include "pch.h"
+#include "TextureCacheTrace.h"
+#include "Utils.h"
+
+using namespace d2dx;
+
+#define D2DX_TEXTURE_CACHE_TRACE_MAGIC 0x43543244 /* "D2TC" */
+#define D2DX_TEXTURE_CACHE_TRACE_VERSION 1
+
+namespace
+{
+	struct TraceHeader final
+	{
+		uint32_t magic;
+		uint32_t version;
+	};
+}
+
+_Use_decl_annotations_
+TextureCacheTraceRecorder::TextureCacheTraceRecorder(
+	const char* filename) :
+	_records{ 65536 }
+{
+	if (fopen_s(&_file, filename, "wb") != 0 || !_file)
+	{
+		D2DX_LOG("Failed to open %s for writing the texture cache trace.", filename);
+		_file = nullptr;
+		return;
+	}
+
+	const TraceHeader header{ D2DX_TEXTURE_CACHE_TRACE_MAGIC, D2DX_TEXTURE_CACHE_TRACE_VERSION };
+	fwrite(&header, sizeof(header), 1, _file);
+
+	D2DX_LOG("Recording texture cache trace to %s.", filename);
+}
+
+TextureCacheTraceRecorder::~TextureCacheTraceRecorder() noexcept
+{
+	Flush();
+
+	if (_file)
+	{
+		fclose(_file);
+	}
+}
+
+_Use_decl_annotations_
+void TextureCacheTraceRecorder::Record(
+	uint32_t frame,
+	uint32_t sizeClass,
+	int32_t width,
+	int32_t height,
+	uint64_t contentKey)
+{
+	if (!_file)
+	{
+		return;
+	}
+
+	DWORD widthLog2 = 0;
+	DWORD heightLog2 = 0;
+	BitScanReverse(&widthLog2, (DWORD)width);
+	BitScanReverse(&heightLog2, (DWORD)height);
+
+	TextureCacheTraceRecord& record = _records.items[_recordCount++];
+	record.frame = frame;
+	record.sizeClass = (uint8_t)sizeClass;
+	record.widthLog2 = (uint8_t)widthLog2;
+	record.heightLog2 = (uint8_t)heightLog2;
+	record.reserved = 0;
+	record.contentKey = contentKey;
+
+	if (_recordCount == _records.capacity)
+	{
+		Flush();
+	}
+}
+
+void TextureCacheTraceRecorder::Flush()
+{
+	if (_file && _recordCount > 0)
+	{
+		fwrite(_records.items, sizeof(TextureCacheTraceRecord), _recordCount, _file);
+		fflush(_file);
+	}
+
+	_recordCount = 0;
+}
+
+_Use_decl_annotations_
+Buffer<TextureCacheTraceRecord> d2dx::ReadTextureCacheTrace(
+	const char* filename)
+{
+	FILE* file = nullptr;
+
+	if (fopen_s(&file, filename, "rb") != 0 || !file)
+	{
+		return Buffer<TextureCacheTraceRecord>();
+	}
+
+	fseek(file, 0, SEEK_END);
+	const long size = ftell(file);
+	fseek(file, 0, SEEK_SET);
+
+	TraceHeader header = { 0, 0 };
+
+	if (size < (long)sizeof(header) ||
+		fread(&header, sizeof(header), 1, file) != 1 ||
+		header.magic != D2DX_TEXTURE_CACHE_TRACE_MAGIC ||
+		header.version != D2DX_TEXTURE_CACHE_TRACE_VERSION)
+	{
+		fclose(file);
+		return Buffer<TextureCacheTraceRecord>();
+	}
+
+	const uint32_t recordCount = (uint32_t)((size - sizeof(header)) / sizeof(TextureCacheTraceRecord));
+
+	if (recordCount == 0)
+	{
+		fclose(file);
+		return Buffer<TextureCacheTraceRecord>();
+	}
+
+	Buffer<TextureCacheTraceRecord> records(recordCount);
+	const size_t readCount = fread(records.items, sizeof(TextureCacheTraceRecord), recordCount, file);
+	fclose(file);
+
+	if (readCount != recordCount)
+	{
+		return Buffer<TextureCacheTraceRecord>();
+	}
+
+	return records;
+}
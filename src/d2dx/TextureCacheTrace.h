@@ -0,0 +1,66 @@
+/*
+	This file is part of D2DX.
+
+	Copyright (C) 2021  Bolrog
+
+	D2DX is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	D2DX is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with D2DX.  If not, see <https://www.gnu.org/licenses/>.
+*/
+#pragma once
+
+#include "Buffer.h"
+
+namespace d2dx
+{
+	/* One texture cache request as seen by RenderContext::UpdateTexture. Requests answered by
+	   the per-frame TextureLocationMemo never reach it, so each texture appears at most once per
+	   frame unless the memo was invalidated. */
+	struct TextureCacheTraceRecord final
+	{
+		uint32_t frame;
+		uint8_t sizeClass;
+		uint8_t widthLog2;
+		uint8_t heightLog2;
+		uint8_t reserved;
+		uint64_t contentKey;
+	};
+
+	static_assert(sizeof(TextureCacheTraceRecord) == 16, "sizeof(TextureCacheTraceRecord) == 16");
+
+	class TextureCacheTraceRecorder final
+	{
+	public:
+		TextureCacheTraceRecorder(
+			_In_z_ const char* filename);
+		~TextureCacheTraceRecorder() noexcept;
+
+		void Record(
+			_In_ uint32_t frame,
+			_In_ uint32_t sizeClass,
+			_In_ int32_t width,
+			_In_ int32_t height,
+			_In_ uint64_t contentKey);
+
+		void Flush();
+
+	private:
+		FILE* _file = nullptr;
+		Buffer<TextureCacheTraceRecord> _records;
+		uint32_t _recordCount = 0;
+	};
+
+	/* Returns the records of a trace written by TextureCacheTraceRecorder, or an empty buffer
+	   if the file is missing or malformed. */
+	Buffer<TextureCacheTraceRecord> ReadTextureCacheTrace(
+		_In_z_ const char* filename);
+}
@@ -0,0 +1,170 @@
+/*
+	This file is part of D2DX.
+
+	Copyright (C) 2021  Bolrog
+
+	D2DX is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	D2DX is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with D2DX.  If not, see <https://www.gnu.org/licenses/>.
+*/
+#include "pch.h"
+#include "TextureHashWorker.h"
+
+using namespace d2dx;
+
+_Use_decl_annotations_
+TextureHashWorker::TextureHashWorker(
+	const uint8_t* memory,
+	uint32_t memorySize,
+	uint32_t capacity,
+	bool startThread) :
+	_memory{ memory },
+	_memorySize{ memorySize },
+	_jobs{ capacity, true },
+	_mask{ capacity - 1 }
+{
+	assert(capacity > 0 && (capacity & (capacity - 1)) == 0);
+
+	if (startThread)
+	{
+		_thread = std::thread(&TextureHashWorker::Run, this);
+	}
+}
+
+TextureHashWorker::~TextureHashWorker() noexcept
+{
+	if (_thread.joinable())
+	{
+		_isStopping.store(true, std::memory_order_release);
+		_signal.fetch_add(1, std::memory_order_release);
+		_signal.notify_one();
+		_thread.join();
+	}
+}
+
+_Use_decl_annotations_
+bool TextureHashWorker::TryEnqueue(
+	uint32_t startAddress,
+	uint32_t size,
+	uint32_t& sequence)
+{
+	assert(startAddress + size <= _memorySize);
+
+	sequence = _queued.load(std::memory_order_relaxed) + 1;
+
+	/* The slot is free once the job that used it before has been collected. */
+	if (sequence - _collected > _jobs.capacity)
+	{
+		return false;
+	}
+
+	Job& job = _jobs.items[sequence & _mask];
+	job.sequence = sequence;
+	job.startAddress = startAddress;
+	job.size = size;
+	job.hash = 0;
+
+	_queued.store(sequence, std::memory_order_release);
+	_signal.fetch_add(1, std::memory_order_release);
+	_signal.notify_one();
+	return true;
+}
+
+_Use_decl_annotations_
+bool TextureHashWorker::IsPending(
+	uint32_t sequence) const
+{
+	const uint32_t queued = _queued.load(std::memory_order_relaxed);
+	const uint32_t completed = _completed.load(std::memory_order_acquire);
+
+	/* Sequence numbers wrap around, so compare distances. */
+	return (int32_t)(queued - sequence) >= 0 && (int32_t)(sequence - completed) > 0;
+}
+
+_Use_decl_annotations_
+bool TextureHashWorker::Wait(
+	uint32_t sequence)
+{
+	if (!IsPending(sequence))
+	{
+		return false;
+	}
+
+	++_waitCount;
+
+	for (uint32_t spin = 0; IsPending(sequence); ++spin)
+	{
+		if (spin < 64)
+		{
+			_mm_pause();
+		}
+		else
+		{
+			_completed.wait(_completed.load(std::memory_order_acquire), std::memory_order_acquire);
+		}
+	}
+
+	return true;
+}
+
+_Use_decl_annotations_
+bool TextureHashWorker::TryCollect(
+	Job& job)
+{
+	if (_collected == _completed.load(std::memory_order_acquire))
+	{
+		return false;
+	}
+
+	job = _jobs.items[(_collected + 1) & _mask];
+	++_collected;
+	return true;
+}
+
+bool TextureHashWorker::RunOne()
+{
+	const uint32_t completed = _completed.load(std::memory_order_relaxed);
+
+	if (completed == _queued.load(std::memory_order_acquire))
+	{
+		return false;
+	}
+
+	Job& job = _jobs.items[(completed + 1) & _mask];
+	job.hash = XXH3_64bits(_memory + job.startAddress, job.size);
+
+	_completed.store(completed + 1, std::memory_order_release);
+	_completed.notify_all();
+	return true;
+}
+
+void TextureHashWorker::Run()
+{
+	for (;;)
+	{
+		/* Read the signal before looking for work, so that a job queued in between wakes
+		   the wait below at once. */
+		const uint32_t signal = _signal.load(std::memory_order_acquire);
+
+		if (RunOne())
+		{
+			continue;
+		}
+
+		if (_isStopping.load(std::memory_order_acquire))
+		{
+			return;
+		}
+
+		_signal.wait(signal, std::memory_order_acquire);
+	}
+}
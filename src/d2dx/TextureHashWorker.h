@@ -0,0 +1,102 @@
+/*
+	This file is part of D2DX.
+
+	Copyright (C) 2021  Bolrog
+
+	D2DX is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	D2DX is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with D2DX.  If not, see <https://www.gnu.org/licenses/>.
+*/
+#pragma once
+
+#include "Buffer.h"
+
+namespace d2dx
+{
+	/* Hashes ranges of TMU memory on a worker thread. Jobs are handed over through a ring
+	   without locks: the game thread fills a slot and publishes it by advancing the queued
+	   sequence number, and the worker hashes it and publishes the result by advancing the
+	   completed sequence number. The game thread then collects the results in order, which
+	   frees their slots.
+
+	   The caller must not write TMU memory that a job still reads, see IsPending() and
+	   Wait(). */
+	class TextureHashWorker final
+	{
+	public:
+		struct Job final
+		{
+			uint32_t sequence;
+			uint32_t startAddress;
+			uint32_t size;
+			XXH64_hash_t hash;
+		};
+
+		/* If startThread is false, the jobs are only run by RunOne(), which is for tests. */
+		TextureHashWorker(
+			_In_reads_(memorySize) const uint8_t* memory,
+			_In_ uint32_t memorySize,
+			_In_ uint32_t capacity,
+			_In_ bool startThread = true);
+
+		~TextureHashWorker() noexcept;
+
+		TextureHashWorker(const TextureHashWorker&) = delete;
+
+		TextureHashWorker& operator=(const TextureHashWorker&) = delete;
+
+		/* Queues hashing of the range. Returns false if all slots hold jobs that haven't been
+		   collected. */
+		bool TryEnqueue(
+			_In_ uint32_t startAddress,
+			_In_ uint32_t size,
+			_Out_ uint32_t& sequence);
+
+		/* Whether the job has been queued and isn't finished. Zero, like any sequence number
+		   that hasn't been handed out, is never pending. */
+		bool IsPending(
+			_In_ uint32_t sequence) const;
+
+		/* Waits until the job is finished. Returns whether it had to wait. */
+		bool Wait(
+			_In_ uint32_t sequence);
+
+		/* Takes the result of the next finished job. Returns false if there is none. */
+		bool TryCollect(
+			_Out_ Job& job);
+
+		/* Runs the next queued job on the calling thread. Returns false if there is none. */
+		bool RunOne();
+
+		uint32_t GetWaitCount() const { return _waitCount; }
+
+	private:
+		void Run();
+
+		const uint8_t* _memory;
+		uint32_t _memorySize;
+		Buffer<Job> _jobs;
+		uint32_t _mask;
+
+		/* Written by the game thread only. */
+		uint32_t _collected = 0;
+		uint32_t _waitCount = 0;
+
+		std::atomic<uint32_t> _queued = 0;
+		std::atomic<uint32_t> _completed = 0;
+
+		/* Advanced with every job queued and when stopping, for the worker to wait on. */
+		std::atomic<uint32_t> _signal = 0;
+		std::atomic<bool> _isStopping = false;
+		std::thread _thread;
+	};
+}
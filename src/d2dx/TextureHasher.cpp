@@ -24,16 +24,265 @@
 
 using namespace d2dx;
 
+static const uint32_t PageCount = D2DX_TMU_MEMORY_SIZE / 256;
+
+/* Downloads from 256x128 texels up are hashed on the worker thread, if there is one. */
+static const uint32_t MinBackgroundHashSize = 256 * 128;
+
+/* Smaller downloads than 64x64 texels are cheaper to copy than to hash, so they are only
+   hashed if the texture is used. */
+static const uint32_t MinDownloadHashSize = 64 * 64;
+
+static inline uint64_t GetPageMask(
+	uint32_t firstBit,
+	uint32_t lastBit)
+{
+	return (~0ULL << firstBit) & (~0ULL >> (63 - lastBit));
+}
+
 TextureHasher::TextureHasher() :
-	_cache{ D2DX_TMU_MEMORY_SIZE / 256, true }
+	_entries{ PageCount, true },
+	_dirtyPages{ PageCount / 64, true }
 {
 }
 
 _Use_decl_annotations_
 void TextureHasher::Invalidate(
-	uint32_t startAddress)
+	uint32_t startAddress,
+	uint32_t size)
+{
+	const uint32_t firstPage = startAddress >> 8;
+	const uint32_t lastPage = min((startAddress + max(size, 1U) - 1) >> 8, PageCount - 1);
+
+	WaitForPages(firstPage, lastPage);
+	_entries.items[firstPage].isWrittenAtStart = true;
+
+	for (uint32_t word = firstPage >> 6; word <= (lastPage >> 6); ++word)
+	{
+		_dirtyPages.items[word] |= GetPageMask(
+			word == (firstPage >> 6) ? firstPage & 63 : 0,
+			word == (lastPage >> 6) ? lastPage & 63 : 63);
+	}
+}
+
+_Use_decl_annotations_
+bool TextureHasher::IsAnyPageDirty(
+	uint32_t firstPage,
+	uint32_t lastPage) const
+{
+	for (uint32_t word = firstPage >> 6; word <= (lastPage >> 6); ++word)
+	{
+		const uint64_t mask = GetPageMask(
+			word == (firstPage >> 6) ? firstPage & 63 : 0,
+			word == (lastPage >> 6) ? lastPage & 63 : 63);
+
+		if (_dirtyPages.items[word] & mask)
+		{
+			return true;
+		}
+	}
+
+	return false;
+}
+
+_Use_decl_annotations_
+void TextureHasher::CleanPages(
+	uint32_t firstPage,
+	uint32_t lastPage)
+{
+	uint32_t firstDirtyPage = PageCount;
+	uint32_t lastDirtyPage = 0;
+
+	for (uint32_t word = firstPage >> 6; word <= (lastPage >> 6); ++word)
+	{
+		const uint64_t dirtyPages = _dirtyPages.items[word] & GetPageMask(
+			word == (firstPage >> 6) ? firstPage & 63 : 0,
+			word == (lastPage >> 6) ? lastPage & 63 : 63);
+
+		if (!dirtyPages)
+		{
+			continue;
+		}
+
+		DWORD first, last;
+		BitScanForward64(&first, dirtyPages);
+		BitScanReverse64(&last, dirtyPages);
+		firstDirtyPage = min(firstDirtyPage, (word << 6) + (uint32_t)first);
+		lastDirtyPage = max(lastDirtyPage, (word << 6) + (uint32_t)last);
+
+		_dirtyPages.items[word] &= ~dirtyPages;
+	}
+
+	if (firstDirtyPage > lastDirtyPage)
+	{
+		return;
+	}
+
+	/* No texture is longer than _maxPageCount pages, so only the ones starting that close
+	   before the dirty pages can reach them. */
+	const uint32_t firstEntry = firstDirtyPage >= _maxPageCount ? firstDirtyPage - _maxPageCount + 1 : 0;
+
+	for (uint32_t i = firstEntry; i <= lastDirtyPage; ++i)
+	{
+		Entry& entry = _entries.items[i];
+
+		if (i != firstPage && (entry.hash || entry.isHashPending) && i + max((entry.pixelsSize + 255) >> 8, 1U) > firstDirtyPage)
+		{
+			entry.isStale = true;
+		}
+	}
+}
+
+_Use_decl_annotations_
+void TextureHasher::SetHash(
+	uint32_t startAddress,
+	uint32_t pixelsSize,
+	XXH64_hash_t hash)
+{
+	const uint32_t firstPage = startAddress >> 8;
+	const uint32_t lastPage = min((startAddress + max(pixelsSize, 1U) - 1) >> 8, PageCount - 1);
+
+	CleanPages(firstPage, lastPage);
+	_maxPageCount = max(_maxPageCount, lastPage - firstPage + 1);
+
+	Entry& entry = _entries.items[firstPage];
+	entry.hash = hash;
+	entry.pixelsSize = pixelsSize;
+	entry.isStale = false;
+	entry.isWrittenAtStart = false;
+	entry.isHashPending = false;
+}
+
+_Use_decl_annotations_
+void TextureHasher::WaitForPages(
+	uint32_t firstPage,
+	uint32_t lastPage)
+{
+	if (!_worker)
+	{
+		return;
+	}
+
+	for (uint32_t i = firstPage; i <= lastPage; ++i)
+	{
+		if (_worker->Wait(_pageJobs.items[i]))
+		{
+			AddTexHashWait();
+		}
+	}
+}
+
+void TextureHasher::CollectBackgroundHashes()
+{
+	TextureHashWorker::Job job;
+
+	while (_worker->TryCollect(job))
+	{
+		const uint32_t firstPage = job.startAddress >> 8;
+		const uint32_t lastPage = min((job.startAddress + max(job.size, 1U) - 1) >> 8, PageCount - 1);
+		Entry& entry = _entries.items[firstPage];
+
+		/* A later download at the same address has its own job. */
+		if (!entry.isHashPending || _pageJobs.items[firstPage] != job.sequence)
+		{
+			continue;
+		}
+
+		entry.isHashPending = false;
+
+		if (!entry.isStale && entry.pixelsSize == job.size && !IsAnyPageDirty(firstPage, lastPage))
+		{
+			entry.hash = job.hash;
+		}
+	}
+}
+
+_Use_decl_annotations_
+void TextureHasher::StartWorker(
+	const uint8_t* memory,
+	uint32_t memorySize,
+	bool startThread)
 {
-	_cache.items[startAddress >> 8] = 0;
+	assert(!_worker);
+	_pageJobs = Buffer<uint32_t>(PageCount, true);
+	_worker = std::make_unique<TextureHashWorker>(memory, memorySize, 64, startThread);
+}
+
+_Use_decl_annotations_
+bool TextureHasher::OnDownload(
+	uint32_t startAddress,
+	const uint8_t* pixels,
+	uint32_t size)
+{
+	assert((startAddress & 255) == 0);
+
+	const uint32_t firstPage = startAddress >> 8;
+	const uint32_t lastPage = min((startAddress + max(size, 1U) - 1) >> 8, PageCount - 1);
+	const Entry& entry = _entries.items[firstPage];
+
+	if (_worker && size >= MinBackgroundHashSize)
+	{
+		/* The texels are hashed once they have been copied, see OnDownloadCopied. */
+		Invalidate(startAddress, size);
+		SetHash(startAddress, size, 0);
+		_entries.items[firstPage].isHashPending = true;
+		return true;
+	}
+
+	if (size < MinDownloadHashSize)
+	{
+		Invalidate(startAddress, size);
+		return true;
+	}
+
+	const XXH64_hash_t hash = XXH3_64bits((void*)pixels, size);
+	++_hashCount;
+
+	if (entry.hash == hash &&
+		entry.pixelsSize == size &&
+		!entry.isStale &&
+		!IsAnyPageDirty(firstPage, lastPage))
+	{
+		return false;
+	}
+
+	Invalidate(startAddress, size);
+	SetHash(startAddress, size, hash);
+	return true;
+}
+
+_Use_decl_annotations_
+void TextureHasher::OnDownloadCopied(
+	uint32_t startAddress,
+	uint32_t size)
+{
+	const uint32_t firstPage = startAddress >> 8;
+	const uint32_t lastPage = min((startAddress + max(size, 1U) - 1) >> 8, PageCount - 1);
+	Entry& entry = _entries.items[firstPage];
+
+	if (!entry.isHashPending)
+	{
+		return;
+	}
+
+	CollectBackgroundHashes();
+
+	uint32_t sequence;
+
+	if (!_worker->TryEnqueue(startAddress, size, sequence))
+	{
+		/* The worker thread is behind, so GetHash will hash the texture instead. */
+		entry.isHashPending = false;
+		return;
+	}
+
+	for (uint32_t i = firstPage; i <= lastPage; ++i)
+	{
+		_pageJobs.items[i] = sequence;
+	}
+
+	++_backgroundHashCount;
+	AddTexHashInBackground();
 }
 
 _Use_decl_annotations_
@@ -46,17 +295,42 @@ XXH64_hash_t TextureHasher::GetHash(
 {
 	assert((startAddress & 255) == 0);
 
-	XXH64_hash_t hash = _cache.items[startAddress >> 8];
+	const uint32_t firstPage = startAddress >> 8;
+	const uint32_t lastPage = min((startAddress + max(pixelsSize, 1U) - 1) >> 8, PageCount - 1);
+	const Entry& entry = _entries.items[firstPage];
 	AddTexHashLookup();
 
-	if (!hash)
+	if (entry.isHashPending)
+	{
+		if (_worker->Wait(_pageJobs.items[firstPage]))
+		{
+			AddTexHashWait();
+		}
+
+		CollectBackgroundHashes();
+	}
+
+	XXH64_hash_t hash = entry.hash;
+
+	if (!hash ||
+		entry.isStale ||
+		entry.pixelsSize != pixelsSize ||
+		IsAnyPageDirty(firstPage, lastPage))
 	{
 		AddTexHashMiss(pixelsSize);
-		hash = XXH3_64bits((void *)pixels, pixelsSize);
-		hash ^= static_cast<XXH64_hash_t>(largeLog2 * 0x01000193u);
-		hash ^= static_cast<XXH64_hash_t>(ratioLog2 * 0x01000193u) << 32;
-		_cache.items[startAddress >> 8] = hash;
+		hash = XXH3_64bits((void*)pixels, pixelsSize);
+		++_hashCount;
+
+		if (entry.hash && !entry.isWrittenAtStart && entry.hash != hash)
+		{
+			++_staleHashAvoidedCount;
+			AddTexHashStaleAvoided();
+		}
+
+		SetHash(startAddress, pixelsSize, hash);
 	}
 
+	hash ^= static_cast<XXH64_hash_t>(largeLog2 * 0x01000193u);
+	hash ^= static_cast<XXH64_hash_t>(ratioLog2 * 0x01000193u) << 32;
 	return hash;
 }
@@ -19,17 +19,52 @@
 #pragma once
 
 #include "Buffer.h"
+#include "TextureHashWorker.h"
 
 namespace d2dx
 {
+	/* Caches the hash of the texture at each TMU start address. Writes to TMU memory mark the
+	   256-byte pages they cover as dirty, and a cached hash is only used while no page under
+	   its texture is dirty. A page is made clean when a texture over it is hashed again, and
+	   then the hashes of other textures over the page are dropped too, so textures that
+	   overlap each other never see a stale hash. Larger downloads are hashed on their way into
+	   TMU memory, so their texels don't have to be read again when the texture is used, and
+	   the copy can be skipped if they are already there.
+
+	   Optionally, large downloads are instead hashed on a worker thread once they are in TMU
+	   memory. Each page remembers the last job that reads it, and writes to the page wait
+	   for that job first. */
 	class TextureHasher final
 	{
 	public:
 		TextureHasher();
 		~TextureHasher() noexcept {}
 
+		/* Notes that the TMU memory in the range is about to be written. Waits until the worker
+		   thread no longer reads it. */
 		void Invalidate(
-			_In_ uint32_t startAddress);
+			_In_ uint32_t startAddress,
+			_In_ uint32_t size);
+
+		/* Hashes the texels of a large enough download before they are copied to TMU memory.
+		   Returns false if the same texels are already there, in which case the copy can be
+		   skipped. */
+		bool OnDownload(
+			_In_ uint32_t startAddress,
+			_In_reads_(size) const uint8_t* pixels,
+			_In_ uint32_t size);
+
+		/* Must be called when the texels that OnDownload let through are in TMU memory. */
+		void OnDownloadCopied(
+			_In_ uint32_t startAddress,
+			_In_ uint32_t size);
+
+		/* From now on, hashes large downloads on a worker thread. memory is the TMU memory
+		   that downloads are copied to. */
+		void StartWorker(
+			_In_reads_(memorySize) const uint8_t* memory,
+			_In_ uint32_t memorySize,
+			_In_ bool startThread = true);
 
 		XXH64_hash_t GetHash(
 			_In_ uint32_t startAddress,
@@ -38,7 +73,69 @@ namespace d2dx
 			_In_ uint32_t largeLog2,
 			_In_ uint32_t ratioLog2);
 
+		uint32_t GetHashCount() const noexcept { return _hashCount; }
+
+		/* The number of hashes that would have been taken from the cache if it were only
+		   invalidated by writes at the same start address, and that would have been wrong. */
+		uint32_t GetStaleHashAvoidedCount() const noexcept { return _staleHashAvoidedCount; }
+
+		/* The number of downloads handed to the worker thread. */
+		uint32_t GetBackgroundHashCount() const noexcept { return _backgroundHashCount; }
+
+		/* The number of times the game thread had to wait for the worker thread. */
+		uint32_t GetWaitCount() const noexcept { return _worker ? _worker->GetWaitCount() : 0; }
+
 	private:
-		Buffer<XXH64_hash_t> _cache;
+		struct Entry final
+		{
+			/* The hash of the texels alone, without the LOD parameters. */
+			XXH64_hash_t hash;
+			uint32_t pixelsSize;
+
+			/* A page under the texture was made clean by hashing another texture. */
+			bool isStale;
+
+			/* TMU memory was written starting at the texture's own address. Only used to
+			   count stale hashes avoided. */
+			bool isWrittenAtStart;
+
+			/* The worker thread hashes the texture, in the job stored for its first page. */
+			bool isHashPending;
+		};
+
+		static_assert(sizeof(Entry) == 16, "sizeof(Entry) == 16");
+
+		bool IsAnyPageDirty(
+			_In_ uint32_t firstPage,
+			_In_ uint32_t lastPage) const;
+
+		/* Makes the pages clean and marks the other textures over the dirty ones as stale. */
+		void CleanPages(
+			_In_ uint32_t firstPage,
+			_In_ uint32_t lastPage);
+
+		/* Stores the hash of the texels now at the texture's pages. */
+		void SetHash(
+			_In_ uint32_t startAddress,
+			_In_ uint32_t pixelsSize,
+			_In_ XXH64_hash_t hash);
+
+		/* Waits until the worker thread no longer reads the pages. */
+		void WaitForPages(
+			_In_ uint32_t firstPage,
+			_In_ uint32_t lastPage);
+
+		/* Stores the hashes the worker thread has finished, where still valid. */
+		void CollectBackgroundHashes();
+
+		Buffer<Entry> _entries;
+		Buffer<uint64_t> _dirtyPages;
+		uint32_t _maxPageCount = 1;
+		uint32_t _hashCount = 0;
+		uint32_t _staleHashAvoidedCount = 0;
+
+		std::unique_ptr<TextureHashWorker> _worker;
+		Buffer<uint32_t> _pageJobs;
+		uint32_t _backgroundHashCount = 0;
 	};
 }
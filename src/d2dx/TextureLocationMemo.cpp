@@ -0,0 +1,91 @@
+/*
+	This file is part of D2DX.
+
+	Copyright (C) 2021  Bolrog
+
+	D2DX is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	D2DX is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with D2DX.  If not, see <https://www.gnu.org/licenses/>.
+*/
+#include "pch.h"
+#include "TextureLocationMemo.h"
+#include "Types.h"
+#include "Profiler.h"
+
+using namespace d2dx;
+
+TextureLocationMemo::TextureLocationMemo() :
+	_entries{ D2DX_TMU_MEMORY_SIZE / 256, true }
+{
+}
+
+_Use_decl_annotations_
+bool TextureLocationMemo::Find(
+	uint32_t startAddress,
+	uint64_t hash,
+	TextureCacheLocation& location) const
+{
+	assert((startAddress & 255) == 0);
+
+	const Entry& entry = _entries.items[startAddress >> 8];
+	AddTexLocationMemoLookup();
+
+	if (entry.stamp != _stamp || entry.hash != hash)
+	{
+		location = { -1, -1 };
+		return false;
+	}
+
+	AddTexLocationMemoHit();
+	location = entry.location;
+	return true;
+}
+
+_Use_decl_annotations_
+void TextureLocationMemo::Insert(
+	uint32_t startAddress,
+	uint64_t hash,
+	TextureCacheLocation location)
+{
+	assert((startAddress & 255) == 0);
+
+	Entry& entry = _entries.items[startAddress >> 8];
+	entry.hash = hash;
+	entry.location = location;
+	entry.stamp = _stamp;
+}
+
+_Use_decl_annotations_
+void TextureLocationMemo::Invalidate(
+	uint32_t startAddress,
+	uint32_t size)
+{
+	const uint32_t first = startAddress >> 8;
+	const uint32_t last = min((startAddress + max(size, 1U) - 1) >> 8, _entries.capacity - 1);
+
+	for (uint32_t i = first; i <= last; ++i)
+	{
+		_entries.items[i].stamp = 0;
+	}
+}
+
+void TextureLocationMemo::InvalidateAll()
+{
+	++_stamp;
+
+	/* Stamp zero marks invalidated entries, so skip it when wrapping around. */
+	if (_stamp == 0)
+	{
+		memset(_entries.items, 0, sizeof(Entry) * _entries.capacity);
+		_stamp = 1;
+	}
+}
@@ -0,0 +1,64 @@
+/*
+	This file is part of D2DX.
+
+	Copyright (C) 2021  Bolrog
+
+	D2DX is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	D2DX is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with D2DX.  If not, see <https://www.gnu.org/licenses/>.
+*/
+#pragma once
+
+#include "Buffer.h"
+#include "ITextureCache.h"
+
+namespace d2dx
+{
+	/* Remembers where in the texture cache the texture at a given TMU start address was
+	   placed during the current frame, so that repeated draws with the same texture can skip
+	   the cache lookup. Entries are only valid until the next call to InvalidateAll(). */
+	class TextureLocationMemo final
+	{
+	public:
+		TextureLocationMemo();
+		~TextureLocationMemo() noexcept {}
+
+		bool Find(
+			_In_ uint32_t startAddress,
+			_In_ uint64_t hash,
+			_Out_ TextureCacheLocation& location) const;
+
+		void Insert(
+			_In_ uint32_t startAddress,
+			_In_ uint64_t hash,
+			_In_ TextureCacheLocation location);
+
+		void Invalidate(
+			_In_ uint32_t startAddress,
+			_In_ uint32_t size);
+
+		void InvalidateAll();
+
+	private:
+		struct Entry final
+		{
+			uint64_t hash;
+			TextureCacheLocation location;
+			uint16_t stamp;
+		};
+
+		static_assert(sizeof(Entry) == 16, "sizeof(Entry) == 16");
+
+		Buffer<Entry> _entries;
+		uint16_t _stamp = 1;
+	};
+}
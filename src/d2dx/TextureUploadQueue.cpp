@@ -0,0 +1,98 @@
+/*
+	This file is part of D2DX.
+
+	Copyright (C) 2021  Bolrog
+
+	D2DX is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	D2DX is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with D2DX.  If not, see <https://www.gnu.org/licenses/>.
+*/
+#include "pch.h"
+#include "TextureUploadQueue.h"
+#include "Profiler.h"
+
+using namespace d2dx;
+
+/* Keeps the staged textures aligned for fast copies. */
+static const uint32_t StagingAlignment = 16;
+
+/* Textures are at least 8x8, so this many uploads always fit in the budget. */
+static const uint32_t MinTextureBytes = 8 * 8;
+
+_Use_decl_annotations_
+TextureUploadQueue::TextureUploadQueue(
+	uint32_t budgetBytes) :
+	_staging{ budgetBytes & ~(StagingAlignment - 1) },
+	_pending{ max(1U, (budgetBytes & ~(StagingAlignment - 1)) / MinTextureBytes) }
+{
+}
+
+_Use_decl_annotations_
+bool TextureUploadQueue::Enqueue(
+	ID3D11Texture2D* texture,
+	uint32_t subresource,
+	uint32_t x,
+	uint32_t y,
+	uint32_t width,
+	uint32_t height,
+	const uint8_t* data)
+{
+	const uint32_t size = width * height;
+	const uint32_t alignedSize = (size + StagingAlignment - 1) & ~(StagingAlignment - 1);
+
+	if (alignedSize > _staging.capacity - _stagingUsed || _pendingCount >= _pending.capacity)
+	{
+		++_overflowCount;
+		AddTexUploadOverflow();
+		return false;
+	}
+
+	TextureUpload& upload = _pending.items[_pendingCount++];
+	upload.texture = texture;
+	upload.subresource = subresource;
+	upload.dataOffset = _stagingUsed;
+	upload.x = (uint16_t)x;
+	upload.y = (uint16_t)y;
+	upload.width = (uint16_t)width;
+	upload.height = (uint16_t)height;
+
+	memcpy(&_staging.items[_stagingUsed], data, size);
+	_stagingUsed += alignedSize;
+
+	return true;
+}
+
+_Use_decl_annotations_
+void TextureUploadQueue::Flush(
+	ID3D11DeviceContext* deviceContext)
+{
+	for (uint32_t i = 0; i < _pendingCount; ++i)
+	{
+		const TextureUpload& upload = _pending.items[i];
+
+#ifndef D2DX_UNITTEST
+		CD3D11_BOX box;
+		box.left = upload.x;
+		box.top = upload.y;
+		box.right = upload.x + upload.width;
+		box.bottom = upload.y + upload.height;
+		box.front = 0;
+		box.back = 1;
+
+		deviceContext->UpdateSubresource(upload.texture, upload.subresource, &box, &_staging.items[upload.dataOffset], upload.width, 0);
+#endif
+		AddTexUpload(upload.width * upload.height);
+	}
+
+	_pendingCount = 0;
+	_stagingUsed = 0;
+}
@@ -0,0 +1,97 @@
+/*
+	This file is part of D2DX.
+
+	Copyright (C) 2021  Bolrog
+
+	D2DX is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	D2DX is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with D2DX.  If not, see <https://www.gnu.org/licenses/>.
+*/
+#pragma once
+
+#include "Buffer.h"
+
+namespace d2dx
+{
+	struct TextureUpload final
+	{
+		ID3D11Texture2D* texture;
+		uint32_t subresource;
+		uint32_t dataOffset;
+		uint16_t x;
+		uint16_t y;
+		uint16_t width;
+		uint16_t height;
+	};
+
+	/* Collects the texture uploads of a frame, so that they can be sent to the device in one
+	   pass before the frame is drawn, instead of one at a time while the game is issuing draw
+	   calls. The texels are copied to a staging buffer as they arrive, since the TMU memory
+	   they come from is overwritten during the frame.
+
+	   The staging buffer is the upload budget of a frame. When it is full, Enqueue fails and
+	   the caller must flush the queue and upload the texture immediately instead, so that
+	   the uploads still reach the device in order. */
+	class TextureUploadQueue final
+	{
+	public:
+		TextureUploadQueue(
+			_In_ uint32_t budgetBytes);
+
+		~TextureUploadQueue() noexcept {}
+
+		/* Copies width x height texels from data (with a pitch of width) for uploading to the
+		   given rectangle of a texture subresource. Returns false if the frame's budget is
+		   used up. */
+		bool Enqueue(
+			_In_ ID3D11Texture2D* texture,
+			_In_ uint32_t subresource,
+			_In_ uint32_t x,
+			_In_ uint32_t y,
+			_In_ uint32_t width,
+			_In_ uint32_t height,
+			_In_reads_(width * height) const uint8_t* data);
+
+		/* Uploads everything queued and starts over. */
+		void Flush(
+			_In_opt_ ID3D11DeviceContext* deviceContext);
+
+		uint32_t GetPendingCount() const { return _pendingCount; }
+
+		uint32_t GetPendingBytes() const { return _stagingUsed; }
+
+		const TextureUpload& GetPending(
+			_In_ uint32_t index) const
+		{
+			assert(index < _pendingCount);
+			return _pending.items[index];
+		}
+
+		const uint8_t* GetPendingData(
+			_In_ uint32_t index) const
+		{
+			return &_staging.items[GetPending(index).dataOffset];
+		}
+
+		uint32_t GetBudget() const { return _staging.capacity; }
+
+		/* The number of textures that did not fit in the budget of their frame. */
+		uint32_t GetOverflowCount() const { return _overflowCount; }
+
+	private:
+		Buffer<uint8_t> _staging;
+		uint32_t _stagingUsed = 0;
+		Buffer<TextureUpload> _pending;
+		uint32_t _pendingCount = 0;
+		uint32_t _overflowCount = 0;
+	};
+}
@@ -23,11 +23,14 @@
 #define D2DX_SIDE_TMU_MEMORY_SIZE (1 * 1024 * 1024)
 #define D2DX_MAX_BATCHES_PER_FRAME 16384
 #define D2DX_MAX_VERTICES_PER_FRAME (1024 * 1024)
+#define D2DX_MAX_INDICES_PER_FRAME (1024 * 1024)
+#define D2DX_MAX_SPRITES_PER_FRAME D2DX_MAX_BATCHES_PER_FRAME
+#define D2DX_TEXTURE_CACHE_COUNT 7
 
-#define D2DX_MAX_GAME_PALETTES 14
-#define D2DX_WHITE_PALETTE_INDEX 14
-#define D2DX_LOGO_PALETTE_INDEX 15
-#define D2DX_MAX_PALETTES 16
+#define D2DX_MAX_GAME_PALETTES 62
+#define D2DX_WHITE_PALETTE_INDEX 62
+#define D2DX_LOGO_PALETTE_INDEX 63
+#define D2DX_MAX_PALETTES 64
 
 #define D2DX_SURFACE_UI 0
 #define D2DX_SURFACE_CURSOR 1
@@ -56,7 +59,8 @@ namespace d2dx
 		Points = 0,
 		Lines = 1,
 		Triangles = 2,
-		Count = 3
+		Sprites = 3,
+		Count = 4
 	};
 
 	enum class AlphaBlend
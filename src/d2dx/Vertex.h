@@ -20,17 +20,30 @@
 
 namespace d2dx
 {
+	/* Positions are stored as 13.3 fixed point, which holds the integer and half-pixel
+	   coordinates the game uses exactly, between -4096 and 4096. Anything finer is rounded
+	   to the nearest 1/8 pixel.
+
+	   The palette index has 6 bits: the low 5 are stored above the 11-bit atlas index, and
+	   the high one above the chroma key flag.
+
+	   Texcoords carry log2 of their texture's size above TEXCOORD_SIZE_SHIFT, or 0 if it
+	   isn't known, so that the bilinear pixel shader can keep its taps inside the texture.
+	   The texcoords themselves must be between -1024 and 1023. */
 	class Vertex final
 	{
 	public:
+		static const int32_t POSITION_FRACTION_BITS = 3;
+		static const int32_t TEXCOORD_SIZE_SHIFT = 11;
+
 		Vertex() noexcept :
 			_x{ 0 },
 			_y{ 0 },
 			_s{ 0 },
 			_t{ 0 },
 			_color{ 0 },
-			_isChromaKeyEnabled_surfaceId{ 0 },
-			_paletteIndex_atlasIndex{ 0 }
+			_paletteIndexHigh_isChromaKeyEnabled_surfaceId{ 0 },
+			_paletteIndexLow_atlasIndex{ 0 }
 		{
 		}
 
@@ -44,18 +57,18 @@ namespace d2dx
 			int32_t atlasIndex,
 			int32_t paletteIndex,
 			int32_t surfaceId) noexcept :
-			_x(x),
-			_y(y),
+			_x(ToFixedPoint(x)),
+			_y(ToFixedPoint(y)),
 			_s(s),
 			_t(t),
 			_color(color),
-			_isChromaKeyEnabled_surfaceId((isChromaKeyEnabled ? 0x4000 : 0) | (surfaceId & 16383)),
-			_paletteIndex_atlasIndex((paletteIndex << 12) | (atlasIndex & 4095))
+			_paletteIndexHigh_isChromaKeyEnabled_surfaceId(((paletteIndex & 32) << 10) | (isChromaKeyEnabled ? 0x4000 : 0) | (surfaceId & 16383)),
+			_paletteIndexLow_atlasIndex(((paletteIndex & 31) << 11) | (atlasIndex & 2047))
 		{
 			assert(s >= INT16_MIN && s <= INT16_MAX);
 			assert(t >= INT16_MIN && t <= INT16_MAX);
 			assert(paletteIndex >= 0 && paletteIndex < D2DX_MAX_PALETTES);
-			assert(atlasIndex >= 0 && atlasIndex <= 4095);
+			assert(atlasIndex >= 0 && atlasIndex <= 2047);
 			assert(surfaceId >= 0 && surfaceId <= 16383);
 		}
 
@@ -63,36 +76,55 @@ namespace d2dx
 			_In_ int32_t x,
 			_In_ int32_t y) noexcept
 		{
-			_x += x;
-			_y += y;
+			_x = Saturate(_x + (x << POSITION_FRACTION_BITS));
+			_y = Saturate(_y + (y << POSITION_FRACTION_BITS));
 		}
 
 		inline float GetX() const noexcept
 		{
-			return _x;
+			return _x * (1.0f / (1 << POSITION_FRACTION_BITS));
 		}
 
 		inline float GetY() const noexcept
 		{
-			return _y;
+			return _y * (1.0f / (1 << POSITION_FRACTION_BITS));
 		}
 
 		inline void SetPosition(float x, float y) noexcept
 		{
-			_x = x;
-			_y = y;
+			_x = ToFixedPoint(x);
+			_y = ToFixedPoint(y);
+		}
+
+		/* The position in 13.3 fixed point, as stored. */
+		inline int32_t GetFixedPointX() const noexcept
+		{
+			return _x;
+		}
+
+		inline int32_t GetFixedPointY() const noexcept
+		{
+			return _y;
+		}
+
+		inline void SetFixedPointPosition(int32_t x, int32_t y) noexcept
+		{
+			assert(x >= INT16_MIN && x <= INT16_MAX);
+			assert(y >= INT16_MIN && y <= INT16_MAX);
+			_x = (int16_t)x;
+			_y = (int16_t)y;
 		}
 
 		inline void SetSurfaceId(int32_t surfaceId) noexcept
 		{
 			assert(surfaceId >= 0 && surfaceId <= 16383);
-			_isChromaKeyEnabled_surfaceId &= ~16383;
-			_isChromaKeyEnabled_surfaceId |= surfaceId & 16383;
+			_paletteIndexHigh_isChromaKeyEnabled_surfaceId &= ~16383;
+			_paletteIndexHigh_isChromaKeyEnabled_surfaceId |= surfaceId & 16383;
 		}
 
 		inline int32_t GetSurfaceId() const noexcept
 		{
-			return _isChromaKeyEnabled_surfaceId & 16383;
+			return _paletteIndexHigh_isChromaKeyEnabled_surfaceId & 16383;
 		}
 
 		inline int32_t GetS() const noexcept
@@ -113,10 +145,39 @@ namespace d2dx
 			_t = t;
 		}
 
+		inline void AddTexcoordOffset(
+			_In_ int32_t s,
+			_In_ int32_t t) noexcept
+		{
+			assert(_s + s >= INT16_MIN && _s + s <= INT16_MAX);
+			assert(_t + t >= INT16_MIN && _t + t <= INT16_MAX);
+			_s += s;
+			_t += t;
+		}
+
+		/* The bits to add to a texcoord to carry the size of its texture. */
+		static inline int32_t GetTexcoordSizeBits(int32_t textureSize) noexcept
+		{
+			DWORD log2Size;
+			BitScanReverse(&log2Size, (uint32_t)textureSize);
+			assert(textureSize == 1 << log2Size && log2Size <= 8);
+			return (int32_t)log2Size << TEXCOORD_SIZE_SHIFT;
+		}
+
 		inline void SetAtlasIndex(int32_t atlasIndex) noexcept
 		{
-			assert(atlasIndex >= 0 && atlasIndex <= 4095);
-			_paletteIndex_atlasIndex = (_paletteIndex_atlasIndex & ~4095) | (atlasIndex & 4095);
+			assert(atlasIndex >= 0 && atlasIndex <= 2047);
+			_paletteIndexLow_atlasIndex = (_paletteIndexLow_atlasIndex & ~2047) | (atlasIndex & 2047);
+		}
+
+		inline int32_t GetAtlasIndex() const noexcept
+		{
+			return _paletteIndexLow_atlasIndex & 2047;
+		}
+
+		inline int32_t GetPaletteIndex() const noexcept
+		{
+			return (_paletteIndexLow_atlasIndex >> 11) | ((_paletteIndexHigh_isChromaKeyEnabled_surfaceId >> 10) & 32);
 		}
 
 		inline uint32_t GetColor() const noexcept
@@ -131,18 +192,29 @@ namespace d2dx
 
 		inline bool IsChromaKeyEnabled() const noexcept
 		{
-			return (_isChromaKeyEnabled_surfaceId & 0x4000) != 0;
+			return (_paletteIndexHigh_isChromaKeyEnabled_surfaceId & 0x4000) != 0;
 		}
 
 	private:
-		float _x;
-		float _y;
+		static inline int16_t Saturate(int32_t value) noexcept
+		{
+			return (int16_t)max(INT16_MIN, min(INT16_MAX, value));
+		}
+
+		/* Rounds to nearest, in the default rounding mode. */
+		static inline int16_t ToFixedPoint(float value) noexcept
+		{
+			return Saturate(_mm_cvtss_si32(_mm_set_ss(value * (1 << POSITION_FRACTION_BITS))));
+		}
+
+		int16_t _x;
+		int16_t _y;
 		int16_t _s;
 		int16_t _t;
 		uint32_t _color;
-		uint16_t _paletteIndex_atlasIndex;
-		uint16_t _isChromaKeyEnabled_surfaceId;
+		uint16_t _paletteIndexLow_atlasIndex;
+		uint16_t _paletteIndexHigh_isChromaKeyEnabled_surfaceId;
 	};
 
-	static_assert(sizeof(Vertex) == 20, "sizeof(Vertex)");
+	static_assert(sizeof(Vertex) == 16, "sizeof(Vertex)");
 }
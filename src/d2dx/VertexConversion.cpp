@@ -0,0 +1,304 @@
+/*
+	This file is part of D2DX.
+
+	Copyright (C) 2021  Bolrog
+
+	D2DX is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	D2DX is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with D2DX.  If not, see <https://www.gnu.org/licenses/>.
+*/
+#include "pch.h"
+#include "VertexConversion.h"
+
+using namespace d2dx;
+
+typedef void(*ConvertVerticesFn)(
+	const D2::Vertex* const* d2Vertices,
+	uint32_t count,
+	const VertexConversionParams& params,
+	Vertex* vertices,
+	BatchBounds& bounds);
+
+static void ConvertVerticesScalar(
+	const D2::Vertex* const* d2Vertices,
+	uint32_t count,
+	const VertexConversionParams& params,
+	Vertex* vertices,
+	BatchBounds& bounds)
+{
+	Vertex v = params.templateVertex;
+
+	for (uint32_t i = 0; i < count; ++i)
+	{
+		const D2::Vertex* d2Vertex = d2Vertices[i];
+		v.SetPosition(d2Vertex->x, d2Vertex->y);
+		v.SetTexcoord((int32_t)d2Vertex->s >> params.stShift, (int32_t)d2Vertex->t >> params.stShift);
+		v.AddTexcoordOffset(params.texcoordOffset.x, params.texcoordOffset.y);
+		v.SetColor(params.maskedConstantColor | (d2Vertex->color & params.iteratedColorMask));
+		vertices[i] = v;
+	}
+
+	bounds = GetVertexBounds(vertices, count);
+}
+
+#ifdef D2DX_SIMD_X86
+
+/* The SIMD kernels build each vertex as four dwords: the position, the texcoords, the color,
+   and the last dword of the template vertex, which holds the palette index, atlas index,
+   chroma key and surface id. They only need SSE2 and AVX2, so the SSE2 kernel also
+   serves the SSE4.1 slot and the AVX2 kernel the AVX-512 slot. */
+
+struct VertexConstants final
+{
+	__m128i colorMask;
+	__m128i colorConstant;
+	__m128i stShift;
+	__m128i texcoordOffset;
+};
+
+static inline VertexConstants MakeVertexConstants(
+	const VertexConversionParams& params)
+{
+	static_assert(sizeof(Vertex) == 16, "sizeof(Vertex)");
+	const __m128i templateVertex = _mm_loadu_si128((const __m128i*)&params.templateVertex);
+
+	return {
+		_mm_setr_epi32(0, 0, (int32_t)params.iteratedColorMask, 0),
+		_mm_or_si128(
+			_mm_and_si128(templateVertex, _mm_setr_epi32(0, 0, 0, -1)),
+			_mm_setr_epi32(0, 0, (int32_t)params.maskedConstantColor, 0)),
+		_mm_cvtsi32_si128(params.stShift),
+		_mm_setr_epi32(0, 0, params.texcoordOffset.x, params.texcoordOffset.y),
+	};
+}
+
+/* Turns the smallest and largest packed positions into bounds rounded outwards. */
+static inline BatchBounds MakeBatchBounds(
+	uint32_t minPosition,
+	uint32_t maxPosition)
+{
+	const int32_t fractionBits = Vertex::POSITION_FRACTION_BITS;
+	const int32_t roundUp = (1 << fractionBits) - 1;
+
+	BatchBounds bounds;
+	bounds.left = (int16_t)((int16_t)minPosition >> fractionBits);
+	bounds.top = (int16_t)((int16_t)(minPosition >> 16) >> fractionBits);
+	bounds.right = (int16_t)(((int16_t)maxPosition + roundUp) >> fractionBits);
+	bounds.bottom = (int16_t)(((int16_t)(maxPosition >> 16) + roundUp) >> fractionBits);
+	return bounds;
+}
+
+static inline __m128i ConvertVertexSse2(
+	const D2::Vertex* d2Vertex,
+	const VertexConstants& constants)
+{
+	const __m128 xyColor = _mm_loadu_ps(&d2Vertex->x);
+	const __m128 st = _mm_castsi128_ps(_mm_loadl_epi64((const __m128i*)&d2Vertex->s));
+	const __m128 xyst = _mm_shuffle_ps(
+		_mm_mul_ps(xyColor, _mm_set1_ps((float)(1 << Vertex::POSITION_FRACTION_BITS))), st, _MM_SHUFFLE(1, 0, 1, 0));
+
+	/* Positions round to nearest and saturate, like Vertex::SetPosition. Texcoords truncate
+	   and keep their low 16 bits, like Vertex::SetTexcoord. */
+	const __m128i position = _mm_packs_epi32(_mm_cvtps_epi32(xyst), _mm_setzero_si128());
+	const __m128i texcoord = _mm_shufflehi_epi16(_mm_add_epi32(
+		_mm_sra_epi32(_mm_cvttps_epi32(xyst), constants.stShift), constants.texcoordOffset), _MM_SHUFFLE(3, 1, 2, 0));
+	const __m128i positionTexcoord = _mm_unpacklo_epi32(position, _mm_srli_si128(texcoord, 8));
+	const __m128i colorMisc = _mm_or_si128(
+		_mm_and_si128(_mm_castps_si128(xyColor), constants.colorMask), constants.colorConstant);
+
+	return _mm_castps_si128(_mm_shuffle_ps(
+		_mm_castsi128_ps(positionTexcoord), _mm_castsi128_ps(colorMisc), _MM_SHUFFLE(3, 2, 1, 0)));
+}
+
+static void ConvertVerticesSse2(
+	const D2::Vertex* const* d2Vertices,
+	uint32_t count,
+	const VertexConversionParams& params,
+	Vertex* vertices,
+	BatchBounds& bounds)
+{
+	const VertexConstants constants = MakeVertexConstants(params);
+
+	__m128i minPosition = _mm_set1_epi16(INT16_MAX);
+	__m128i maxPosition = _mm_set1_epi16(INT16_MIN);
+
+	for (uint32_t i = 0; i < count; ++i)
+	{
+		const __m128i vertex = ConvertVertexSse2(d2Vertices[i], constants);
+		_mm_storeu_si128((__m128i*)&vertices[i], vertex);
+		minPosition = _mm_min_epi16(minPosition, vertex);
+		maxPosition = _mm_max_epi16(maxPosition, vertex);
+	}
+
+	bounds = MakeBatchBounds((uint32_t)_mm_cvtsi128_si32(minPosition), (uint32_t)_mm_cvtsi128_si32(maxPosition));
+}
+
+/* Converts two vertices at a time, one in each 128-bit lane. */
+D2DX_SIMD_TARGET("avx2")
+static void ConvertVerticesAvx2(
+	const D2::Vertex* const* d2Vertices,
+	uint32_t count,
+	const VertexConversionParams& params,
+	Vertex* vertices,
+	BatchBounds& bounds)
+{
+	const VertexConstants constants = MakeVertexConstants(params);
+	const __m256i colorMask = _mm256_broadcastsi128_si256(constants.colorMask);
+	const __m256i colorConstant = _mm256_broadcastsi128_si256(constants.colorConstant);
+	const __m256i texcoordOffset = _mm256_broadcastsi128_si256(constants.texcoordOffset);
+	const __m256 scale = _mm256_set1_ps((float)(1 << Vertex::POSITION_FRACTION_BITS));
+
+	__m256i minPositions = _mm256_set1_epi16(INT16_MAX);
+	__m256i maxPositions = _mm256_set1_epi16(INT16_MIN);
+	uint32_t i = 0;
+
+	for (; i + 1 < count; i += 2)
+	{
+		const D2::Vertex* d2Vertex0 = d2Vertices[i];
+		const D2::Vertex* d2Vertex1 = d2Vertices[i + 1];
+
+		const __m256 xyColor = _mm256_insertf128_ps(
+			_mm256_castps128_ps256(_mm_loadu_ps(&d2Vertex0->x)), _mm_loadu_ps(&d2Vertex1->x), 1);
+		const __m256 st = _mm256_castsi256_ps(_mm256_inserti128_si256(
+			_mm256_castsi128_si256(_mm_loadl_epi64((const __m128i*)&d2Vertex0->s)),
+			_mm_loadl_epi64((const __m128i*)&d2Vertex1->s), 1));
+		const __m256 xyst = _mm256_shuffle_ps(_mm256_mul_ps(xyColor, scale), st, _MM_SHUFFLE(1, 0, 1, 0));
+
+		const __m256i position = _mm256_packs_epi32(_mm256_cvtps_epi32(xyst), _mm256_setzero_si256());
+		const __m256i texcoord = _mm256_shufflehi_epi16(_mm256_add_epi32(
+			_mm256_sra_epi32(_mm256_cvttps_epi32(xyst), constants.stShift), texcoordOffset), _MM_SHUFFLE(3, 1, 2, 0));
+		const __m256i positionTexcoord = _mm256_unpacklo_epi32(position, _mm256_srli_si256(texcoord, 8));
+		const __m256i colorMisc = _mm256_or_si256(
+			_mm256_and_si256(_mm256_castps_si256(xyColor), colorMask), colorConstant);
+
+		const __m256i vertex = _mm256_castps_si256(_mm256_shuffle_ps(
+			_mm256_castsi256_ps(positionTexcoord), _mm256_castsi256_ps(colorMisc), _MM_SHUFFLE(3, 2, 1, 0)));
+		_mm256_storeu_si256((__m256i*)&vertices[i], vertex);
+		minPositions = _mm256_min_epi16(minPositions, vertex);
+		maxPositions = _mm256_max_epi16(maxPositions, vertex);
+	}
+
+	__m128i minPosition = _mm_min_epi16(_mm256_castsi256_si128(minPositions), _mm256_extracti128_si256(minPositions, 1));
+	__m128i maxPosition = _mm_max_epi16(_mm256_castsi256_si128(maxPositions), _mm256_extracti128_si256(maxPositions, 1));
+
+	if (i < count)
+	{
+		const __m128i vertex = ConvertVertexSse2(d2Vertices[i], constants);
+		_mm_storeu_si128((__m128i*)&vertices[i], vertex);
+		minPosition = _mm_min_epi16(minPosition, vertex);
+		maxPosition = _mm_max_epi16(maxPosition, vertex);
+	}
+
+	bounds = MakeBatchBounds((uint32_t)_mm_cvtsi128_si32(minPosition), (uint32_t)_mm_cvtsi128_si32(maxPosition));
+
+	/* The caller is SSE2 code. */
+	_mm256_zeroupper();
+}
+
+static const ConvertVerticesFn convertVerticesKernels[] =
+{
+	ConvertVerticesScalar,
+	ConvertVerticesSse2,
+	ConvertVerticesAvx2,
+	ConvertVerticesAvx2,
+};
+
+#else
+
+static const ConvertVerticesFn convertVerticesKernels[] =
+{
+	ConvertVerticesScalar,
+	ConvertVerticesScalar,
+	ConvertVerticesScalar,
+	ConvertVerticesScalar,
+};
+
+#endif
+
+static_assert(sizeof(convertVerticesKernels) / sizeof(convertVerticesKernels[0]) == (size_t)SimdKernel::Count, "one ConvertVertices kernel per SimdKernel");
+
+_Use_decl_annotations_
+bool d2dx::IsAnyVertexOnScreen(
+	const D2::Vertex* const* d2Vertices,
+	uint32_t count,
+	Size screenSize)
+{
+	for (uint32_t i = 0; i < count; ++i)
+	{
+		const D2::Vertex* d2Vertex = d2Vertices[i];
+
+		if (0 <= d2Vertex->x && d2Vertex->x < screenSize.width &&
+			0 <= d2Vertex->y && d2Vertex->y < screenSize.height)
+		{
+			return true;
+		}
+	}
+
+	return false;
+}
+
+_Use_decl_annotations_
+void d2dx::ConvertVertices(
+	const D2::Vertex* const* d2Vertices,
+	uint32_t count,
+	const VertexConversionParams& params,
+	Vertex* vertices,
+	BatchBounds& bounds)
+{
+	ConvertVertices(GetBestSimdKernel(), d2Vertices, count, params, vertices, bounds);
+}
+
+_Use_decl_annotations_
+void d2dx::ConvertVertices(
+	SimdKernel kernel,
+	const D2::Vertex* const* d2Vertices,
+	uint32_t count,
+	const VertexConversionParams& params,
+	Vertex* vertices,
+	BatchBounds& bounds)
+{
+	assert(IsSimdKernelSupported(kernel));
+	assert(count > 0);
+	convertVerticesKernels[(int32_t)kernel](d2Vertices, count, params, vertices, bounds);
+}
+
+_Use_decl_annotations_
+BatchBounds d2dx::GetVertexBounds(
+	const Vertex* vertices,
+	uint32_t count)
+{
+	BatchBounds bounds = BatchBounds::Empty();
+
+	if (count > 0)
+	{
+		float left = vertices->GetX();
+		float top = vertices->GetY();
+		float right = left;
+		float bottom = top;
+
+		for (auto i = vertices + 1, end = vertices + count; i < end; ++i)
+		{
+			left = min(left, i->GetX());
+			top = min(top, i->GetY());
+			right = max(right, i->GetX());
+			bottom = max(bottom, i->GetY());
+		}
+
+		/* Round outwards, so that every pixel the vertices can touch is inside. */
+		bounds.left = (int16_t)max(floorf(left), (float)INT16_MIN);
+		bounds.top = (int16_t)max(floorf(top), (float)INT16_MIN);
+		bounds.right = (int16_t)min(ceilf(right), (float)INT16_MAX);
+		bounds.bottom = (int16_t)min(ceilf(bottom), (float)INT16_MAX);
+	}
+
+	return bounds;
+}
@@ -0,0 +1,68 @@
+/*
+	This file is part of D2DX.
+
+	Copyright (C) 2021  Bolrog
+
+	D2DX is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	D2DX is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with D2DX.  If not, see <https://www.gnu.org/licenses/>.
+*/
+#pragma once
+
+#include "BatchReorderer.h"
+#include "D2Types.h"
+#include "Simd.h"
+#include "Types.h"
+#include "Vertex.h"
+
+namespace d2dx
+{
+	/* How game vertices map to ours. Every converted vertex takes its palette index, atlas
+	   index, chroma key and surface id from templateVertex. texcoordOffset is added after
+	   the shift, for textures that share an atlas slice with others. */
+	struct VertexConversionParams final
+	{
+		Vertex templateVertex;
+		uint32_t iteratedColorMask = 0;
+		uint32_t maskedConstantColor = 0;
+		int32_t stShift = 0;
+		Offset texcoordOffset{ 0, 0 };
+	};
+
+	/* Returns true if any of the game vertices is on the screen. */
+	bool IsAnyVertexOnScreen(
+		_In_reads_(count) const D2::Vertex* const* d2Vertices,
+		_In_ uint32_t count,
+		_In_ Size screenSize);
+
+	/* Converts count game vertices, shifting the texcoords and masking the colors. bounds
+	   receives the bounds of the converted positions, rounded outwards to whole pixels. */
+	void ConvertVertices(
+		_In_reads_(count) const D2::Vertex* const* d2Vertices,
+		_In_ uint32_t count,
+		_In_ const VertexConversionParams& params,
+		_Out_writes_(count) Vertex* vertices,
+		_Out_ BatchBounds& bounds);
+
+	void ConvertVertices(
+		_In_ SimdKernel kernel,
+		_In_reads_(count) const D2::Vertex* const* d2Vertices,
+		_In_ uint32_t count,
+		_In_ const VertexConversionParams& params,
+		_Out_writes_(count) Vertex* vertices,
+		_Out_ BatchBounds& bounds);
+
+	/* The bounds of the vertex positions, rounded outwards to whole pixels. */
+	BatchBounds GetVertexBounds(
+		_In_reads_(count) const Vertex* vertices,
+		_In_ uint32_t count);
+}
@@ -0,0 +1,233 @@
+/*
+	This file is part of D2DX.
+
+	Copyright (C) 2021  Bolrog
+
+	D2DX is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	D2DX is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with D2DX.  If not, see <https://www.gnu.org/licenses/>.
+*/
+#include "pch.h"
+#include "VertexRing.h"
+
+using namespace d2dx;
+
+_Use_decl_annotations_
+VertexRing::VertexRing(
+	IVertexRingStorage* storage,
+	uint32_t capacity,
+	uint32_t frameReserve,
+	uint32_t maxFrameVertexCount,
+	bool isStaged) :
+	_storage{ storage },
+	_capacity{ capacity },
+	_frameReserve{ min(frameReserve, capacity - WriteReserve) },
+	_maxFrameVertexCount{ min(maxFrameVertexCount, capacity - WriteReserve) },
+	_isStaged{ isStaged },
+	_staging{ 0, _maxFrameVertexCount }
+{
+	assert(storage && capacity > WriteReserve);
+}
+
+_Use_decl_annotations_
+Vertex* VertexRing::AppendSlow(
+	uint32_t count)
+{
+	switch (_state)
+	{
+	case State::Idle:
+		BeginFrame(count);
+		return Append(count);
+
+	case State::Suspended:
+		if (_frameVertexCount + count <= GetFrameVertexLimit())
+		{
+			_mappedVertices = _storage->MapVertices(false);
+			_state = State::Mapped;
+			return Append(count);
+		}
+		break;
+
+	case State::Staged:
+		if (_staging.Reserve(_frameVertexCount, count))
+		{
+			Vertex* vertices = _staging.GetItems() + _frameVertexCount;
+			_frameVertexCount += count;
+			return vertices;
+		}
+		break;
+
+	case State::Mapped:
+	default:
+		break;
+	}
+
+	/* The caller keeps frames within GetFrameVertexLimit(). */
+	D2DX_FATAL_ERROR("Too many vertices in frame.");
+}
+
+_Use_decl_annotations_
+void VertexRing::BeginFrame(
+	uint32_t count)
+{
+	assert(_state == State::Idle && _frameVertexCount == 0);
+
+	if (_isStaged)
+	{
+		_state = State::Staged;
+		return;
+	}
+
+	/* Frames are recorded in place, so the first vertices must fit as well. */
+	const bool discard = _cursor + max(_frameReserve, count) + WriteReserve > _capacity;
+
+	if (discard)
+	{
+		_cursor = 0;
+		++_discardCount;
+	}
+
+	_frameStart = _cursor;
+	_mappedVertices = _storage->MapVertices(discard);
+	_state = State::Mapped;
+}
+
+uint32_t VertexRing::GetFrameVertexLimit() const noexcept
+{
+	switch (_state)
+	{
+	case State::Mapped:
+	case State::Suspended:
+		return _frameWriteCount ? _frameVertexCount : min(_maxFrameVertexCount, _capacity - WriteReserve - _frameStart);
+
+	case State::Idle:
+	case State::Staged:
+	default:
+		return _maxFrameVertexCount;
+	}
+}
+
+uint32_t VertexRing::EndFrame()
+{
+	uint32_t startLocation = _cursor;
+
+	switch (_state)
+	{
+	case State::Mapped:
+		_storage->UnmapVertices();
+		_mappedVertices = nullptr;
+		[[fallthrough]];
+
+	case State::Suspended:
+		startLocation = _frameStart;
+		_cursor = _frameStart + _frameVertexCount + _frameWriteCount;
+		break;
+
+	case State::Staged:
+		startLocation = WriteToStorage(_staging.GetItems(), _frameVertexCount);
+		_staging.OnReuse(_frameVertexCount);
+		break;
+
+	case State::Idle:
+	default:
+		break;
+	}
+
+	_state = State::Idle;
+	_frameVertexCount = 0;
+	_frameWriteCount = 0;
+	return startLocation;
+}
+
+_Use_decl_annotations_
+uint32_t VertexRing::Write(
+	const Vertex* vertices,
+	uint32_t count)
+{
+	/* A staged frame is copied after the vertices at EndFrame, so they go straight to the
+	   buffer. */
+	if (_state != State::Mapped && _state != State::Suspended)
+	{
+		return WriteToStorage(vertices, count);
+	}
+
+	uint32_t location = 0;
+
+	if (_frameVertexCount + count <= GetFrameVertexLimit())
+	{
+		location = _frameStart + _frameVertexCount;
+		memcpy(Append(count), vertices, sizeof(Vertex) * count);
+	}
+	else
+	{
+		location = _frameStart + _frameVertexCount + _frameWriteCount;
+
+		if (location + count > _capacity)
+		{
+			D2DX_FATAL_ERROR("Too many vertices written after full frame.");
+		}
+
+		if (_state == State::Suspended)
+		{
+			_mappedVertices = _storage->MapVertices(false);
+			_state = State::Mapped;
+		}
+
+		memcpy(_mappedVertices + location, vertices, sizeof(Vertex) * count);
+		_frameWriteCount += count;
+	}
+
+	/* The vertices are drawn from where they are, before the rest of the frame. */
+	if (_state == State::Mapped)
+	{
+		_storage->UnmapVertices();
+		_mappedVertices = nullptr;
+		_state = State::Suspended;
+	}
+
+	return location;
+}
+
+_Use_decl_annotations_
+uint32_t VertexRing::WriteToStorage(
+	const Vertex* vertices,
+	uint32_t count)
+{
+	assert(_state == State::Idle || _state == State::Staged);
+	assert(count <= _capacity);
+	count = min(count, _capacity);
+
+	const bool discard = _cursor + count > _capacity;
+
+	if (discard)
+	{
+		_cursor = 0;
+		++_discardCount;
+	}
+
+	const uint32_t startLocation = _cursor;
+
+	if (count > 0)
+	{
+		Vertex* mappedVertices = _storage->MapVertices(discard);
+		memcpy(mappedVertices + _cursor, vertices, sizeof(Vertex) * count);
+		_storage->UnmapVertices();
+	}
+
+	_cursor += count;
+	return startLocation;
+}
+
+uint32_t VertexRing::GetDiscardCount() const noexcept
+{
+	return _discardCount;
+}
@@ -0,0 +1,130 @@
+/*
+	This file is part of D2DX.
+
+	Copyright (C) 2021  Bolrog
+
+	D2DX is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	D2DX is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with D2DX.  If not, see <https://www.gnu.org/licenses/>.
+*/
+#pragma once
+
+#include "FrameArena.h"
+#include "IVertexRingStorage.h"
+#include "Types.h"
+#include "Vertex.h"
+
+namespace d2dx
+{
+	/* Lets the vertices of a frame be recorded straight into the vertex buffer, which stays
+	   mapped from the first vertex of the frame until EndFrame. A frame continues where the
+	   previous one ended if at least frameReserve vertices are left, otherwise the buffer is
+	   discarded and the frame starts over at the beginning. The mapped buffer is never read,
+	   so a frame can't be moved once recording has started: the caller ends the frame before
+	   it outgrows GetFrameVertexLimit(), and records the rest as a new frame.
+
+	   Vertices written with Write while a frame is being recorded also become part of the
+	   frame, and the buffer is unmapped so that they can be drawn. Recording maps it again.
+	   If the frame has no room for them, they go right after it instead, in a few vertices
+	   kept free at the end of the buffer, and the frame can't grow any further.
+
+	   If isStaged is set, every frame is recorded into a staging buffer and copied at
+	   EndFrame. */
+	class VertexRing final
+	{
+	public:
+		VertexRing(
+			_In_ IVertexRingStorage* storage,
+			_In_ uint32_t capacity,
+			_In_ uint32_t frameReserve,
+			_In_ uint32_t maxFrameVertexCount,
+			_In_ bool isStaged);
+
+		/* Returns where to write the next count vertices of the frame, which are numbered
+		   from GetFrameVertexCount() within the frame. The memory may be write-combined, so it
+		   should not be read. The pointer is only valid until the next call. */
+		inline Vertex* Append(
+			_In_ uint32_t count)
+		{
+			if (_state == State::Mapped && _frameStart + _frameVertexCount + count <= _capacity)
+			{
+				Vertex* vertices = _mappedVertices + _frameStart + _frameVertexCount;
+				_frameVertexCount += count;
+				return vertices;
+			}
+
+			return AppendSlow(count);
+		}
+
+		inline uint32_t GetFrameVertexCount() const noexcept
+		{
+			return _frameVertexCount;
+		}
+
+		/* The number of vertices the current frame can hold. Before the first vertex of a
+		   frame, this is maxFrameVertexCount, less the vertices kept free for Write. */
+		uint32_t GetFrameVertexLimit() const noexcept;
+
+		/* Finishes the frame and returns the location of its first vertex in the buffer. */
+		uint32_t EndFrame();
+
+		/* Writes vertices that are about to be drawn, and returns the location of the first
+		   one in the buffer. */
+		uint32_t Write(
+			_In_reads_(count) const Vertex* vertices,
+			_In_ uint32_t count);
+
+		uint32_t GetDiscardCount() const noexcept;
+
+		/* The staging buffer only grows as large as the largest staged frame. */
+		inline const FrameArena<Vertex>& GetStaging() const noexcept
+		{
+			return _staging;
+		}
+
+	private:
+		/* Enough for a few full-screen triangles written while a frame is full. */
+		static const uint32_t WriteReserve = 24;
+
+		enum class State
+		{
+			Idle,
+			Mapped,
+			Suspended,
+			Staged,
+		};
+
+		Vertex* AppendSlow(
+			_In_ uint32_t count);
+
+		void BeginFrame(
+			_In_ uint32_t count);
+
+		uint32_t WriteToStorage(
+			_In_reads_(count) const Vertex* vertices,
+			_In_ uint32_t count);
+
+		IVertexRingStorage* _storage = nullptr;
+		Vertex* _mappedVertices = nullptr;
+		State _state = State::Idle;
+		uint32_t _capacity = 0;
+		uint32_t _frameReserve = 0;
+		uint32_t _maxFrameVertexCount = 0;
+		bool _isStaged = false;
+		uint32_t _cursor = 0;
+		uint32_t _frameStart = 0;
+		uint32_t _frameVertexCount = 0;
+		uint32_t _frameWriteCount = 0;
+		uint32_t _discardCount = 0;
+		FrameArena<Vertex> _staging;
+	};
+}
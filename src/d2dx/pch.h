@@ -27,6 +27,8 @@
 
 #include <array>
 #include <atomic>
+#include <bit>
+#include <thread>
 #include <stdexcept>
 #include <cstdio>
 #include <cstdint>
@@ -41,6 +43,7 @@
 #include <wrl/implements.h>
 #include <wrl.h>
 #include <memory>
+#include <vector>
 #include <comdef.h>
 #include <system_error>
 #include <emmintrin.h>
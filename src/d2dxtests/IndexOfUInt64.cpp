@@ -0,0 +1,293 @@
+/*
+	This file is part of D2DX.
+
+	Copyright (C) 2021  Bolrog
+
+	D2DX is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	D2DX is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with D2DX.  If not, see <https://www.gnu.org/licenses/>.
+*/
+#include "pch.h"
+#include "IndexOfUInt64.h"
+
+using namespace d2dx;
+using namespace d2dxtests;
+
+typedef int32_t(*IndexOfUInt64Fn)(
+	const uint64_t* __restrict items,
+	uint32_t itemsCount,
+	uint64_t item);
+
+static inline uint32_t HighestSetBit(
+	uint32_t mask)
+{
+	assert(mask);
+#if defined(_MSC_VER)
+	unsigned long index = 0;
+	_BitScanReverse(&index, mask);
+	return index;
+#else
+	return 31 - __builtin_clz(mask);
+#endif
+}
+
+static inline uint32_t HighestSetBit64(
+	uint64_t mask)
+{
+	const uint32_t high = (uint32_t)(mask >> 32);
+	return high ? 32 + HighestSetBit(high) : HighestSetBit((uint32_t)mask);
+}
+
+/* The callers may be built for SSE2, so the AVX kernels clear the upper halves of the
+   vector registers before returning, to avoid the penalty for mixing in legacy SSE code. */
+
+/* All kernels scan blocks of 32 items and return the last match within the first block that
+   has one, so that they agree even if the key occurs more than once. */
+
+static int32_t IndexOfUInt64Scalar(
+	const uint64_t* __restrict items,
+	uint32_t itemsCount,
+	uint64_t item)
+{
+	for (uint32_t i = 0; i < itemsCount; i += 32)
+	{
+		int32_t findIndex = -1;
+
+		for (uint32_t j = i; j < i + 32; ++j)
+		{
+			if (items[j] == item)
+			{
+				findIndex = (int32_t)j;
+			}
+		}
+
+		if (findIndex >= 0)
+		{
+			return findIndex;
+		}
+	}
+
+	return -1;
+}
+
+#ifdef D2DX_SIMD_X86
+
+D2DX_SIMD_TARGET("sse4.1")
+static int32_t IndexOfUInt64Sse41(
+	const uint64_t* __restrict items,
+	uint32_t itemsCount,
+	uint64_t item)
+{
+	const __m128i key4 = _mm_set1_epi64x(item);
+
+	uint32_t i = 0;
+	uint64_t res = 0;
+
+	/* Note: don't tweak this loop. It manages to fit within the XMM registers on x86
+	   and any change could cause temporaries to spill onto the stack. */
+
+	for (; i < itemsCount; i += 32)
+	{
+		const __m128i ck0 = _mm_load_si128((const __m128i*) & items[i + 0]);
+		const __m128i ck1 = _mm_load_si128((const __m128i*) & items[i + 2]);
+		const __m128i ck2 = _mm_load_si128((const __m128i*) & items[i + 4]);
+		const __m128i ck3 = _mm_load_si128((const __m128i*) & items[i + 6]);
+		const __m128i ck4 = _mm_load_si128((const __m128i*) & items[i + 8]);
+		const __m128i ck5 = _mm_load_si128((const __m128i*) & items[i + 10]);
+		const __m128i ck6 = _mm_load_si128((const __m128i*) & items[i + 12]);
+		const __m128i ck7 = _mm_load_si128((const __m128i*) & items[i + 14]);
+
+		const __m128i cmp0 = _mm_cmpeq_epi64(key4, ck0);
+		const __m128i cmp1 = _mm_cmpeq_epi64(key4, ck1);
+		const __m128i cmp2 = _mm_cmpeq_epi64(key4, ck2);
+		const __m128i cmp3 = _mm_cmpeq_epi64(key4, ck3);
+		const __m128i cmp4 = _mm_cmpeq_epi64(key4, ck4);
+		const __m128i cmp5 = _mm_cmpeq_epi64(key4, ck5);
+		const __m128i cmp6 = _mm_cmpeq_epi64(key4, ck6);
+		const __m128i cmp7 = _mm_cmpeq_epi64(key4, ck7);
+
+		const __m128i pack01 = _mm_packs_epi32(cmp0, cmp1);
+		const __m128i pack23 = _mm_packs_epi32(cmp2, cmp3);
+		const __m128i pack45 = _mm_packs_epi32(cmp4, cmp5);
+		const __m128i pack67 = _mm_packs_epi32(cmp6, cmp7);
+
+		const __m128i pack0123 = _mm_packs_epi16(pack01, pack23);
+		const __m128i pack4567 = _mm_packs_epi16(pack45, pack67);
+
+		const __m128i ck8 = _mm_load_si128((const __m128i*) & items[i + 16]);
+		const __m128i ck9 = _mm_load_si128((const __m128i*) & items[i + 18]);
+		const __m128i ckA = _mm_load_si128((const __m128i*) & items[i + 20]);
+		const __m128i ckB = _mm_load_si128((const __m128i*) & items[i + 22]);
+		const __m128i ckC = _mm_load_si128((const __m128i*) & items[i + 24]);
+		const __m128i ckD = _mm_load_si128((const __m128i*) & items[i + 26]);
+		const __m128i ckE = _mm_load_si128((const __m128i*) & items[i + 28]);
+		const __m128i ckF = _mm_load_si128((const __m128i*) & items[i + 30]);
+
+		const __m128i cmp8 = _mm_cmpeq_epi64(key4, ck8);
+		const __m128i cmp9 = _mm_cmpeq_epi64(key4, ck9);
+		const __m128i cmpA = _mm_cmpeq_epi64(key4, ckA);
+		const __m128i cmpB = _mm_cmpeq_epi64(key4, ckB);
+		const __m128i cmpC = _mm_cmpeq_epi64(key4, ckC);
+		const __m128i cmpD = _mm_cmpeq_epi64(key4, ckD);
+		const __m128i cmpE = _mm_cmpeq_epi64(key4, ckE);
+		const __m128i cmpF = _mm_cmpeq_epi64(key4, ckF);
+
+		const __m128i pack89 = _mm_packs_epi32(cmp8, cmp9);
+		const __m128i packAB = _mm_packs_epi32(cmpA, cmpB);
+		const __m128i packCD = _mm_packs_epi32(cmpC, cmpD);
+		const __m128i packEF = _mm_packs_epi32(cmpE, cmpF);
+
+		const __m128i pack89AB = _mm_packs_epi16(pack89, packAB);
+		const __m128i packCDEF = _mm_packs_epi16(packCD, packEF);
+
+		const uint32_t res01234567 = (uint32_t)_mm_movemask_epi8(pack0123) | ((uint32_t)_mm_movemask_epi8(pack4567) << 16);
+		const uint32_t res89ABCDEF = (uint32_t)_mm_movemask_epi8(pack89AB) | ((uint32_t)_mm_movemask_epi8(packCDEF) << 16);
+
+		res = res01234567 | ((uint64_t)res89ABCDEF << 32);
+		if (res > 0) {
+			break;
+		}
+	}
+
+	if (res > 0)
+	{
+		const int32_t findIndex = i + HighestSetBit64(res) / 2;
+		assert(findIndex >= 0 && findIndex < (int32_t)itemsCount);
+		assert(items[findIndex] == item);
+		return findIndex;
+	}
+
+	return -1;
+}
+
+D2DX_SIMD_TARGET("avx2")
+static int32_t IndexOfUInt64Avx2(
+	const uint64_t* __restrict items,
+	uint32_t itemsCount,
+	uint64_t item)
+{
+	const __m256i key = _mm256_set1_epi64x((int64_t)item);
+
+	for (uint32_t i = 0; i < itemsCount; i += 32)
+	{
+		const __m256i cmp0 = _mm256_cmpeq_epi64(key, _mm256_load_si256((const __m256i*) & items[i + 0]));
+		const __m256i cmp1 = _mm256_cmpeq_epi64(key, _mm256_load_si256((const __m256i*) & items[i + 4]));
+		const __m256i cmp2 = _mm256_cmpeq_epi64(key, _mm256_load_si256((const __m256i*) & items[i + 8]));
+		const __m256i cmp3 = _mm256_cmpeq_epi64(key, _mm256_load_si256((const __m256i*) & items[i + 12]));
+		const __m256i cmp4 = _mm256_cmpeq_epi64(key, _mm256_load_si256((const __m256i*) & items[i + 16]));
+		const __m256i cmp5 = _mm256_cmpeq_epi64(key, _mm256_load_si256((const __m256i*) & items[i + 20]));
+		const __m256i cmp6 = _mm256_cmpeq_epi64(key, _mm256_load_si256((const __m256i*) & items[i + 24]));
+		const __m256i cmp7 = _mm256_cmpeq_epi64(key, _mm256_load_si256((const __m256i*) & items[i + 28]));
+
+		const __m256i any = _mm256_or_si256(
+			_mm256_or_si256(_mm256_or_si256(cmp0, cmp1), _mm256_or_si256(cmp2, cmp3)),
+			_mm256_or_si256(_mm256_or_si256(cmp4, cmp5), _mm256_or_si256(cmp6, cmp7)));
+
+		if (_mm256_testz_si256(any, any))
+		{
+			continue;
+		}
+
+		const uint32_t mask =
+			(uint32_t)_mm256_movemask_pd(_mm256_castsi256_pd(cmp0)) |
+			((uint32_t)_mm256_movemask_pd(_mm256_castsi256_pd(cmp1)) << 4) |
+			((uint32_t)_mm256_movemask_pd(_mm256_castsi256_pd(cmp2)) << 8) |
+			((uint32_t)_mm256_movemask_pd(_mm256_castsi256_pd(cmp3)) << 12) |
+			((uint32_t)_mm256_movemask_pd(_mm256_castsi256_pd(cmp4)) << 16) |
+			((uint32_t)_mm256_movemask_pd(_mm256_castsi256_pd(cmp5)) << 20) |
+			((uint32_t)_mm256_movemask_pd(_mm256_castsi256_pd(cmp6)) << 24) |
+			((uint32_t)_mm256_movemask_pd(_mm256_castsi256_pd(cmp7)) << 28);
+
+		const int32_t findIndex = i + HighestSetBit(mask);
+		assert(items[findIndex] == item);
+		_mm256_zeroupper();
+		return findIndex;
+	}
+
+	_mm256_zeroupper();
+	return -1;
+}
+
+D2DX_SIMD_TARGET("avx512f")
+static int32_t IndexOfUInt64Avx512(
+	const uint64_t* __restrict items,
+	uint32_t itemsCount,
+	uint64_t item)
+{
+	const __m512i key = _mm512_set1_epi64((int64_t)item);
+
+	for (uint32_t i = 0; i < itemsCount; i += 32)
+	{
+		/* Items are only guaranteed to be 32-byte aligned, so use unaligned loads. */
+		const uint32_t mask =
+			(uint32_t)_mm512_cmpeq_epi64_mask(key, _mm512_loadu_si512(&items[i + 0])) |
+			((uint32_t)_mm512_cmpeq_epi64_mask(key, _mm512_loadu_si512(&items[i + 8])) << 8) |
+			((uint32_t)_mm512_cmpeq_epi64_mask(key, _mm512_loadu_si512(&items[i + 16])) << 16) |
+			((uint32_t)_mm512_cmpeq_epi64_mask(key, _mm512_loadu_si512(&items[i + 24])) << 24);
+
+		if (mask)
+		{
+			const int32_t findIndex = i + HighestSetBit(mask);
+			assert(items[findIndex] == item);
+			_mm256_zeroupper();
+			return findIndex;
+		}
+	}
+
+	_mm256_zeroupper();
+	return -1;
+}
+
+static const IndexOfUInt64Fn indexOfUInt64Kernels[] =
+{
+	IndexOfUInt64Scalar,
+	IndexOfUInt64Sse41,
+	IndexOfUInt64Avx2,
+	IndexOfUInt64Avx512,
+};
+
+#else
+
+static const IndexOfUInt64Fn indexOfUInt64Kernels[] =
+{
+	IndexOfUInt64Scalar,
+	IndexOfUInt64Scalar,
+	IndexOfUInt64Scalar,
+	IndexOfUInt64Scalar,
+};
+
+#endif
+
+static_assert(sizeof(indexOfUInt64Kernels) / sizeof(indexOfUInt64Kernels[0]) == (size_t)SimdKernel::Count, "one IndexOfUInt64 kernel per SimdKernel");
+
+_Use_decl_annotations_
+int32_t d2dxtests::IndexOfUInt64(
+	const uint64_t* __restrict items,
+	uint32_t itemsCount,
+	uint64_t item)
+{
+	return IndexOfUInt64(GetBestSimdKernel(), items, itemsCount, item);
+}
+
+_Use_decl_annotations_
+int32_t d2dxtests::IndexOfUInt64(
+	SimdKernel kernel,
+	const uint64_t* __restrict items,
+	uint32_t itemsCount,
+	uint64_t item)
+{
+	assert(items && ((uintptr_t)items & 0x1F) == 0);
+	assert(!(itemsCount & 0x1F));
+	assert(IsSimdKernelSupported(kernel));
+
+	return indexOfUInt64Kernels[(int32_t)kernel](items, itemsCount, item);
+}
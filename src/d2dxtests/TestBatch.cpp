@@ -55,10 +55,10 @@ namespace d2dxtests
 			Assert::AreEqual(2, batch.GetTextureHeight());
 			Assert::AreEqual(0, batch.GetPaletteIndex());
 			Assert::AreEqual(RgbCombine::ColorMultipliedByTexture, batch.GetRgbCombine());
-			Assert::AreEqual(0, batch.GetStartVertex());
+			Assert::AreEqual(0, batch.GetStartIndex());
 			Assert::AreEqual(0, (int)batch.GetSurfaceId());
 			Assert::AreEqual(-D2DX_TMU_ADDRESS_ALIGNMENT, batch.GetTextureStartAddress());
-			Assert::AreEqual(0U, batch.GetVertexCount());
+			Assert::AreEqual(0U, batch.GetIndexCount());
 			Assert::AreEqual(2, batch.GetTextureWidth());
 		}
 
@@ -77,10 +77,10 @@ namespace d2dxtests
 				Assert::AreEqual(2, batch.GetTextureHeight());
 				Assert::AreEqual(0, batch.GetPaletteIndex());
 				Assert::AreEqual(RgbCombine::ColorMultipliedByTexture, batch.GetRgbCombine());
-				Assert::AreEqual(0, batch.GetStartVertex());
+				Assert::AreEqual(0, batch.GetStartIndex());
 				Assert::AreEqual(0, (int)batch.GetSurfaceId());
 				Assert::AreEqual(-D2DX_TMU_ADDRESS_ALIGNMENT, batch.GetTextureStartAddress());
-				Assert::AreEqual(0U, batch.GetVertexCount());
+				Assert::AreEqual(0U, batch.GetIndexCount());
 				Assert::AreEqual(2, batch.GetTextureWidth());
 			}
 		}
@@ -100,10 +100,10 @@ namespace d2dxtests
 				Assert::AreEqual(2, batch.GetTextureHeight());
 				Assert::AreEqual(0, batch.GetPaletteIndex());
 				Assert::AreEqual(RgbCombine::ColorMultipliedByTexture, batch.GetRgbCombine());
-				Assert::AreEqual(0, batch.GetStartVertex());
+				Assert::AreEqual(0, batch.GetStartIndex());
 				Assert::AreEqual(0, (int)batch.GetSurfaceId());
 				Assert::AreEqual(-D2DX_TMU_ADDRESS_ALIGNMENT, batch.GetTextureStartAddress());
-				Assert::AreEqual(0U, batch.GetVertexCount());
+				Assert::AreEqual(0U, batch.GetIndexCount());
 				Assert::AreEqual(2, batch.GetTextureWidth());
 			}
 		}
@@ -124,10 +124,10 @@ namespace d2dxtests
 				Assert::AreEqual(2, batch.GetTextureHeight());
 				Assert::AreEqual(0, batch.GetPaletteIndex());
 				Assert::AreEqual(RgbCombine::ColorMultipliedByTexture, batch.GetRgbCombine());
-				Assert::AreEqual(0, batch.GetStartVertex());
+				Assert::AreEqual(0, batch.GetStartIndex());
 				Assert::AreEqual(0, (int)batch.GetSurfaceId());
 				Assert::AreEqual(-D2DX_TMU_ADDRESS_ALIGNMENT, batch.GetTextureStartAddress());
-				Assert::AreEqual(0U, batch.GetVertexCount());
+				Assert::AreEqual(0U, batch.GetIndexCount());
 				Assert::AreEqual(2, batch.GetTextureWidth());
 			}
 		}
@@ -147,10 +147,10 @@ namespace d2dxtests
 				Assert::AreEqual(2, batch.GetTextureHeight());
 				Assert::AreEqual(0, batch.GetPaletteIndex());
 				Assert::AreEqual(RgbCombine::ColorMultipliedByTexture, batch.GetRgbCombine());
-				Assert::AreEqual(0, batch.GetStartVertex());
+				Assert::AreEqual(0, batch.GetStartIndex());
 				Assert::AreEqual(0, (int)batch.GetSurfaceId());
 				Assert::AreEqual(-D2DX_TMU_ADDRESS_ALIGNMENT, batch.GetTextureStartAddress());
-				Assert::AreEqual(0U, batch.GetVertexCount());
+				Assert::AreEqual(0U, batch.GetIndexCount());
 				Assert::AreEqual(2, batch.GetTextureWidth());
 			}
 		}
@@ -172,10 +172,10 @@ namespace d2dxtests
 					Assert::AreEqual(1 << h, batch.GetTextureHeight());
 					Assert::AreEqual(0, batch.GetPaletteIndex());
 					Assert::AreEqual(RgbCombine::ColorMultipliedByTexture, batch.GetRgbCombine());
-					Assert::AreEqual(0, batch.GetStartVertex());
+					Assert::AreEqual(0, batch.GetStartIndex());
 					Assert::AreEqual(0, (int)batch.GetSurfaceId());
 					Assert::AreEqual(-D2DX_TMU_ADDRESS_ALIGNMENT, batch.GetTextureStartAddress());
-					Assert::AreEqual(0U, batch.GetVertexCount());
+					Assert::AreEqual(0U, batch.GetIndexCount());
 					Assert::AreEqual(1 << w, batch.GetTextureWidth());
 				}
 			}
@@ -196,10 +196,34 @@ namespace d2dxtests
 				Assert::AreEqual(2, batch.GetTextureHeight());
 				Assert::AreEqual(i, batch.GetPaletteIndex());
 				Assert::AreEqual(RgbCombine::ColorMultipliedByTexture, batch.GetRgbCombine());
-				Assert::AreEqual(0, batch.GetStartVertex());
+				Assert::AreEqual(0, batch.GetStartIndex());
 				Assert::AreEqual(0, (int)batch.GetSurfaceId());
 				Assert::AreEqual(-D2DX_TMU_ADDRESS_ALIGNMENT, batch.GetTextureStartAddress());
-				Assert::AreEqual(0U, batch.GetVertexCount());
+				Assert::AreEqual(0U, batch.GetIndexCount());
+				Assert::AreEqual(2, batch.GetTextureWidth());
+			}
+		}
+
+		TEST_METHOD(SetPrimitiveType)
+		{
+			Batch batch;
+			for (int32_t i = 0; i < (int32_t)PrimitiveType::Count; ++i)
+			{
+				batch.SetPrimitiveType((d2dx::PrimitiveType)i);
+				Assert::IsFalse(batch.IsValid());
+				Assert::AreEqual((d2dx::PrimitiveType)i, batch.GetPrimitiveType());
+				Assert::AreEqual(AlphaBlend::Opaque, batch.GetAlphaBlend());
+				Assert::AreEqual(AlphaCombine::One, batch.GetAlphaCombine());
+				Assert::AreEqual(0U, batch.GetTextureAtlas());
+				Assert::AreEqual(0U, batch.GetTextureIndex());
+				Assert::AreEqual(0ULL, batch.GetHash());
+				Assert::AreEqual(2, batch.GetTextureHeight());
+				Assert::AreEqual(0, batch.GetPaletteIndex());
+				Assert::AreEqual(RgbCombine::ColorMultipliedByTexture, batch.GetRgbCombine());
+				Assert::AreEqual(0, batch.GetStartIndex());
+				Assert::AreEqual(0, (int)batch.GetSurfaceId());
+				Assert::AreEqual(-D2DX_TMU_ADDRESS_ALIGNMENT, batch.GetTextureStartAddress());
+				Assert::AreEqual(0U, batch.GetIndexCount());
 				Assert::AreEqual(2, batch.GetTextureWidth());
 			}
 		}
@@ -219,20 +243,20 @@ namespace d2dxtests
 				Assert::AreEqual(2, batch.GetTextureHeight());
 				Assert::AreEqual(0, batch.GetPaletteIndex());
 				Assert::AreEqual((RgbCombine)i, batch.GetRgbCombine());
-				Assert::AreEqual(0, batch.GetStartVertex());
+				Assert::AreEqual(0, batch.GetStartIndex());
 				Assert::AreEqual(0, (int)batch.GetSurfaceId());
 				Assert::AreEqual(-D2DX_TMU_ADDRESS_ALIGNMENT, batch.GetTextureStartAddress());
-				Assert::AreEqual(0U, batch.GetVertexCount());
+				Assert::AreEqual(0U, batch.GetIndexCount());
 				Assert::AreEqual(2, batch.GetTextureWidth());
 			}
 		}
 
-		TEST_METHOD(SetStartVertex)
+		TEST_METHOD(SetStartIndex)
 		{
 			Batch batch;
 			for (int32_t i = 0; i < 1000000; i += 127) /* prime */
 			{
-				batch.SetStartVertex(i);
+				batch.SetStartIndex(i);
 				Assert::IsFalse(batch.IsValid());
 				Assert::AreEqual(AlphaBlend::Opaque, batch.GetAlphaBlend());
 				Assert::AreEqual(AlphaCombine::One, batch.GetAlphaCombine());
@@ -243,10 +267,10 @@ namespace d2dxtests
 				Assert::AreEqual(2, batch.GetTextureHeight());
 				Assert::AreEqual(0, batch.GetPaletteIndex());
 				Assert::AreEqual(RgbCombine::ColorMultipliedByTexture, batch.GetRgbCombine());
-				Assert::AreEqual(i, batch.GetStartVertex());
+				Assert::AreEqual(i, batch.GetStartIndex());
 				Assert::AreEqual(0, (int)batch.GetSurfaceId());
 				Assert::AreEqual(-D2DX_TMU_ADDRESS_ALIGNMENT, batch.GetTextureStartAddress());
-				Assert::AreEqual(0U, batch.GetVertexCount());
+				Assert::AreEqual(0U, batch.GetIndexCount());
 				Assert::AreEqual(2, batch.GetTextureWidth());
 			}
 		}
@@ -266,10 +290,10 @@ namespace d2dxtests
 				Assert::AreEqual(2, batch.GetTextureHeight());
 				Assert::AreEqual(0, batch.GetPaletteIndex());
 				Assert::AreEqual(RgbCombine::ColorMultipliedByTexture, batch.GetRgbCombine());
-				Assert::AreEqual(0, batch.GetStartVertex());
+				Assert::AreEqual(0, batch.GetStartIndex());
 				Assert::AreEqual(i, batch.GetSurfaceId());
 				Assert::AreEqual(-D2DX_TMU_ADDRESS_ALIGNMENT, batch.GetTextureStartAddress());
-				Assert::AreEqual(0U, batch.GetVertexCount());
+				Assert::AreEqual(0U, batch.GetIndexCount());
 				Assert::AreEqual(2, batch.GetTextureWidth());
 			}
 		}
@@ -289,20 +313,20 @@ namespace d2dxtests
 				Assert::AreEqual(2, batch.GetTextureHeight());
 				Assert::AreEqual(0, batch.GetPaletteIndex());
 				Assert::AreEqual(RgbCombine::ColorMultipliedByTexture, batch.GetRgbCombine());
-				Assert::AreEqual(0, batch.GetStartVertex());
+				Assert::AreEqual(0, batch.GetStartIndex());
 				Assert::AreEqual(0, (int)batch.GetSurfaceId());
 				Assert::AreEqual(i, batch.GetTextureStartAddress());
-				Assert::AreEqual(0U, batch.GetVertexCount());
+				Assert::AreEqual(0U, batch.GetIndexCount());
 				Assert::AreEqual(2, batch.GetTextureWidth());
 			}
 		}
 
-		TEST_METHOD(SetVertexCount)
+		TEST_METHOD(SetIndexCount)
 		{
 			Batch batch;
 			for (uint32_t i = 0; i < 65536; i += 7) /* prime */
 			{
-				batch.SetVertexCount(i);
+				batch.SetIndexCount(i);
 				Assert::IsFalse(batch.IsValid());
 				Assert::AreEqual(AlphaBlend::Opaque, batch.GetAlphaBlend());
 				Assert::AreEqual(AlphaCombine::One, batch.GetAlphaCombine());
@@ -312,10 +336,10 @@ namespace d2dxtests
 				Assert::AreEqual(2, batch.GetTextureHeight());
 				Assert::AreEqual(0, batch.GetPaletteIndex());
 				Assert::AreEqual(RgbCombine::ColorMultipliedByTexture, batch.GetRgbCombine());
-				Assert::AreEqual(0, batch.GetStartVertex());
+				Assert::AreEqual(0, batch.GetStartIndex());
 				Assert::AreEqual(0, (int)batch.GetSurfaceId());
 				Assert::AreEqual(-D2DX_TMU_ADDRESS_ALIGNMENT, batch.GetTextureStartAddress());
-				Assert::AreEqual(i, batch.GetVertexCount());
+				Assert::AreEqual(i, batch.GetIndexCount());
 				Assert::AreEqual(2, batch.GetTextureWidth());
 			}
 		}
@@ -0,0 +1,197 @@
+/*
+	This file is part of D2DX.
+
+	Copyright (C) 2021  Bolrog
+
+	D2DX is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	D2DX is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with D2DX.  If not, see <https://www.gnu.org/licenses/>.
+*/
+#include "pch.h"
+#include "CppUnitTest.h"
+
+#include "../d2dx/Batch.h"
+#include "../d2dx/BatchCoalescing.h"
+#include "../d2dx/BatchReorderer.h"
+
+using namespace Microsoft::VisualStudio::CppUnitTestFramework;
+using namespace d2dx;
+
+namespace d2dxtests
+{
+	static Batch MakeBatch(uint32_t startIndex, uint32_t indexCount)
+	{
+		Batch batch;
+		batch.SetTextureStartAddress(0x1000);
+		batch.SetStartIndex(startIndex);
+		batch.SetIndexCount(indexCount);
+		return batch;
+	}
+
+	/* Records batches the way D2DXContext::AppendBatch does. */
+	struct CoalescingRecorder final
+	{
+		void Append(Batch batch, const BatchBounds& bounds, uint32_t drawStateKey)
+		{
+			++recordedCount;
+
+			if (!batches.empty() && TryCoalesceBatch(batches.back(), batchBounds.back(), drawStateKeys.back(), batch, bounds, drawStateKey))
+			{
+				return;
+			}
+
+			batches.push_back(batch);
+			batchBounds.push_back(bounds);
+			drawStateKeys.push_back(drawStateKey);
+		}
+
+		uint32_t recordedCount = 0;
+		std::vector<Batch> batches;
+		std::vector<BatchBounds> batchBounds;
+		std::vector<uint32_t> drawStateKeys;
+	};
+
+	TEST_CLASS(TestBatchCoalescing)
+	{
+	public:
+		TEST_METHOD(CoalescesFollowingBatch)
+		{
+			Batch lastBatch = MakeBatch(100, 6);
+			BatchBounds lastBounds = { 0, 0, 10, 10 };
+
+			Assert::IsTrue(TryCoalesceBatch(lastBatch, lastBounds, 5, MakeBatch(106, 3), { 20, -5, 30, 5 }, 5));
+			Assert::AreEqual(100, lastBatch.GetStartIndex());
+			Assert::AreEqual(9U, lastBatch.GetIndexCount());
+			Assert::AreEqual((int16_t)0, lastBounds.left);
+			Assert::AreEqual((int16_t)-5, lastBounds.top);
+			Assert::AreEqual((int16_t)30, lastBounds.right);
+			Assert::AreEqual((int16_t)10, lastBounds.bottom);
+		}
+
+		TEST_METHOD(KeepsOtherDrawStateApart)
+		{
+			Batch lastBatch = MakeBatch(100, 6);
+			BatchBounds lastBounds = { 0, 0, 10, 10 };
+
+			Assert::IsFalse(TryCoalesceBatch(lastBatch, lastBounds, 5, MakeBatch(106, 3), { 20, 20, 30, 30 }, 6));
+			Assert::AreEqual(6U, lastBatch.GetIndexCount());
+			Assert::AreEqual((int16_t)10, lastBounds.right);
+		}
+
+		TEST_METHOD(KeepsGapsApart)
+		{
+			Batch lastBatch = MakeBatch(100, 6);
+			BatchBounds lastBounds = { 0, 0, 10, 10 };
+
+			Assert::IsFalse(TryCoalesceBatch(lastBatch, lastBounds, 5, MakeBatch(107, 3), { 0, 0, 1, 1 }, 5));
+			Assert::IsFalse(TryCoalesceBatch(lastBatch, lastBounds, 5, MakeBatch(94, 6), { 0, 0, 1, 1 }, 5));
+			Assert::AreEqual(6U, lastBatch.GetIndexCount());
+		}
+
+		TEST_METHOD(KeepsSkippedAndInvalidApart)
+		{
+			Batch lastBatch = MakeBatch(0, 6);
+			BatchBounds lastBounds = { 0, 0, 10, 10 };
+
+			Assert::IsFalse(TryCoalesceBatch(lastBatch, lastBounds, BatchReorderer::SkipKey, MakeBatch(6, 6), { 0, 0, 1, 1 }, BatchReorderer::SkipKey));
+
+			Batch invalidBatch;
+			invalidBatch.SetStartIndex(6);
+			invalidBatch.SetIndexCount(6);
+			Assert::IsFalse(TryCoalesceBatch(lastBatch, lastBounds, 5, invalidBatch, { 0, 0, 1, 1 }, 5));
+			Assert::AreEqual(6U, lastBatch.GetIndexCount());
+		}
+
+		TEST_METHOD(StopsAtMaxIndexCount)
+		{
+			Batch lastBatch = MakeBatch(0, 65532);
+			BatchBounds lastBounds = { 0, 0, 10, 10 };
+
+			Assert::IsTrue(TryCoalesceBatch(lastBatch, lastBounds, 5, MakeBatch(65532, 3), { 0, 0, 1, 1 }, 5));
+			Assert::AreEqual(65535U, lastBatch.GetIndexCount());
+			Assert::IsFalse(TryCoalesceBatch(lastBatch, lastBounds, 5, MakeBatch(65535, 3), { 0, 0, 1, 1 }, 5));
+		}
+
+		TEST_METHOD(ShrinksLinesAndParticles)
+		{
+			/* Automap lines between the UI panels, and weather particles between the
+			   sprites of the level. */
+			CoalescingRecorder recorder;
+			uint32_t indexCount = 0;
+
+			for (uint32_t i = 0; i < 4000; ++i)
+			{
+				const uint32_t primitiveIndexCount = (i % 200) == 199 ? 3 : 6;
+				const uint32_t drawStateKey = (i % 200) == 199 ? 2 : 1;
+				const int16_t x = (int16_t)((i * 37) % 800);
+				const int16_t y = (int16_t)((i * 91) % 600);
+
+				recorder.Append(MakeBatch(indexCount, primitiveIndexCount), { x, y, (int16_t)(x + 4), (int16_t)(y + 4) }, drawStateKey);
+				indexCount += primitiveIndexCount;
+			}
+
+			Assert::AreEqual(4000U, recorder.recordedCount);
+			Assert::AreEqual((size_t)40, recorder.batches.size());
+
+			/* The coalesced batches still cover every index, in order. */
+			uint32_t nextIndex = 0;
+
+			for (const Batch& batch : recorder.batches)
+			{
+				Assert::AreEqual(nextIndex, (uint32_t)batch.GetStartIndex());
+				nextIndex += batch.GetIndexCount();
+			}
+
+			Assert::AreEqual(indexCount, nextIndex);
+		}
+
+		TEST_METHOD(ReordersToAboutAsFewDrawCalls)
+		{
+			std::vector<uint32_t> keys;
+			std::vector<BatchBounds> bounds;
+			CoalescingRecorder recorder;
+
+			uint32_t seed = 1;
+			auto random = [&](uint32_t n) { seed = seed * 1664525 + 1013904223; return (seed >> 8) % n; };
+
+			uint32_t drawStateKey = 0;
+
+			for (uint32_t i = 0; i < 5000; ++i)
+			{
+				if (random(8) == 0)
+				{
+					drawStateKey = random(4);
+				}
+
+				const int16_t x = (int16_t)random(640);
+				const int16_t y = (int16_t)random(480);
+				const BatchBounds b = { x, y, (int16_t)(x + random(64)), (int16_t)(y + random(64)) };
+
+				keys.push_back(drawStateKey);
+				bounds.push_back(b);
+				recorder.Append(MakeBatch(i * 6, 6), b, drawStateKey);
+			}
+
+			Assert::IsTrue(recorder.batches.size() < keys.size() / 4);
+
+			BatchReorderer reorderer(8192);
+			reorderer.Reorder(keys.data(), bounds.data(), (uint32_t)keys.size());
+			const uint32_t runCount = reorderer.GetRunCountAfter();
+
+			/* A coalesced batch can only move as a whole, so now and then it can't join an
+			   earlier run that some of its primitives could have. */
+			reorderer.Reorder(recorder.drawStateKeys.data(), recorder.batchBounds.data(), (uint32_t)recorder.batches.size());
+			Assert::IsTrue(reorderer.GetRunCountAfter() >= runCount);
+			Assert::IsTrue(reorderer.GetRunCountAfter() <= runCount + runCount / 20);
+		}
+	};
+}
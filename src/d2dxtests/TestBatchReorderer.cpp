@@ -0,0 +1,223 @@
+/*
+	This file is part of D2DX.
+
+	Copyright (C) 2021  Bolrog
+
+	D2DX is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	D2DX is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with D2DX.  If not, see <https://www.gnu.org/licenses/>.
+*/
+#include "pch.h"
+#include <algorithm>
+#include "CppUnitTest.h"
+
+#include "../d2dx/BatchReorderer.h"
+
+using namespace Microsoft::VisualStudio::CppUnitTestFramework;
+using namespace d2dx;
+
+namespace d2dxtests
+{
+	static const int32_t ScreenWidth = 160;
+	static const int32_t ScreenHeight = 120;
+
+	/* Draws every batch as its whole bounds rectangle, in the given order, and records for
+	   each pixel the batch drawn last and a hash of all batches drawn, in order, so that
+	   blending would come out the same too. */
+	static void Rasterize(
+		const std::vector<BatchBounds>& bounds,
+		const uint32_t* order,
+		uint32_t orderCount,
+		std::vector<int32_t>& owners,
+		std::vector<uint64_t>& histories)
+	{
+		owners.assign(ScreenWidth * ScreenHeight, -1);
+		histories.assign(ScreenWidth * ScreenHeight, 0);
+
+		for (uint32_t i = 0; i < orderCount; ++i)
+		{
+			const uint32_t batchIndex = order[i];
+			const BatchBounds& b = bounds[batchIndex];
+
+			for (int32_t y = max((int32_t)b.top, 0); y <= min((int32_t)b.bottom, ScreenHeight - 1); ++y)
+			{
+				for (int32_t x = max((int32_t)b.left, 0); x <= min((int32_t)b.right, ScreenWidth - 1); ++x)
+				{
+					owners[y * ScreenWidth + x] = (int32_t)batchIndex;
+					histories[y * ScreenWidth + x] = histories[y * ScreenWidth + x] * 0x100000001B3ull + batchIndex + 1;
+				}
+			}
+		}
+	}
+
+	static uint32_t CountRuns(
+		const std::vector<uint32_t>& drawStateKeys,
+		const uint32_t* order,
+		uint32_t orderCount)
+	{
+		uint32_t runCount = 0;
+
+		for (uint32_t i = 0; i < orderCount; ++i)
+		{
+			if (i == 0 || drawStateKeys[order[i]] != drawStateKeys[order[i - 1]])
+			{
+				++runCount;
+			}
+		}
+
+		return runCount;
+	}
+
+	static BatchBounds MakeBounds(int32_t x, int32_t y, int32_t width, int32_t height)
+	{
+		return { (int16_t)x, (int16_t)y, (int16_t)(x + width - 1), (int16_t)(y + height - 1) };
+	}
+
+	TEST_CLASS(TestBatchReorderer)
+	{
+	public:
+		TEST_METHOD(KeepsOrderWhenNothingCanMove)
+		{
+			/* Alternating state, all on top of each other. */
+			std::vector<uint32_t> keys = { 1, 2, 1, 2 };
+			std::vector<BatchBounds> bounds(4, MakeBounds(10, 10, 8, 8));
+
+			BatchReorderer reorderer(16);
+			Assert::IsFalse(reorderer.Reorder(keys.data(), bounds.data(), 4));
+			Assert::AreEqual(4U, reorderer.GetOrderCount());
+			Assert::AreEqual(4U, reorderer.GetRunCountBefore());
+			Assert::AreEqual(4U, reorderer.GetRunCountAfter());
+
+			for (uint32_t i = 0; i < 4; ++i)
+			{
+				Assert::AreEqual(i, reorderer.GetOrder()[i]);
+			}
+		}
+
+		TEST_METHOD(GroupsNonOverlappingBatches)
+		{
+			/* A row of tiles with alternating state, none overlapping. */
+			std::vector<uint32_t> keys;
+			std::vector<BatchBounds> bounds;
+
+			for (int32_t i = 0; i < 16; ++i)
+			{
+				keys.push_back(i & 1);
+				bounds.push_back(MakeBounds(i * 8, 0, 8, 8));
+			}
+
+			BatchReorderer reorderer(16);
+			Assert::IsTrue(reorderer.Reorder(keys.data(), bounds.data(), 16));
+			Assert::AreEqual(16U, reorderer.GetOrderCount());
+			Assert::AreEqual(16U, reorderer.GetRunCountBefore());
+			Assert::AreEqual(2U, reorderer.GetRunCountAfter());
+			Assert::AreEqual(2U, CountRuns(keys, reorderer.GetOrder(), reorderer.GetOrderCount()));
+		}
+
+		TEST_METHOD(DoesNotMovePastOverlappingBatch)
+		{
+			/* The last batch has the first one's state, but the middle one covers it. */
+			std::vector<uint32_t> keys = { 1, 2, 1 };
+			std::vector<BatchBounds> bounds = {
+				MakeBounds(0, 0, 8, 8),
+				MakeBounds(20, 20, 8, 8),
+				MakeBounds(24, 24, 8, 8) };
+
+			BatchReorderer reorderer(16);
+			Assert::IsFalse(reorderer.Reorder(keys.data(), bounds.data(), 3));
+			Assert::AreEqual(3U, reorderer.GetRunCountAfter());
+
+			/* Touching edges count as overlapping. */
+			bounds[2] = MakeBounds(28, 0, 8, 8);
+			Assert::IsTrue(reorderer.Reorder(keys.data(), bounds.data(), 3));
+			Assert::AreEqual(2U, reorderer.GetRunCountAfter());
+
+			bounds[2] = MakeBounds(27, 0, 8, 21);
+			Assert::IsFalse(reorderer.Reorder(keys.data(), bounds.data(), 3));
+		}
+
+		TEST_METHOD(LeavesOutSkippedBatches)
+		{
+			std::vector<uint32_t> keys = { 1, BatchReorderer::SkipKey, 1 };
+			std::vector<BatchBounds> bounds(3, MakeBounds(0, 0, 8, 8));
+			bounds[1] = BatchBounds::Empty();
+
+			BatchReorderer reorderer(16);
+			Assert::IsTrue(reorderer.Reorder(keys.data(), bounds.data(), 3));
+			Assert::AreEqual(2U, reorderer.GetOrderCount());
+			Assert::AreEqual(0U, reorderer.GetOrder()[0]);
+			Assert::AreEqual(2U, reorderer.GetOrder()[1]);
+			Assert::AreEqual(1U, reorderer.GetRunCountBefore());
+		}
+
+		TEST_METHOD(PreservesPixelOwnership)
+		{
+			BatchReorderer reorderer(4096);
+			uint32_t seed = 777;
+			uint32_t totalRunsBefore = 0;
+			uint32_t totalRunsAfter = 0;
+
+			for (uint32_t frame = 0; frame < 50; ++frame)
+			{
+				/* A frame like the game draws: many small sprites with a handful of draw
+				   states, some large ones, and some overlapping. */
+				const uint32_t batchCount = 200 + frame * 60;
+				std::vector<uint32_t> keys(batchCount);
+				std::vector<BatchBounds> bounds(batchCount);
+
+				for (uint32_t i = 0; i < batchCount; ++i)
+				{
+					seed = seed * 1664525 + 1013904223;
+					const uint32_t r = seed >> 8;
+					const int32_t size = (r & 15) == 0 ? 40 : 4 + (r >> 4) % 12;
+					keys[i] = (r >> 8) % 6;
+					bounds[i] = MakeBounds((int32_t)((r >> 11) % ScreenWidth) - 8, (int32_t)((r >> 3) % ScreenHeight) - 8, size, size);
+				}
+
+				std::vector<uint32_t> identity(batchCount);
+				for (uint32_t i = 0; i < batchCount; ++i)
+				{
+					identity[i] = i;
+				}
+
+				std::vector<int32_t> expectedOwners, owners;
+				std::vector<uint64_t> expectedHistories, histories;
+				Rasterize(bounds, identity.data(), batchCount, expectedOwners, expectedHistories);
+
+				reorderer.Reorder(keys.data(), bounds.data(), batchCount);
+				Assert::AreEqual(batchCount, reorderer.GetOrderCount());
+				Rasterize(bounds, reorderer.GetOrder(), reorderer.GetOrderCount(), owners, histories);
+
+				Assert::IsTrue(expectedOwners == owners);
+				Assert::IsTrue(expectedHistories == histories);
+
+				/* Every batch is drawn exactly once. */
+				std::vector<uint32_t> sortedOrder(reorderer.GetOrder(), reorderer.GetOrder() + reorderer.GetOrderCount());
+				std::sort(sortedOrder.begin(), sortedOrder.end());
+				Assert::IsTrue(identity == sortedOrder);
+
+				Assert::AreEqual(CountRuns(keys, identity.data(), batchCount), reorderer.GetRunCountBefore());
+				Assert::AreEqual(CountRuns(keys, reorderer.GetOrder(), reorderer.GetOrderCount()), reorderer.GetRunCountAfter());
+				Assert::IsTrue(reorderer.GetRunCountAfter() <= reorderer.GetRunCountBefore());
+
+				totalRunsBefore += reorderer.GetRunCountBefore();
+				totalRunsAfter += reorderer.GetRunCountAfter();
+			}
+
+			char message[256];
+			sprintf_s(message, "Draw calls: %u before reordering, %u after.\n", totalRunsBefore, totalRunsAfter);
+			Logger::WriteMessage(message);
+
+			Assert::IsTrue(totalRunsAfter < totalRunsBefore);
+		}
+	};
+}
@@ -0,0 +1,375 @@
+/*
+	This file is part of D2DX.
+
+	Copyright (C) 2021  Bolrog
+
+	D2DX is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	D2DX is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with D2DX.  If not, see <https://www.gnu.org/licenses/>.
+*/
+#include "pch.h"
+#include "CppUnitTest.h"
+
+#include "../d2dx/Batch.h"
+#include "../d2dx/BatchReorderer.h"
+#include "../d2dx/BatchStream.h"
+#include "../d2dx/Simd.h"
+#include "../d2dx/Utils.h"
+
+using namespace Microsoft::VisualStudio::CppUnitTestFramework;
+using namespace d2dx;
+
+namespace d2dxtests
+{
+	/* A batch stream kept in plain vectors, with the batches it was made from. */
+	struct VectorBatchStream final
+	{
+		void Append(uint32_t drawStateKey, uint32_t startIndex, uint32_t indexCount)
+		{
+			drawStateKeys.push_back(drawStateKey);
+			startIndices.push_back(startIndex);
+			indexCounts.push_back(indexCount);
+		}
+
+		uint32_t Merge(SimdKernel kernel, std::vector<DrawCallRange>& drawCalls) const
+		{
+			const uint32_t batchCount = (uint32_t)drawStateKeys.size();
+			drawCalls.resize(batchCount + 1);
+			return MergeBatches(kernel, drawStateKeys.data(), startIndices.data(), indexCounts.data(), batchCount, drawCalls.data());
+		}
+
+		std::vector<Batch> batches;
+		std::vector<uint32_t> drawStateKeys;
+		std::vector<uint32_t> startIndices;
+		std::vector<uint32_t> indexCounts;
+	};
+
+	/* As RenderContextResources::GetTextureCacheIndex. */
+	static uint32_t GetTextureCacheIndex(const Batch& batch)
+	{
+		const int32_t width = batch.GetTextureWidth();
+		const int32_t height = batch.GetTextureHeight();
+
+		if (width != height && max(width, height) >= 64)
+		{
+			return 6;
+		}
+
+		DWORD log2Longest = 0;
+		BitScanForward(&log2Longest, (DWORD)max(width, height));
+		return log2Longest - 3;
+	}
+
+	/* As D2DXContext::GetBatchDrawStateKey. */
+	static uint32_t GetDrawStateKey(const Batch& batch)
+	{
+		return !batch.IsValid() ? BatchReorderer::SkipKey :
+			((batch.GetPrimitiveType() == PrimitiveType::Sprites ? 1U : 0U) << 12) |
+			(GetTextureCacheIndex(batch) << 8) |
+			(batch.GetTextureAtlas() << 4) |
+			((uint32_t)batch.GetAlphaBlend() << 1) |
+			(uint32_t)batch.GetFilterMode();
+	}
+
+	/* A frame of batches in drawing order, as after reordering: runs of batches with the same
+	   state, and the indices and sprites laid out in that order. */
+	static VectorBatchStream MakeReorderedFrame(uint32_t batchCount, uint32_t seed)
+	{
+		auto next = [&]()
+		{
+			seed = seed * 1664525 + 1013904223;
+			return seed >> 8;
+		};
+
+		VectorBatchStream stream;
+		uint32_t startIndex = 0;
+		uint32_t startSprite = 0;
+		Batch batch;
+
+		for (uint32_t i = 0; i < batchCount; ++i)
+		{
+			if (i == 0 || (next() % 4) == 0)
+			{
+				const int32_t size = 8 << (next() % 6);
+				batch.SetTextureStartAddress(0x1000);
+				batch.SetTextureSize(size, (next() % 4) == 0 ? max(8, size / 2) : size);
+				batch.SetTextureAtlas(next() % 8);
+				batch.SetAlphaBlend((AlphaBlend)(next() % 4));
+				batch.SetFilterMode((next() % 8) == 0 ? GR_TEXTUREFILTER_BILINEAR : GR_TEXTUREFILTER_POINT_SAMPLED);
+				batch.SetPrimitiveType((next() % 3) == 0 ? PrimitiveType::Sprites : PrimitiveType::Triangles);
+			}
+
+			const bool isSprites = batch.GetPrimitiveType() == PrimitiveType::Sprites;
+			uint32_t& start = isSprites ? startSprite : startIndex;
+			batch.SetStartIndex(start);
+			batch.SetIndexCount(isSprites ? 1 + next() % 4 : 6 * (1 + next() % 8));
+			start += batch.GetIndexCount();
+
+			stream.batches.push_back(batch);
+			stream.Append(GetDrawStateKey(batch), batch.GetStartIndex(), batch.GetIndexCount());
+		}
+
+		return stream;
+	}
+
+	/* The merge loop DrawBatches used before the batch stream, which compared the state of
+	   each batch with that of the draw call so far. */
+	static uint32_t MergeBatchObjects(const Batch* batches, uint32_t batchCount, DrawCallRange* drawCalls)
+	{
+		Batch mergedBatch;
+		uint32_t firstBatch = 0;
+		uint32_t drawCallCount = 0;
+
+		for (uint32_t i = 0; i < batchCount; ++i)
+		{
+			const Batch& batch = batches[i];
+
+			if (!batch.IsValid())
+			{
+				continue;
+			}
+
+			if (!mergedBatch.IsValid())
+			{
+				mergedBatch = batch;
+				firstBatch = i;
+			}
+			else
+			{
+				if (GetTextureCacheIndex(batch) != GetTextureCacheIndex(mergedBatch) ||
+					batch.GetTextureAtlas() != mergedBatch.GetTextureAtlas() ||
+					batch.GetAlphaBlend() != mergedBatch.GetAlphaBlend() ||
+					batch.GetFilterMode() != mergedBatch.GetFilterMode() ||
+					(batch.GetPrimitiveType() == PrimitiveType::Sprites) != (mergedBatch.GetPrimitiveType() == PrimitiveType::Sprites) ||
+					((mergedBatch.GetIndexCount() + batch.GetIndexCount()) > 65535))
+				{
+					drawCalls[drawCallCount++] = { firstBatch, (uint32_t)mergedBatch.GetStartIndex(), mergedBatch.GetIndexCount() };
+					mergedBatch = batch;
+					firstBatch = i;
+				}
+				else
+				{
+					mergedBatch.SetIndexCount(mergedBatch.GetIndexCount() + batch.GetIndexCount());
+				}
+			}
+		}
+
+		if (mergedBatch.IsValid())
+		{
+			drawCalls[drawCallCount++] = { firstBatch, (uint32_t)mergedBatch.GetStartIndex(), mergedBatch.GetIndexCount() };
+		}
+
+		return drawCallCount;
+	}
+
+	static void AssertDrawCallsEqual(const DrawCallRange* expected, uint32_t expectedCount, const DrawCallRange* actual, uint32_t actualCount)
+	{
+		Assert::AreEqual(expectedCount, actualCount);
+
+		for (uint32_t i = 0; i < expectedCount; ++i)
+		{
+			Assert::AreEqual(expected[i].firstBatch, actual[i].firstBatch);
+			Assert::AreEqual(expected[i].startIndex, actual[i].startIndex);
+			Assert::AreEqual(expected[i].indexCount, actual[i].indexCount);
+		}
+	}
+
+	TEST_CLASS(TestBatchStream)
+	{
+	public:
+		TEST_METHOD(MergesRunsOfEqualKeys)
+		{
+			VectorBatchStream stream;
+			stream.Append(1, 0, 6);
+			stream.Append(1, 6, 3);
+			stream.Append(2, 9, 6);
+			stream.Append(2, 15, 6);
+			stream.Append(2, 21, 3);
+			stream.Append(1, 24, 6);
+
+			std::vector<DrawCallRange> drawCalls;
+			Assert::AreEqual(3U, stream.Merge(SimdKernel::Scalar, drawCalls));
+
+			const DrawCallRange expected[] = { { 0, 0, 9 }, { 2, 9, 15 }, { 5, 24, 6 } };
+			AssertDrawCallsEqual(expected, 3, drawCalls.data(), 3);
+		}
+
+		TEST_METHOD(LeavesOutSkippedBatches)
+		{
+			VectorBatchStream stream;
+			stream.Append(BatchReorderer::SkipKey, 0, 6);
+			stream.Append(1, 6, 6);
+			stream.Append(BatchReorderer::SkipKey, 12, 6);
+			stream.Append(1, 18, 6);
+			stream.Append(BatchReorderer::SkipKey, 24, 6);
+
+			std::vector<DrawCallRange> drawCalls;
+			Assert::AreEqual(2U, stream.Merge(SimdKernel::Scalar, drawCalls));
+
+			const DrawCallRange expected[] = { { 1, 6, 6 }, { 3, 18, 6 } };
+			AssertDrawCallsEqual(expected, 2, drawCalls.data(), 2);
+		}
+
+		TEST_METHOD(SplitsWhereIndicesDontFollowOn)
+		{
+			VectorBatchStream stream;
+			stream.Append(1, 0, 6);
+			stream.Append(1, 12, 6);
+			stream.Append(1, 18, 6);
+
+			std::vector<DrawCallRange> drawCalls;
+			Assert::AreEqual(2U, stream.Merge(SimdKernel::Scalar, drawCalls));
+
+			const DrawCallRange expected[] = { { 0, 0, 6 }, { 1, 12, 12 } };
+			AssertDrawCallsEqual(expected, 2, drawCalls.data(), 2);
+		}
+
+		TEST_METHOD(SplitsAtMaxIndexCount)
+		{
+			VectorBatchStream stream;
+
+			for (uint32_t i = 0; i < 12; ++i)
+			{
+				stream.Append(1, i * 6000, 6000);
+			}
+
+			std::vector<DrawCallRange> drawCalls;
+			Assert::AreEqual(2U, stream.Merge(SimdKernel::Scalar, drawCalls));
+
+			const DrawCallRange expected[] = { { 0, 0, 60000 }, { 10, 60000, 12000 } };
+			AssertDrawCallsEqual(expected, 2, drawCalls.data(), 2);
+		}
+
+		TEST_METHOD(MatchesBatchObjectMerging)
+		{
+			VectorBatchStream stream = MakeReorderedFrame(10 * 1024, 1234);
+
+			std::vector<DrawCallRange> expected(stream.batches.size());
+			const uint32_t expectedCount = MergeBatchObjects(stream.batches.data(), (uint32_t)stream.batches.size(), expected.data());
+			Assert::IsTrue(expectedCount < stream.batches.size() / 2);
+
+			std::vector<DrawCallRange> drawCalls;
+			const uint32_t drawCallCount = stream.Merge(SimdKernel::Scalar, drawCalls);
+			AssertDrawCallsEqual(expected.data(), expectedCount, drawCalls.data(), drawCallCount);
+		}
+
+		TEST_METHOD(KernelsMatchScalar)
+		{
+			uint32_t seed = 4321;
+			auto next = [&]()
+			{
+				seed = seed * 1664525 + 1013904223;
+				return seed >> 8;
+			};
+
+			for (uint32_t batchCount = 0; batchCount < 300; batchCount += 1 + batchCount / 8)
+			{
+				/* Long runs with the odd skipped batch, gap and very large batch, so that
+				   every rule ends up in and out of a group of four. */
+				VectorBatchStream stream;
+				uint32_t drawStateKey = 0;
+				uint32_t start = 0;
+
+				for (uint32_t i = 0; i < batchCount; ++i)
+				{
+					const uint32_t r = next() % 32;
+					drawStateKey = r == 0 ? drawStateKey + 1 : drawStateKey;
+					start += r == 1 ? 3 : 0;
+					const uint32_t indexCount = r == 2 ? 30000 : 6;
+					stream.Append(r == 3 ? BatchReorderer::SkipKey : drawStateKey, start, indexCount);
+					start += indexCount;
+				}
+
+				std::vector<DrawCallRange> expected;
+				const uint32_t expectedCount = stream.Merge(SimdKernel::Scalar, expected);
+
+				for (int32_t k = 1; k < (int32_t)SimdKernel::Count; ++k)
+				{
+					if (!IsSimdKernelSupported((SimdKernel)k))
+					{
+						continue;
+					}
+
+					std::vector<DrawCallRange> drawCalls;
+					const uint32_t drawCallCount = stream.Merge((SimdKernel)k, drawCalls);
+					AssertDrawCallsEqual(expected.data(), expectedCount, drawCalls.data(), drawCallCount);
+				}
+			}
+		}
+
+		TEST_METHOD(BenchmarkMergeBatches)
+		{
+			const uint32_t batchCounts[] = { 1024, 10 * 1024, 16 * 1024 };
+			const uint32_t frameCount = 64;
+
+			for (uint32_t batchCount : batchCounts)
+			{
+				const VectorBatchStream stream = MakeReorderedFrame(batchCount, batchCount);
+				std::vector<DrawCallRange> drawCalls(batchCount);
+				uint32_t drawCallCount = 0;
+
+				double batchObjectsMs = 1e9;
+				double kernelMs[(int32_t)SimdKernel::Count] = {};
+
+				for (uint32_t run = 0; run < 5; ++run)
+				{
+					const int64_t start = TimeStamp();
+
+					for (uint32_t frame = 0; frame < frameCount; ++frame)
+					{
+						drawCallCount = MergeBatchObjects(stream.batches.data(), batchCount, drawCalls.data());
+					}
+
+					batchObjectsMs = min(batchObjectsMs, TimeToMs(TimeStamp() - start));
+				}
+
+				for (int32_t k = 0; k < (int32_t)SimdKernel::Count; ++k)
+				{
+					if (!IsSimdKernelSupported((SimdKernel)k))
+					{
+						continue;
+					}
+
+					kernelMs[k] = 1e9;
+
+					for (uint32_t run = 0; run < 5; ++run)
+					{
+						const int64_t start = TimeStamp();
+
+						for (uint32_t frame = 0; frame < frameCount; ++frame)
+						{
+							Assert::AreEqual(drawCallCount, MergeBatches((SimdKernel)k,
+								stream.drawStateKeys.data(), stream.startIndices.data(), stream.indexCounts.data(), batchCount, drawCalls.data()));
+						}
+
+						kernelMs[k] = min(kernelMs[k], TimeToMs(TimeStamp() - start));
+					}
+				}
+
+				char message[256];
+				sprintf_s(message, "%u batches, %u draw calls, batch objects: %.4f ms.\n",
+					batchCount, drawCallCount, batchObjectsMs / frameCount);
+				Logger::WriteMessage(message);
+
+				for (int32_t k = 0; k < (int32_t)SimdKernel::Count; ++k)
+				{
+					if (kernelMs[k] > 0)
+					{
+						sprintf_s(message, "%u batches, batch stream, %s: %.4f ms.\n",
+							batchCount, GetSimdKernelName((SimdKernel)k), kernelMs[k] / frameCount);
+						Logger::WriteMessage(message);
+					}
+				}
+			}
+		}
+	};
+}
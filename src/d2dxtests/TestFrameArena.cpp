@@ -0,0 +1,261 @@
+/*
+	This file is part of D2DX.
+
+	Copyright (C) 2021  Bolrog
+
+	D2DX is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	D2DX is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with D2DX.  If not, see <https://www.gnu.org/licenses/>.
+*/
+#include "pch.h"
+#include "CppUnitTest.h"
+
+#include "../d2dx/BatchReorderer.h"
+#include "../d2dx/FrameArena.h"
+#include "../d2dx/Types.h"
+
+using namespace Microsoft::VisualStudio::CppUnitTestFramework;
+using namespace d2dx;
+
+namespace d2dxtests
+{
+	/* Records batches the way D2DXContext does, into arenas capped at the per-frame limits,
+	   and draws what it has whenever the next batch would not fit. */
+	class BatchRecorder final
+	{
+	public:
+		BatchRecorder() :
+			_batchIds{ 1024, D2DX_MAX_BATCHES_PER_FRAME },
+			_batchBounds{ 1024, D2DX_MAX_BATCHES_PER_FRAME },
+			_batchKeys{ 0, D2DX_MAX_BATCHES_PER_FRAME },
+			_indices{ 16 * 1024, D2DX_MAX_INDICES_PER_FRAME },
+			_reorderer{ D2DX_MAX_BATCHES_PER_FRAME }
+		{
+		}
+
+		void Record(uint32_t batchId, uint32_t indexCount)
+		{
+			if (!_batchIds.CanReserve(_batchCount, 1) || !_indices.CanReserve(_indexCount, indexCount))
+			{
+				Flush();
+				++_partialFlushCount;
+			}
+
+			Assert::IsTrue(_batchIds.Reserve(_batchCount, 1));
+			Assert::IsTrue(_batchBounds.Reserve(_batchCount, 1));
+			Assert::IsTrue(_indices.Reserve(_indexCount, indexCount));
+
+			for (uint32_t i = 0; i < indexCount; ++i)
+			{
+				_indices.GetItems()[_indexCount + i] = batchId;
+			}
+
+			const int16_t x = (int16_t)((batchId * 37) % 800);
+			const int16_t y = (int16_t)((batchId * 91) % 600);
+			_batchBounds.GetItems()[_batchCount] = { x, y, (int16_t)(x + 31), (int16_t)(y + 31) };
+			_batchIds.GetItems()[_batchCount] = { batchId, _indexCount, indexCount };
+			++_batchCount;
+			_indexCount += indexCount;
+		}
+
+		void Flush()
+		{
+			Assert::IsTrue(_batchKeys.Reserve(0, _batchCount));
+
+			for (uint32_t i = 0; i < _batchCount; ++i)
+			{
+				_batchKeys.GetItems()[i] = _batchIds.GetItems()[i].id % 7;
+			}
+
+			std::vector<uint32_t> order;
+
+			if (_reorderer.Reorder(_batchKeys.GetItems(), _batchBounds.GetItems(), _batchCount))
+			{
+				order.assign(_reorderer.GetOrder(), _reorderer.GetOrder() + _reorderer.GetOrderCount());
+			}
+			else
+			{
+				for (uint32_t i = 0; i < _batchCount; ++i)
+				{
+					order.push_back(i);
+				}
+			}
+
+			Assert::AreEqual((size_t)_batchCount, order.size());
+
+			for (uint32_t i : order)
+			{
+				const RecordedBatch& batch = _batchIds.GetItems()[i];
+
+				for (uint32_t j = 0; j < batch.indexCount; ++j)
+				{
+					Assert::AreEqual(batch.id, _indices.GetItems()[batch.startIndex + j]);
+				}
+
+				_drawnIds.push_back(batch.id);
+			}
+
+			_batchIds.OnReuse(_batchCount);
+			_indices.OnReuse(_indexCount);
+			_batchCount = 0;
+			_indexCount = 0;
+		}
+
+		struct RecordedBatch
+		{
+			uint32_t id;
+			uint32_t startIndex;
+			uint32_t indexCount;
+		};
+
+		uint32_t _batchCount = 0;
+		uint32_t _indexCount = 0;
+		uint32_t _partialFlushCount = 0;
+		FrameArena<RecordedBatch> _batchIds;
+		FrameArena<BatchBounds> _batchBounds;
+		FrameArena<uint32_t> _batchKeys;
+		FrameArena<uint32_t> _indices;
+		BatchReorderer _reorderer;
+		std::vector<uint32_t> _drawnIds;
+	};
+
+	TEST_CLASS(TestFrameArena)
+	{
+	public:
+		TEST_METHOD(GrowsAndKeepsItems)
+		{
+			FrameArena<uint32_t> arena(4, 100000);
+			Assert::AreEqual(4U, arena.GetCapacity());
+
+			uint32_t count = 0;
+
+			for (uint32_t i = 0; i < 5000; ++i)
+			{
+				Assert::IsTrue(arena.Reserve(count, 3));
+				Assert::IsTrue(arena.GetCapacity() >= count + 3);
+
+				for (uint32_t j = 0; j < 3; ++j)
+				{
+					arena.GetItems()[count++] = i * 3 + j;
+				}
+			}
+
+			for (uint32_t i = 0; i < count; ++i)
+			{
+				Assert::AreEqual(i, arena.GetItems()[i]);
+			}
+
+			/* Grows by doubling, not to the hard limit. */
+			Assert::IsTrue(arena.GetCapacity() < 2 * count);
+		}
+
+		TEST_METHOD(StartsEmpty)
+		{
+			FrameArena<uint32_t> arena(0, 1000);
+			Assert::AreEqual(0U, arena.GetCapacity());
+			Assert::AreEqual(0U, arena.GetAllocatedSize());
+
+			Assert::IsTrue(arena.Reserve(0, 1));
+			Assert::IsTrue(arena.GetCapacity() >= 1);
+		}
+
+		TEST_METHOD(StopsAtHardLimit)
+		{
+			FrameArena<uint32_t> arena(16, 1000);
+
+			Assert::IsTrue(arena.Reserve(0, 600));
+			for (uint32_t i = 0; i < 600; ++i)
+			{
+				arena.GetItems()[i] = i;
+			}
+
+			Assert::IsTrue(arena.CanReserve(600, 400));
+			Assert::IsFalse(arena.CanReserve(600, 401));
+
+			const uint32_t capacity = arena.GetCapacity();
+			Assert::IsFalse(arena.Reserve(600, 401));
+			Assert::AreEqual(capacity, arena.GetCapacity());
+
+			Assert::IsTrue(arena.Reserve(600, 400));
+			Assert::AreEqual(1000U, arena.GetCapacity());
+
+			for (uint32_t i = 0; i < 600; ++i)
+			{
+				Assert::AreEqual(i, arena.GetItems()[i]);
+			}
+		}
+
+		TEST_METHOD(TracksHighWater)
+		{
+			FrameArena<uint64_t> arena(16, 1000);
+
+			arena.OnReuse(10);
+			arena.OnReuse(700);
+			arena.OnReuse(3);
+
+			Assert::AreEqual(700U, arena.GetHighWaterCount());
+			Assert::AreEqual(16U * 8, arena.GetAllocatedSize());
+		}
+
+		TEST_METHOD(StressMoreBatchesThanFrameLimit)
+		{
+			const uint32_t batchCount = 3 * D2DX_MAX_BATCHES_PER_FRAME + 1000;
+
+			BatchRecorder recorder;
+
+			for (uint32_t i = 0; i < batchCount; ++i)
+			{
+				recorder.Record(i, i % 5 == 0 ? 1 : 6);
+			}
+
+			recorder.Flush();
+
+			Assert::AreEqual(3U, recorder._partialFlushCount);
+			Assert::AreEqual((uint32_t)D2DX_MAX_BATCHES_PER_FRAME, recorder._batchIds.GetHighWaterCount());
+			Assert::AreEqual((uint32_t)D2DX_MAX_BATCHES_PER_FRAME, recorder._batchIds.GetCapacity());
+
+			/* Every batch is drawn once, and none is moved across a flush. */
+			Assert::AreEqual((size_t)batchCount, recorder._drawnIds.size());
+
+			std::vector<uint8_t> isDrawn(batchCount, 0);
+
+			for (size_t i = 0; i < recorder._drawnIds.size(); ++i)
+			{
+				const uint32_t id = recorder._drawnIds[i];
+				Assert::AreEqual((uint32_t)(i / D2DX_MAX_BATCHES_PER_FRAME), id / D2DX_MAX_BATCHES_PER_FRAME);
+				Assert::AreEqual((uint8_t)0, isDrawn[id]);
+				isDrawn[id] = 1;
+			}
+		}
+
+		TEST_METHOD(StressFlushesOnIndexLimit)
+		{
+			BatchRecorder recorder;
+
+			/* Few batches, but more indices than a frame can hold. */
+			const uint32_t indexCountPerBatch = 1000;
+			const uint32_t batchCount = 3 * D2DX_MAX_INDICES_PER_FRAME / indexCountPerBatch;
+
+			for (uint32_t i = 0; i < batchCount; ++i)
+			{
+				recorder.Record(i, indexCountPerBatch);
+			}
+
+			recorder.Flush();
+
+			const uint32_t batchCountPerFlush = D2DX_MAX_INDICES_PER_FRAME / indexCountPerBatch;
+			Assert::AreEqual((batchCount - 1) / batchCountPerFlush, recorder._partialFlushCount);
+			Assert::IsTrue(recorder._indices.GetHighWaterCount() <= D2DX_MAX_INDICES_PER_FRAME);
+			Assert::AreEqual((size_t)batchCount, recorder._drawnIds.size());
+		}
+	};
+}
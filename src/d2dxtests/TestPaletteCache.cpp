@@ -0,0 +1,139 @@
+/*
+	This file is part of D2DX.
+
+	Copyright (C) 2021  Bolrog
+
+	D2DX is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	D2DX is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with D2DX.  If not, see <https://www.gnu.org/licenses/>.
+*/
+#include "pch.h"
+#include "CppUnitTest.h"
+
+#include "../d2dx/PaletteCache.h"
+#include "../d2dx/Types.h"
+#include "../d2dx/Utils.h"
+
+using namespace Microsoft::VisualStudio::CppUnitTestFramework;
+using namespace d2dx;
+
+namespace d2dxtests
+{
+	TEST_CLASS(TestPaletteCache)
+	{
+	public:
+		TEST_METHOD(FindsInsertedPalettes)
+		{
+			PaletteCache cache(D2DX_MAX_GAME_PALETTES);
+
+			for (uint64_t key = 1; key <= D2DX_MAX_GAME_PALETTES; ++key)
+			{
+				Assert::AreEqual(-1, cache.Find(key));
+
+				bool evicted = true;
+				Assert::AreEqual((int32_t)key - 1, cache.Insert(key, evicted));
+				Assert::IsFalse(evicted);
+			}
+
+			for (uint64_t key = 1; key <= D2DX_MAX_GAME_PALETTES; ++key)
+			{
+				Assert::AreEqual((int32_t)key - 1, cache.Find(key));
+			}
+
+			Assert::AreEqual((uint32_t)D2DX_MAX_GAME_PALETTES, cache.GetUsedCount());
+			Assert::AreEqual(0U, cache.GetEvictionCount());
+		}
+
+		TEST_METHOD(EvictsLeastRecentlyUsedPalette)
+		{
+			PaletteCache cache(4);
+			bool evicted;
+
+			for (uint64_t key = 1; key <= 4; ++key)
+			{
+				cache.Insert(key, evicted);
+			}
+
+			cache.OnNewFrame();
+			cache.Find(1);
+			cache.Find(3);
+
+			Assert::AreEqual(1, cache.Insert(5, evicted));
+			Assert::IsTrue(evicted);
+			Assert::AreEqual(-1, cache.Find(2));
+			Assert::AreEqual(3, cache.Insert(6, evicted));
+			Assert::AreEqual(-1, cache.Find(4));
+			Assert::AreEqual(0, cache.Find(1));
+			Assert::AreEqual(0U, cache.GetResetCount());
+		}
+
+		TEST_METHOD(CyclesThroughMorePalettesThanGameSlots)
+		{
+			/* The old fixed table held 14 palettes. */
+			PaletteCache cache(D2DX_MAX_GAME_PALETTES);
+			std::vector<uint64_t> slotKeys(D2DX_MAX_GAME_PALETTES, 0);
+
+			uint32_t seed = 1234;
+			auto next = [&]()
+			{
+				seed = seed * 1664525 + 1013904223;
+				return seed >> 8;
+			};
+
+			for (uint32_t frame = 0; frame < 1000; ++frame)
+			{
+				std::vector<int32_t> usedInFrame;
+
+				/* A frame draws with up to 48 of 200 palettes, a few of which change each frame. */
+				for (uint32_t i = 0; i < 48; ++i)
+				{
+					const uint64_t key = 1 + (frame / 4 + next() % 48) % 200;
+
+					int32_t index = cache.Find(key);
+
+					if (index < 0)
+					{
+						bool evicted;
+						index = cache.Insert(key, evicted);
+						Assert::AreEqual(slotKeys[index] != 0, evicted);
+
+						/* A palette that was drawn with in this frame must not be replaced. */
+						Assert::IsTrue(std::find(usedInFrame.begin(), usedInFrame.end(), index) == usedInFrame.end());
+						slotKeys[index] = key;
+					}
+
+					Assert::AreEqual(key, slotKeys[index]);
+					usedInFrame.push_back(index);
+				}
+
+				cache.OnNewFrame();
+			}
+
+			Assert::IsTrue(cache.GetEvictionCount() > 0);
+			Assert::AreEqual(0U, cache.GetResetCount());
+		}
+
+		TEST_METHOD(ReplacesPaletteUsedInFrameOnlyWhenAllAre)
+		{
+			PaletteCache cache(4);
+			bool evicted;
+
+			for (uint64_t key = 1; key <= 4; ++key)
+			{
+				cache.Insert(key, evicted);
+			}
+
+			Assert::AreEqual(0, cache.Insert(5, evicted));
+			Assert::AreEqual(1U, cache.GetResetCount());
+		}
+	};
+}
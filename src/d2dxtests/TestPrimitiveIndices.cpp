@@ -0,0 +1,115 @@
+/*
+	This file is part of D2DX.
+
+	Copyright (C) 2021  Bolrog
+
+	D2DX is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	D2DX is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with D2DX.  If not, see <https://www.gnu.org/licenses/>.
+*/
+#include "pch.h"
+#include "CppUnitTest.h"
+
+#include "../d2dx/PrimitiveIndices.h"
+
+using namespace Microsoft::VisualStudio::CppUnitTestFramework;
+using namespace d2dx;
+
+namespace d2dxtests
+{
+	TEST_CLASS(TestPrimitiveIndices)
+	{
+	public:
+		TEST_METHOD(CountsIndices)
+		{
+			Assert::AreEqual(0U, GetTriangleListIndexCount(0));
+			Assert::AreEqual(0U, GetTriangleListIndexCount(2));
+			Assert::AreEqual(3U, GetTriangleListIndexCount(3));
+			Assert::AreEqual(6U, GetTriangleListIndexCount(4));
+			Assert::AreEqual(30U, GetTriangleListIndexCount(12));
+		}
+
+		TEST_METHOD(WritesStripIndices)
+		{
+			uint32_t indices[9] = { 0 };
+			Assert::AreEqual(9U, WriteTriangleStripIndices(indices, 100, 5));
+
+			const uint32_t expected[9] = { 100, 101, 102, 101, 102, 103, 102, 103, 104 };
+			for (uint32_t i = 0; i < 9; ++i)
+			{
+				Assert::AreEqual(expected[i], indices[i]);
+			}
+		}
+
+		TEST_METHOD(WritesFanIndices)
+		{
+			uint32_t indices[9] = { 0 };
+			Assert::AreEqual(9U, WriteTriangleFanIndices(indices, 100, 5));
+
+			const uint32_t expected[9] = { 100, 101, 102, 100, 102, 103, 100, 103, 104 };
+			for (uint32_t i = 0; i < 9; ++i)
+			{
+				Assert::AreEqual(expected[i], indices[i]);
+			}
+		}
+
+		TEST_METHOD(WritesQuadAsFan)
+		{
+			uint32_t indices[6] = { 0 };
+			Assert::AreEqual(6U, WriteTriangleFanIndices(indices, 0, 4));
+
+			const uint32_t expected[6] = { 0, 1, 2, 0, 2, 3 };
+			for (uint32_t i = 0; i < 6; ++i)
+			{
+				Assert::AreEqual(expected[i], indices[i]);
+			}
+		}
+
+		TEST_METHOD(WritesNothingForDegenerateInput)
+		{
+			uint32_t indices[3] = { 7, 7, 7 };
+			Assert::AreEqual(0U, WriteTriangleStripIndices(indices, 0, 2));
+			Assert::AreEqual(0U, WriteTriangleFanIndices(indices, 0, 1));
+			Assert::AreEqual(7U, indices[0]);
+		}
+
+		TEST_METHOD(MatchesExpandedTriangleLists)
+		{
+			/* The triangles must be the same ones D2DXContext used to write out vertex by
+			   vertex: strip triangle i is (i, i+1, i+2), fan triangle i is (0, i+1, i+2). */
+			for (uint32_t count = 3; count < 64; ++count)
+			{
+				std::vector<uint32_t> stripIndices(GetTriangleListIndexCount(count));
+				std::vector<uint32_t> fanIndices(GetTriangleListIndexCount(count));
+				WriteTriangleStripIndices(stripIndices.data(), 10, count);
+				WriteTriangleFanIndices(fanIndices.data(), 10, count);
+
+				std::vector<uint32_t> expandedStrip = { 10, 11, 12 };
+				std::vector<uint32_t> expandedFan = { 10, 11, 12 };
+
+				for (uint32_t i = 0; i < count - 3; ++i)
+				{
+					expandedStrip.push_back(expandedStrip[expandedStrip.size() - 2]);
+					expandedStrip.push_back(expandedStrip[expandedStrip.size() - 2]);
+					expandedStrip.push_back(10 + i + 3);
+
+					expandedFan.push_back(10);
+					expandedFan.push_back(expandedFan[expandedFan.size() - 2]);
+					expandedFan.push_back(10 + i + 3);
+				}
+
+				Assert::IsTrue(expandedStrip == stripIndices);
+				Assert::IsTrue(expandedFan == fanIndices);
+			}
+		}
+	};
+}
@@ -19,8 +19,11 @@
 #include "pch.h"
 #include <array>
 #include "CppUnitTest.h"
+#include "../d2dx/Simd.h"
 #include "../d2dx/Utils.h"
 
+#include "IndexOfUInt64.h"
+
 using namespace Microsoft::WRL;
 using namespace Microsoft::VisualStudio::CppUnitTestFramework;
 using namespace d2dx;
@@ -39,10 +42,100 @@ namespace d2dxtests
 				items[i] = 1023ull - i;
 			}
 
-			Assert::AreEqual(0, IndexOfUInt64(items.data(), items.size(), 1023));
-			Assert::AreEqual(1023, IndexOfUInt64(items.data(), items.size(), 0));
-			Assert::AreEqual(1009, IndexOfUInt64(items.data(), items.size(), 14));
+			for (int32_t k = 0; k < (int32_t)SimdKernel::Count; ++k)
+			{
+				const SimdKernel kernel = (SimdKernel)k;
+
+				if (!IsSimdKernelSupported(kernel))
+				{
+					char message[256];
+					sprintf_s(message, "Skipping unsupported kernel %s.\n", GetSimdKernelName(kernel));
+					Logger::WriteMessage(message);
+					continue;
+				}
+
+				Assert::AreEqual(0, IndexOfUInt64(kernel, items.data(), items.size(), 1023));
+				Assert::AreEqual(1023, IndexOfUInt64(kernel, items.data(), items.size(), 0));
+				Assert::AreEqual(1009, IndexOfUInt64(kernel, items.data(), items.size(), 14));
+				Assert::AreEqual(114, IndexOfUInt64(kernel, items.data(), items.size(), 909));
+				Assert::AreEqual(-1, IndexOfUInt64(kernel, items.data(), items.size(), 1024));
+				Assert::AreEqual(-1, IndexOfUInt64(kernel, items.data(), 32, 32));
+			}
+
 			Assert::AreEqual(114, IndexOfUInt64(items.data(), items.size(), 909));
 		}
+
+		TEST_METHOD(FindUInt64KernelsAgree)
+		{
+			alignas(64) std::array<uint64_t, 256> items;
+
+			for (uint32_t i = 0; i < items.size(); ++i)
+			{
+				items[i] = (i % 3) ? 0xFFFFFFFF00000000ull | i : (uint64_t)i << 32;
+			}
+
+			/* Duplicates in the same and in different blocks of 32. */
+			items[40] = items[45] = items[200] = 0x123456789ABCDEFull;
+
+			for (int32_t k = 0; k < (int32_t)SimdKernel::Count; ++k)
+			{
+				const SimdKernel kernel = (SimdKernel)k;
+
+				if (!IsSimdKernelSupported(kernel))
+				{
+					continue;
+				}
+
+				for (uint32_t i = 0; i < items.size(); ++i)
+				{
+					const int32_t expected = IndexOfUInt64(SimdKernel::Scalar, items.data(), items.size(), items[i]);
+					Assert::AreEqual(expected, IndexOfUInt64(kernel, items.data(), items.size(), items[i]));
+				}
+
+				Assert::AreEqual(45, IndexOfUInt64(kernel, items.data(), items.size(), 0x123456789ABCDEFull));
+				Assert::AreEqual(-1, IndexOfUInt64(kernel, items.data(), items.size(), 0xFFFFFFFFull));
+			}
+		}
+
+		TEST_METHOD(BenchmarkFindUInt64Kernels)
+		{
+			const uint32_t itemsCount = 2048;
+			const uint32_t lookupCount = 1 << 16;
+			Buffer<uint64_t> items(itemsCount);
+
+			for (uint32_t i = 0; i < itemsCount; ++i)
+			{
+				items.items[i] = 0x9E3779B97F4A7C15ull * (i + 1);
+			}
+
+			char message[256];
+			sprintf_s(message, "Best kernel: %s.\n", GetSimdKernelName(GetBestSimdKernel()));
+			Logger::WriteMessage(message);
+
+			for (int32_t k = 0; k < (int32_t)SimdKernel::Count; ++k)
+			{
+				const SimdKernel kernel = (SimdKernel)k;
+
+				if (!IsSimdKernelSupported(kernel))
+				{
+					continue;
+				}
+
+				/* Always miss, so that every lookup scans the whole array. */
+				int64_t checksum = 0;
+				const int64_t start = TimeStamp();
+				for (uint32_t i = 0; i < lookupCount; ++i)
+				{
+					checksum += IndexOfUInt64(kernel, items.items, itemsCount, i);
+				}
+				const double ms = TimeToMs(TimeStamp() - start);
+
+				Assert::AreEqual(-(int64_t)lookupCount, checksum);
+
+				sprintf_s(message, "%s: %.2f keys/ns\n", GetSimdKernelName(kernel),
+					(double)itemsCount * lookupCount / (ms * 1e6));
+				Logger::WriteMessage(message);
+			}
+		}
 	};
 }
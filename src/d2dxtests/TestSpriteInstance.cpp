@@ -0,0 +1,288 @@
+/*
+	This file is part of D2DX.
+
+	Copyright (C) 2021  Bolrog
+
+	D2DX is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	D2DX is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with D2DX.  If not, see <https://www.gnu.org/licenses/>.
+*/
+#include "pch.h"
+#include "CppUnitTest.h"
+
+#include "../d2dx/PrimitiveIndices.h"
+#include "../d2dx/SpriteInstance.h"
+
+using namespace Microsoft::VisualStudio::CppUnitTestFramework;
+using namespace d2dx;
+
+namespace d2dxtests
+{
+	TEST_CLASS(TestSpriteInstance)
+	{
+	public:
+		TEST_METHOD(PacksScreenAlignedQuad)
+		{
+			const Vertex vertices[4] = {
+				Vertex(10, 20, 0, 0, 0xFF808080, true, 5, 3, 77),
+				Vertex(42, 20, 32, 0, 0xFF808080, true, 5, 3, 77),
+				Vertex(42, 36, 32, 16, 0xFF808080, true, 5, 3, 77),
+				Vertex(10, 36, 0, 16, 0xFF808080, true, 5, 3, 77),
+			};
+
+			SpriteInstance sprite;
+			Assert::IsTrue(TryMakeSpriteInstance(vertices, sprite));
+			Assert::AreEqual(20.0f, sprite.GetY0());
+
+			for (int32_t i = 0; i < 4; ++i)
+			{
+				Assert::IsTrue(AreEqual(vertices[i], sprite.GetCorner(i)));
+			}
+
+			AssertDrawsSameTriangles(vertices, sprite);
+		}
+
+		TEST_METHOD(PacksOtherWindingsAndMirroredTexcoords)
+		{
+			/* Counter-clockwise, mirrored in s, starting at the bottom right. */
+			const Vertex vertices[4] = {
+				Vertex(42, 36, 0, 16, 0xFFFFFFFF, false, 1, 2, 3),
+				Vertex(42, 20, 0, 0, 0xFFFFFFFF, false, 1, 2, 3),
+				Vertex(10, 20, 32, 0, 0xFFFFFFFF, false, 1, 2, 3),
+				Vertex(10, 36, 32, 16, 0xFFFFFFFF, false, 1, 2, 3),
+			};
+
+			SpriteInstance sprite;
+			Assert::IsTrue(TryMakeSpriteInstance(vertices, sprite));
+			AssertDrawsSameTriangles(vertices, sprite);
+		}
+
+		TEST_METHOD(KeepsFractionalPositions)
+		{
+			const Vertex vertices[4] = {
+				Vertex(10.25f, 20.5f, 0, 0, 0xFFFFFFFF, false, 0, 0, 0),
+				Vertex(41.75f, 20.5f, 32, 0, 0xFFFFFFFF, false, 0, 0, 0),
+				Vertex(41.75f, 36.125f, 32, 16, 0xFFFFFFFF, false, 0, 0, 0),
+				Vertex(10.25f, 36.125f, 0, 16, 0xFFFFFFFF, false, 0, 0, 0),
+			};
+
+			SpriteInstance sprite;
+			Assert::IsTrue(TryMakeSpriteInstance(vertices, sprite));
+			AssertDrawsSameTriangles(vertices, sprite);
+		}
+
+		TEST_METHOD(KeepsPositionsAtTheEdgesOfTheFixedPointRange)
+		{
+			const Vertex vertices[4] = {
+				Vertex(-4096, -4096, 0, 0, 0xFFFFFFFF, false, 0, 0, 0),
+				Vertex(4095.875f, -4096, 32, 0, 0xFFFFFFFF, false, 0, 0, 0),
+				Vertex(4095.875f, 4095.875f, 32, 16, 0xFFFFFFFF, false, 0, 0, 0),
+				Vertex(-4096, 4095.875f, 0, 16, 0xFFFFFFFF, false, 0, 0, 0),
+			};
+
+			SpriteInstance sprite;
+			Assert::IsTrue(TryMakeSpriteInstance(vertices, sprite));
+
+			for (int32_t i = 0; i < 4; ++i)
+			{
+				Assert::AreEqual(vertices[i].GetFixedPointX(), sprite.GetCorner(i).GetFixedPointX());
+				Assert::AreEqual(vertices[i].GetFixedPointY(), sprite.GetCorner(i).GetFixedPointY());
+			}
+		}
+
+		TEST_METHOD(FallsBackForOtherQuads)
+		{
+			const Vertex quad[4] = {
+				Vertex(10, 20, 0, 0, 0xFFFFFFFF, false, 0, 0, 0),
+				Vertex(42, 20, 32, 0, 0xFFFFFFFF, false, 0, 0, 0),
+				Vertex(42, 36, 32, 16, 0xFFFFFFFF, false, 0, 0, 0),
+				Vertex(10, 36, 0, 16, 0xFFFFFFFF, false, 0, 0, 0),
+			};
+
+			SpriteInstance sprite;
+			Vertex vertices[4];
+
+			/* Not screen-aligned (a floor tile diamond). */
+			memcpy(vertices, quad, sizeof(quad));
+			vertices[0].SetPosition(26, 20);
+			vertices[1].SetPosition(42, 28);
+			vertices[2].SetPosition(26, 36);
+			vertices[3].SetPosition(10, 28);
+			Assert::IsFalse(TryMakeSpriteInstance(vertices, sprite));
+
+			/* Gouraud shaded. */
+			memcpy(vertices, quad, sizeof(quad));
+			vertices[2].SetColor(0xFF000000);
+			Assert::IsFalse(TryMakeSpriteInstance(vertices, sprite));
+
+			/* Rotated texture: s follows y. */
+			memcpy(vertices, quad, sizeof(quad));
+			vertices[0].SetTexcoord(0, 0);
+			vertices[1].SetTexcoord(0, 32);
+			vertices[2].SetTexcoord(16, 32);
+			vertices[3].SetTexcoord(16, 0);
+			Assert::IsFalse(TryMakeSpriteInstance(vertices, sprite));
+
+			/* Sheared texture. */
+			memcpy(vertices, quad, sizeof(quad));
+			vertices[3].SetTexcoord(4, 16);
+			Assert::IsFalse(TryMakeSpriteInstance(vertices, sprite));
+
+			/* Degenerate. */
+			memcpy(vertices, quad, sizeof(quad));
+			vertices[1].SetPosition(10, 20);
+			vertices[2].SetPosition(10, 36);
+			Assert::IsFalse(TryMakeSpriteInstance(vertices, sprite));
+
+			/* Corners out of order (a bow tie). */
+			memcpy(vertices, quad, sizeof(quad));
+			vertices[0] = quad[0];
+			vertices[1] = quad[2];
+			vertices[2] = quad[1];
+			vertices[3] = quad[3];
+			Assert::IsFalse(TryMakeSpriteInstance(vertices, sprite));
+
+			/* Different surfaces. */
+			memcpy(vertices, quad, sizeof(quad));
+			vertices[3].SetSurfaceId(1);
+			Assert::IsFalse(TryMakeSpriteInstance(vertices, sprite));
+		}
+
+		TEST_METHOD(MatchesTriangleListOutput)
+		{
+			/* Random quads, most of them screen-aligned. Whenever a quad packs, the sprite must
+			   draw the same triangles as the triangle list it replaces. */
+			uint32_t seed = 31337;
+			uint32_t packedCount = 0;
+
+			for (int32_t n = 0; n < 20000; ++n)
+			{
+				uint32_t r[8];
+				for (int32_t i = 0; i < 8; ++i)
+				{
+					seed = seed * 1664525 + 1013904223;
+					r[i] = seed >> 8;
+				}
+
+				const float x0 = (float)(r[0] % 800) - 100.0f;
+				const float y0 = (float)(r[1] % 600) - 100.0f;
+				const float x1 = x0 + 1 + (r[2] % 256);
+				const float y1 = y0 + 1 + (r[3] % 256);
+				const int32_t s0 = r[4] % 256;
+				const int32_t t0 = r[5] % 256;
+				const int32_t s1 = (r[6] & 1) ? s0 + (r[2] % 256) : s0 - (int32_t)(r[2] % 256);
+				const int32_t t1 = (r[6] & 2) ? t0 + (r[3] % 256) : t0 - (int32_t)(r[3] % 256);
+
+				Vertex corners[4] = {
+					Vertex(x0, y0, s0, t0, 0xFFFFFFFF, false, 7, 1, 100),
+					Vertex(x1, y0, s1, t0, 0xFFFFFFFF, false, 7, 1, 100),
+					Vertex(x1, y1, s1, t1, 0xFFFFFFFF, false, 7, 1, 100),
+					Vertex(x0, y1, s0, t1, 0xFFFFFFFF, false, 7, 1, 100),
+				};
+
+				/* Any start corner and either winding. */
+				const int32_t start = r[7] % 4;
+				const int32_t step = (r[7] & 4) ? 1 : 3;
+				Vertex vertices[4];
+				for (int32_t i = 0; i < 4; ++i)
+				{
+					vertices[i] = corners[(start + i * step) % 4];
+				}
+
+				/* Now and then, something the sprite can't express. */
+				switch ((r[7] >> 3) % 8)
+				{
+				case 0:
+					vertices[r[0] % 4].SetColor(0xFF102030);
+					break;
+				case 1:
+					vertices[r[1] % 4].AddOffset(1, 0);
+					break;
+				case 2:
+					vertices[r[2] % 4].AddTexcoordOffset(0, 1);
+					break;
+				default:
+					break;
+				}
+
+				SpriteInstance sprite;
+				if (TryMakeSpriteInstance(vertices, sprite))
+				{
+					AssertDrawsSameTriangles(vertices, sprite);
+					++packedCount;
+				}
+			}
+
+			Assert::IsTrue(packedCount > 20000 / 2);
+			Assert::IsTrue(packedCount < 20000);
+		}
+
+	private:
+		static bool AreEqual(
+			const Vertex& a,
+			const Vertex& b)
+		{
+			return
+				a.GetX() == b.GetX() &&
+				a.GetY() == b.GetY() &&
+				a.GetS() == b.GetS() &&
+				a.GetT() == b.GetT() &&
+				a.GetColor() == b.GetColor() &&
+				a.GetAtlasIndex() == b.GetAtlasIndex() &&
+				a.GetPaletteIndex() == b.GetPaletteIndex() &&
+				a.GetSurfaceId() == b.GetSurfaceId() &&
+				a.IsChromaKeyEnabled() == b.IsChromaKeyEnabled();
+		}
+
+		static bool IsSameTriangle(
+			const Vertex* a,
+			const Vertex* b)
+		{
+			for (int32_t i = 0; i < 3; ++i)
+			{
+				if (!AreEqual(a[i], b[0]) && !AreEqual(a[i], b[1]) && !AreEqual(a[i], b[2]))
+				{
+					return false;
+				}
+			}
+
+			return true;
+		}
+
+		static void AssertDrawsSameTriangles(
+			const Vertex* vertices,
+			const SpriteInstance& sprite)
+		{
+			/* What the triangle path draws... */
+			uint32_t indices[6];
+			Assert::AreEqual(6U, WriteTriangleFanIndices(indices, 0, 4));
+
+			Vertex fanTriangles[6];
+			for (int32_t i = 0; i < 6; ++i)
+			{
+				fanTriangles[i] = vertices[indices[i]];
+			}
+
+			/* ...and what SpriteVS draws. */
+			const int32_t spriteCorners[6] = { 0, 1, 2, 0, 2, 3 };
+			Vertex spriteTriangles[6];
+			for (int32_t i = 0; i < 6; ++i)
+			{
+				spriteTriangles[i] = sprite.GetCorner(spriteCorners[i]);
+			}
+
+			Assert::IsTrue(
+				(IsSameTriangle(fanTriangles, spriteTriangles) && IsSameTriangle(fanTriangles + 3, spriteTriangles + 3)) ||
+				(IsSameTriangle(fanTriangles, spriteTriangles + 3) && IsSameTriangle(fanTriangles + 3, spriteTriangles)));
+		}
+	};
+}
@@ -0,0 +1,361 @@
+/*
+	This file is part of D2DX.
+
+	Copyright (C) 2021  Bolrog
+
+	D2DX is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	D2DX is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with D2DX.  If not, see <https://www.gnu.org/licenses/>.
+*/
+#include "pch.h"
+#include "CppUnitTest.h"
+
+#include "../d2dx/Batch.h"
+#include "../d2dx/TextureAtlasPacker.h"
+#include "../d2dx/TextureCache.h"
+
+#include "TestUtils.h"
+
+using namespace Microsoft::VisualStudio::CppUnitTestFramework;
+using namespace d2dx;
+
+namespace d2dxtests
+{
+	/* Checks that the rects are inside their slices, that no two of them overlap, and that each
+	   is aligned to its size rounded up to a power of two of at least 8 texels, which the
+	   bilinear pixel shader relies on to find it. */
+	static void AssertNoOverlap(
+		const std::vector<TextureAtlasRect>& rects,
+		uint32_t sliceSize,
+		uint32_t sliceCount)
+	{
+		std::vector<uint8_t> texels((size_t)sliceSize * sliceSize * sliceCount, 0);
+
+		for (const auto& rect : rects)
+		{
+			Assert::IsTrue(rect.slice < sliceCount);
+			Assert::IsTrue(rect.x + rect.width <= sliceSize);
+			Assert::IsTrue(rect.y + rect.height <= sliceSize);
+
+			uint32_t cellWidth = 8;
+			uint32_t cellHeight = 8;
+
+			while (cellWidth < rect.width)
+			{
+				cellWidth *= 2;
+			}
+
+			while (cellHeight < rect.height)
+			{
+				cellHeight *= 2;
+			}
+
+			Assert::AreEqual(0U, rect.x % cellWidth);
+			Assert::AreEqual(0U, rect.y % cellHeight);
+
+			for (uint32_t y = rect.y; y < (uint32_t)rect.y + rect.height; ++y)
+			{
+				for (uint32_t x = rect.x; x < (uint32_t)rect.x + rect.width; ++x)
+				{
+					uint8_t& texel = texels[((size_t)rect.slice * sliceSize + y) * sliceSize + x];
+					Assert::AreEqual((uint8_t)0, texel);
+					texel = 1;
+				}
+			}
+		}
+	}
+
+	TEST_CLASS(TestTextureAtlasPacker)
+	{
+	public:
+		TEST_METHOD(PacksNarrowTexturesIntoOneSlice)
+		{
+			TextureAtlasPacker packer(256, 64);
+			std::vector<TextureAtlasRect> rects;
+
+			for (uint32_t i = 0; i < 16; ++i)
+			{
+				uint32_t evictedCount = 0;
+				rects.push_back(packer.Insert(MakeContentKey(i), 16, 256, evictedCount));
+				Assert::AreEqual(0U, evictedCount);
+				Assert::AreEqual((uint16_t)0, rects.back().slice);
+			}
+
+			AssertNoOverlap(rects, 256, 64);
+			Assert::AreEqual(1U, packer.GetUsedSliceCount());
+			Assert::AreEqual(16U, packer.GetTextureCount());
+			Assert::AreEqual(packer.GetShelfTexelCount(), packer.GetTexelCount());
+
+			for (uint32_t i = 0; i < 16; ++i)
+			{
+				TextureAtlasRect rect;
+				Assert::IsTrue(packer.Find(MakeContentKey(i), rect));
+				Assert::AreEqual(rects[i].x, rect.x);
+				Assert::AreEqual(rects[i].y, rect.y);
+			}
+
+			/* Wide textures stack on shelves of their own height. */
+			for (uint32_t i = 0; i < 8; ++i)
+			{
+				uint32_t evictedCount = 0;
+				rects.push_back(packer.Insert(MakeContentKey(100 + i), 256, 32, evictedCount));
+				Assert::AreEqual((uint16_t)1, rects.back().slice);
+			}
+
+			AssertNoOverlap(rects, 256, 64);
+			Assert::AreEqual(2U, packer.GetUsedSliceCount());
+		}
+
+		TEST_METHOD(ReportsPackingEfficiency)
+		{
+			TextureAtlasPacker packer(256, 64);
+			uint32_t evictedCount = 0;
+
+			packer.Insert(MakeContentKey(0), 64, 16, evictedCount);
+			Assert::AreEqual((uint64_t)64 * 16, packer.GetTexelCount());
+			Assert::AreEqual((uint64_t)256 * 16, packer.GetShelfTexelCount());
+
+			for (uint32_t i = 1; i < 4; ++i)
+			{
+				packer.Insert(MakeContentKey(i), 64, 16, evictedCount);
+			}
+
+			Assert::AreEqual(packer.GetShelfTexelCount(), packer.GetTexelCount());
+
+			/* Sizes are rounded up to powers of two in units of 8 texels. */
+			packer.Insert(MakeContentKey(4), 24, 64, evictedCount);
+			Assert::AreEqual((uint64_t)4 * 64 * 16 + 24 * 64, packer.GetTexelCount());
+			Assert::AreEqual((uint64_t)256 * 16 + 256 * 64, packer.GetShelfTexelCount());
+		}
+
+		TEST_METHOD(NeverOverlapsOrEvictsTexturesUsedInFrame)
+		{
+			const uint32_t sliceCount = 32;
+			TextureAtlasPacker packer(256, sliceCount);
+
+			std::vector<uint64_t> residentKeys;
+			uint32_t seed = 4711;
+			uint32_t totalEvictedCount = 0;
+
+			for (uint32_t frame = 0; frame < 300; ++frame)
+			{
+				packer.OnNewFrame();
+				std::vector<uint64_t> usedInFrame;
+
+				for (uint32_t i = 0; i < 40; ++i)
+				{
+					seed = seed * 1664525 + 1013904223;
+					const uint64_t key = MakeContentKey((seed >> 8) % 2000);
+
+					/* Every key always has the same shape, as content hashes would. */
+					const uint32_t shape = (uint32_t)(key % 7);
+					const uint32_t longSide = 64 << (shape % 3);
+					const uint32_t shortSide = longSide >> (1 + shape % 3);
+					const uint32_t width = (shape & 1) ? longSide : shortSide;
+					const uint32_t height = (shape & 1) ? shortSide : longSide;
+
+					TextureAtlasRect rect;
+					if (!packer.Find(key, rect))
+					{
+						const uint32_t resetCount = packer.GetResetCount();
+						uint32_t evictedCount = 0;
+						rect = packer.Insert(key, width, height, evictedCount);
+						totalEvictedCount += evictedCount;
+
+						Assert::AreEqual(resetCount, packer.GetResetCount());
+						Assert::AreEqual((uint16_t)width, rect.width);
+						Assert::AreEqual((uint16_t)height, rect.height);
+
+						/* The key may have been evicted earlier in this frame. */
+						if (std::find(residentKeys.begin(), residentKeys.end(), key) == residentKeys.end())
+						{
+							residentKeys.push_back(key);
+						}
+					}
+
+					usedInFrame.push_back(key);
+				}
+
+				/* Nothing used in this frame was evicted, and the resident textures don't overlap. */
+				std::vector<TextureAtlasRect> rects;
+				std::vector<uint64_t> stillResidentKeys;
+
+				for (uint64_t key : residentKeys)
+				{
+					TextureAtlasRect rect;
+					if (packer.Find(key, rect))
+					{
+						rects.push_back(rect);
+						stillResidentKeys.push_back(key);
+					}
+					else
+					{
+						Assert::IsTrue(std::find(usedInFrame.begin(), usedInFrame.end(), key) == usedInFrame.end());
+					}
+				}
+
+				residentKeys.swap(stillResidentKeys);
+				Assert::AreEqual((uint32_t)residentKeys.size(), packer.GetTextureCount());
+				AssertNoOverlap(rects, 256, sliceCount);
+			}
+
+			Assert::IsTrue(totalEvictedCount > 0);
+			Assert::AreEqual(0U, packer.GetResetCount());
+		}
+
+		TEST_METHOD(StartsOverWhenEverythingIsUsedInFrame)
+		{
+			TextureAtlasPacker packer(256, 2);
+			uint32_t evictedCount = 0;
+
+			packer.Insert(MakeContentKey(0), 256, 256, evictedCount);
+			packer.Insert(MakeContentKey(1), 128, 256, evictedCount);
+			packer.Insert(MakeContentKey(2), 128, 256, evictedCount);
+			Assert::AreEqual(0U, evictedCount);
+			Assert::AreEqual(0U, packer.GetResetCount());
+
+			/* Only shelves not used in this frame may be evicted to make room. */
+			TextureAtlasRect rect3;
+			Assert::IsFalse(packer.TryInsert(MakeContentKey(3), 64, 256, rect3, evictedCount));
+			Assert::AreEqual(0U, evictedCount);
+			Assert::AreEqual(3U, packer.GetTextureCount());
+
+			packer.Insert(MakeContentKey(3), 64, 256, evictedCount);
+			Assert::AreEqual(3U, evictedCount);
+			Assert::AreEqual(1U, packer.GetResetCount());
+			Assert::AreEqual(1U, packer.GetTextureCount());
+
+			/* In the next frame, the texture fills up its shelf and the other slice. */
+			packer.OnNewFrame();
+			packer.Insert(MakeContentKey(4), 64, 256, evictedCount);
+			packer.Insert(MakeContentKey(5), 128, 256, evictedCount);
+			Assert::AreEqual(0U, evictedCount);
+
+			const auto rect6 = packer.Insert(MakeContentKey(6), 256, 256, evictedCount);
+			Assert::AreEqual(0U, evictedCount);
+			Assert::AreEqual((uint16_t)1, rect6.slice);
+
+			/* Then the least recently used slice is evicted instead of starting over. */
+			packer.OnNewFrame();
+			TextureAtlasRect rect;
+			Assert::IsTrue(packer.Find(MakeContentKey(6), rect));
+
+			const auto rect7 = packer.Insert(MakeContentKey(7), 256, 256, evictedCount);
+			Assert::AreEqual(3U, evictedCount);
+			Assert::AreEqual((uint16_t)0, rect7.slice);
+			Assert::IsTrue(packer.Find(MakeContentKey(6), rect));
+			Assert::IsFalse(packer.Find(MakeContentKey(3), rect));
+			Assert::AreEqual(2U, packer.GetTextureCount());
+			Assert::AreEqual(1U, packer.GetResetCount());
+		}
+
+		TEST_METHOD(SetSliceCountKeepsTexturesInKeptSlices)
+		{
+			TextureAtlasPacker packer(64, 2);
+			uint32_t evictedCount = 0;
+			TextureAtlasRect rect;
+
+			for (uint64_t i = 0; i < 8; ++i)
+			{
+				packer.Insert(MakeContentKey(i), 32, 32, evictedCount);
+				Assert::AreEqual(0U, evictedCount);
+			}
+
+			packer.SetSliceCount(4);
+			Assert::AreEqual(2U, packer.GetUsedSliceCount());
+
+			for (uint64_t i = 0; i < 8; ++i)
+			{
+				Assert::IsTrue(packer.Find(MakeContentKey(i), rect));
+				Assert::AreEqual((uint16_t)(i / 4), rect.slice);
+			}
+
+			for (uint64_t i = 8; i < 16; ++i)
+			{
+				rect = packer.Insert(MakeContentKey(i), 32, 32, evictedCount);
+				Assert::AreEqual(0U, evictedCount);
+				Assert::AreEqual((uint16_t)(i / 4), rect.slice);
+			}
+
+			packer.SetSliceCount(1);
+			Assert::AreEqual(1U, packer.GetUsedSliceCount());
+			Assert::AreEqual(4U, packer.GetTextureCount());
+
+			for (uint64_t i = 0; i < 16; ++i)
+			{
+				Assert::AreEqual(i < 4, packer.Find(MakeContentKey(i), rect));
+			}
+
+			Assert::AreEqual(0U, packer.GetResetCount());
+		}
+
+		TEST_METHOD(PackedTextureCacheReturnsOffsets)
+		{
+			auto tmuData = std::make_unique<std::array<uint32_t, 2 * 256 * 128>>();
+
+			Batch batch;
+			batch.SetTextureStartAddress(0);
+			batch.SetTextureSize(32, 256);
+
+			TextureCache textureCache(256, 256, 64, 512, true, nullptr, (ID3D11Device*)nullptr);
+
+			for (uint64_t i = 0; i < 8; ++i)
+			{
+				const auto location = textureCache.InsertTexture(MakeContentKey(i), batch, (const uint8_t*)tmuData->data(), (uint32_t)tmuData->size());
+				Assert::AreEqual((int16_t)0, location._textureAtlas);
+				Assert::AreEqual((int16_t)0, location._textureIndex);
+				Assert::AreEqual((uint8_t)(32 * i), location._offsetS);
+				Assert::AreEqual((uint8_t)0, location._offsetT);
+
+				const auto foundLocation = textureCache.FindTexture(MakeContentKey(i), -1);
+				Assert::AreEqual(location._offsetS, foundLocation._offsetS);
+			}
+
+			Assert::AreEqual(1U, textureCache.GetUsedCount());
+			Assert::AreEqual(0U, textureCache.GetEvictionCount());
+			Assert::AreEqual(textureCache.GetReservedTexelCount(), textureCache.GetTexelCount());
+		}
+
+		TEST_METHOD(BenchmarkPackedVersusSlotMemory)
+		{
+			/* A dense scene of narrow sprites, as some mods use for UI and effects. */
+			const uint32_t widths[] = { 16, 32, 64, 128, 256, 256, 256, 256 };
+			const uint32_t heights[] = { 256, 256, 256, 256, 128, 64, 32, 16 };
+
+			TextureAtlasPacker packer(256, 512);
+			uint64_t slotTexelCount = 0;
+
+			for (uint32_t i = 0; i < 2000; ++i)
+			{
+				uint32_t evictedCount = 0;
+				packer.Insert(MakeContentKey(i), widths[i & 7], heights[i & 7], evictedCount);
+				Assert::AreEqual(0U, evictedCount);
+
+				/* Without packing, the texture would take a square slot of its longest side
+				   (or a 256x128 slot). */
+				slotTexelCount += (widths[i & 7] == 256 && heights[i & 7] == 128) ? 256 * 128 : 256 * 256;
+			}
+
+			const uint64_t packedTexelCount = (uint64_t)packer.GetUsedSliceCount() * 256 * 256;
+
+			char message[256];
+			sprintf_s(message, "2000 narrow textures: %u kB in slots, %u kB packed into %u slices, %.1f%% packing efficiency.\n",
+				(uint32_t)(slotTexelCount / 1024),
+				(uint32_t)(packedTexelCount / 1024),
+				packer.GetUsedSliceCount(),
+				100.0 * packer.GetTexelCount() / packer.GetShelfTexelCount());
+			Logger::WriteMessage(message);
+
+			Assert::IsTrue(packedTexelCount * 3 < slotTexelCount);
+		}
+	};
+}
@@ -21,14 +21,167 @@
 #include "CppUnitTest.h"
 
 #include "../d2dx/Batch.h"
+#include "../d2dx/Simd.h"
 #include "../d2dx/Types.h"
 #include "../d2dx/TextureCache.h"
+#include "../d2dx/TextureCacheBalancer.h"
+#include "../d2dx/TextureCacheKeyIndex.h"
+#include "../d2dx/TextureCachePolicyBitPmru.h"
+#include "../d2dx/TextureLocationMemo.h"
+#include "../d2dx/TextureUploadQueue.h"
+#include "../d2dx/Utils.h"
+
+#include "IndexOfUInt64.h"
+#include "TestUtils.h"
 
 using namespace Microsoft::VisualStudio::CppUnitTestFramework;
 using namespace d2dx;
 
 namespace d2dxtests
 {
+	/* The bit PMRU policy as it was before the two-level bitmap and frame epochs, as a
+	   baseline for the benchmark. */
+	class WordScanBitPmru final : public ITextureCachePolicy
+	{
+	public:
+		WordScanBitPmru(uint32_t capacity) :
+			_keys{ capacity },
+			_usedInFrameBits{ capacity >> 5, true },
+			_mruBits{ capacity >> 5, true }
+		{
+		}
+
+		virtual int32_t Find(uint64_t contentKey, int32_t lastIndex) override
+		{
+			if (lastIndex >= 0 && lastIndex < (int32_t)_keys.GetCapacity() &&
+				contentKey == _keys.GetContentKey(lastIndex))
+			{
+				Touch(lastIndex);
+				return lastIndex;
+			}
+
+			const int32_t index = _keys.Find(contentKey);
+
+			if (index >= 0)
+			{
+				Touch(index);
+			}
+
+			return index;
+		}
+
+		virtual int32_t Insert(uint64_t contentKey, bool& evicted) override
+		{
+			int32_t replacementIndex = FindUnmarked();
+
+			if (replacementIndex < 0)
+			{
+				memcpy(_mruBits.items, _usedInFrameBits.items, sizeof(uint32_t) * _mruBits.capacity);
+				replacementIndex = FindUnmarked();
+			}
+
+			if (replacementIndex < 0)
+			{
+				++_resetCount;
+				memset(_mruBits.items, 0, sizeof(uint32_t) * _mruBits.capacity);
+				memset(_usedInFrameBits.items, 0, sizeof(uint32_t) * _usedInFrameBits.capacity);
+				_usedInFrameCount = 0;
+				replacementIndex = FindUnmarked();
+			}
+
+			Touch(replacementIndex);
+			evicted = _keys.Replace(replacementIndex, contentKey) != 0;
+
+			if (!evicted)
+			{
+				++_usedCount;
+			}
+
+			return replacementIndex;
+		}
+
+		virtual void OnNewFrame() override
+		{
+			memset(_usedInFrameBits.items, 0, sizeof(uint32_t) * _usedInFrameBits.capacity);
+			_usedInFrameCount = 0;
+		}
+
+		virtual void SetCapacity(uint32_t capacity) override
+		{
+			_usedCount = _keys.Resize(capacity);
+			_usedInFrameBits.Resize(capacity >> 5, 0);
+			_mruBits.Resize(capacity >> 5, 0);
+			_usedInFrameCount = 0;
+		}
+
+		virtual uint32_t GetUsedCount() const override { return _usedCount; }
+		virtual uint32_t GetUsedInFrameCount() const override { return _usedInFrameCount; }
+		virtual uint32_t GetResetCount() const override { return _resetCount; }
+
+	private:
+		void Touch(int32_t index)
+		{
+			if (!(_usedInFrameBits.items[index >> 5] & (1 << (index & 31))))
+			{
+				_usedInFrameBits.items[index >> 5] |= 1 << (index & 31);
+				++_usedInFrameCount;
+			}
+
+			_mruBits.items[index >> 5] |= 1 << (index & 31);
+		}
+
+		int32_t FindUnmarked() const
+		{
+			for (uint32_t i = 0; i < _mruBits.capacity; ++i)
+			{
+				DWORD ri;
+				if (BitScanForward(&ri, (DWORD)~_mruBits.items[i]))
+				{
+					return (int32_t)(i * 32 + ri);
+				}
+			}
+
+			return -1;
+		}
+
+		TextureCacheKeyIndex _keys;
+		Buffer<uint32_t> _usedInFrameBits;
+		Buffer<uint32_t> _mruBits;
+		uint32_t _usedCount = 0;
+		uint32_t _usedInFrameCount = 0;
+		uint32_t _resetCount = 0;
+	};
+
+	/* Replays frames of lookups against a policy, inserting on misses, and returns a
+	   checksum of the slots handed out. */
+	static int64_t ReplayPolicyFrames(
+		ITextureCachePolicy& policy,
+		const Buffer<uint64_t>& lookups,
+		uint32_t lookupsPerFrame)
+	{
+		int64_t checksum = 0;
+
+		for (uint32_t i = 0; i < lookups.capacity; ++i)
+		{
+			if (!(i % lookupsPerFrame))
+			{
+				policy.OnNewFrame();
+			}
+
+			int32_t index = policy.Find(lookups.items[i], -1);
+
+			if (index < 0)
+			{
+				bool evicted = false;
+				index = policy.Insert(lookups.items[i], evicted);
+			}
+
+			checksum = checksum * 31 + index;
+		}
+
+		return checksum;
+	}
+
 	TEST_CLASS(TestTextureCache)
 	{
 	public:
@@ -39,14 +192,14 @@ namespace d2dxtests
 				for (int32_t w = 3; w <= 8; ++w)
 				{
 					auto textureCache = std::make_unique<TextureCache>(
-						1 << w, 1 << h, 1024, 512, (ID3D11Device*)nullptr);
+						1 << w, 1 << h, 1024, 512, false, nullptr, (ID3D11Device*)nullptr);
 				}
 			}
 		}
 
 		TEST_METHOD(FindNonExistentTexture)
 		{
-			auto textureCache = std::make_unique<TextureCache>(256, 128, 2048, 512, (ID3D11Device*)nullptr);
+			auto textureCache = std::make_unique<TextureCache>(256, 128, 2048, 512, false, nullptr, (ID3D11Device*)nullptr);
 			auto tcl = textureCache->FindTexture(0x12345678, -1);
 			Assert::AreEqual((int16_t)-1, tcl._textureAtlas);
 			Assert::AreEqual((int16_t)-1, tcl._textureIndex);
@@ -60,7 +213,7 @@ namespace d2dxtests
 			batch.SetTextureStartAddress(0);
 			batch.SetTextureSize(256, 128);
 
-			auto textureCache = std::make_unique<TextureCache>(256, 128, 64, 512, (ID3D11Device*)nullptr);
+			auto textureCache = std::make_unique<TextureCache>(256, 128, 64, 512, false, nullptr, (ID3D11Device*)nullptr);
 
 			for (uint64_t i = 0; i < 64; ++i)
 			{
@@ -85,11 +238,18 @@ namespace d2dxtests
 			batch.SetTextureStartAddress(0);
 			batch.SetTextureSize(256, 128);
 
-			auto textureCache = std::make_unique<TextureCache>(256, 128, 64, 512, (ID3D11Device*)nullptr);
+			auto textureCache = std::make_unique<TextureCache>(256, 128, 64, 512, false, nullptr, (ID3D11Device*)nullptr);
 
 			for (uint64_t i = 0; i < 65; ++i)
 			{
 				uint64_t hash = (0xFFull << 24) | (i << 16) | (i << 8) | i;
+
+				if (i == 64)
+				{
+					// Simulate new frame, so that the cache doesn't need to overflow
+					textureCache->OnNewFrame();
+				}
+
 				auto tcl = textureCache->InsertTexture(hash, batch, (const uint8_t*)tmuData->data(), (uint32_t)tmuData->size());
 
 				if (i == 64)
@@ -135,7 +295,7 @@ namespace d2dxtests
 			batch.SetTextureStartAddress(0);
 			batch.SetTextureSize(256, 128);
 
-			auto textureCache = std::make_unique<TextureCache>(256, 128, 64, 512, (ID3D11Device*)nullptr);
+			auto textureCache = std::make_unique<TextureCache>(256, 128, 64, 512, false, nullptr, (ID3D11Device*)nullptr);
 
 			for (uint64_t i = 0; i < 65; ++i)
 			{
@@ -186,5 +346,642 @@ namespace d2dxtests
 				Assert::AreEqual(expectedTextureIndex, tcl._textureIndex);
 			}
 		}
+
+		TEST_METHOD(TexturesOverflowWhenAllSlotsUsedInFrame)
+		{
+			auto tmuData = std::make_unique<std::array<uint32_t, 2 * 256 * 128>>();
+
+			Batch batch;
+			batch.SetTextureStartAddress(0);
+			batch.SetTextureSize(32, 32);
+
+			TextureCache textureCache(32, 32, 64, 512, false, nullptr, (ID3D11Device*)nullptr);
+
+			for (uint64_t i = 0; i < 64; ++i)
+			{
+				textureCache.InsertTexture(MakeContentKey(i), batch, (const uint8_t*)tmuData->data(), (uint32_t)tmuData->size() * 4);
+			}
+
+			Assert::AreEqual(64U * 32 * 32, textureCache.GetMemoryFootprint());
+
+			/* Every slot is used in this frame, so the next textures go to the overflow atlas
+			   instead of evicting textures that the frame still draws. */
+			for (uint64_t i = 0; i < 64; ++i)
+			{
+				const auto location = textureCache.InsertTexture(MakeContentKey(100 + i), batch, (const uint8_t*)tmuData->data(), (uint32_t)tmuData->size() * 4);
+				Assert::AreEqual((int16_t)4, location._textureAtlas);
+				Assert::AreEqual((int16_t)i, location._textureIndex);
+			}
+
+			Assert::AreEqual(64U, textureCache.GetOverflowCount());
+			Assert::AreEqual(0U, textureCache.GetResetCount());
+			Assert::AreEqual(0U, textureCache.GetEvictionCount());
+			Assert::AreEqual(128U * 32 * 32, textureCache.GetMemoryFootprint());
+
+			for (uint64_t i = 0; i < 64; ++i)
+			{
+				Assert::AreEqual((int16_t)i, textureCache.FindTexture(MakeContentKey(i), -1)._textureIndex);
+				Assert::AreEqual((int16_t)4, textureCache.FindTexture(MakeContentKey(100 + i), -1)._textureAtlas);
+			}
+
+			/* Only when the overflow slots are used up too does the cache start over. */
+			textureCache.InsertTexture(MakeContentKey(200), batch, (const uint8_t*)tmuData->data(), (uint32_t)tmuData->size() * 4);
+			Assert::AreEqual(1U, textureCache.GetResetCount());
+			Assert::AreEqual(64U, textureCache.GetOverflowCount());
+
+			/* In the next frame, overflowed textures are still found, and new textures go to
+			   the regular slots again. */
+			textureCache.OnNewFrame();
+
+			const auto overflowLocation = textureCache.FindTexture(MakeContentKey(100), -1);
+			Assert::AreEqual((int16_t)4, overflowLocation._textureAtlas);
+			Assert::AreEqual((int16_t)0, overflowLocation._textureIndex);
+
+			const auto location = textureCache.InsertTexture(MakeContentKey(201), batch, (const uint8_t*)tmuData->data(), (uint32_t)tmuData->size() * 4);
+			Assert::AreEqual((int16_t)0, location._textureAtlas);
+			Assert::AreEqual(64U, textureCache.GetOverflowCount());
+
+			/* Overflow slots used in the frame are skipped when the cache overflows again. */
+			for (uint64_t i = 0; i < 64; ++i)
+			{
+				textureCache.FindTexture(MakeContentKey(i), -1);
+				textureCache.InsertTexture(MakeContentKey(300 + i), batch, (const uint8_t*)tmuData->data(), (uint32_t)tmuData->size() * 4);
+			}
+
+			Assert::IsTrue(textureCache.GetOverflowCount() > 64);
+			Assert::AreEqual((int16_t)0, textureCache.FindTexture(MakeContentKey(100), -1)._textureIndex);
+			Assert::AreEqual(1U, textureCache.GetResetCount());
+		}
+
+		TEST_METHOD(PackedTexturesOverflowWhenAllShelvesUsedInFrame)
+		{
+			auto tmuData = std::make_unique<std::array<uint32_t, 2 * 256 * 128>>();
+
+			Batch batch;
+			batch.SetTextureStartAddress(0);
+			batch.SetTextureSize(256, 128);
+
+			TextureCache textureCache(256, 256, 2, 512, true, nullptr, (ID3D11Device*)nullptr);
+
+			for (uint64_t i = 0; i < 4; ++i)
+			{
+				const auto location = textureCache.InsertTexture(MakeContentKey(i), batch, (const uint8_t*)tmuData->data(), (uint32_t)tmuData->size() * 4);
+				Assert::AreEqual((int16_t)0, location._textureAtlas);
+				Assert::AreEqual((int16_t)(i / 2), location._textureIndex);
+			}
+
+			/* Both slices are used in this frame, so the next textures are packed into the
+			   overflow atlas instead of evicting textures that the frame still draws. */
+			for (uint64_t i = 0; i < 32; ++i)
+			{
+				const auto location = textureCache.InsertTexture(MakeContentKey(100 + i), batch, (const uint8_t*)tmuData->data(), (uint32_t)tmuData->size() * 4);
+				Assert::AreEqual((int16_t)4, location._textureAtlas);
+				Assert::AreEqual((int16_t)(i / 2), location._textureIndex);
+				Assert::AreEqual((uint8_t)0, location._offsetS);
+				Assert::AreEqual((uint8_t)(128 * (i & 1)), location._offsetT);
+			}
+
+			Assert::AreEqual(32U, textureCache.GetOverflowCount());
+			Assert::AreEqual(0U, textureCache.GetResetCount());
+			Assert::AreEqual(0U, textureCache.GetEvictionCount());
+
+			for (uint64_t i = 0; i < 4; ++i)
+			{
+				Assert::AreEqual((int16_t)0, textureCache.FindTexture(MakeContentKey(i), -1)._textureAtlas);
+			}
+
+			for (uint64_t i = 0; i < 32; ++i)
+			{
+				Assert::AreEqual((int16_t)4, textureCache.FindTexture(MakeContentKey(100 + i), -1)._textureAtlas);
+			}
+
+			/* Only when the overflow atlas is full too does the cache start over. */
+			textureCache.InsertTexture(MakeContentKey(200), batch, (const uint8_t*)tmuData->data(), (uint32_t)tmuData->size() * 4);
+			Assert::AreEqual(1U, textureCache.GetResetCount());
+			Assert::AreEqual(32U, textureCache.GetOverflowCount());
+			Assert::AreEqual((int16_t)4, textureCache.FindTexture(MakeContentKey(100), -1)._textureAtlas);
+
+			/* In the next frame, new textures go to the regular slices again, and overflow
+			   shelves used in the frame are kept when the cache overflows again. */
+			textureCache.OnNewFrame();
+			Assert::AreEqual((int16_t)0, textureCache.FindTexture(MakeContentKey(200), -1)._textureAtlas);
+			Assert::AreEqual((int16_t)4, textureCache.FindTexture(MakeContentKey(131), -1)._textureAtlas);
+
+			for (uint64_t i = 0; i < 3; ++i)
+			{
+				const auto location = textureCache.InsertTexture(MakeContentKey(201 + i), batch, (const uint8_t*)tmuData->data(), (uint32_t)tmuData->size() * 4);
+				Assert::AreEqual((int16_t)0, location._textureAtlas);
+			}
+
+			for (uint64_t i = 0; i < 30; ++i)
+			{
+				const auto location = textureCache.InsertTexture(MakeContentKey(300 + i), batch, (const uint8_t*)tmuData->data(), (uint32_t)tmuData->size() * 4);
+				Assert::AreEqual((int16_t)4, location._textureAtlas);
+				Assert::AreNotEqual((int16_t)15, location._textureIndex);
+			}
+
+			Assert::AreEqual((int16_t)4, textureCache.FindTexture(MakeContentKey(131), -1)._textureAtlas);
+			Assert::AreEqual(1U, textureCache.GetResetCount());
+		}
+
+		TEST_METHOD(PolicyFindsEveryInsertedTextureAfterEvictions)
+		{
+			const uint32_t capacity = 512;
+			TextureCachePolicyBitPmru policy(capacity);
+			Buffer<uint64_t> slots(capacity, true);
+
+			for (uint64_t i = 0; i < capacity * 8; ++i)
+			{
+				if (!(i & 63))
+				{
+					policy.OnNewFrame();
+				}
+
+				const uint64_t contentKey = MakeContentKey(i);
+				Assert::AreEqual(-1, policy.Find(contentKey, -1));
+
+				bool evicted = false;
+				const int32_t index = policy.Insert(contentKey, evicted);
+				Assert::IsTrue(index >= 0 && index < (int32_t)capacity);
+				Assert::AreEqual(slots.items[index] != 0, evicted);
+
+				if (evicted)
+				{
+					Assert::AreEqual(-1, policy.Find(slots.items[index], -1));
+				}
+
+				slots.items[index] = contentKey;
+			}
+
+			for (uint32_t i = 0; i < capacity; ++i)
+			{
+				Assert::AreEqual((int32_t)i, policy.Find(slots.items[i], -1));
+			}
+		}
+
+		TEST_METHOD(PolicyCountsResetWhenAllSlotsUsedInFrame)
+		{
+			const uint32_t capacity = 64;
+			TextureCachePolicyBitPmru policy(capacity);
+
+			for (uint64_t i = 0; i < capacity; ++i)
+			{
+				bool evicted = false;
+				policy.Insert(MakeContentKey(i), evicted);
+			}
+
+			Assert::AreEqual(0U, policy.GetResetCount());
+
+			bool evicted = false;
+			policy.Insert(MakeContentKey(capacity), evicted);
+			Assert::IsTrue(evicted);
+			Assert::AreEqual(1U, policy.GetResetCount());
+
+			policy.OnNewFrame();
+			policy.Insert(MakeContentKey(capacity + 1), evicted);
+			Assert::AreEqual(1U, policy.GetResetCount());
+		}
+
+		TEST_METHOD(LocationMemoRemembersLocationUntilInvalidated)
+		{
+			TextureLocationMemo memo;
+			TextureCacheLocation tcl;
+
+			Assert::IsFalse(memo.Find(0, 0, tcl));
+			Assert::IsFalse(memo.Find(0x1000, MakeContentKey(1), tcl));
+
+			memo.Insert(0x1000, MakeContentKey(1), { 2, 37 });
+			memo.Insert(0x3000, MakeContentKey(2), { 0, 5 });
+
+			Assert::IsTrue(memo.Find(0x1000, MakeContentKey(1), tcl));
+			Assert::AreEqual((int16_t)2, tcl._textureAtlas);
+			Assert::AreEqual((int16_t)37, tcl._textureIndex);
+
+			/* Same address, different contents. */
+			Assert::IsFalse(memo.Find(0x1000, MakeContentKey(3), tcl));
+
+			/* A download covering the start address invalidates only that entry. */
+			memo.Invalidate(0x0F00, 0x200);
+			Assert::IsFalse(memo.Find(0x1000, MakeContentKey(1), tcl));
+			Assert::IsTrue(memo.Find(0x3000, MakeContentKey(2), tcl));
+
+			/* A download ending just before the start address does not. */
+			memo.Insert(0x1000, MakeContentKey(1), { 2, 37 });
+			memo.Invalidate(0x0E00, 0x200);
+			Assert::IsTrue(memo.Find(0x1000, MakeContentKey(1), tcl));
+
+			memo.InvalidateAll();
+			Assert::IsFalse(memo.Find(0x1000, MakeContentKey(1), tcl));
+			Assert::IsFalse(memo.Find(0x3000, MakeContentKey(2), tcl));
+
+			memo.Insert(0x3000, MakeContentKey(2), { 0, 6 });
+			Assert::IsTrue(memo.Find(0x3000, MakeContentKey(2), tcl));
+			Assert::AreEqual((int16_t)6, tcl._textureIndex);
+
+			memo.Invalidate(D2DX_TMU_MEMORY_SIZE - 256, 256);
+			Assert::IsTrue(memo.Find(0x3000, MakeContentKey(2), tcl));
+		}
+
+		TEST_METHOD(SetCapacityKeepsTexturesInKeptSlots)
+		{
+			auto tmuData = std::make_unique<std::array<uint32_t, 2 * 256 * 128>>();
+
+			Batch batch;
+			batch.SetTextureStartAddress(0);
+			batch.SetTextureSize(32, 32);
+
+			TextureCache textureCache(32, 32, 128, 512, false, nullptr, (ID3D11Device*)nullptr);
+			TextureCacheLocation locations[192];
+
+			for (uint64_t i = 0; i < 192; ++i)
+			{
+				textureCache.OnNewFrame();
+				locations[i] = textureCache.InsertTexture(MakeContentKey(i), batch, (const uint8_t*)tmuData->data(), (uint32_t)tmuData->size() * 4);
+			}
+
+			Assert::AreEqual(64U, textureCache.GetEvictionCount());
+			Assert::AreEqual(0U, textureCache.GetResetCount());
+
+			textureCache.SetCapacity(1088);
+			textureCache.OnNewFrame();
+
+			Assert::AreEqual(1088U, textureCache.GetCapacity());
+			Assert::AreEqual(0U, textureCache.GetResetCount());
+			Assert::AreEqual(128U, textureCache.GetUsedCount());
+			Assert::AreEqual(128ULL * 32 * 32, textureCache.GetTexelCount());
+
+			for (uint64_t i = 64; i < 192; ++i)
+			{
+				const TextureCacheLocation location = textureCache.FindTexture(MakeContentKey(i), -1);
+				Assert::AreEqual(locations[i]._textureAtlas, location._textureAtlas);
+				Assert::AreEqual(locations[i]._textureIndex, location._textureIndex);
+			}
+
+			/* The added slots are filled before anything is evicted, and the capacity no longer
+			   fills whole atlases, but the last slot must still be usable. */
+			TextureCacheLocation location{ -1, -1 };
+			for (uint64_t i = 0; i < 960; ++i)
+			{
+				location = textureCache.InsertTexture(MakeContentKey(1000 + i), batch, (const uint8_t*)tmuData->data(), (uint32_t)tmuData->size() * 4);
+				Assert::IsTrue(location._textureAtlas * 512 + location._textureIndex < 1088);
+				textureCache.GetSrv(location._textureAtlas);
+			}
+
+			Assert::AreEqual(1088U, textureCache.GetUsedCount());
+			Assert::AreEqual(64U, textureCache.GetEvictionCount());
+
+			/* Shrinking only forgets the textures in the slots that are given away. */
+			textureCache.SetCapacity(128);
+			textureCache.OnNewFrame();
+
+			Assert::AreEqual(128U, textureCache.GetUsedCount());
+			Assert::AreEqual(128ULL * 32 * 32, textureCache.GetTexelCount());
+			Assert::AreEqual(0U, textureCache.GetResetCount());
+
+			for (uint64_t i = 64; i < 192; ++i)
+			{
+				Assert::AreEqual(locations[i]._textureIndex, textureCache.FindTexture(MakeContentKey(i), -1)._textureIndex);
+			}
+
+			Assert::AreEqual((int16_t)-1, textureCache.FindTexture(MakeContentKey(1000 + 959), -1)._textureIndex);
+		}
+
+		TEST_METHOD(AtlasAllocationTracksUse)
+		{
+			auto tmuData = std::make_unique<std::array<uint32_t, 2 * 256 * 128>>();
+
+			Batch batch;
+			batch.SetTextureStartAddress(0);
+			batch.SetTextureSize(32, 32);
+
+			const uint32_t textureSize = 32 * 32;
+			TextureCache textureCache(32, 32, 2048, 512, false, nullptr, (ID3D11Device*)nullptr);
+
+			Assert::AreEqual(0U, textureCache.GetMemoryFootprint());
+
+			for (uint64_t i = 0; i < 1100; ++i)
+			{
+				const auto location = textureCache.InsertTexture(MakeContentKey(i), batch, (const uint8_t*)tmuData->data(), (uint32_t)tmuData->size() * 4);
+				const uint32_t atlasCount = (uint32_t)i / 512 + 1;
+
+				Assert::AreEqual((int16_t)(atlasCount - 1), location._textureAtlas);
+				Assert::AreEqual(atlasCount * 512 * textureSize, textureCache.GetMemoryFootprint());
+			}
+
+			/* The two full atlases are kept, the third is shrunk to the slices the new capacity
+			   addresses, and the fourth is never created. */
+			textureCache.SetCapacity(1088);
+			Assert::AreEqual(1088 * textureSize, textureCache.GetMemoryFootprint());
+
+			textureCache.OnNewFrame();
+
+			for (uint64_t i = 0; i < 1088; ++i)
+			{
+				textureCache.InsertTexture(MakeContentKey(2000 + i), batch, (const uint8_t*)tmuData->data(), (uint32_t)tmuData->size() * 4);
+			}
+
+			Assert::AreEqual(1088 * textureSize, textureCache.GetMemoryFootprint());
+
+			/* A cache smaller than an atlas only allocates the slices it can address. */
+			TextureCache smallTextureCache(8, 8, 256, 2048, false, nullptr, (ID3D11Device*)nullptr);
+			smallTextureCache.InsertTexture(MakeContentKey(0), batch, (const uint8_t*)tmuData->data(), (uint32_t)tmuData->size() * 4);
+			Assert::AreEqual(256U * 8 * 8, smallTextureCache.GetMemoryFootprint());
+		}
+
+		TEST_METHOD(NewTexturesAreStagedUntilFlush)
+		{
+			auto tmuData = std::make_unique<std::array<uint8_t, 4 * 32 * 32>>();
+
+			for (uint32_t i = 0; i < tmuData->size(); ++i)
+			{
+				(*tmuData)[i] = (uint8_t)(i * 7);
+			}
+
+			TextureUploadQueue uploadQueue(64 * 1024);
+			TextureCache textureCache(32, 32, 512, 512, false, &uploadQueue, (ID3D11Device*)nullptr);
+
+			for (uint32_t i = 0; i < 4; ++i)
+			{
+				Batch batch;
+				batch.SetTextureStartAddress(i * 32 * 32);
+				batch.SetTextureSize(32, 32);
+
+				const auto location = textureCache.InsertTexture(MakeContentKey(i), batch, tmuData->data(), (uint32_t)tmuData->size());
+
+				/* The texture is staged, so the TMU memory may change before the flush. */
+				memset(tmuData->data() + i * 32 * 32, 0xFF, 32 * 32);
+
+				const TextureUpload& upload = uploadQueue.GetPending(i);
+				Assert::AreEqual((uint32_t)location._textureIndex, upload.subresource);
+				Assert::AreEqual((uint16_t)32, upload.width);
+				Assert::AreEqual((uint16_t)32, upload.height);
+			}
+
+			Assert::AreEqual(4U, uploadQueue.GetPendingCount());
+			Assert::AreEqual(4U * 32 * 32, uploadQueue.GetPendingBytes());
+
+			for (uint32_t i = 0; i < 4; ++i)
+			{
+				const uint8_t* data = uploadQueue.GetPendingData(i);
+
+				for (uint32_t j = 0; j < 32 * 32; ++j)
+				{
+					Assert::AreEqual((uint8_t)((i * 32 * 32 + j) * 7), data[j]);
+				}
+			}
+
+			uploadQueue.Flush(nullptr);
+			Assert::AreEqual(0U, uploadQueue.GetPendingCount());
+			Assert::AreEqual(0U, uploadQueue.GetPendingBytes());
+			Assert::AreEqual(0U, uploadQueue.GetOverflowCount());
+		}
+
+		TEST_METHOD(TexturesBeyondUploadBudgetAreNotStaged)
+		{
+			auto tmuData = std::make_unique<std::array<uint32_t, 2 * 256 * 128>>();
+
+			Batch batch;
+			batch.SetTextureStartAddress(0);
+			batch.SetTextureSize(64, 64);
+
+			/* Room for three 64x64 textures per frame. */
+			TextureUploadQueue uploadQueue(3 * 64 * 64 + 100);
+			TextureCache textureCache(64, 64, 512, 512, false, &uploadQueue, (ID3D11Device*)nullptr);
+
+			for (uint32_t frame = 0; frame < 2; ++frame)
+			{
+				for (uint32_t i = 0; i < 5; ++i)
+				{
+					const auto location = textureCache.InsertTexture(MakeContentKey(frame * 5 + i), batch, (const uint8_t*)tmuData->data(), (uint32_t)tmuData->size() * 4);
+
+					/* A texture that doesn't fit is still cached, but uploaded immediately, after
+					   the queued ones: one of them may be for the same slot. */
+					Assert::AreEqual((int16_t)(frame * 5 + i), location._textureIndex);
+					Assert::AreEqual(i == 3 ? 0U : (i + 1) & 3, uploadQueue.GetPendingCount());
+				}
+
+				Assert::AreEqual(64U * 64, uploadQueue.GetPendingBytes());
+				Assert::AreEqual(frame + 1, uploadQueue.GetOverflowCount());
+
+				uploadQueue.Flush(nullptr);
+				textureCache.OnNewFrame();
+			}
+		}
+
+		TEST_METHOD(BalancerMovesUnusedSlotsToCacheUnderPressure)
+		{
+			const uint32_t capacities[D2DX_TEXTURE_CACHE_COUNT] = { 512, 1024, 2048, 2048, 1024, 512, 1024 };
+			const uint32_t textureSizes[D2DX_TEXTURE_CACHE_COUNT] = { 8 * 8, 16 * 16, 32 * 32, 64 * 64, 128 * 128, 256 * 256, 256 * 128 };
+
+			TextureCacheBalancer balancer(capacities, textureSizes, 4 * 2048, 0);
+			const uint64_t budget = balancer.GetBudget();
+			Assert::AreEqual(balancer.GetTotalSize(), budget);
+
+			/* The 32x32 cache overflows while the 256x256 one sits mostly empty. */
+			uint32_t evictionCounts[D2DX_TEXTURE_CACHE_COUNT] = { 0 };
+			uint32_t usedCounts[D2DX_TEXTURE_CACHE_COUNT] = { 512, 1024, 2048, 2048, 1024, 100, 1024 };
+
+			uint32_t rebalanceCount = 0;
+
+			for (uint32_t frame = 0; frame < TextureCacheBalancer::RebalancePeriod * 4; ++frame)
+			{
+				evictionCounts[2] += 3;
+				evictionCounts[3] += frame & 1;
+
+				if (balancer.OnNewFrame(evictionCounts, usedCounts))
+				{
+					++rebalanceCount;
+					Assert::AreEqual(TextureCacheBalancer::RebalancePeriod - 1, frame % TextureCacheBalancer::RebalancePeriod);
+					Assert::IsTrue(balancer.GetTotalSize() <= budget);
+
+					for (uint32_t i = 0; i < D2DX_TEXTURE_CACHE_COUNT; ++i)
+					{
+						Assert::AreEqual(0U, balancer.GetCapacity(i) % TextureCacheBalancer::CapacityGranularity);
+						usedCounts[i] = min(usedCounts[i], balancer.GetCapacity(i));
+					}
+				}
+			}
+
+			Assert::IsTrue(rebalanceCount > 0);
+			Assert::AreEqual(3U * TextureCacheBalancer::RebalancePeriod, balancer.GetPressure(2));
+			Assert::IsTrue(balancer.GetCapacity(2) > 2048);
+
+			/* Only the unused 256x256 slots were given away, and only the caches involved changed. */
+			Assert::IsTrue(balancer.GetCapacity(5) < 512);
+			Assert::IsTrue(balancer.GetCapacity(5) >= 128);
+
+			for (uint32_t i : { 0, 1, 3, 4, 6 })
+			{
+				Assert::AreEqual(capacities[i], balancer.GetCapacity(i));
+			}
+		}
+
+		TEST_METHOD(BalancerKeepsCapacitiesWithinBudget)
+		{
+			const uint32_t capacities[D2DX_TEXTURE_CACHE_COUNT] = { 512, 1024, 2048, 2048, 1024, 512, 1024 };
+			const uint32_t textureSizes[D2DX_TEXTURE_CACHE_COUNT] = { 8 * 8, 16 * 16, 32 * 32, 64 * 64, 128 * 128, 256 * 256, 256 * 128 };
+			uint32_t evictionCounts[D2DX_TEXTURE_CACHE_COUNT] = { 0 };
+
+			/* No pressure, no change. */
+			{
+				TextureCacheBalancer balancer(capacities, textureSizes, 4 * 2048, 0);
+
+				for (uint32_t frame = 0; frame < TextureCacheBalancer::RebalancePeriod * 4; ++frame)
+				{
+					evictionCounts[4] += frame & 7 ? 0 : 1;
+					Assert::IsFalse(balancer.OnNewFrame(evictionCounts, capacities));
+				}
+			}
+
+			/* Pressure, but every slot is in use and there is no free budget. */
+			{
+				TextureCacheBalancer balancer(capacities, textureSizes, 4 * 2048, 0);
+
+				for (uint32_t frame = 0; frame < TextureCacheBalancer::RebalancePeriod * 4; ++frame)
+				{
+					evictionCounts[2] += 3;
+					Assert::IsFalse(balancer.OnNewFrame(evictionCounts, capacities));
+				}
+			}
+
+			/* Free budget can be spent without taking slots from anyone, up to the largest capacity. */
+			{
+				TextureCacheBalancer balancer(capacities, textureSizes, 4 * 1024, 256 * 1024 * 1024);
+				Assert::AreEqual((uint64_t)256 * 1024 * 1024, balancer.GetBudget());
+
+				for (uint32_t frame = 0; frame < TextureCacheBalancer::RebalancePeriod * 16; ++frame)
+				{
+					evictionCounts[2] += 3;
+					balancer.OnNewFrame(evictionCounts, capacities);
+				}
+
+				Assert::AreEqual(4U * 1024, balancer.GetCapacity(2));
+
+				for (uint32_t i : { 0, 1, 3, 4, 5, 6 })
+				{
+					Assert::AreEqual(capacities[i], balancer.GetCapacity(i));
+				}
+			}
+		}
+
+		TEST_METHOD(BenchmarkPolicyFindVersusLinearScan)
+		{
+			const uint32_t capacities[] = { 512, 1024, 2048 };
+
+			/* Approximate hit rates seen in town, in a typical fight and on area transitions. */
+			const uint32_t hitPercentages[] = { 98, 90, 70 };
+
+			const uint32_t lookupCount = 1 << 18;
+			Buffer<uint64_t> lookups(lookupCount);
+
+			for (auto capacity : capacities)
+			{
+				TextureCachePolicyBitPmru policy(capacity);
+				Buffer<uint64_t> contentKeys(capacity, true);
+
+				for (uint32_t i = 0; i < capacity; ++i)
+				{
+					bool evicted = false;
+					const uint64_t contentKey = MakeContentKey(i);
+					contentKeys.items[policy.Insert(contentKey, evicted)] = contentKey;
+				}
+
+				for (auto hitPercentage : hitPercentages)
+				{
+					uint32_t seed = 12345;
+
+					for (uint32_t i = 0; i < lookupCount; ++i)
+					{
+						seed = seed * 1664525 + 1013904223;
+						const uint32_t r = seed >> 8;
+						lookups.items[i] = (r % 100) < hitPercentage ?
+							MakeContentKey(r % capacity) :
+							MakeContentKey(capacity + r);
+					}
+
+					int64_t scanChecksum = 0;
+					const int64_t scanStart = TimeStamp();
+					for (uint32_t i = 0; i < lookupCount; ++i)
+					{
+						scanChecksum += IndexOfUInt64(contentKeys.items, capacity, lookups.items[i]);
+					}
+					const double scanMs = TimeToMs(TimeStamp() - scanStart);
+
+					int64_t hashChecksum = 0;
+					const int64_t hashStart = TimeStamp();
+					for (uint32_t i = 0; i < lookupCount; ++i)
+					{
+						hashChecksum += policy.Find(lookups.items[i], -1);
+					}
+					const double hashMs = TimeToMs(TimeStamp() - hashStart);
+
+					Assert::AreEqual(scanChecksum, hashChecksum);
+
+					char message[256];
+					sprintf_s(message, "Capacity %u, %u%% hits: SIMD scan %.2f ns/lookup, hash index %.2f ns/lookup.\n",
+						capacity, hitPercentage, scanMs * 1e6 / lookupCount, hashMs * 1e6 / lookupCount);
+					Logger::WriteMessage(message);
+				}
+			}
+		}
+
+		TEST_METHOD(BenchmarkPolicyReplacementVersusWordScan)
+		{
+			const uint32_t capacities[] = { 512, 1024, 2048 };
+			const uint32_t frameCount = 400;
+
+			for (auto capacity : capacities)
+			{
+				for (uint32_t saturated = 0; saturated < 2; ++saturated)
+				{
+					/* Light: a frame draws a working set of half the cache, plus a few new
+					   textures. Saturated: a frame touches nearly every slot, and one in ten
+					   textures is new, so the cache is always rolling over. */
+					const uint32_t lookupsPerFrame = saturated ? capacity - capacity / 16 : capacity / 2;
+					const uint32_t newPercentage = saturated ? 10 : 2;
+
+					Buffer<uint64_t> lookups(lookupsPerFrame * frameCount);
+					uint32_t seed = 12345;
+					uint32_t nextNewKey = capacity * 4;
+
+					for (uint32_t i = 0; i < lookups.capacity; ++i)
+					{
+						seed = seed * 1664525 + 1013904223;
+						const uint32_t r = seed >> 8;
+						lookups.items[i] = (r % 100) < newPercentage ?
+							MakeContentKey(nextNewKey++) :
+							MakeContentKey((i % lookupsPerFrame) + (i / lookupsPerFrame / 8) * 4);
+					}
+
+					/* Best of a few runs, each on a fresh policy. */
+					int64_t baselineChecksum = 0;
+					int64_t policyChecksum = 0;
+					double baselineMs = 1e9;
+					double policyMs = 1e9;
+
+					for (uint32_t run = 0; run < 5; ++run)
+					{
+						WordScanBitPmru baseline(capacity);
+						const int64_t baselineStart = TimeStamp();
+						baselineChecksum = ReplayPolicyFrames(baseline, lookups, lookupsPerFrame);
+						baselineMs = min(baselineMs, TimeToMs(TimeStamp() - baselineStart));
+
+						TextureCachePolicyBitPmru policy(capacity);
+						const int64_t policyStart = TimeStamp();
+						policyChecksum = ReplayPolicyFrames(policy, lookups, lookupsPerFrame);
+						policyMs = min(policyMs, TimeToMs(TimeStamp() - policyStart));
+					}
+
+					/* Both pick the same slots. */
+					Assert::AreEqual(baselineChecksum, policyChecksum);
+
+					char message[256];
+					sprintf_s(message, "Capacity %u, %s: word scan %.2f ns/lookup, two-level bitmap %.2f ns/lookup.\n",
+						capacity, saturated ? "saturated" : "light",
+						baselineMs * 1e6 / lookups.capacity, policyMs * 1e6 / lookups.capacity);
+					Logger::WriteMessage(message);
+				}
+			}
+		}
 	};
 }
@@ -0,0 +1,344 @@
+/*
+	This file is part of D2DX.
+
+	Copyright (C) 2021  Bolrog
+
+	D2DX is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	D2DX is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with D2DX.  If not, see <https://www.gnu.org/licenses/>.
+*/
+#include "pch.h"
+#include "CppUnitTest.h"
+
+#include "../d2dx/TextureCachePolicyFactory.h"
+#include "../d2dx/TextureCacheSimulator.h"
+#include "../d2dx/TextureCacheTrace.h"
+
+#include "TestUtils.h"
+
+using namespace Microsoft::VisualStudio::CppUnitTestFramework;
+using namespace d2dx;
+
+namespace d2dxtests
+{
+	static void LogSimulatorReport(
+		const char* traceName,
+		TextureCachePolicyType policyType,
+		const TextureCacheSimulator& simulator)
+	{
+		const TextureCacheSimulatorStats totals = simulator.GetTotals();
+		const double frames = totals.frame > 0 ? (double)totals.frame : 1.0;
+
+		uint64_t worstFrameUploadBytes = 0;
+		for (const auto& frameStats : simulator.GetFrameStats())
+		{
+			worstFrameUploadBytes = max(worstFrameUploadBytes, frameStats.uploadBytes);
+		}
+
+		char message[512];
+		sprintf_s(message, "%s, %s: hit rate %.2f%%, %.1f kB uploaded/frame (worst %.1f kB), %.2f evictions/frame, %u resets over %u frames.\n",
+			traceName,
+			TextureCachePolicyFactory::GetName(policyType),
+			totals.lookups ? 100.0 * totals.hits / totals.lookups : 100.0,
+			totals.uploadBytes / 1024.0 / frames,
+			worstFrameUploadBytes / 1024.0,
+			totals.evictions / frames,
+			totals.resets,
+			totals.frame);
+		Logger::WriteMessage(message);
+	}
+
+	/* The default capacities of the texture caches, see Options. */
+	static const uint32_t defaultCapacities[] = { 512, 1024, 2048, 2048, 1024, 512, 512 };
+
+	/* A hot working set that is used every frame, plus a stream of textures that are
+	   only used for a few frames, like spell effects in a busy area. */
+	static std::vector<TextureCacheTraceRecord> MakeBusySceneTrace(
+		uint32_t frameCount,
+		uint32_t hotCount,
+		uint32_t transientPerFrame)
+	{
+		std::vector<TextureCacheTraceRecord> records;
+		uint32_t seed = 12345;
+
+		for (uint32_t frame = 0; frame < frameCount; ++frame)
+		{
+			for (uint32_t i = 0; i < hotCount; ++i)
+			{
+				seed = seed * 1664525 + 1013904223;
+
+				/* Each hot texture shows up in most, but not all frames. */
+				if ((seed >> 24) < 230)
+				{
+					records.push_back({ frame, 3, 6, 6, 0, MakeContentKey(i) });
+				}
+			}
+
+			for (uint32_t i = 0; i < transientPerFrame; ++i)
+			{
+				/* Transient textures live for four frames. */
+				const uint64_t id = 1000000 + (frame / 4) * transientPerFrame + i;
+				records.push_back({ frame, 3, 6, 6, 0, MakeContentKey(id) });
+			}
+		}
+
+		return records;
+	}
+
+	TEST_CLASS(TestTextureCacheSimulator)
+	{
+	public:
+		TEST_METHOD(EveryPolicyFindsInsertedTextures)
+		{
+			const uint32_t capacity = 512;
+
+			for (int32_t t = 0; t < (int32_t)TextureCachePolicyType::Count; ++t)
+			{
+				auto policy = TextureCachePolicyFactory::Create((TextureCachePolicyType)t, capacity);
+				std::vector<uint64_t> slots(capacity, 0);
+
+				for (uint64_t i = 0; i < capacity * 8; ++i)
+				{
+					if (!(i & 63))
+					{
+						policy->OnNewFrame();
+					}
+
+					const uint64_t contentKey = MakeContentKey(i);
+					Assert::AreEqual(-1, policy->Find(contentKey, -1));
+
+					bool evicted = false;
+					const int32_t index = policy->Insert(contentKey, evicted);
+					Assert::IsTrue(index >= 0 && index < (int32_t)capacity);
+					Assert::AreEqual(slots[index] != 0, evicted);
+
+					if (evicted)
+					{
+						Assert::AreEqual(-1, policy->Find(slots[index], -1));
+					}
+
+					slots[index] = contentKey;
+				}
+
+				for (uint32_t i = 0; i < capacity; ++i)
+				{
+					Assert::AreEqual((int32_t)i, policy->Find(slots[i], -1));
+					Assert::AreEqual((int32_t)i, policy->Find(slots[i], (int32_t)i));
+				}
+
+				Assert::AreEqual(capacity, policy->GetUsedCount());
+				Assert::AreEqual(0U, policy->GetResetCount());
+			}
+		}
+
+		TEST_METHOD(EveryPolicyKeepsTexturesInKeptSlotsWhenResized)
+		{
+			for (int32_t t = 0; t < (int32_t)TextureCachePolicyType::Count; ++t)
+			{
+				auto policy = TextureCachePolicyFactory::Create((TextureCachePolicyType)t, 256);
+				std::vector<uint64_t> slots(1024, 0);
+				bool evicted = false;
+
+				for (uint64_t i = 0; i < 256; ++i)
+				{
+					slots[policy->Insert(MakeContentKey(i), evicted)] = MakeContentKey(i);
+				}
+
+				/* Growing keeps everything, and the added slots are filled without evictions. */
+				policy->SetCapacity(1024);
+				policy->OnNewFrame();
+				Assert::AreEqual(256U, policy->GetUsedCount());
+
+				for (uint64_t i = 256; i < 1024; ++i)
+				{
+					const int32_t index = policy->Insert(MakeContentKey(i), evicted);
+					Assert::IsFalse(evicted);
+					Assert::AreEqual(0ULL, (unsigned long long)slots[index]);
+					slots[index] = MakeContentKey(i);
+				}
+
+				/* Shrinking keeps the slots below the new capacity. */
+				policy->SetCapacity(320);
+				policy->OnNewFrame();
+				Assert::AreEqual(320U, policy->GetUsedCount());
+
+				for (uint32_t i = 0; i < 1024; ++i)
+				{
+					Assert::AreEqual(i < 320 ? (int32_t)i : -1, policy->Find(slots[i], -1));
+				}
+
+				for (uint64_t i = 1024; i < 2048; ++i)
+				{
+					if (!(i & 63))
+					{
+						policy->OnNewFrame();
+					}
+
+					const int32_t index = policy->Insert(MakeContentKey(i), evicted);
+					Assert::IsTrue(index >= 0 && index < 320);
+				}
+
+				Assert::AreEqual(0U, policy->GetResetCount());
+			}
+		}
+
+		TEST_METHOD(NoPolicyEvictsTexturesUsedInFrame)
+		{
+			const uint32_t capacity = 256;
+
+			for (int32_t t = 0; t < (int32_t)TextureCachePolicyType::Count; ++t)
+			{
+				auto policy = TextureCachePolicyFactory::Create((TextureCachePolicyType)t, capacity);
+				std::vector<uint8_t> usedInFrame(capacity, 0);
+				uint32_t seed = 4711;
+
+				for (uint32_t frame = 0; frame < 200; ++frame)
+				{
+					policy->OnNewFrame();
+					std::fill(usedInFrame.begin(), usedInFrame.end(), 0);
+
+					for (uint32_t i = 0; i < capacity - 1; ++i)
+					{
+						seed = seed * 1664525 + 1013904223;
+						const uint64_t contentKey = MakeContentKey((seed >> 8) % (capacity * 3));
+
+						int32_t index = policy->Find(contentKey, -1);
+
+						if (index < 0)
+						{
+							bool evicted = false;
+							index = policy->Insert(contentKey, evicted);
+							Assert::IsFalse(usedInFrame[index] != 0);
+						}
+
+						usedInFrame[index] = 1;
+					}
+				}
+
+				Assert::AreEqual(0U, policy->GetResetCount());
+
+				/* Using every slot in one frame forces a reset. */
+				policy->OnNewFrame();
+
+				for (uint32_t i = 0; i <= capacity; ++i)
+				{
+					bool evicted = false;
+					policy->Insert(MakeContentKey(0x10000000 + i), evicted);
+				}
+
+				Assert::AreEqual(1U, policy->GetResetCount());
+			}
+		}
+
+		TEST_METHOD(SimulatorCountsUploadsAndHits)
+		{
+			const uint32_t hotCount = 1000;
+			std::vector<TextureCacheTraceRecord> records;
+
+			for (uint32_t frame = 0; frame < 10; ++frame)
+			{
+				for (uint32_t i = 0; i < hotCount; ++i)
+				{
+					records.push_back({ frame, 4, 7, 7, 0, MakeContentKey(i) });
+				}
+			}
+
+			for (int32_t t = 0; t < (int32_t)TextureCachePolicyType::Count; ++t)
+			{
+				TextureCacheSimulator simulator((TextureCachePolicyType)t, defaultCapacities, ARRAYSIZE(defaultCapacities));
+				simulator.Replay(records.data(), (uint32_t)records.size());
+
+				const auto& frameStats = simulator.GetFrameStats();
+				Assert::AreEqual((size_t)10, frameStats.size());
+
+				/* Everything fits, so only the first frame uploads. */
+				Assert::AreEqual(hotCount, frameStats[0].lookups);
+				Assert::AreEqual(0U, frameStats[0].hits);
+				Assert::AreEqual((uint64_t)hotCount * 128 * 128, frameStats[0].uploadBytes);
+
+				for (size_t i = 1; i < frameStats.size(); ++i)
+				{
+					Assert::AreEqual(hotCount, frameStats[i].hits);
+					Assert::AreEqual((uint64_t)0, frameStats[i].uploadBytes);
+					Assert::AreEqual(0U, frameStats[i].evictions);
+				}
+
+				const TextureCacheSimulatorStats totals = simulator.GetTotals();
+				Assert::AreEqual(10U, totals.frame);
+				Assert::AreEqual(hotCount * 10, totals.lookups);
+				Assert::AreEqual(hotCount * 9, totals.hits);
+				Assert::AreEqual(0U, totals.resets);
+			}
+		}
+
+		TEST_METHOD(SimulateBusyScene)
+		{
+			const auto records = MakeBusySceneTrace(600, 1600, 150);
+			uint32_t bestMisses = UINT32_MAX;
+			uint32_t bitPmruMisses = 0;
+
+			for (int32_t t = 0; t < (int32_t)TextureCachePolicyType::Count; ++t)
+			{
+				TextureCacheSimulator simulator((TextureCachePolicyType)t, defaultCapacities, ARRAYSIZE(defaultCapacities));
+				simulator.Replay(records.data(), (uint32_t)records.size());
+
+				const TextureCacheSimulatorStats totals = simulator.GetTotals();
+				Assert::AreEqual((uint32_t)records.size(), totals.lookups);
+				Assert::AreEqual((uint64_t)(totals.lookups - totals.hits) * 64 * 64, totals.uploadBytes);
+				Assert::AreEqual(0U, totals.resets);
+
+				const uint32_t misses = totals.lookups - totals.hits;
+				bestMisses = min(bestMisses, misses);
+
+				if ((TextureCachePolicyType)t == TextureCachePolicyType::BitPmru)
+				{
+					bitPmruMisses = misses;
+				}
+
+				LogSimulatorReport("Busy scene", (TextureCachePolicyType)t, simulator);
+			}
+
+			/* The policy the texture caches use misses at most 10% more than the best one. */
+			Assert::IsTrue(bitPmruMisses * 10 <= bestMisses * 11);
+		}
+
+		TEST_METHOD(TraceRoundTrip)
+		{
+			const char* filename = "d2dx_texture_cache_trace_test.bin";
+
+			{
+				TextureCacheTraceRecorder recorder(filename);
+
+				for (uint32_t i = 0; i < 70000; ++i)
+				{
+					recorder.Record(i / 100, i % 7, 8 << (i % 6), 8 << ((i + 1) % 6), MakeContentKey(i));
+				}
+			}
+
+			auto records = ReadTextureCacheTrace(filename);
+			remove(filename);
+
+			Assert::AreEqual(70000U, records.capacity);
+
+			for (uint32_t i = 0; i < records.capacity; ++i)
+			{
+				Assert::AreEqual(i / 100, records.items[i].frame);
+				Assert::AreEqual((uint8_t)(i % 7), records.items[i].sizeClass);
+				Assert::AreEqual((uint8_t)(3 + i % 6), records.items[i].widthLog2);
+				Assert::AreEqual((uint8_t)(3 + (i + 1) % 6), records.items[i].heightLog2);
+				Assert::AreEqual(MakeContentKey(i), records.items[i].contentKey);
+			}
+
+			Assert::AreEqual(0U, ReadTextureCacheTrace("does_not_exist.bin").capacity);
+		}
+	};
+}
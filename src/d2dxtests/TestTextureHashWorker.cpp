@@ -0,0 +1,127 @@
+/*
+	This file is part of D2DX.
+
+	Copyright (C) 2021  Bolrog
+
+	D2DX is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	D2DX is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with D2DX.  If not, see <https://www.gnu.org/licenses/>.
+*/
+#include "pch.h"
+#include "CppUnitTest.h"
+
+#include "../d2dx/TextureHashWorker.h"
+#include "../d2dx/Types.h"
+#include "../d2dx/Utils.h"
+
+using namespace Microsoft::VisualStudio::CppUnitTestFramework;
+using namespace d2dx;
+
+namespace d2dxtests
+{
+	TEST_CLASS(TestTextureHashWorker)
+	{
+	public:
+		TEST_METHOD(HashesQueuedRanges)
+		{
+			std::vector<uint8_t> memory(256 * 1024);
+
+			for (uint32_t i = 0; i < memory.size(); ++i)
+			{
+				memory[i] = (uint8_t)(i * 7 + (i >> 9));
+			}
+
+			TextureHashWorker worker(memory.data(), (uint32_t)memory.size(), 16);
+
+			uint32_t collectedCount = 0;
+
+			for (uint32_t i = 0; i < 1000; ++i)
+			{
+				const uint32_t startAddress = (i * 4096) % (192 * 1024);
+				const uint32_t size = 256U << (i % 8);
+
+				uint32_t sequence;
+				while (!worker.TryEnqueue(startAddress, size, sequence))
+				{
+					/* All slots are taken, so the oldest job has been queued. */
+					worker.Wait(collectedCount + 1);
+
+					TextureHashWorker::Job job;
+
+					while (worker.TryCollect(job))
+					{
+						++collectedCount;
+						Assert::AreEqual(collectedCount, job.sequence);
+						Assert::AreEqual(XXH3_64bits(&memory[job.startAddress], job.size), job.hash);
+					}
+				}
+
+				Assert::AreEqual(i + 1, sequence);
+			}
+
+			worker.Wait(1000);
+			Assert::IsFalse(worker.IsPending(1000));
+
+			TextureHashWorker::Job job;
+			while (worker.TryCollect(job))
+			{
+				++collectedCount;
+				Assert::AreEqual(collectedCount, job.sequence);
+				Assert::AreEqual(XXH3_64bits(&memory[job.startAddress], job.size), job.hash);
+			}
+
+			Assert::AreEqual(1000U, collectedCount);
+		}
+
+		TEST_METHOD(RefusesJobsUntilSlotsAreCollected)
+		{
+			std::vector<uint8_t> memory(4096, 1);
+			TextureHashWorker worker(memory.data(), (uint32_t)memory.size(), 4, false);
+
+			uint32_t sequence;
+			for (uint32_t i = 0; i < 4; ++i)
+			{
+				Assert::IsTrue(worker.TryEnqueue(i * 256, 256, sequence));
+			}
+
+			Assert::IsFalse(worker.TryEnqueue(0, 256, sequence));
+
+			/* A finished job still holds its slot until it is collected. */
+			Assert::IsTrue(worker.IsPending(1));
+			Assert::IsTrue(worker.RunOne());
+			Assert::IsFalse(worker.IsPending(1));
+			Assert::IsTrue(worker.IsPending(2));
+			Assert::IsFalse(worker.TryEnqueue(0, 256, sequence));
+
+			TextureHashWorker::Job job;
+			Assert::IsTrue(worker.TryCollect(job));
+			Assert::AreEqual(1U, job.sequence);
+			Assert::IsFalse(worker.TryCollect(job));
+
+			Assert::IsTrue(worker.TryEnqueue(0, 512, sequence));
+			Assert::AreEqual(5U, sequence);
+			Assert::IsTrue(worker.IsPending(5));
+
+			/* Sequence numbers that haven't been handed out are never pending. */
+			Assert::IsFalse(worker.IsPending(0));
+			Assert::IsFalse(worker.IsPending(6));
+
+			while (worker.RunOne())
+			{
+			}
+
+			Assert::IsFalse(worker.IsPending(5));
+			Assert::IsFalse(worker.Wait(5));
+			Assert::AreEqual(0U, worker.GetWaitCount());
+		}
+	};
+}
@@ -0,0 +1,393 @@
+/*
+	This file is part of D2DX.
+
+	Copyright (C) 2021  Bolrog
+
+	D2DX is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	D2DX is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with D2DX.  If not, see <https://www.gnu.org/licenses/>.
+*/
+#include "pch.h"
+#include "CppUnitTest.h"
+
+#include "../d2dx/TextureHasher.h"
+#include "../d2dx/Types.h"
+#include "../d2dx/Utils.h"
+
+using namespace Microsoft::VisualStudio::CppUnitTestFramework;
+using namespace d2dx;
+
+namespace d2dxtests
+{
+	static void FillTexels(uint8_t* texels, uint32_t size, uint8_t seed)
+	{
+		for (uint32_t i = 0; i < size; ++i)
+		{
+			texels[i] = (uint8_t)(seed + i * 7 + (i >> 8));
+		}
+	}
+
+	/* TMU memory written the way OnTexDownload does. */
+	struct TestTmuMemory final
+	{
+		TestTmuMemory(bool backgroundHashing = false) :
+			memory(256 * 1024, 0),
+			source(64 * 1024, 0)
+		{
+			if (backgroundHashing)
+			{
+				hasher.StartWorker(memory.data(), (uint32_t)memory.size());
+			}
+		}
+
+		/* Returns whether the texels were copied. */
+		bool Download(uint32_t startAddress, uint32_t size, uint8_t seed)
+		{
+			FillTexels(source.data(), size, seed);
+
+			if (!hasher.OnDownload(startAddress, source.data(), size))
+			{
+				return false;
+			}
+
+			memcpy(&memory[startAddress], source.data(), size);
+			hasher.OnDownloadCopied(startAddress, size);
+			return true;
+		}
+
+		/* Writes TMU memory without going through OnDownload. */
+		void Write(uint32_t startAddress, uint32_t size, uint8_t seed)
+		{
+			hasher.Invalidate(startAddress, size);
+			FillTexels(&memory[startAddress], size, seed);
+		}
+
+		XXH64_hash_t GetHash(uint32_t startAddress, uint32_t size, uint32_t largeLog2 = 6, uint32_t ratioLog2 = 0)
+		{
+			return hasher.GetHash(startAddress, &memory[startAddress], size, largeLog2, ratioLog2);
+		}
+
+		/* The hash as computed from the memory as it is now. */
+		XXH64_hash_t GetFreshHash(uint32_t startAddress, uint32_t size, uint32_t largeLog2 = 6, uint32_t ratioLog2 = 0)
+		{
+			XXH64_hash_t hash = XXH3_64bits(&memory[startAddress], size);
+			hash ^= static_cast<XXH64_hash_t>(largeLog2 * 0x01000193u);
+			hash ^= static_cast<XXH64_hash_t>(ratioLog2 * 0x01000193u) << 32;
+			return hash;
+		}
+
+		std::vector<uint8_t> memory;
+		std::vector<uint8_t> source;
+		TextureHasher hasher;
+	};
+
+	/* Downloads, writes and uses textures at random addresses, and checks every hash against
+	   the memory. sizeLog2 maps a page to the log2 of the size of textures starting there. */
+	template<typename TSizeLog2>
+	static void RunRandomOverlappingDownloads(TestTmuMemory& tmu, TSizeLog2 sizeLog2)
+	{
+		uint32_t seed = 1234;
+		auto next = [&]()
+		{
+			seed = seed * 1664525 + 1013904223;
+			return seed >> 8;
+		};
+
+		for (uint32_t i = 0; i < 20000; ++i)
+		{
+			const uint32_t startAddress = (next() % 256) << 8;
+			const uint32_t size = 1U << sizeLog2(startAddress >> 8);
+
+			const uint32_t action = next() % 8;
+
+			if (action == 0)
+			{
+				tmu.Download(startAddress, size, (uint8_t)next());
+			}
+			else if (action == 1)
+			{
+				tmu.Write(startAddress, size, (uint8_t)next());
+			}
+			else
+			{
+				Assert::AreEqual(tmu.GetFreshHash(startAddress, size), tmu.GetHash(startAddress, size));
+			}
+		}
+	}
+
+	TEST_CLASS(TestTextureHasher)
+	{
+	public:
+		TEST_METHOD(ReusesHashOfDownload)
+		{
+			TestTmuMemory tmu;
+			tmu.Download(0x1000, 4096, 1);
+
+			/* The download was hashed, so using the texture doesn't hash it again. */
+			const XXH64_hash_t hash = tmu.GetHash(0x1000, 4096);
+			Assert::AreEqual(tmu.GetFreshHash(0x1000, 4096), hash);
+			Assert::AreEqual(hash, tmu.GetHash(0x1000, 4096));
+			Assert::AreEqual(1U, tmu.hasher.GetHashCount());
+
+			tmu.Download(0x1000, 4096, 2);
+			Assert::AreEqual(tmu.GetFreshHash(0x1000, 4096), tmu.GetHash(0x1000, 4096));
+			Assert::AreEqual(2U, tmu.hasher.GetHashCount());
+			Assert::AreEqual(0U, tmu.hasher.GetStaleHashAvoidedCount());
+		}
+
+		TEST_METHOD(ReusesHashUntilWritten)
+		{
+			TestTmuMemory tmu;
+			tmu.Write(0x1000, 4096, 1);
+
+			const XXH64_hash_t hash = tmu.GetHash(0x1000, 4096);
+			Assert::AreEqual(hash, tmu.GetHash(0x1000, 4096));
+			Assert::AreEqual(1U, tmu.hasher.GetHashCount());
+
+			tmu.Write(0x1000, 4096, 2);
+			Assert::AreEqual(tmu.GetFreshHash(0x1000, 4096), tmu.GetHash(0x1000, 4096));
+			Assert::AreEqual(2U, tmu.hasher.GetHashCount());
+		}
+
+		TEST_METHOD(SkipsCopyOfSameTexels)
+		{
+			TestTmuMemory tmu;
+			Assert::IsTrue(tmu.Download(0x1000, 8192, 1));
+			Assert::IsFalse(tmu.Download(0x1000, 8192, 1));
+			Assert::IsTrue(tmu.Download(0x1000, 8192, 2));
+			Assert::IsTrue(tmu.Download(0x1000, 4096, 2));
+
+			/* Other writes into the texture mean the texels have to be copied again. */
+			Assert::IsFalse(tmu.Download(0x1000, 4096, 2));
+			tmu.Download(0x1200, 256, 3);
+			Assert::IsTrue(tmu.Download(0x1000, 4096, 2));
+			tmu.Write(0x1300, 256, 4);
+			Assert::IsTrue(tmu.Download(0x1000, 4096, 2));
+
+			Assert::AreEqual(tmu.GetFreshHash(0x1000, 4096), tmu.GetHash(0x1000, 4096));
+		}
+
+		TEST_METHOD(CopiesSmallDownloadsWithoutHashing)
+		{
+			TestTmuMemory tmu;
+			Assert::IsTrue(tmu.Download(0x1000, 1024, 1));
+			Assert::IsTrue(tmu.Download(0x1000, 1024, 1));
+			Assert::AreEqual(0U, tmu.hasher.GetHashCount());
+
+			/* They are hashed when the texture is used instead. */
+			Assert::AreEqual(tmu.GetFreshHash(0x1000, 1024), tmu.GetHash(0x1000, 1024));
+			Assert::AreEqual(tmu.GetFreshHash(0x1000, 1024), tmu.GetHash(0x1000, 1024));
+			Assert::AreEqual(1U, tmu.hasher.GetHashCount());
+
+			tmu.Download(0x1000, 1024, 2);
+			Assert::AreEqual(tmu.GetFreshHash(0x1000, 1024), tmu.GetHash(0x1000, 1024));
+			Assert::AreEqual(2U, tmu.hasher.GetHashCount());
+		}
+
+		TEST_METHOD(KeepsHashWhenOtherPagesAreWritten)
+		{
+			TestTmuMemory tmu;
+			tmu.Download(0x1000, 4096, 1);
+			tmu.GetHash(0x1000, 4096);
+
+			tmu.Download(0x0000, 4096, 2);
+			tmu.Download(0x2000, 256, 3);
+			tmu.Write(0x2100, 256, 4);
+			const uint32_t hashCount = tmu.hasher.GetHashCount();
+			tmu.GetHash(0x1000, 4096);
+
+			Assert::AreEqual(hashCount, tmu.hasher.GetHashCount());
+		}
+
+		TEST_METHOD(RehashesWhenOverlappingDownloadWritesFootprint)
+		{
+			TestTmuMemory tmu;
+			tmu.Download(0x1000, 4096, 1);
+			const XXH64_hash_t hash = tmu.GetHash(0x1000, 4096);
+
+			/* Starts inside the texture, so its own start address is never written. */
+			tmu.Download(0x1800, 1024, 2);
+
+			const XXH64_hash_t newHash = tmu.GetHash(0x1000, 4096);
+			Assert::AreNotEqual(hash, newHash);
+			Assert::AreEqual(tmu.GetFreshHash(0x1000, 4096), newHash);
+			Assert::AreEqual(1U, tmu.hasher.GetStaleHashAvoidedCount());
+
+			/* A download that starts before the texture and runs into it. */
+			tmu.Download(0x0C00, 1024 + 256, 3);
+			Assert::AreEqual(tmu.GetFreshHash(0x1000, 4096), tmu.GetHash(0x1000, 4096));
+			Assert::AreEqual(2U, tmu.hasher.GetStaleHashAvoidedCount());
+		}
+
+		TEST_METHOD(RehashesTextureWhosePagesWereCleanedByAnother)
+		{
+			TestTmuMemory tmu;
+			tmu.Download(0x1000, 4096, 1);
+			tmu.GetHash(0x1000, 4096);
+			tmu.GetHash(0x1800, 1024);
+
+			/* The inner texture is hashed again first and cleans the shared pages. */
+			tmu.Download(0x1800, 1024, 2);
+			Assert::AreEqual(tmu.GetFreshHash(0x1800, 1024), tmu.GetHash(0x1800, 1024));
+			Assert::AreEqual(tmu.GetFreshHash(0x1000, 4096), tmu.GetHash(0x1000, 4096));
+			Assert::AreEqual(1U, tmu.hasher.GetStaleHashAvoidedCount());
+		}
+
+		TEST_METHOD(RehashesWhenSizeChanges)
+		{
+			TestTmuMemory tmu;
+			tmu.Download(0x1000, 4096, 1);
+			tmu.GetHash(0x1000, 4096);
+
+			Assert::AreEqual(tmu.GetFreshHash(0x1000, 1024, 5), tmu.GetHash(0x1000, 1024, 5));
+
+			/* The LOD parameters are mixed into the hash of the texels. */
+			Assert::AreEqual(tmu.GetFreshHash(0x1000, 1024, 5, 1), tmu.GetHash(0x1000, 1024, 5, 1));
+			Assert::AreEqual(2U, tmu.hasher.GetHashCount());
+		}
+
+		TEST_METHOD(MatchesFreshHashUnderRandomOverlappingDownloads)
+		{
+			TestTmuMemory tmu;
+
+			RunRandomOverlappingDownloads(tmu, [](uint32_t page) { return 6 + 2 * (page % 4); });
+
+			Assert::IsTrue(tmu.hasher.GetHashCount() < 15000);
+			Assert::IsTrue(tmu.hasher.GetStaleHashAvoidedCount() > 0);
+		}
+
+		TEST_METHOD(MatchesFreshHashUnderRandomOverlappingBackgroundDownloads)
+		{
+			TestTmuMemory tmu(true);
+
+			/* Half of the textures are large enough to be hashed on the worker thread. */
+			RunRandomOverlappingDownloads(tmu, [](uint32_t page) { return page % 2 ? 15 + (page >> 1) % 2 : 8 + (page >> 1) % 4; });
+
+			Assert::IsTrue(tmu.hasher.GetBackgroundHashCount() > 0);
+
+			char message[128];
+			sprintf_s(message, "%u background hashes, %u waits\n",
+				tmu.hasher.GetBackgroundHashCount(), tmu.hasher.GetWaitCount());
+			Logger::WriteMessage(message);
+		}
+
+		TEST_METHOD(SkipsHashOfLargeDownloadOnGameThread)
+		{
+			TestTmuMemory tmu(true);
+
+			tmu.Download(0x10000, 256 * 256, 1);
+			Assert::AreEqual(0U, tmu.hasher.GetHashCount());
+			Assert::AreEqual(1U, tmu.hasher.GetBackgroundHashCount());
+
+			Assert::AreEqual(tmu.GetFreshHash(0x10000, 256 * 256, 8), tmu.GetHash(0x10000, 256 * 256, 8));
+			Assert::AreEqual(0U, tmu.hasher.GetHashCount());
+
+			/* Writing the texels waits for the worker, so the hash isn't taken from them. */
+			tmu.Download(0x10000, 256 * 256, 2);
+			tmu.Write(0x10000, 256, 3);
+			Assert::AreEqual(tmu.GetFreshHash(0x10000, 256 * 256, 8), tmu.GetHash(0x10000, 256 * 256, 8));
+			Assert::AreEqual(1U, tmu.hasher.GetHashCount());
+		}
+
+		TEST_METHOD(BenchmarkDownloads)
+		{
+			/* Each texture is downloaded and then used once. Previously the texels were
+			   copied, and then read again from TMU memory to be hashed. */
+			const int32_t sizes[] = { 64, 256 };
+			const uint32_t textureCount = 64;
+			const uint32_t frameCount = 32;
+
+			for (int32_t size : sizes)
+			{
+				const uint32_t pixelsSize = (uint32_t)(size * size);
+
+				/* Two versions of each texture, so that every download changes the texels. */
+				std::vector<uint8_t> sources(pixelsSize * textureCount * 2);
+
+				for (uint32_t i = 0; i < textureCount * 2; ++i)
+				{
+					FillTexels(&sources[i * pixelsSize], pixelsSize, (uint8_t)i);
+				}
+
+				std::vector<uint8_t> memory(pixelsSize * textureCount);
+				double copyThenHashMs = 1e9;
+				double hashThenCopyMs = 1e9;
+				double sameTexelsMs = 1e9;
+				XXH64_hash_t checksum[3] = {};
+
+				for (uint32_t run = 0; run < 5; ++run)
+				{
+					TextureHasher hasher;
+					int64_t start = TimeStamp();
+
+					for (uint32_t frame = 0; frame < frameCount; ++frame)
+					{
+						for (uint32_t i = 0; i < textureCount; ++i)
+						{
+							const uint8_t* source = &sources[(i * 2 + (frame & 1)) * pixelsSize];
+							memcpy(&memory[i * pixelsSize], source, pixelsSize);
+							checksum[0] += XXH3_64bits(&memory[i * pixelsSize], pixelsSize);
+						}
+					}
+
+					copyThenHashMs = min(copyThenHashMs, TimeToMs(TimeStamp() - start));
+
+					start = TimeStamp();
+
+					for (uint32_t frame = 0; frame < frameCount; ++frame)
+					{
+						for (uint32_t i = 0; i < textureCount; ++i)
+						{
+							const uint8_t* source = &sources[(i * 2 + (frame & 1)) * pixelsSize];
+
+							if (hasher.OnDownload(i * pixelsSize, source, pixelsSize))
+							{
+								memcpy(&memory[i * pixelsSize], source, pixelsSize);
+							}
+
+							checksum[1] += hasher.GetHash(i * pixelsSize, &memory[i * pixelsSize], pixelsSize, 0, 0);
+						}
+					}
+
+					hashThenCopyMs = min(hashThenCopyMs, TimeToMs(TimeStamp() - start));
+
+					start = TimeStamp();
+
+					for (uint32_t frame = 0; frame < frameCount; ++frame)
+					{
+						for (uint32_t i = 0; i < textureCount; ++i)
+						{
+							const uint8_t* source = &sources[i * 2 * pixelsSize];
+
+							if (hasher.OnDownload(i * pixelsSize, source, pixelsSize))
+							{
+								memcpy(&memory[i * pixelsSize], source, pixelsSize);
+							}
+
+							checksum[2] += hasher.GetHash(i * pixelsSize, &memory[i * pixelsSize], pixelsSize, 0, 0);
+						}
+					}
+
+					sameTexelsMs = min(sameTexelsMs, TimeToMs(TimeStamp() - start));
+				}
+
+				Assert::AreEqual(checksum[0], checksum[1]);
+
+				const double downloadCount = (double)(textureCount * frameCount);
+				char message[256];
+				sprintf_s(message, "%dx%d downloads: copy then hash %.2f us, hash then copy %.2f us, same texels %.2f us.\n",
+					size, size, copyThenHashMs * 1000 / downloadCount, hashThenCopyMs * 1000 / downloadCount, sameTexelsMs * 1000 / downloadCount);
+				Logger::WriteMessage(message);
+			}
+		}
+	};
+}
@@ -0,0 +1,236 @@
+/*
+	This file is part of D2DX.
+
+	Copyright (C) 2021  Bolrog
+
+	D2DX is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	D2DX is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with D2DX.  If not, see <https://www.gnu.org/licenses/>.
+*/
+#include "pch.h"
+#include "CppUnitTest.h"
+
+#include "../d2dx/Buffer.h"
+#include "../d2dx/Types.h"
+#include "../d2dx/Utils.h"
+#include "../d2dx/Vertex.h"
+
+using namespace Microsoft::VisualStudio::CppUnitTestFramework;
+using namespace d2dx;
+
+namespace d2dxtests
+{
+	TEST_CLASS(TestVertex)
+	{
+	public:
+		TEST_METHOD(KeepsGamePositions)
+		{
+			/* Integer and half-pixel positions, from well off the top-left of the screen to
+			   well past the bottom-right of the largest game sizes. */
+			Vertex vertex;
+
+			for (int32_t i = -1024 * 2; i < 4096 * 2; ++i)
+			{
+				const float position = i * 0.5f;
+				vertex.SetPosition(position, -position);
+				Assert::AreEqual(position, vertex.GetX());
+				Assert::AreEqual(-position, vertex.GetY());
+			}
+
+			/* Eighths are exact too. */
+			for (int32_t i = -64 * 8; i < 64 * 8; ++i)
+			{
+				const float position = i * 0.125f;
+				vertex.SetPosition(position, position);
+				Assert::AreEqual(position, vertex.GetX());
+				Assert::AreEqual(position, vertex.GetY());
+			}
+		}
+
+		TEST_METHOD(RoundsFinerPositionsToNearestEighth)
+		{
+			Vertex vertex;
+
+			vertex.SetPosition(10.3f, -10.3f);
+			Assert::AreEqual(10.25f, vertex.GetX());
+			Assert::AreEqual(-10.25f, vertex.GetY());
+
+			vertex.SetPosition(10.07f, 99.95f);
+			Assert::AreEqual(10.125f, vertex.GetX());
+			Assert::AreEqual(100.0f, vertex.GetY());
+
+			/* The widened edges of a diagonal line. */
+			const float widening = 0.5f * 0.70710678f;
+			vertex.SetPosition(200.0f + widening, 300.0f - widening);
+			Assert::IsTrue(fabs(vertex.GetX() - (200.0f + widening)) <= 1.0f / 16);
+			Assert::IsTrue(fabs(vertex.GetY() - (300.0f - widening)) <= 1.0f / 16);
+		}
+
+		TEST_METHOD(SaturatesOutOfRangePositions)
+		{
+			Vertex vertex(5000.0f, -5000.0f, 0, 0, 0, false, 0, 0, 0);
+			Assert::AreEqual(4096.0f - 0.125f, vertex.GetX());
+			Assert::AreEqual(-4096.0f, vertex.GetY());
+
+			vertex.SetPosition(4000.0f, -4000.0f);
+			vertex.AddOffset(200, -200);
+			Assert::AreEqual(4096.0f - 0.125f, vertex.GetX());
+			Assert::AreEqual(-4096.0f, vertex.GetY());
+		}
+
+		TEST_METHOD(AddsOffsets)
+		{
+			Vertex vertex(10.5f, 20.0f, 0, 0, 0, false, 0, 0, 0);
+			vertex.AddOffset(1, 1);
+			Assert::AreEqual(11.5f, vertex.GetX());
+			Assert::AreEqual(21.0f, vertex.GetY());
+		}
+
+		TEST_METHOD(KeepsTexcoordsAndAttributes)
+		{
+			for (int32_t s = INT16_MIN; s <= INT16_MAX; s += 7)
+			{
+				const Vertex vertex(1.0f, 2.0f, s, -s - 1, 0x80FF4020, true, 2047, D2DX_MAX_PALETTES - 1, 16383);
+				Assert::AreEqual(s, vertex.GetS());
+				Assert::AreEqual(-s - 1, vertex.GetT());
+				Assert::AreEqual(0x80FF4020U, vertex.GetColor());
+				Assert::IsTrue(vertex.IsChromaKeyEnabled());
+				Assert::AreEqual(2047, vertex.GetAtlasIndex());
+				Assert::AreEqual(D2DX_MAX_PALETTES - 1, vertex.GetPaletteIndex());
+				Assert::AreEqual(16383, vertex.GetSurfaceId());
+			}
+
+			Vertex vertex;
+			for (int32_t t = 0; t <= 511; ++t)
+			{
+				vertex.SetTexcoord(511 - t, t);
+				vertex.AddTexcoordOffset(256, 256);
+				Assert::AreEqual(511 - t + 256, vertex.GetS());
+				Assert::AreEqual(t + 256, vertex.GetT());
+			}
+		}
+
+		TEST_METHOD(CarriesTextureSizeInTexcoords)
+		{
+			for (int32_t log2Size = 3; log2Size <= 8; ++log2Size)
+			{
+				const int32_t sizeBits = Vertex::GetTexcoordSizeBits(1 << log2Size);
+
+				for (int32_t s = -1024; s <= 1023; ++s)
+				{
+					Vertex vertex(1.0f, 2.0f, s + sizeBits, 0, 0, false, 0, 0, 0);
+
+					/* Decoded like the vertex shaders do. */
+					const int32_t decodedLog2Size = (vertex.GetS() + 1024) >> Vertex::TEXCOORD_SIZE_SHIFT;
+					Assert::AreEqual(log2Size, decodedLog2Size);
+					Assert::AreEqual(s, vertex.GetS() - (decodedLog2Size << Vertex::TEXCOORD_SIZE_SHIFT));
+				}
+			}
+		}
+
+		TEST_METHOD(KeepsEveryPaletteIndex)
+		{
+			for (int32_t paletteIndex = 0; paletteIndex < D2DX_MAX_PALETTES; ++paletteIndex)
+			{
+				Vertex vertex(1.0f, 2.0f, 3, 4, 0, paletteIndex & 1, 2047 - paletteIndex, paletteIndex, 16383 - paletteIndex);
+				vertex.SetAtlasIndex(paletteIndex);
+				vertex.SetSurfaceId(paletteIndex);
+				Assert::AreEqual(paletteIndex, vertex.GetPaletteIndex());
+				Assert::AreEqual(paletteIndex, vertex.GetAtlasIndex());
+				Assert::AreEqual(paletteIndex, vertex.GetSurfaceId());
+				Assert::AreEqual((paletteIndex & 1) != 0, vertex.IsChromaKeyEnabled());
+			}
+		}
+
+		TEST_METHOD(BenchmarkBulkWriteVertices)
+		{
+			/* The previous layout, with float positions. */
+			struct FloatVertex
+			{
+				float x;
+				float y;
+				int16_t s;
+				int16_t t;
+				uint32_t color;
+				uint16_t paletteIndex_atlasIndex;
+				uint16_t isChromaKeyEnabled_surfaceId;
+			};
+
+			static_assert(sizeof(FloatVertex) == 20, "sizeof(FloatVertex)");
+
+			/* A busy frame, copied into a ring the size of the vertex buffer, as
+			   a staged frame is copied into the mapped buffer. */
+			const uint32_t vertexCount = 64 * 1024;
+			const uint32_t frameCount = 64;
+			const uint32_t ringCapacity = 1024 * 1024;
+
+			Buffer<FloatVertex> floatVertices(vertexCount);
+			Buffer<Vertex> vertices(vertexCount);
+			Buffer<uint8_t> ring(ringCapacity * sizeof(FloatVertex));
+
+			for (uint32_t i = 0; i < vertexCount; ++i)
+			{
+				const float x = (float)(i % 1024);
+				const float y = (float)((i / 1024) * 8 % 768);
+				floatVertices.items[i] = { x, y, (int16_t)(i & 255), (int16_t)((i >> 8) & 255), 0xFFFFFFFF, 0x1005, 0x0080 };
+				vertices.items[i] = Vertex(x, y, i & 255, (i >> 8) & 255, 0xFFFFFFFF, false, 5, 1, 0x80);
+			}
+
+			double floatMs = 1e9;
+			double fixedMs = 1e9;
+
+			for (uint32_t run = 0; run < 5; ++run)
+			{
+				uint32_t writeIndex = 0;
+				const int64_t floatStart = TimeStamp();
+
+				for (uint32_t frame = 0; frame < frameCount; ++frame)
+				{
+					if (writeIndex + vertexCount > ringCapacity)
+					{
+						writeIndex = 0;
+					}
+
+					memcpy((FloatVertex*)ring.items + writeIndex, floatVertices.items, sizeof(FloatVertex) * vertexCount);
+					writeIndex += vertexCount;
+				}
+
+				floatMs = min(floatMs, TimeToMs(TimeStamp() - floatStart));
+
+				writeIndex = 0;
+				const int64_t fixedStart = TimeStamp();
+
+				for (uint32_t frame = 0; frame < frameCount; ++frame)
+				{
+					if (writeIndex + vertexCount > ringCapacity)
+					{
+						writeIndex = 0;
+					}
+
+					memcpy((Vertex*)ring.items + writeIndex, vertices.items, sizeof(Vertex) * vertexCount);
+					writeIndex += vertexCount;
+				}
+
+				fixedMs = min(fixedMs, TimeToMs(TimeStamp() - fixedStart));
+			}
+
+			Assert::AreEqual(16U, (uint32_t)sizeof(Vertex));
+
+			char message[256];
+			sprintf_s(message, "%u vertices per frame: float positions %u kB, %.3f ms; fixed-point positions %u kB, %.3f ms.\n",
+				vertexCount,
+				(uint32_t)(sizeof(FloatVertex) * vertexCount / 1024), floatMs / frameCount,
+				(uint32_t)(sizeof(Vertex) * vertexCount / 1024), fixedMs / frameCount);
+			Logger::WriteMessage(message);
+		}
+	};
+}
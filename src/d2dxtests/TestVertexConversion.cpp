@@ -0,0 +1,461 @@
+/*
+	This file is part of D2DX.
+
+	Copyright (C) 2021  Bolrog
+
+	D2DX is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	D2DX is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with D2DX.  If not, see <https://www.gnu.org/licenses/>.
+*/
+#include "pch.h"
+#include "CppUnitTest.h"
+
+#include "../d2dx/Buffer.h"
+#include "../d2dx/Simd.h"
+#include "../d2dx/Types.h"
+#include "../d2dx/Utils.h"
+#include "../d2dx/VertexConversion.h"
+
+using namespace Microsoft::VisualStudio::CppUnitTestFramework;
+using namespace d2dx;
+
+namespace d2dxtests
+{
+	TEST_CLASS(TestVertexConversion)
+	{
+	public:
+		static VertexConversionParams MakeParams(
+			int32_t stShift,
+			bool isIteratedColor)
+		{
+			VertexConversionParams params;
+			params.templateVertex = Vertex(0, 0, 0, 0, 0, true, 1234, 7, 4321);
+			params.iteratedColorMask = isIteratedColor ? 0x00FFFFFF : 0x00000000;
+			params.maskedConstantColor = isIteratedColor ? 0x80000000 : 0x80402010;
+			params.stShift = stShift;
+			return params;
+		}
+
+		TEST_METHOD(ConvertsQuad)
+		{
+			const D2::Vertex d2Vertices[4] = {
+				{ 10.0f, 20.5f, 0x11223344, 0, 0.0f, 0.0f, 0 },
+				{ 42.0f, 20.5f, 0x11223344, 0, 8191.0f, 0.0f, 0 },
+				{ 42.0f, 52.5f, 0x11223344, 0, 8191.0f, 8191.0f, 0 },
+				{ 10.0f, 52.5f, 0x11223344, 0, 0.0f, 8191.0f, 0 },
+			};
+			const D2::Vertex* pointers[4] = { &d2Vertices[0], &d2Vertices[1], &d2Vertices[2], &d2Vertices[3] };
+
+			const VertexConversionParams params = MakeParams(4, true);
+
+			for (int32_t k = 0; k < (int32_t)SimdKernel::Count; ++k)
+			{
+				const SimdKernel kernel = (SimdKernel)k;
+
+				if (!IsSimdKernelSupported(kernel))
+				{
+					continue;
+				}
+
+				Vertex vertices[4];
+				BatchBounds bounds;
+				ConvertVertices(kernel, pointers, 4, params, vertices, bounds);
+
+				Assert::AreEqual(42.0f, vertices[2].GetX());
+				Assert::AreEqual(52.5f, vertices[2].GetY());
+				Assert::AreEqual(511, vertices[2].GetS());
+				Assert::AreEqual(511, vertices[2].GetT());
+				Assert::AreEqual(0x80223344U, vertices[2].GetColor());
+				Assert::IsTrue(vertices[2].IsChromaKeyEnabled());
+				Assert::AreEqual(1234, vertices[2].GetAtlasIndex());
+				Assert::AreEqual(7, vertices[2].GetPaletteIndex());
+				Assert::AreEqual(4321, vertices[2].GetSurfaceId());
+
+				Assert::AreEqual((int16_t)10, bounds.left);
+				Assert::AreEqual((int16_t)20, bounds.top);
+				Assert::AreEqual((int16_t)42, bounds.right);
+				Assert::AreEqual((int16_t)53, bounds.bottom);
+			}
+		}
+
+		TEST_METHOD(AddsTexcoordOffset)
+		{
+			const D2::Vertex d2Vertex = { 1.0f, 2.0f, 0xFF000000, 0, 1000.0f, 24.0f, 0 };
+			const D2::Vertex* pointers[3] = { &d2Vertex, &d2Vertex, &d2Vertex };
+
+			VertexConversionParams params = MakeParams(2, false);
+			params.texcoordOffset = { 256, 128 };
+
+			for (int32_t k = 0; k < (int32_t)SimdKernel::Count; ++k)
+			{
+				const SimdKernel kernel = (SimdKernel)k;
+
+				if (!IsSimdKernelSupported(kernel))
+				{
+					continue;
+				}
+
+				Vertex vertices[3];
+				BatchBounds bounds;
+				ConvertVertices(kernel, pointers, 3, params, vertices, bounds);
+
+				for (int32_t i = 0; i < 3; ++i)
+				{
+					Assert::AreEqual(250 + 256, vertices[i].GetS());
+					Assert::AreEqual(6 + 128, vertices[i].GetT());
+					Assert::AreEqual(0x80402010U, vertices[i].GetColor());
+				}
+			}
+		}
+
+		TEST_METHOD(DetectsOffScreenVertices)
+		{
+			/* Only a vertex inside the screen counts, not a bounding box overlapping it. */
+			const D2::Vertex d2Vertices[3] = {
+				{ -10.0f, -10.0f, 0, 0, 0.0f, 0.0f, 0 },
+				{ 900.0f, -10.0f, 0, 0, 0.0f, 0.0f, 0 },
+				{ 800.0f, 600.0f, 0, 0, 0.0f, 0.0f, 0 },
+			};
+			const D2::Vertex* pointers[3] = { &d2Vertices[0], &d2Vertices[1], &d2Vertices[2] };
+			const Size screenSize = { 800, 600 };
+
+			Assert::IsFalse(IsAnyVertexOnScreen(pointers, 3, screenSize));
+
+			const D2::Vertex nan = { NAN, NAN, 0, 0, 0.0f, 0.0f, 0 };
+			const D2::Vertex* nanPointers[2] = { pointers[2], &nan };
+			Assert::IsFalse(IsAnyVertexOnScreen(nanPointers, 2, screenSize));
+
+			const D2::Vertex inside = { 799.5f, 0.0f, 0, 0, 0.0f, 0.0f, 0 };
+			const D2::Vertex* insidePointers[3] = { pointers[0], pointers[1], &inside };
+			Assert::IsTrue(IsAnyVertexOnScreen(insidePointers, 3, screenSize));
+		}
+
+		TEST_METHOD(KernelsMatchScalar)
+		{
+			/* Random vertices, including ties between eighths, positions that saturate and
+			   NaNs. Every kernel must produce the same bytes as the scalar one. */
+			const float specialPositions[] = {
+				0.0f, -0.0f, 0.0625f, 0.1875f, -0.0625f, 799.999f, 800.0f, 4095.875f, 4096.0f, 5000.0f,
+				-4096.0f, -4096.0625f, -5000.0f, 1e9f, -1e9f, INFINITY, -INFINITY, NAN,
+			};
+			const uint32_t specialCount = sizeof(specialPositions) / sizeof(specialPositions[0]);
+
+			uint32_t seed = 4711;
+			auto next = [&]()
+			{
+				seed = seed * 1664525 + 1013904223;
+				return seed >> 8;
+			};
+
+			D2::Vertex d2Vertices[9];
+			const D2::Vertex* pointers[9];
+			uint32_t mismatchCount = 0;
+
+			for (int32_t n = 0; n < 20000; ++n)
+			{
+				const uint32_t count = 1 + next() % 9;
+				const int32_t stShift = next() % 9;
+				VertexConversionParams params = MakeParams(stShift, (n & 1) != 0);
+
+				if (n & 2)
+				{
+					/* A texture packed into a shared atlas slice. */
+					params.texcoordOffset = { (int32_t)(next() % 16) * 32, (int32_t)(next() % 16) * 32 };
+				}
+
+				for (uint32_t i = 0; i < count; ++i)
+				{
+					D2::Vertex& d2Vertex = d2Vertices[i];
+					const uint32_t r = next();
+
+					d2Vertex.x = (r & 15) == 0 ? specialPositions[next() % specialCount] : (float)((int32_t)(next() % 12000) - 2000) * (1.0f / 16);
+					d2Vertex.y = (r & 15) == 1 ? specialPositions[next() % specialCount] : (float)((int32_t)(next() % 12000) - 2000) * (1.0f / 16);
+					d2Vertex.color = next() * 251;
+					d2Vertex.padding = next();
+					d2Vertex.s = (float)(next() % (512 << stShift)) + (next() % 100) * 0.01f;
+					d2Vertex.t = (float)(next() % (512 << stShift)) + (next() % 100) * 0.01f;
+					d2Vertex.padding2 = next();
+					pointers[i] = &d2Vertex;
+				}
+
+				Vertex expected[9];
+				BatchBounds expectedBounds;
+				ConvertVertices(SimdKernel::Scalar, pointers, count, params, expected, expectedBounds);
+
+				for (int32_t k = 1; k < (int32_t)SimdKernel::Count; ++k)
+				{
+					const SimdKernel kernel = (SimdKernel)k;
+
+					if (!IsSimdKernelSupported(kernel))
+					{
+						continue;
+					}
+
+					Vertex actual[9];
+					BatchBounds actualBounds;
+					ConvertVertices(kernel, pointers, count, params, actual, actualBounds);
+
+					mismatchCount += memcmp(expected, actual, sizeof(Vertex) * count) != 0;
+					mismatchCount += memcmp(&expectedBounds, &actualBounds, sizeof(BatchBounds)) != 0;
+				}
+			}
+
+			Assert::AreEqual(0U, mismatchCount);
+		}
+
+		TEST_METHOD(BoundsMatchVertexBounds)
+		{
+			const D2::Vertex d2Vertices[3] = {
+				{ -0.0625f, 3.9375f, 0, 0, 0.0f, 0.0f, 0 },
+				{ 100.0625f, -7.5f, 0, 0, 0.0f, 0.0f, 0 },
+				{ 5000.0f, -5000.0f, 0, 0, 0.0f, 0.0f, 0 },
+			};
+			const D2::Vertex* pointers[3] = { &d2Vertices[0], &d2Vertices[1], &d2Vertices[2] };
+
+			const VertexConversionParams params = MakeParams(0, true);
+
+			for (int32_t k = 0; k < (int32_t)SimdKernel::Count; ++k)
+			{
+				const SimdKernel kernel = (SimdKernel)k;
+
+				if (!IsSimdKernelSupported(kernel))
+				{
+					continue;
+				}
+
+				for (uint32_t count = 1; count <= 3; ++count)
+				{
+					Vertex vertices[3];
+					BatchBounds bounds;
+					ConvertVertices(kernel, pointers, count, params, vertices, bounds);
+
+					const BatchBounds vertexBounds = GetVertexBounds(vertices, count);
+					Assert::AreEqual(vertexBounds.left, bounds.left);
+					Assert::AreEqual(vertexBounds.top, bounds.top);
+					Assert::AreEqual(vertexBounds.right, bounds.right);
+					Assert::AreEqual(vertexBounds.bottom, bounds.bottom);
+				}
+			}
+
+			/* -0.0625 and 3.9375 are ties, and round to the even eighths 0 and 4. */
+			Vertex vertices[3];
+			BatchBounds bounds;
+			ConvertVertices(SimdKernel::Scalar, pointers, 3, params, vertices, bounds);
+			Assert::AreEqual((int16_t)0, bounds.left);
+			Assert::AreEqual((int16_t)-4096, bounds.top);
+			Assert::AreEqual((int16_t)4096, bounds.right);
+			Assert::AreEqual((int16_t)4, bounds.bottom);
+		}
+
+		TEST_METHOD(BenchmarkConvertVertices)
+		{
+			/* A busy frame of quads, drawn through OnDrawVertexArray with each quad's vertices
+			   scattered in game memory. */
+			const uint32_t quadCount = 16 * 1024;
+			const uint32_t frameCount = 32;
+
+			Buffer<D2::Vertex> d2Vertices(quadCount * 4);
+			Buffer<const D2::Vertex*> pointers(quadCount * 4);
+			Buffer<Vertex> vertices(quadCount * 4);
+
+			for (uint32_t i = 0; i < quadCount * 4; ++i)
+			{
+				const uint32_t quad = (i / 4) * 2654435761U % quadCount;
+				const float x = (float)(quad % 800) + ((i & 1) ^ ((i >> 1) & 1)) * 32.0f;
+				const float y = (float)(quad % 600) + ((i >> 1) & 1) * 32.0f;
+				d2Vertices.items[quad * 4 + (i & 3)] = { x, y, 0xFFFFFFFF, 0, (float)((i & 1) * 8191), (float)(((i >> 1) & 1) * 8191), 0 };
+				pointers.items[i] = &d2Vertices.items[quad * 4 + (i & 3)];
+			}
+
+			const VertexConversionParams params = MakeParams(4, true);
+			double kernelMs[(int32_t)SimdKernel::Count] = {};
+
+			for (int32_t k = 0; k < (int32_t)SimdKernel::Count; ++k)
+			{
+				const SimdKernel kernel = (SimdKernel)k;
+
+				if (!IsSimdKernelSupported(kernel))
+				{
+					continue;
+				}
+
+				kernelMs[k] = 1e9;
+
+				for (uint32_t run = 0; run < 5; ++run)
+				{
+					const int64_t start = TimeStamp();
+
+					for (uint32_t frame = 0; frame < frameCount; ++frame)
+					{
+						for (uint32_t quad = 0; quad < quadCount; ++quad)
+						{
+							BatchBounds bounds;
+							ConvertVertices(kernel, &pointers.items[quad * 4], 4, params, &vertices.items[quad * 4], bounds);
+						}
+					}
+
+					kernelMs[k] = min(kernelMs[k], TimeToMs(TimeStamp() - start));
+				}
+			}
+
+			Assert::AreEqual(511, vertices.items[quadCount * 4 - 1].GetS() | vertices.items[quadCount * 4 - 1].GetT());
+
+			for (int32_t k = 0; k < (int32_t)SimdKernel::Count; ++k)
+			{
+				if (kernelMs[k] > 0)
+				{
+					char message[256];
+					sprintf_s(message, "%u quads per frame, %s: %.3f ms.\n",
+						quadCount, GetSimdKernelName((SimdKernel)k), kernelMs[k] / frameCount);
+					Logger::WriteMessage(message);
+				}
+			}
+		}
+
+		TEST_METHOD(BenchmarkDrawVertexWrites)
+		{
+			/* The vertex work of the Draw category for a busy frame: mostly quads, some fans,
+			   every draw on its own surface and a fifth of them from packed textures.
+			   Previously the vertices were converted before the texture lookup, and the atlas
+			   index, surface id and texcoord offset were patched in by separate passes. Now
+			   only the positions are read before the lookup, and each vertex is written once.
+			   The lookup itself costs the same either way and is left out. */
+			const uint32_t drawCount = 12 * 1024;
+			const uint32_t frameCount = 32;
+
+			struct Draw
+			{
+				uint32_t firstVertex;
+				uint32_t vertexCount;
+				int32_t atlasIndex;
+				int32_t surfaceId;
+				Offset texcoordOffset;
+			};
+
+			Buffer<Draw> draws(drawCount);
+			Buffer<D2::Vertex> d2Vertices(drawCount * 8);
+			Buffer<const D2::Vertex*> pointers(drawCount * 8);
+			Buffer<Vertex> vertices(drawCount * 8);
+
+			uint32_t seed = 1234;
+			auto next = [&]()
+			{
+				seed = seed * 1664525 + 1013904223;
+				return seed >> 8;
+			};
+
+			uint32_t totalVertexCount = 0;
+
+			for (uint32_t i = 0; i < drawCount; ++i)
+			{
+				Draw& draw = draws.items[i];
+				draw.firstVertex = totalVertexCount;
+				draw.vertexCount = (next() % 10) < 7 ? 4 : 4 + next() % 5;
+				draw.atlasIndex = next() % 2048;
+				draw.surfaceId = i % 16384;
+				draw.texcoordOffset = (next() % 5) == 0 ? Offset{ 128, 64 } : Offset{ 0, 0 };
+
+				const float x = (float)(next() % 800);
+				const float y = (float)(next() % 600);
+
+				for (uint32_t j = 0; j < draw.vertexCount; ++j)
+				{
+					D2::Vertex& d2Vertex = d2Vertices.items[totalVertexCount];
+					d2Vertex = { x + (j & 1) * 32.0f, y + (j & 2) * 16.0f, 0xFFFFFFFF, 0, (float)((j & 1) * 2040), (float)((j & 2) * 1020), 0 };
+					pointers.items[totalVertexCount++] = &d2Vertex;
+				}
+			}
+
+			const Size screenSize = { 800, 600 };
+			const VertexConversionParams params = MakeParams(3, true);
+
+			double separateMs = 1e9;
+			double foldedMs = 1e9;
+			uint32_t onScreenCount = 0;
+
+			for (uint32_t run = 0; run < 5; ++run)
+			{
+				int64_t start = TimeStamp();
+
+				for (uint32_t frame = 0; frame < frameCount; ++frame)
+				{
+					for (uint32_t i = 0; i < drawCount; ++i)
+					{
+						const Draw& draw = draws.items[i];
+						Vertex* pVertices = &vertices.items[draw.firstVertex];
+
+						BatchBounds bounds;
+						ConvertVertices(&pointers.items[draw.firstVertex], draw.vertexCount, params, pVertices, bounds);
+
+						if (draw.texcoordOffset.x || draw.texcoordOffset.y)
+						{
+							for (uint32_t j = 0; j < draw.vertexCount; ++j)
+							{
+								pVertices[j].AddTexcoordOffset(draw.texcoordOffset.x, draw.texcoordOffset.y);
+							}
+						}
+
+						for (uint32_t j = 0; j < draw.vertexCount; ++j)
+						{
+							pVertices[j].SetAtlasIndex(draw.atlasIndex);
+						}
+
+						for (uint32_t j = 0; j < draw.vertexCount; ++j)
+						{
+							pVertices[j].SetSurfaceId(draw.surfaceId);
+						}
+					}
+				}
+
+				separateMs = min(separateMs, TimeToMs(TimeStamp() - start));
+
+				const Vertex separateLast = vertices.items[totalVertexCount - 1];
+
+				start = TimeStamp();
+
+				for (uint32_t frame = 0; frame < frameCount; ++frame)
+				{
+					for (uint32_t i = 0; i < drawCount; ++i)
+					{
+						const Draw& draw = draws.items[i];
+
+						if (!IsAnyVertexOnScreen(&pointers.items[draw.firstVertex], draw.vertexCount, screenSize))
+						{
+							continue;
+						}
+
+						++onScreenCount;
+
+						VertexConversionParams drawParams = params;
+						drawParams.templateVertex.SetAtlasIndex(draw.atlasIndex);
+						drawParams.templateVertex.SetSurfaceId(draw.surfaceId);
+						drawParams.texcoordOffset = draw.texcoordOffset;
+
+						BatchBounds bounds;
+						ConvertVertices(&pointers.items[draw.firstVertex], draw.vertexCount, drawParams, &vertices.items[draw.firstVertex], bounds);
+					}
+				}
+
+				foldedMs = min(foldedMs, TimeToMs(TimeStamp() - start));
+
+				Assert::IsTrue(memcmp(&separateLast, &vertices.items[totalVertexCount - 1], sizeof(Vertex)) == 0);
+			}
+
+			Assert::IsTrue(onScreenCount > 0);
+
+			char message[256];
+			sprintf_s(message, "%u draws (%u vertices) per frame: separate fixups %.3f ms, folded into conversion %.3f ms.\n",
+				drawCount, totalVertexCount, separateMs / frameCount, foldedMs / frameCount);
+			Logger::WriteMessage(message);
+		}
+	};
+}
@@ -0,0 +1,483 @@
+/*
+	This file is part of D2DX.
+
+	Copyright (C) 2021  Bolrog
+
+	D2DX is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	D2DX is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with D2DX.  If not, see <https://www.gnu.org/licenses/>.
+*/
+#include "pch.h"
+#include "CppUnitTest.h"
+
+#include "../d2dx/IVertexRingStorage.h"
+#include "../d2dx/Types.h"
+#include "../d2dx/Vertex.h"
+#include "../d2dx/VertexRing.h"
+
+using namespace Microsoft::VisualStudio::CppUnitTestFramework;
+using namespace d2dx;
+
+namespace d2dxtests
+{
+	/* Stands in for a dynamic vertex buffer. A discard renames the buffer like the driver
+	   does, so the contents seen by every draw so far are kept and can be checked later. */
+	class FakeVertexRingStorage final : public IVertexRingStorage
+	{
+	public:
+		struct Draw
+		{
+			uint32_t generation;
+			uint32_t startLocation;
+			std::vector<Vertex> vertices;
+		};
+
+		FakeVertexRingStorage(uint32_t capacity) :
+			_capacity{ capacity }
+		{
+		}
+
+		virtual Vertex* MapVertices(bool discard) override
+		{
+			Assert::IsFalse(_isMapped);
+
+			if (discard || _generations.empty())
+			{
+				/* The contents after a discard are undefined. */
+				_generations.emplace_back(_capacity, Vertex(-1.0f, -1.0f, 0, 0, 0xDEADBEEF, false, 0, 0, 0));
+			}
+
+			_isMapped = true;
+			++_mapCount;
+			return _generations.back().data();
+		}
+
+		virtual void UnmapVertices() override
+		{
+			Assert::IsTrue(_isMapped);
+			_isMapped = false;
+		}
+
+		/* Remembers what a draw of the vertices at startLocation reads. */
+		void DrawVertices(uint32_t startLocation, uint32_t count)
+		{
+			Assert::IsFalse(_isMapped);
+			Assert::IsTrue(startLocation + count <= _capacity);
+
+			const std::vector<Vertex>& buffer = _generations.back();
+			_draws.push_back({ (uint32_t)_generations.size() - 1, startLocation,
+				std::vector<Vertex>(buffer.begin() + startLocation, buffer.begin() + startLocation + count) });
+		}
+
+		/* Checks that no draw had its vertices overwritten after it was submitted. */
+		void AssertDrawsIntact() const
+		{
+			for (const Draw& draw : _draws)
+			{
+				const std::vector<Vertex>& buffer = _generations[draw.generation];
+				Assert::AreEqual(0, memcmp(&buffer[draw.startLocation], draw.vertices.data(), sizeof(Vertex) * draw.vertices.size()));
+			}
+		}
+
+		const Draw& GetLastDraw() const
+		{
+			return _draws.back();
+		}
+
+		uint32_t GetGenerationCount() const
+		{
+			return (uint32_t)_generations.size();
+		}
+
+		uint32_t GetMapCount() const
+		{
+			return _mapCount;
+		}
+
+		bool IsMapped() const
+		{
+			return _isMapped;
+		}
+
+	private:
+		uint32_t _capacity;
+		bool _isMapped = false;
+		uint32_t _mapCount = 0;
+		std::vector<std::vector<Vertex>> _generations;
+		std::vector<Draw> _draws;
+	};
+
+	/* Leaves 100 vertices for frames, besides the 24 that VertexRing keeps free for Write. */
+	static const uint32_t SmallCapacity = 124;
+
+	static Vertex MakeVertex(uint32_t i)
+	{
+		return Vertex((float)(i % 1000), (float)(i / 1000), i & 511, (i >> 9) & 511, 0xFF000000 | i, false, 0, 0, 0);
+	}
+
+	static void AppendVertices(VertexRing& ring, uint32_t firstId, uint32_t count)
+	{
+		Vertex* vertices = ring.Append(count);
+
+		for (uint32_t i = 0; i < count; ++i)
+		{
+			vertices[i] = MakeVertex(firstId + i);
+		}
+	}
+
+	static void AssertVertices(const std::vector<Vertex>& vertices, uint32_t offset, uint32_t firstId, uint32_t count)
+	{
+		for (uint32_t i = 0; i < count; ++i)
+		{
+			const Vertex expected = MakeVertex(firstId + i);
+			Assert::AreEqual(0, memcmp(&expected, &vertices[offset + i], sizeof(Vertex)));
+		}
+	}
+
+	TEST_CLASS(TestVertexRing)
+	{
+	public:
+		TEST_METHOD(RecordsFramesInPlace)
+		{
+			FakeVertexRingStorage storage(SmallCapacity);
+			VertexRing ring(&storage, SmallCapacity, 25, 100, false);
+
+			const uint32_t expectedStarts[] = { 0, 20, 40, 60, 0, 20 };
+
+			for (uint32_t frame = 0; frame < ARRAYSIZE(expectedStarts); ++frame)
+			{
+				AppendVertices(ring, frame * 100, 5);
+				AppendVertices(ring, frame * 100 + 5, 15);
+				Assert::AreEqual(20U, ring.GetFrameVertexCount());
+				Assert::IsTrue(storage.IsMapped());
+
+				const uint32_t startLocation = ring.EndFrame();
+				Assert::AreEqual(expectedStarts[frame], startLocation);
+				Assert::AreEqual(0U, ring.GetFrameVertexCount());
+				Assert::IsFalse(storage.IsMapped());
+
+				storage.DrawVertices(startLocation, 20);
+				AssertVertices(storage.GetLastDraw().vertices, 0, frame * 100, 20);
+			}
+
+			/* The fifth frame would have left less than the reserve. */
+			Assert::AreEqual(1U, ring.GetDiscardCount());
+			Assert::AreEqual(6U, storage.GetMapCount());
+			storage.AssertDrawsIntact();
+		}
+
+		TEST_METHOD(EmptyFrameDoesNotMap)
+		{
+			FakeVertexRingStorage storage(SmallCapacity);
+			VertexRing ring(&storage, SmallCapacity, 25, 100, false);
+
+			ring.EndFrame();
+			ring.EndFrame();
+
+			Assert::AreEqual(0U, storage.GetMapCount());
+		}
+
+		TEST_METHOD(FrameIsLimitedToRestOfBuffer)
+		{
+			FakeVertexRingStorage storage(SmallCapacity);
+			VertexRing ring(&storage, SmallCapacity, 25, 100, false);
+
+			Assert::AreEqual(100U, ring.GetFrameVertexLimit());
+			AppendVertices(ring, 0, 60);
+			Assert::AreEqual(100U, ring.GetFrameVertexLimit());
+			storage.DrawVertices(ring.EndFrame(), 60);
+
+			/* Starts at 60, so only the 40 vertices left fit. The caller ends the frame
+			   before it outgrows them. */
+			AppendVertices(ring, 1000, 30);
+			Assert::AreEqual(40U, ring.GetFrameVertexLimit());
+			Assert::AreEqual(60U, ring.EndFrame());
+			storage.DrawVertices(60, 30);
+			AssertVertices(storage.GetLastDraw().vertices, 0, 1000, 30);
+
+			/* The rest is recorded as a new frame, which no longer fits after the first. */
+			Assert::AreEqual(100U, ring.GetFrameVertexLimit());
+			AppendVertices(ring, 1030, 30);
+			Assert::AreEqual(0U, ring.EndFrame());
+			Assert::AreEqual(1U, ring.GetDiscardCount());
+
+			storage.DrawVertices(0, 30);
+			AssertVertices(storage.GetLastDraw().vertices, 0, 1030, 30);
+			storage.AssertDrawsIntact();
+		}
+
+		TEST_METHOD(FrameStartingBeyondReserveDiscards)
+		{
+			FakeVertexRingStorage storage(SmallCapacity);
+			VertexRing ring(&storage, SmallCapacity, 25, 100, false);
+
+			AppendVertices(ring, 0, 60);
+			storage.DrawVertices(ring.EndFrame(), 60);
+
+			/* The reserve is left, but the first vertices of the frame don't fit in it. */
+			AppendVertices(ring, 1000, 50);
+			Assert::AreEqual(100U, ring.GetFrameVertexLimit());
+			Assert::AreEqual(0U, ring.EndFrame());
+			Assert::AreEqual(1U, ring.GetDiscardCount());
+
+			storage.DrawVertices(0, 50);
+			AssertVertices(storage.GetLastDraw().vertices, 0, 1000, 50);
+			storage.AssertDrawsIntact();
+		}
+
+		TEST_METHOD(WriteDuringFrameSuspendsMapping)
+		{
+			FakeVertexRingStorage storage(SmallCapacity);
+			VertexRing ring(&storage, SmallCapacity, 25, 100, false);
+
+			AppendVertices(ring, 0, 10);
+
+			const Vertex triangle[3] = { MakeVertex(500), MakeVertex(501), MakeVertex(502) };
+			const uint32_t triangleLocation = ring.Write(triangle, 3);
+			Assert::AreEqual(10U, triangleLocation);
+			Assert::IsFalse(storage.IsMapped());
+			storage.DrawVertices(triangleLocation, 3);
+			AssertVertices(storage.GetLastDraw().vertices, 0, 500, 3);
+
+			/* The written vertices are part of the frame. */
+			AppendVertices(ring, 13, 10);
+			Assert::IsTrue(storage.IsMapped());
+			Assert::AreEqual(23U, ring.GetFrameVertexCount());
+
+			const uint32_t startLocation = ring.EndFrame();
+			Assert::AreEqual(0U, startLocation);
+			storage.DrawVertices(startLocation, 23);
+			AssertVertices(storage.GetLastDraw().vertices, 0, 0, 10);
+			AssertVertices(storage.GetLastDraw().vertices, 10, 500, 3);
+			AssertVertices(storage.GetLastDraw().vertices, 13, 13, 10);
+
+			storage.AssertDrawsIntact();
+		}
+
+		TEST_METHOD(WriteBetweenFramesGoesAfterLastFrame)
+		{
+			FakeVertexRingStorage storage(SmallCapacity);
+			VertexRing ring(&storage, SmallCapacity, 25, 100, false);
+
+			AppendVertices(ring, 0, 40);
+			storage.DrawVertices(ring.EndFrame(), 40);
+
+			const Vertex triangle[3] = { MakeVertex(500), MakeVertex(501), MakeVertex(502) };
+			Assert::AreEqual(40U, ring.Write(triangle, 3));
+			storage.DrawVertices(40, 3);
+
+			AppendVertices(ring, 1000, 10);
+			Assert::AreEqual(43U, ring.EndFrame());
+
+			storage.AssertDrawsIntact();
+		}
+
+		TEST_METHOD(WriteCountsTowardsFrameLimit)
+		{
+			FakeVertexRingStorage storage(SmallCapacity);
+			VertexRing ring(&storage, SmallCapacity, 25, 100, false);
+
+			AppendVertices(ring, 0, 50);
+			storage.DrawVertices(ring.EndFrame(), 50);
+
+			/* The frame starts at 50, and the triangle is drawn from 60. */
+			AppendVertices(ring, 1000, 10);
+			const Vertex triangle[3] = { MakeVertex(500), MakeVertex(501), MakeVertex(502) };
+			storage.DrawVertices(ring.Write(triangle, 3), 3);
+			Assert::AreEqual(13U, ring.GetFrameVertexCount());
+			Assert::AreEqual(50U, ring.GetFrameVertexLimit());
+
+			AppendVertices(ring, 1013, 37);
+			Assert::AreEqual(50U, ring.EndFrame());
+			Assert::AreEqual(0U, ring.GetDiscardCount());
+
+			storage.DrawVertices(50, 50);
+			AssertVertices(storage.GetLastDraw().vertices, 0, 1000, 10);
+			AssertVertices(storage.GetLastDraw().vertices, 10, 500, 3);
+			AssertVertices(storage.GetLastDraw().vertices, 13, 1013, 37);
+			storage.AssertDrawsIntact();
+		}
+
+		TEST_METHOD(WriteDuringFullFrameGoesAfterIt)
+		{
+			FakeVertexRingStorage storage(SmallCapacity);
+			VertexRing ring(&storage, SmallCapacity, 25, 100, false);
+
+			AppendVertices(ring, 0, 50);
+			storage.DrawVertices(ring.EndFrame(), 50);
+
+			/* The frame starts at 50 and is full, so the triangles go after it, and it can't
+			   grow any further. */
+			AppendVertices(ring, 1000, 49);
+			Assert::AreEqual(50U, ring.GetFrameVertexLimit());
+
+			for (uint32_t i = 0; i < 2; ++i)
+			{
+				const Vertex triangle[3] = { MakeVertex(500 + 3 * i), MakeVertex(501 + 3 * i), MakeVertex(502 + 3 * i) };
+				const uint32_t triangleLocation = ring.Write(triangle, 3);
+				Assert::AreEqual(99U + 3 * i, triangleLocation);
+				Assert::IsFalse(storage.IsMapped());
+				storage.DrawVertices(triangleLocation, 3);
+				AssertVertices(storage.GetLastDraw().vertices, 0, 500 + 3 * i, 3);
+			}
+
+			Assert::AreEqual(49U, ring.GetFrameVertexCount());
+			Assert::AreEqual(49U, ring.GetFrameVertexLimit());
+
+			Assert::AreEqual(50U, ring.EndFrame());
+			storage.DrawVertices(50, 49);
+			AssertVertices(storage.GetLastDraw().vertices, 0, 1000, 49);
+
+			/* The next frame starts after the triangles. */
+			const Vertex triangle[3] = { MakeVertex(600), MakeVertex(601), MakeVertex(602) };
+			Assert::AreEqual(105U, ring.Write(triangle, 3));
+			storage.DrawVertices(105, 3);
+
+			Assert::AreEqual(0U, ring.GetDiscardCount());
+			storage.AssertDrawsIntact();
+		}
+
+		TEST_METHOD(WriteDuringStagedFrameIsNotPartOfIt)
+		{
+			FakeVertexRingStorage storage(100);
+			VertexRing ring(&storage, 100, 25, 100, true);
+
+			AppendVertices(ring, 0, 10);
+
+			const Vertex triangle[3] = { MakeVertex(500), MakeVertex(501), MakeVertex(502) };
+			const uint32_t triangleLocation = ring.Write(triangle, 3);
+			Assert::AreEqual(0U, triangleLocation);
+			storage.DrawVertices(triangleLocation, 3);
+			AssertVertices(storage.GetLastDraw().vertices, 0, 500, 3);
+			Assert::AreEqual(10U, ring.GetFrameVertexCount());
+
+			AppendVertices(ring, 10, 10);
+			Assert::AreEqual(3U, ring.EndFrame());
+			storage.DrawVertices(3, 20);
+			AssertVertices(storage.GetLastDraw().vertices, 0, 0, 20);
+			storage.AssertDrawsIntact();
+		}
+
+		TEST_METHOD(StagedModeCopiesOncePerFrame)
+		{
+			FakeVertexRingStorage storage(100);
+			VertexRing ring(&storage, 100, 25, 100, true);
+
+			for (uint32_t frame = 0; frame < 8; ++frame)
+			{
+				AppendVertices(ring, frame * 100, 15);
+				AppendVertices(ring, frame * 100 + 15, 15);
+				Assert::IsFalse(storage.IsMapped());
+
+				const uint32_t startLocation = ring.EndFrame();
+				Assert::AreEqual(frame + 1, storage.GetMapCount());
+				storage.DrawVertices(startLocation, 30);
+				AssertVertices(storage.GetLastDraw().vertices, 0, frame * 100, 30);
+			}
+
+			Assert::AreEqual(2U, ring.GetDiscardCount());
+			storage.AssertDrawsIntact();
+		}
+
+		TEST_METHOD(StagingGrowsWithFrames)
+		{
+			FakeVertexRingStorage storage(100000);
+			VertexRing ring(&storage, 100000, 25000, 100000, true);
+
+			Assert::AreEqual(0U, ring.GetStaging().GetAllocatedSize());
+
+			AppendVertices(ring, 0, 150);
+			AppendVertices(ring, 150, 150);
+			storage.DrawVertices(ring.EndFrame(), 300);
+			AssertVertices(storage.GetLastDraw().vertices, 0, 0, 300);
+
+			Assert::AreEqual(300U, ring.GetStaging().GetHighWaterCount());
+			Assert::IsTrue(ring.GetStaging().GetCapacity() < 1000);
+		}
+
+		TEST_METHOD(RandomFramesKeepDrawsIntact)
+		{
+			const uint32_t capacity = 4096;
+			FakeVertexRingStorage storage(capacity);
+			VertexRing ring(&storage, capacity, capacity / 4, capacity, false);
+
+			uint32_t seed = 12345;
+			auto random = [&](uint32_t n) { seed = seed * 1664525 + 1013904223; return (seed >> 8) % n; };
+
+			uint32_t nextId = 0;
+			uint32_t firstId = 0;
+			uint32_t partialFrameCount = 0;
+
+			auto endFrame = [&]()
+			{
+				const uint32_t frameVertexCount = ring.GetFrameVertexCount();
+				Assert::AreEqual(nextId - firstId, frameVertexCount);
+
+				const uint32_t startLocation = ring.EndFrame();
+
+				if (frameVertexCount > 0)
+				{
+					storage.DrawVertices(startLocation, frameVertexCount);
+					AssertVertices(storage.GetLastDraw().vertices, 0, firstId, frameVertexCount);
+				}
+
+				firstId = nextId;
+			};
+
+			for (uint32_t frame = 0; frame < 500; ++frame)
+			{
+				const uint32_t appendCount = random(16);
+
+				for (uint32_t i = 0; i < appendCount; ++i)
+				{
+					const bool isTriangle = random(8) == 0;
+
+					/* Mostly small frames, but sometimes one that outgrows the rest of the buffer. */
+					const uint32_t count = isTriangle ? 3 : random(50) == 0 ? 1 + random(capacity / 2) : 1 + random(64);
+
+					/* Like a partial flush, the rest goes into a new frame. */
+					if (ring.GetFrameVertexCount() + count > ring.GetFrameVertexLimit())
+					{
+						endFrame();
+						++partialFrameCount;
+					}
+
+					if (isTriangle)
+					{
+						const Vertex triangle[3] = { MakeVertex(nextId), MakeVertex(nextId + 1), MakeVertex(nextId + 2) };
+						const bool isInFrame = ring.GetFrameVertexCount() > 0;
+						storage.DrawVertices(ring.Write(triangle, 3), 3);
+						nextId += 3;
+
+						/* Only vertices written after the frame has started are part of it. */
+						if (!isInFrame)
+						{
+							firstId = nextId;
+						}
+					}
+					else
+					{
+						AppendVertices(ring, nextId, count);
+						nextId += count;
+					}
+				}
+
+				endFrame();
+			}
+
+			Assert::IsTrue(partialFrameCount > 0);
+			Assert::IsTrue(ring.GetDiscardCount() > 0);
+			Assert::AreEqual(ring.GetDiscardCount() + 1, storage.GetGenerationCount());
+			storage.AssertDrawsIntact();
+		}
+	};
+}